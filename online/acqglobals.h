@@ -53,7 +53,15 @@ const float EE_BIP_GAIN=4.;
 
 const unsigned int CBUF_SIZE_IN_SECS=10;
 
+const unsigned int AUX_CHN_COUNT=2; // Audio L/R, captured at 48kHz and decimated to the EEG rate
+
 const unsigned int AMP_SIMU_TRIG=0xFE;
 const unsigned int AMP_SYNC_TRIG=0xFF;
 
+const unsigned int ACQ_MAX_DATA_CLIENTS=8; // Simultaneous data port consumers
+const unsigned int ACQ_CLIENT_REPORT_MSECS=5000; // Per-client lag/overrun report period
+const unsigned int ACQ_CLIENT_IDLE_MSECS=100; // Max. sender sleep w/o new data (disconnection checks)
+const unsigned int ACQ_CLIENT_OUT_CHUNKS=4; // Sender ring in tcpBufGuard-sample chunks (zero-copy pages in flight)
+const unsigned int ACQ_RESUME_MSECS=500; // Data clients' reconnect interval after losing the connection
+
 #endif
@@ -34,6 +34,7 @@ typedef struct _chninfo {
  unsigned int physChnMaxCount;
  unsigned int totalChnCount;
  unsigned int totalCount; // Chncount among all connected amplifiers
+ unsigned int ampCount; // Number of connected amplifiers (AMP|COUNT)
  unsigned int probe_eeg_msecs;
  unsigned int probe_cm_msecs;
 } chninfo;
@@ -61,10 +61,23 @@ Octopus-ReEL - Realtime Encephalography Laboratory Network
 #define CS_ACQ_MANUAL_TRIG_ACK		(0x0011)
 #define CS_ACQ_MANUAL_SYNC		(0x0012)
 #define CS_ACQ_MANUAL_SYNC_ACK		(0x0013)
+#define CS_ACQ_TIMED_TRIG		(0x0014)
+#define CS_ACQ_RETRANSMIT		(0x0020)
+#define CS_ACQ_RETRANSMIT_RESULT	(0x0021)
+#define CS_ACQ_CLIENT_STATS		(0x0022)
+#define CS_ACQ_CLIENT_STATS_RESULT	(0x0023)
+#define CS_ACQ_STATS			(0x0024)
+#define CS_ACQ_STATS_RESULT		(0x0025)
+#define CS_ACQ_LOG_DUMP			(0x0026)
+#define CS_ACQ_REC_START		(0x0030)
+#define CS_ACQ_REC_STOP			(0x0031)
+#define CS_ACQ_REC_STATUS		(0x0032)
+#define CS_ACQ_REC_STATUS_RESULT	(0x0033)
 #define CS_ACQ_TRIGTEST			(0x1001)
 
 /* -------------------------------------------------- */
 #define CS_ACQ_SETMODE			(0x5001)
+#define CS_ACQ_SETFILTER		(0x5002)
 /* -------------------------------------------------- */
 #define CS_REBOOT			(0xFFFE)
 #define CS_SHUTDOWN			(0xFFFF)
@@ -0,0 +1,360 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* Lossless coding of sample columns, for the data stream (TCP_SUB_LPC, see
+   tcpsubscription.h) and for recordings (REC_CODEC_LPC, see recfile.h).
+
+   A column is n consecutive samples of one channel. Voltages (RAW, FLT, AUX) are
+   taken as integer nanovolts where that loses nothing: only if every float of the
+   column comes back bit for bit from its nanovolt count (so values that do not fit,
+   |x|>=2^30 nV, non-finite ones and -0 rule it out too). Otherwise the column goes as
+   the bit patterns of its floats, mapped to ordered integers, which also is how the CM
+   levels (squared volts) always go. Integer columns (trigger words, sample offsets) go
+   as they are. All arithmetic on the integers wraps, so any input comes back
+   bit-exact, whichever way it went.
+
+   Each column is predicted by the best of the fixed polynomial predictors of order
+   0..3 and a quantized linear predictor (LPC_MAX_ORDER taps, Levinson-Durbin) on its
+   first differences -- whichever leaves the smallest residual magnitude -- and the
+   residuals are Rice coded in partitions of LPC_PART samples, each with its own
+   parameter; a residual whose quotient would not fit LPC_ESC bits is sent verbatim.
+
+   The integer conversions and the fixed-predictor residuals are vectorized (AVX2, 8
+   samples per step) with scalar fallbacks; the Rice coder reads and writes 32 bits at a
+   time and finds unary runs with a bit scan. Column layout:
+
+     uint8 kind, pred, shift, order   pred: 0..3 fixed order, LPC_PRED_LPC else
+     int16 coef[order]
+     bits: warm-up samples (32 bits each), then per partition 5 bits of Rice parameter
+           and the residuals -- unary quotient as zeros ended by a one, LSB first */
+
+#ifndef _LPCCODEC_H
+#define _LPCCODEC_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+const uint32_t LPC_PART=64;       // Samples per Rice partition
+const uint32_t LPC_ESC=16;        // Quotients from here on are escaped
+const uint32_t LPC_MAX_ORDER=8;   // Taps of the linear predictor
+const uint32_t LPC_COEF_BITS=14;  // Precision of its coefficients
+const double LPC_MIN_GAIN=0.15;   // Bits per sample it has to promise over the first differences
+const uint8_t LPC_PRED_LPC=4;
+
+const uint8_t LPC_KIND_NV=0;   // Float volts as integer nanovolts
+const uint8_t LPC_KIND_BITS=1; // Float bit patterns
+const uint8_t LPC_KIND_INT=2;  // 32-bit words as they are
+const double LPC_NV=1e-9;
+
+// Bytes an encoded column of n samples may take at most.
+inline size_t lpcBound(uint32_t n) { return 4+2*LPC_MAX_ORDER+(size_t)n*7+LPC_MAX_ORDER*4+(n/LPC_PART+1)+8; }
+
+// Float volts to nanovolts; false if any does not fit (the caller then takes the bits).
+inline bool lpcQuantize(const float *x,uint32_t n,int32_t *q) { uint32_t i=0; bool ok=true;
+#ifdef __AVX2__
+ const __m256d s=_mm256_set1_pd(1./LPC_NV),lim=_mm256_set1_pd(1073741823.),sgn=_mm256_set1_pd(-0.);
+ __m256d a,b,bad=_mm256_setzero_pd();
+ for (;i+8<=n;i+=8) {
+  a=_mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(x+i)),s); b=_mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(x+i+4)),s);
+  bad=_mm256_or_pd(bad,_mm256_cmp_pd(_mm256_andnot_pd(sgn,a),lim,_CMP_NLE_UQ)); // NaN too
+  bad=_mm256_or_pd(bad,_mm256_cmp_pd(_mm256_andnot_pd(sgn,b),lim,_CMP_NLE_UQ));
+  _mm_storeu_si128((__m128i*)(q+i),_mm256_cvtpd_epi32(a)); _mm_storeu_si128((__m128i*)(q+i+4),_mm256_cvtpd_epi32(b));
+ }
+ ok=(_mm256_movemask_pd(bad)==0);
+#endif
+ for (;i<n;i++) { double v=(double)x[i]/LPC_NV;
+  if (!(std::fabs(v)<=1073741823.)) ok=false; else q[i]=(int32_t)std::nearbyint(v);
+ }
+ return ok;
+}
+
+inline void lpcDequantize(const int32_t *q,uint32_t n,float *x) { uint32_t i=0;
+#ifdef __AVX2__
+ const __m256d s=_mm256_set1_pd(LPC_NV);
+ for (;i+4<=n;i+=4) _mm_storeu_ps(x+i,_mm256_cvtpd_ps(_mm256_mul_pd(_mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)(q+i))),s)));
+#endif
+ for (;i<n;i++) x[i]=(float)(q[i]*LPC_NV);
+}
+
+// Float bits to integers of the same order (and back: the mapping is its own inverse).
+inline void lpcFloatBits(const void *x,uint32_t n,int32_t *q) { const int32_t *u=(const int32_t*)x;
+ for (uint32_t i=0;i<n;i++) q[i]=u[i]^((u[i]>>31)&0x7fffffff);
+}
+
+class LpcBitWriter {
+ public:
+  LpcBitWriter(unsigned char *d) { p=d; acc=0; n=0; }
+  void put(uint32_t v,uint32_t len) { // len<=32
+   acc|=(uint64_t)v<<n; n+=len;
+   if (n>=32) { std::memcpy(p,&acc,4); p+=4; acc>>=32; n-=32; }
+  }
+  unsigned char *end() { std::memcpy(p,&acc,8); return p+(n+7)/8; } // Flushes the rest
+ private:
+  unsigned char *p; uint64_t acc; uint32_t n;
+};
+
+class LpcBitReader {
+ public:
+  LpcBitReader(const unsigned char *d,size_t len) { p=d; size=len; pos=0; }
+  uint64_t peek() const { uint64_t w=0; size_t b=pos>>3;
+   if (b+8<=size) std::memcpy(&w,p+b,8); else if (b<size) std::memcpy(&w,p+b,size-b);
+   return w>>(pos&7);
+  }
+  uint32_t get(uint32_t len) { uint32_t v=(uint32_t)(peek()&((len<32) ? ((1u<<len)-1) : 0xffffffffu)); pos+=len; return v; }
+  void skip(uint32_t len) { pos+=len; }
+  bool ok() const { return pos<=8*size; }
+ private:
+  const unsigned char *p; size_t size,pos;
+};
+
+class LpcCodec {
+ public:
+  // One column of n samples into dst (lpcBound(n) bytes); returns the bytes used.
+  // kind: LPC_KIND_NV takes x as floats, falling back to their bits unless the nanovolts
+  // give them all back exactly; else x is 32-bit words.
+  size_t encode(const void *x,uint32_t n,uint8_t kind,unsigned char *dst) {
+   v.resize(n+LPC_MAX_ORDER+1);
+   if (kind==LPC_KIND_NV) { f.resize(n);
+    if (!lpcQuantize((const float*)x,n,v.data())) kind=LPC_KIND_BITS;
+    else { lpcDequantize(v.data(),n,f.data()); if (n && std::memcmp(f.data(),x,(size_t)n*4)) kind=LPC_KIND_BITS; }
+   }
+   if (kind==LPC_KIND_BITS) lpcFloatBits(x,n,v.data());
+   else if (kind==LPC_KIND_INT) std::memcpy(v.data(),x,(size_t)n*4);
+   return encodeInts(v.data(),n,kind,dst);
+  }
+
+  // Back into x (floats for NV/BITS columns, words for INT), from src of len bytes; false if corrupt.
+  bool decode(const unsigned char *src,size_t len,uint32_t n,void *x) { uint8_t kind;
+   v.resize(n+LPC_MAX_ORDER+1);
+   if (!decodeInts(src,len,n,kind,v.data())) return false;
+   if (kind==LPC_KIND_NV) lpcDequantize(v.data(),n,(float*)x);
+   else if (kind==LPC_KIND_BITS) lpcFloatBits(v.data(),n,(int32_t*)x);
+   else std::memcpy(x,v.data(),(size_t)n*4);
+   return true;
+  }
+
+  size_t encodeInts(const int32_t *x,uint32_t n,uint8_t kind,unsigned char *dst) {
+   uint64_t cost[4]; uint32_t best=0,order,w; int16_t coef[LPC_MAX_ORDER]; int shift=0,lpcOrder=0;
+   r.resize(n+8); fixedCosts(x,n,cost);
+   for (uint32_t o=1;o<4;o++) if (cost[o]<cost[best]) best=o;
+   if (n>=4*LPC_PART && cost[best]>(uint64_t)n && (lpcOrder=lpcFit(x,n,coef,shift))>0 &&
+       lpcResidual(x,n,coef,lpcOrder,shift)<cost[best]-cost[best]/32)
+    best=LPC_PRED_LPC;
+   if (best<LPC_PRED_LPC) fixedResidual(x,n,best);
+   order=(best>0 && n>0) ? 1 : 0; // Warm-up: the first sample; predictors ramp up from there
+   dst[0]=kind; dst[1]=(uint8_t)best; dst[2]=(uint8_t)shift; dst[3]=(uint8_t)((best==LPC_PRED_LPC) ? lpcOrder : 0);
+   unsigned char *p=dst+4;
+   if (best==LPC_PRED_LPC) { std::memcpy(p,coef,2*lpcOrder); p+=2*lpcOrder; }
+   LpcBitWriter bw(p);
+   for (w=0;w<order;w++) bw.put((uint32_t)x[w],32);
+   for (uint32_t s=order;s<n;s+=LPC_PART) { uint32_t e=std::min(n,s+LPC_PART),k=riceParam(s,e);
+    bw.put(k,5);
+    for (uint32_t i=0;i<e-s;i++) { uint32_t q=u[i]>>k;
+     if (q<LPC_ESC) { bw.put(1u<<q,q+1); if (k) bw.put(u[i]&((1u<<k)-1),k); }
+     else { bw.put(1u<<LPC_ESC,LPC_ESC+1); bw.put(u[i],32); }
+    }
+   }
+   return bw.end()-dst;
+  }
+
+  bool decodeInts(const unsigned char *src,size_t len,uint32_t n,uint8_t &kind,int32_t *x) {
+   int16_t coef[LPC_MAX_ORDER]; uint32_t pred,order,lpcOrder,shift;
+   if (len<4) return false;
+   kind=src[0]; pred=src[1]; shift=src[2]; lpcOrder=src[3];
+   if (kind>LPC_KIND_INT || pred>LPC_PRED_LPC || lpcOrder>LPC_MAX_ORDER || (pred==LPC_PRED_LPC && (lpcOrder==0 || shift>30))) return false;
+   order=(pred>0 && n>0) ? 1 : 0;
+   const unsigned char *p=src+4;
+   if (pred==LPC_PRED_LPC) { if (len<4+2*lpcOrder) return false; std::memcpy(coef,p,2*lpcOrder); p+=2*lpcOrder; }
+   LpcBitReader br(p,len-(p-src));
+   for (uint32_t w=0;w<order;w++) x[w]=(int32_t)br.get(32);
+   r.resize(n+8);
+   for (uint32_t s=order;s<n;s+=LPC_PART) { uint32_t e=std::min(n,s+LPC_PART),k=br.get(5),u,q; uint64_t b;
+    for (uint32_t i=s;i<e;i++) { b=br.peek(); q=b ? (uint32_t)__builtin_ctzll(b) : 64;
+     if (q<LPC_ESC) { br.skip(q+1); u=(q<<k)|(k ? br.get(k) : 0); }
+     else if (q==LPC_ESC) { br.skip(LPC_ESC+1); u=br.get(32); }
+     else return false;
+     r[i]=unzig(u);
+    }
+    if (!br.ok()) return false;
+   }
+   reconstruct(x,n,pred,coef,lpcOrder,shift);
+   return true;
+  }
+
+ private:
+  static uint32_t zig(int32_t v) { return ((uint32_t)v<<1)^(uint32_t)(v>>31); }
+  static int32_t unzig(uint32_t u) { return (int32_t)((u>>1)^(0u-(u&1))); }
+  static int32_t wsub(int32_t a,int32_t b) { return (int32_t)((uint32_t)a-(uint32_t)b); }
+  static int32_t wadd(int32_t a,int32_t b) { return (int32_t)((uint32_t)a+(uint32_t)b); }
+
+  // Sum of |residual| of the fixed predictors of order 0..3, all in one pass.
+  void fixedCosts(const int32_t *x,uint32_t n,uint64_t *cost) { uint32_t i=3;
+   for (int o=0;o<4;o++) cost[o]=0;
+   if (n<4) { cost[0]=0; cost[1]=cost[2]=cost[3]=~0ull; return; }
+#ifdef __AVX2__
+   __m256i c[4]; for (int o=0;o<4;o++) c[o]=_mm256_setzero_si256();
+   for (;i+8<=n;i+=8) {
+    __m256i x0=_mm256_loadu_si256((const __m256i*)(x+i)),x1=_mm256_loadu_si256((const __m256i*)(x+i-1)),
+            x2=_mm256_loadu_si256((const __m256i*)(x+i-2)),x3=_mm256_loadu_si256((const __m256i*)(x+i-3));
+    __m256i d1=_mm256_sub_epi32(x0,x1),d1p=_mm256_sub_epi32(x1,x2),d1pp=_mm256_sub_epi32(x2,x3);
+    __m256i d2=_mm256_sub_epi32(d1,d1p),d2p=_mm256_sub_epi32(d1p,d1pp),d3=_mm256_sub_epi32(d2,d2p);
+    __m256i a[4]={_mm256_abs_epi32(x0),_mm256_abs_epi32(d1),_mm256_abs_epi32(d2),_mm256_abs_epi32(d3)};
+    for (int o=0;o<4;o++) c[o]=_mm256_add_epi64(c[o],_mm256_add_epi64(_mm256_cvtepu32_epi64(_mm256_castsi256_si128(a[o])),
+                                                                       _mm256_cvtepu32_epi64(_mm256_extracti128_si256(a[o],1))));
+   }
+   for (int o=0;o<4;o++) { uint64_t t[4]; _mm256_storeu_si256((__m256i*)t,c[o]); cost[o]=t[0]+t[1]+t[2]+t[3]; }
+#endif
+   for (;i<n;i++) { int32_t d1=wsub(x[i],x[i-1]),d1p=wsub(x[i-1],x[i-2]),d1pp=wsub(x[i-2],x[i-3]),d2=wsub(d1,d1p),d3=wsub(d2,wsub(d1p,d1pp));
+    cost[0]+=(uint32_t)std::abs((int64_t)x[i]); cost[1]+=absw(d1); cost[2]+=absw(d2); cost[3]+=absw(d3);
+   }
+  }
+  static uint32_t absw(int32_t v) { return v<0 ? 0u-(uint32_t)v : (uint32_t)v; }
+
+  // Residuals of the fixed predictor of the given order into r; below it, of the orders available.
+  void fixedResidual(const int32_t *x,uint32_t n,uint32_t order) { uint32_t i=order;
+   for (uint32_t j=1;j<order && j<n;j++) r[j]=fixedAt(x,j,j);
+#ifdef __AVX2__
+   for (;i+8<=n && order>0;i+=8) {
+    __m256i x0=_mm256_loadu_si256((const __m256i*)(x+i)),x1=_mm256_loadu_si256((const __m256i*)(x+i-1)),d;
+    if (order==1) d=_mm256_sub_epi32(x0,x1);
+    else { __m256i x2=_mm256_loadu_si256((const __m256i*)(x+i-2));
+     d=_mm256_sub_epi32(_mm256_sub_epi32(x0,x1),_mm256_sub_epi32(x1,x2));
+     if (order==3) { __m256i x3=_mm256_loadu_si256((const __m256i*)(x+i-3));
+      d=_mm256_sub_epi32(d,_mm256_sub_epi32(_mm256_sub_epi32(x1,x2),_mm256_sub_epi32(x2,x3)));
+     }
+    }
+    _mm256_storeu_si256((__m256i*)(r.data()+i),d);
+   }
+#endif
+   for (;i<n;i++) r[i]=fixedAt(x,i,order);
+  }
+  static int32_t fixedAt(const int32_t *x,uint32_t i,uint32_t order) {
+   return (order==0) ? x[i] : (order==1) ? wsub(x[i],x[i-1]) :
+          (order==2) ? wsub(wsub(x[i],x[i-1]),wsub(x[i-1],x[i-2])) :
+                       wsub(wsub(wsub(x[i],x[i-1]),wsub(x[i-1],x[i-2])),wsub(wsub(x[i-1],x[i-2]),wsub(x[i-2],x[i-3])));
+  }
+
+  // Quantized LPC of the first differences (windowed autocorrelation, Levinson-Durbin);
+  // returns its order, 0 if it would not gain LPC_MIN_GAIN bits per sample over them.
+  int lpcFit(const int32_t *x,uint32_t n,int16_t *coef,int &shift) { double ac[LPC_MAX_ORDER+1],a[LPC_MAX_ORDER+1]={0},t[LPC_MAX_ORDER+1],e,k,mx=0.;
+   uint32_t m=n-1,i; int64_t big=0,csum=0;
+   if (win.size()!=m) { win.resize(m); for (i=0;i<m;i++) win[i]=0.5-0.5*cos(2.*M_PI*(i+0.5)/m); } // Hann
+   d.resize(m+LPC_MAX_ORDER); for (i=0;i<LPC_MAX_ORDER;i++) d[i]=0.;
+   double *dd=d.data()+LPC_MAX_ORDER; // Zeros before, so that all lags run over [0,m)
+   for (i=0;i<m;i++) { int32_t w=wsub(x[i+1],x[i]); big=std::max(big,std::abs((int64_t)w)); dd[i]=(double)w*win[i]; }
+   for (uint32_t l=0;l<=LPC_MAX_ORDER;l++) { double s=0.; i=0;
+#ifdef __AVX2__
+    __m256d acc=_mm256_setzero_pd(); double q[4];
+    for (;i+4<=m;i+=4) acc=_mm256_add_pd(acc,_mm256_mul_pd(_mm256_loadu_pd(dd+i),_mm256_loadu_pd(dd+i-l)));
+    _mm256_storeu_pd(q,acc); s=q[0]+q[1]+q[2]+q[3];
+#endif
+    for (;i<m;i++) s+=dd[i]*(dd+i)[-(std::ptrdiff_t)l];
+    ac[l]=s;
+   }
+   if (ac[0]<=0.) return 0;
+   ac[0]*=1.+1e-9; e=ac[0];
+   for (uint32_t o=1;o<=LPC_MAX_ORDER;o++) { k=ac[o]; for (uint32_t j=1;j<o;j++) k-=a[j]*ac[o-j]; k/=e;
+    for (uint32_t j=1;j<o;j++) t[j]=a[j]-k*a[o-j];
+    for (uint32_t j=1;j<o;j++) a[j]=t[j];
+    a[o]=k; e*=1.-k*k; if (e<=0.) return 0;
+   }
+   if (0.5*std::log2(ac[0]/e)<LPC_MIN_GAIN) return 0;
+   for (uint32_t j=1;j<=LPC_MAX_ORDER;j++) mx=std::max(mx,std::fabs(a[j]));
+   shift=LPC_COEF_BITS-1-(int)std::ceil(std::log2(mx+1e-12)); shift=std::max(0,std::min(shift,15));
+   for (uint32_t j=1;j<=LPC_MAX_ORDER;j++) { coef[j-1]=(int16_t)std::max(-32768.,std::min(32767.,std::round(a[j]*(1<<shift)))); csum+=std::abs(coef[j-1]); }
+   if (((big*csum)>>shift)>=(1ll<<30)) return 0; // Predictions must stay well within 32 bits
+   return LPC_MAX_ORDER;
+  }
+
+  // Residual of the LPC predictor into r; returns its sum of magnitudes. The products
+  // (16 x 32 bits) and their sum stay below 2^53, so the double lanes are exact and
+  // floor() matches the decoder's integer shift.
+  uint64_t lpcResidual(const int32_t *x,uint32_t n,const int16_t *coef,int order,int shift) { uint64_t s=0; uint32_t i=1;
+   const int32_t *dx=diffs(x,n);
+   for (;i<n && i<=(uint32_t)order;i++) { r[i]=wsub(dx[i],lpcAt(dx,i,coef,order,shift)); s+=absw(r[i]); }
+#ifdef __AVX2__
+   const __m256d sc=_mm256_set1_pd(1./(1<<shift)); __m256d c[LPC_MAX_ORDER];
+   for (int j=0;j<order;j++) c[j]=_mm256_set1_pd(coef[j]);
+   for (;i+4<=n;i+=4) { __m256d p=_mm256_setzero_pd();
+    for (int j=0;j<order;j++) p=_mm256_add_pd(p,_mm256_mul_pd(c[j],_mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)(dx+i-1-j)))));
+    __m128i e=_mm_sub_epi32(_mm_loadu_si128((const __m128i*)(dx+i)),_mm256_cvttpd_epi32(_mm256_floor_pd(_mm256_mul_pd(p,sc))));
+    _mm_storeu_si128((__m128i*)(r.data()+i),e); e=_mm_abs_epi32(e);
+    s+=(uint32_t)_mm_extract_epi32(e,0)+(uint64_t)(uint32_t)_mm_extract_epi32(e,1)+(uint32_t)_mm_extract_epi32(e,2)+(uint32_t)_mm_extract_epi32(e,3);
+   }
+#endif
+   for (;i<n;i++) { r[i]=wsub(dx[i],lpcAt(dx,i,coef,order,shift)); s+=absw(r[i]); }
+   return s;
+  }
+
+  // First differences of x, with LPC_MAX_ORDER+1 zeros before dx[1] (dx[0] is 0 too).
+  int32_t *diffs(const int32_t *x,uint32_t n) { di.assign(n+LPC_MAX_ORDER+1,0); int32_t *dx=di.data()+LPC_MAX_ORDER;
+   for (uint32_t j=1;j<n;j++) dx[j]=wsub(x[j],x[j-1]);
+   return dx;
+  }
+  static int32_t lpcAt(const int32_t *dx,uint32_t i,const int16_t *coef,uint32_t order,uint32_t shift) { int64_t p=0;
+   for (uint32_t j=0;j<order;j++) p+=(int64_t)coef[j]*dx[(int64_t)i-1-j]; // The previous differences
+   return (int32_t)(p>>shift);
+  }
+
+  void reconstruct(int32_t *x,uint32_t n,uint32_t pred,const int16_t *coef,uint32_t order,uint32_t shift) { uint32_t i;
+   if (pred==0) { for (i=0;i<n;i++) x[i]=r[i]; return; }
+   if (pred==LPC_PRED_LPC) { di.assign(n+LPC_MAX_ORDER+1,0); int32_t *dx=di.data()+LPC_MAX_ORDER;
+    for (i=1;i<n;i++) { dx[i]=wadd(lpcAt(dx,i,coef,order,shift),r[i]); x[i]=wadd(x[i-1],dx[i]); }
+    return;
+   }
+   for (i=1;i<n && i<pred;i++) x[i]=reconstructAt(x,i,i);
+   switch (pred) {
+    case 1: for (;i<n;i++) x[i]=wadd(x[i-1],r[i]); break;
+    case 2: for (;i<n;i++) x[i]=wadd(wsub(wadd(x[i-1],x[i-1]),x[i-2]),r[i]); break;
+    default: for (;i<n;i++) x[i]=wadd(wadd(wsub(wadd(x[i-1],wadd(x[i-1],x[i-1])),wadd(x[i-2],wadd(x[i-2],x[i-2]))),x[i-3]),r[i]);
+   }
+  }
+  int32_t reconstructAt(const int32_t *x,uint32_t i,uint32_t order) const {
+   return (order==1) ? wadd(x[i-1],r[i]) : wadd(wsub(wadd(x[i-1],x[i-1]),x[i-2]),r[i]); // Ramp-up: order<=2
+  }
+
+  // Rice parameter of the residuals [s,e): from their mean magnitude, lowered while that
+  // costs fewer bits (outliers, which go escaped, pull the mean up).
+  uint32_t riceParam(uint32_t s,uint32_t e) { uint64_t sum=0; uint32_t k=0,best,c;
+   for (uint32_t i=s;i<e;i++) { u[i-s]=zig(r[i]); sum+=u[i-s]; }
+   sum/=(e-s); while (k<31 && (2ull<<k)<=sum) k++; // ~log2(mean)
+   best=riceBits(e-s,k);
+   while (k>0 && (c=riceBits(e-s,k-1))<best) { best=c; k--; }
+   return k;
+  }
+  uint32_t riceBits(uint32_t n,uint32_t k) const { uint32_t b=0;
+   for (uint32_t i=0;i<n;i++) { uint32_t q=u[i]>>k; b+=(q<LPC_ESC) ? q+1+k : LPC_ESC+33; }
+   return b;
+  }
+
+  uint32_t u[LPC_PART]; std::vector<int32_t> v,r,di; std::vector<float> f; std::vector<double> d,win;
+};
+
+#endif
@@ -0,0 +1,114 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* Optional UDP (multicast) data stream of the acquisition daemon (NET|MCAST), for
+   several receivers wanting the identical stream at the cost of one sender. Every
+   datagram is one mcastheader followed by count frames in the tcpsubscription.h
+   layout, for the fixed MCAST_FIELDS of all channels of all amps. smpIdx is the
+   daemon's running sample index (tcpBuffer ring index) of the first frame, by which
+   receivers order the stream; seq counts the datagrams and is only there to tell
+   loss from reordering. Frames are never split; datagrams beyond the path MTU get
+   IP-fragmented, which is fine on a lab LAN (jumbo frames help with many amps).
+   A receiver seeing a gap may ask for the missing span over the command port
+   (CS_ACQ_RETRANSMIT); the daemon answers from its BUFPAST ring while it is still
+   there. session changes whenever the daemon restarts. */
+
+#ifndef _MCASTPACKET_H
+#define _MCASTPACKET_H
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "tcpsubscription.h"
+
+const unsigned int MCAST_MAGIC=0x4f434d43; // "OCMC"
+const unsigned int MCAST_FIELDS=TCP_SUB_RAW|TCP_SUB_FLT|TCP_SUB_AUX; // CM levels stay with the daemon GUI
+const unsigned int MCAST_PAYLOAD=8192; // Default max. frame bytes per datagram
+const unsigned int MCAST_DATAGRAM_MAX=65507; // UDP over IPv4
+const unsigned int MCAST_GAP_MSECS=250; // A receiver gives up on a gap after
+const unsigned int MCAST_RETX_MAX=2048; // Max. frames per retransmission request
+
+typedef struct _mcastheader {
+ unsigned int magic;
+ unsigned int session; // Daemon instance
+ unsigned int seq; // Datagram counter
+ unsigned int count; // Frames following
+ unsigned int frameSize; // Bytes per frame
+ unsigned int reserved;
+ uint64_t smpIdx; // Sample index of the first frame
+} mcastheader;
+
+// The subscription every multicast frame is packed with.
+inline tcpsubscription mcastSubscription() {
+ tcpsubscription s=TcpSubscription::full(); s.fields=MCAST_FIELDS; return s;
+}
+
+// Receiver side: holds out-of-order spans until the stream is contiguous again.
+class McastReorder {
+ public:
+  McastReorder() { reset(0); }
+
+  void reset(unsigned int fs) { frameSize=fs; held.clear(); started=false; nextIdx=lost=late=0; }
+
+  // Take count frames starting at sample idx; whatever is behind the delivery point is dropped.
+  void insert(uint64_t idx,const char *frames,unsigned int count) {
+   if (!started) { nextIdx=idx; started=true; }
+   if (idx+count<=nextIdx) { late+=count; return; }
+   if (idx<nextIdx) { frames+=(nextIdx-idx)*frameSize; count-=nextIdx-idx; idx=nextIdx; }
+   std::vector<char> &v=held[idx];
+   if (v.size()>=(size_t)count*frameSize) { late+=count; return; } // Duplicate
+   v.assign(frames,frames+(size_t)count*frameSize);
+  }
+
+  // In-order frames ready to be delivered (valid until pop()), 0 if the stream is at a gap.
+  unsigned int front(const char *&frames) { trim();
+   if (held.empty() || held.begin()->first!=nextIdx) return 0;
+   frames=held.begin()->second.data(); return held.begin()->second.size()/frameSize;
+  }
+  void pop() { nextIdx+=held.begin()->second.size()/frameSize; held.erase(held.begin()); }
+
+  // The span missing before the earliest held frames, if any.
+  bool gap(uint64_t &from,uint64_t &to) { trim();
+   if (held.empty() || held.begin()->first==nextIdx) return false;
+   from=nextIdx; to=held.begin()->first; return true;
+  }
+  void skip() { uint64_t f,t; if (gap(f,t)) { lost+=t-f; nextIdx=t; } } // Give up on the gap
+
+  uint64_t nextIdx,lost,late;
+
+ private:
+  // Spans already partially delivered (by an overlapping retransmission) are cut to what is new.
+  void trim() {
+   while (!held.empty() && held.begin()->first<nextIdx) { auto it=held.begin();
+    uint64_t n=it->second.size()/frameSize,d=nextIdx-it->first;
+    if (d>=n) { late+=n; held.erase(it); continue; }
+    std::vector<char> v(it->second.begin()+d*frameSize,it->second.end()); held.erase(it); late+=d;
+    std::vector<char> &w=held[nextIdx]; if (w.size()<v.size()) w.swap(v);
+   }
+  }
+
+  unsigned int frameSize; bool started; std::map<uint64_t,std::vector<char> > held;
+};
+
+#endif
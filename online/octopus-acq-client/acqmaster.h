@@ -41,6 +41,7 @@ Octopus-ReEL - Realtime Encephalography Laboratory Network
 #include <QStringList>
 #include <QVector>
 #include <QMutex>
+#include <QTimer>
 
 #include <cmath>
 
@@ -56,6 +57,10 @@ Octopus-ReEL - Realtime Encephalography Laboratory Network
 #include "../cs_command.h"
 #include "../sample.h"
 #include "../tcpsample.h"
+#include "../tcpsubscription.h"
+#include "../mcastpacket.h"
+#include "shmwaiter.h"
+#include "../rtlog.h"
 #include "../chninfo.h"
 #include "../patt_datagram.h"
 #include "../stim_event_names.h"
@@ -71,21 +76,20 @@ class AcqMaster : QObject {
    // *** INITIAL VALUES OF RUNTIME VARIABLES ***
 
    clientRunning=recording=withinAvgEpoch=eventOccured=false;
-   seconds=cp.cntPastIndex=avgCounter=0; cntSpeedX=4; globalCounter=scrCounter=0;
+   seconds=cp.cntPastIndex=avgCounter=0; cntSpeedX=4; globalCounter=scrCounter=ampSlips=0;
+   acqRate=0; acqMcast=acqRetransmit=acqRecServer=acqPacked=retxBusy=retxHaveHdr=false; acqMcastSocket=0; acqRetxSocket=0; mcastPort=mcastSession=0;
+   acqStreamIdx=0; acqSession=0; acqResumeTimer=0; acqResuming=false; acqOverrun=TCP_SUB_POLICY_DEFAULT; acqGapFrames=acqGapLost=0; acqGapResync=false; acqStep=1;
+   shmWaiter=0; shmOffered=false; shmSession=0; shmCIdx=shmOverruns=shmLost=0;
+   mcastSeq=mcastSeqGaps=mcastSeqLate=mcastBad=mcastRecovered=mcastGapFrom=0; mcastStarted=false;
    
    notch=true; notchN=20; notchThreshold=20.;
 
    // *** LOAD CONFIG FILE AND READ ALL LINES ***
 
-   ampCount=EE_AMPCOUNT;
-
    QString cfgLine; QStringList cfgLines; cfgFile.setFileName("/etc/octopus_acq_client.conf");
    if (!cfgFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
     qDebug() << "octopus_acq_client: <AcqMaster> Cannot open ./octopus_acq_client.conf for reading!.."; application->quit();
    } else { cfgStream.setDevice(&cfgFile); // Load all of the file to string
-    digExists.resize(ampCount); scalpExists.resize(ampCount); skullExists.resize(ampCount); brainExists.resize(ampCount);
-    for (unsigned int i=0;i<ampCount;i++)
-     gizmoExists=digExists[i]=scalpExists[i]=skullExists[i]=brainExists[i]=false;
     while (!cfgStream.atEnd()) { cfgLine=cfgStream.readLine(160); cfgLines.append(cfgLine); }
     cfgFile.close();
 
@@ -129,6 +133,17 @@ class AcqMaster : QObject {
          qDebug() << "octopus_acq_client: <AcqMaster> <.conf> Error in ACQ IP and/or port settings!"; application->quit();
         }
        }
+      } else if (opts[0].trimmed()=="SHM") { acqShmName=opts[1].trimmed(); // Daemon's shared memory ring, if on this host
+      } else if (opts[0].trimmed()=="MCAST") { acqMcast=(opts[1].trimmed().toInt()==1); // Use the daemon's multicast stream, if any
+      } else if (opts[0].trimmed()=="RETRANSMIT") { acqRetransmit=(opts[1].trimmed().toInt()==1); // Fetch lost spans from it
+      } else if (opts[0].trimmed()=="RECSERVER") { acqRecServer=(opts[1].trimmed().toInt()==1); // Daemon records along with us
+      } else if (opts[0].trimmed()=="RATE") { acqRate=opts[1].trimmed().toInt(); // Below the daemon's: decimated for us
+      } else if (opts[0].trimmed()=="PACKED") { acqPacked=(opts[1].trimmed().toInt()==1); // LPC-coded blocks over TCP
+      } else if (opts[0].trimmed()=="OVERRUN") { opts[1]=opts[1].trimmed(); // What the daemon does if we fall behind
+       if (opts[1]=="DROP") acqOverrun=TCP_SUB_DROP; else if (opts[1]=="DECIMATE") acqOverrun=TCP_SUB_DECIMATE;
+       else if (opts[1]=="DISCONNECT") acqOverrun=TCP_SUB_DISCONNECT; else if (opts[1]!="DEFAULT") {
+        qDebug() << "octopus_acq_client: <AcqMaster> <.conf> NET|OVERRUN must be DEFAULT, DROP, DECIMATE or DISCONNECT!"; application->quit();
+       }
       } else { qDebug() << "octopus_acq_client: <AcqMaster> <.conf> Parse error in NET sections!"; application->quit(); }
      }
     }
@@ -144,17 +159,27 @@ class AcqMaster : QObject {
     acqCommandStream.readRawData((char*)(&csCmd),sizeof(cs_command)); acqCommandSocket->disconnectFromHost();
     if (csCmd.cmd!=CS_ACQ_INFO_RESULT) { qDebug() << "octopus_acq_client: <AcqMaster> <.conf> ACQ server returned nonsense crucial info!"; application->quit(); }
 
-    sampleRate=chnInfo.sampleRate=csCmd.iparam[0];
+    acqFullRate=csCmd.iparam[0]; sampleRate=chnInfo.sampleRate=TcpSubscription::outputRate(acqRate,acqFullRate);
     chnInfo.refChnCount=csCmd.iparam[1]; chnInfo.bipChnCount=csCmd.iparam[2];
     chnInfo.physChnCount=csCmd.iparam[3]; chnInfo.refChnMaxCount=csCmd.iparam[4];
     chnInfo.bipChnMaxCount=csCmd.iparam[5]; chnInfo.physChnMaxCount=csCmd.iparam[6];
     tChns=chnInfo.totalChnCount=csCmd.iparam[7]; chnInfo.totalCount=csCmd.iparam[8];
-    chnInfo.probe_eeg_msecs=csCmd.iparam[9];
-    
-    acqCurData.resize(chnInfo.probe_eeg_msecs);
+    chnInfo.probe_eeg_msecs=csCmd.iparam[9]; chnInfo.probe_cm_msecs=csCmd.iparam[10];
+    ampCount=chnInfo.ampCount=csCmd.iparam[11];
+    mcastPort=csCmd.iparam[14]; mcastGroup=QHostAddress((quint32)csCmd.iparam[15]); mcastSession=csCmd.iparam[16];
+    shmOffered=(csCmd.iparam[17]==1); shmSession=csCmd.iparam[18];
+    if (ampCount<1 || ampCount>EE_MAX_AMPCOUNT) { qDebug() << "octopus_acq_client: <AcqMaster> <.conf> ACQ server returned an invalid amp count!"; application->quit(); }
 
-    qDebug() << "octopus_acq_client: <AcqMaster> <.conf> ACQ server returned: Total Phys Chn#=" << 2*chnInfo.physChnCount;
-    qDebug() << "octopus_acq_client: <AcqMaster> <.conf> ACQ server returned: Samplerate=" << sampleRate;
+    digExists.resize(ampCount); scalpExists.resize(ampCount); skullExists.resize(ampCount); brainExists.resize(ampCount);
+    for (unsigned int i=0;i<ampCount;i++)
+     gizmoExists=digExists[i]=scalpExists[i]=skullExists[i]=brainExists[i]=false;
+
+    acqProbeFrames=qMax(1u,chnInfo.sampleRate*chnInfo.probe_eeg_msecs/1000); // Samples per EEG probe, at our rate
+    acqCurData.resize(acqProbeFrames);
+    for (tcpsample &t:acqCurData) t.amp.resize(ampCount);
+
+    qDebug() << "octopus_acq_client: <AcqMaster> <.conf> ACQ server returned: Amp#=" << ampCount << "Total Phys Chn#=" << ampCount*chnInfo.physChnCount;
+    qDebug() << "octopus_acq_client: <AcqMaster> <.conf> ACQ server returned: Samplerate=" << acqFullRate << "-- taken at" << sampleRate;
 
     if (avgSection.size()>0) { // AVG
      for (int i=0;i<avgSection.size();i++) { opts=avgSection[i].split("=");
@@ -378,9 +403,49 @@ class AcqMaster : QObject {
     connect(digitizer,SIGNAL(digMonitor()),this,SLOT(slotDigMonitor())); connect(digitizer,SIGNAL(digResult()),this,SLOT(slotDigResult()));
    }
 
-   // Begin retrieving continuous data
-   acqDataSocket->connectToHost(acqHost,acqDataPort,QIODevice::ReadOnly); acqDataSocket->waitForConnected();
-   connect(acqDataSocket,SIGNAL(readyRead()),this,SLOT(slotAcqReadData()));
+   if (sampleRate<acqFullRate && ((!acqShmName.isEmpty() && shmOffered) || (acqMcast && mcastPort))) {
+    qDebug() << "octopus_acq_client: <AcqMaster> Shared memory/multicast carry the full rate only, taking TCP at" << sampleRate;
+    shmOffered=false; mcastPort=0;
+   }
+   if (!acqShmName.isEmpty() && shmOffered && acqShm.open(acqShmName.toStdString()) &&
+       acqShm.header()->session==shmSession && acqShm.header()->ampCount==ampCount) { // Same host: map the daemon's ring
+    acqSubscription.set(TcpSubscription::full(),ampCount); shmCIdx=acqShm.published();
+    shmWaiter=new ShmWaiter(&acqShm,this);
+    connect(shmWaiter,SIGNAL(shmData()),this,SLOT(slotAcqReadData()));
+    connect(shmWaiter,SIGNAL(shmGone()),this,SLOT(slotAcqShmGone()));
+    qDebug() << "octopus_acq_client: <AcqMaster> Mapped ACQ shared memory ring" << acqShmName
+             << "Bytes/sample:" << acqSubscription.frameSize << "History (samples):" << (quint64)acqShm.header()->slots;
+    shmWaiter->start(QThread::HighPriority);
+   } else if (acqMcast && mcastPort) { // Multicast: everybody gets the same frames, see ../mcastpacket.h
+    acqSubscription.set(mcastSubscription(),ampCount); mcastReorder.reset(acqSubscription.frameSize);
+    acqMcastSocket=new QUdpSocket(this);
+    acqMcastSocket->setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption,4<<20);
+    if (!acqMcastSocket->bind(QHostAddress::AnyIPv4,mcastPort,QUdpSocket::ShareAddress|QUdpSocket::ReuseAddressHint) ||
+        (mcastGroup.isMulticast() && !acqMcastSocket->joinMulticastGroup(mcastGroup))) {
+     qDebug() << "octopus_acq_client: <AcqMaster> Cannot join ACQ multicast stream" << mcastGroup.toString() << mcastPort; application->quit();
+    }
+    qDebug() << "octopus_acq_client: <AcqMaster> Joined ACQ multicast stream" << mcastGroup.toString() << ":" << mcastPort
+             << "Bytes/sample:" << acqSubscription.frameSize << "Retransmission:" << acqRetransmit;
+    acqRawData.resize(MCAST_DATAGRAM_MAX);
+    acqRetxSocket=new QTcpSocket(this);
+    connect(acqRetxSocket,SIGNAL(readyRead()),this,SLOT(slotAcqRetransmitData()));
+    connect(acqMcastSocket,SIGNAL(readyRead()),this,SLOT(slotAcqReadData()));
+   } else {
+    // Begin retrieving continuous data -- only raw and filtered data of the configured channels
+    acqDataSocket->connectToHost(acqHost,acqDataPort); acqDataSocket->waitForConnected();
+    if (!acqSubscribe()) {
+     qDebug() << "octopus_acq_client: <AcqMaster> ACQ server did not accept data subscription!"; application->quit();
+    }
+    qDebug() << "octopus_acq_client: <AcqMaster> Subscribed to ACQ data stream. Bytes/sample:" << acqSubscription.frameSize
+             << (acqSubscription.packed() ? "(LPC-coded)" : "");
+    acqRawData.resize(acqProbeFrames*acqSubscription.frameSize);
+    // A lost connection is resumed where it broke, from the daemon's BUFPAST history
+    acqResumeTimer=new QTimer(this); acqResumeTimer->setSingleShot(true);
+    connect(acqResumeTimer,SIGNAL(timeout()),this,SLOT(slotAcqResume()));
+    connect(acqDataSocket,SIGNAL(connected()),this,SLOT(slotAcqDataConnected()));
+    connect(acqDataSocket,SIGNAL(disconnected()),this,SLOT(slotAcqDataLost()));
+    connect(acqDataSocket,SIGNAL(readyRead()),this,SLOT(slotAcqReadData()));
+   }
 
    clientRunning=true;
   }
@@ -402,6 +467,21 @@ class AcqMaster : QObject {
    acqCommandStream.writeRawData((const char*)(&csCmd),sizeof(cs_command)); acqCommandSocket->flush(); acqCommandSocket->disconnectFromHost();
   }
 
+  // Server-side recording of the daemon (its REC|DIR and REC|FIELDS) under the given file name.
+  void acqSendRecStart(QString name) { QByteArray n=name.toLocal8Bit().left(16*sizeof(int)-1);
+   std::memset(&csCmd.iparam[4],0,16*sizeof(int)); std::memcpy(&csCmd.iparam[4],n.constData(),n.size());
+   acqSendCommand(CS_ACQ_REC_START,0,0,0);
+  }
+
+  // A trigger for the sample being acquired now rather than when the command arrives: stamped
+  // here with the monotonic clock if the daemon shares it (same host), else with the
+  // real-time clock, which is then assumed to be synchronized (NTP/PTP) between the hosts.
+  void acqSendTimedTrig(int code) { timespec t; bool local=(shmWaiter || QHostAddress(acqHost).isLoopback()); qint64 ns;
+   clock_gettime(local ? CLOCK_MONOTONIC : CLOCK_REALTIME,&t); ns=(qint64)t.tv_sec*1000000000LL+t.tv_nsec;
+   csCmd.iparam[3]=local ? 0 : 1;
+   acqSendCommand(CS_ACQ_TIMED_TRIG,code,(int)(ns&0xffffffff),(int)((quint64)ns>>32));
+  }
+
   int gizFindIndex(QString s) { int idx=-1;
    for (int i=0;i<gizmo.size();i++) if (gizmo[i]->name==s) { idx=i; break; }
    return idx;
@@ -576,7 +656,11 @@ class AcqMaster : QObject {
   // Non-volatile (read from and saved to octopus.cfg)
 
   // NET
-  QString acqHost; int acqCommPort,acqDataPort;
+  QString acqHost; int acqCommPort,acqDataPort,acqRate,acqFullRate; unsigned int acqProbeFrames; bool acqMcast,acqRetransmit,acqRecServer,acqPacked;
+  quint64 acqStreamIdx; unsigned int acqSession; QTimer *acqResumeTimer; bool acqResuming; // Data port position, for resuming
+  unsigned int acqOverrun; quint64 acqGapFrames,acqGapLost; bool acqGapResync; // Daemon-side overruns (gap frames)
+  unsigned int acqStep; // Samples per frame while the daemon thins out our backlog (step frames)
+  QHostAddress mcastGroup; int mcastPort; unsigned int mcastSession,mcastSeq; bool mcastStarted;
 
   // CHN
   QVector<QVector<Channel*> > acqChannels; QVector<Event*> acqEvents;
@@ -594,11 +678,14 @@ class AcqMaster : QObject {
 
   // Volatile-Runtime
   QApplication *application; cs_command csCmd,csAck; QTcpSocket *acqCommandSocket,*acqDataSocket;
+  QUdpSocket *acqMcastSocket; QTcpSocket *acqRetxSocket; cs_command retxCmd; bool retxBusy,retxHaveHdr; QElapsedTimer retxTimer,mcastGapTimer;
+  ShmRing acqShm; ShmWaiter *shmWaiter; QString acqShmName; bool shmOffered; unsigned int shmSession; quint64 shmCIdx,shmOverruns,shmLost;
+  McastReorder mcastReorder; quint64 mcastSeqGaps,mcastSeqLate,mcastBad,mcastRecovered,mcastGapFrom;
   QStatusBar *guiStatusBar; QLabel *timeLabel;
 
   bool notch; int notchN; float notchThreshold;
 
-  QVector<tcpsample> acqCurData; int eIndex; channel_params cp; int tChns,sampleRate,cntSpeedX;
+  QVector<tcpsample> acqCurData; TcpSubscription acqSubscription; QByteArray acqRawData,acqBlockFrames; int eIndex; channel_params cp; int tChns,sampleRate,cntSpeedX;
   QVector<QVector<float> > scrPrvData,scrCurData,scrPrvDataF,scrCurDataF; QVector<float> cntAmpX,avgAmpX;
   QString curEventName; int curEventType;
 
@@ -650,120 +737,120 @@ class AcqMaster : QObject {
   }
 
   void slotAcqReadData() {
-   unsigned int acqCurEvent,avgDataCount,avgStartOffset; QVector<float> *avgInChn; //,*stdInChn;
-   float n1,k1,k2; unsigned int offsetC,offsetP;
-   QDataStream acqDataStream(acqDataSocket);
-
-   while (acqDataSocket->bytesAvailable() >= chnInfo.probe_eeg_msecs*(unsigned int)(sizeof(tcpsample))) {
-    acqDataStream.readRawData((char*)(acqCurData.data()),chnInfo.probe_eeg_msecs*(unsigned int)(sizeof(tcpsample)));
+   if (shmWaiter) { // Shared memory: frames are processed right out of the mapping
+    quint64 pIdx,span=acqShm.header()->slots-acqShm.header()->guard,n;
+    shmWaiter->consumed(); pIdx=acqShm.published();
+    if (pIdx-shmCIdx>span) { shmOverruns++; shmLost+=pIdx-span-shmCIdx; shmCIdx=pIdx-span; } // Lapped
+    while (shmCIdx<pIdx) { n=qMin(qMin(pIdx-shmCIdx,(quint64)acqShm.contiguous(shmCIdx)),(quint64)acqCurData.size());
+     acqHandleFrames(acqShm.frame(shmCIdx),n);
+     if (!acqShm.intact(shmCIdx)) shmOverruns++; // Overwritten while being unpacked
+     shmCIdx+=n;
+    }
+    return;
+   }
 
-    for (unsigned int dOffset=0;dOffset<chnInfo.probe_eeg_msecs;dOffset++) {
-     // Check Sample Offset Delta for all amps
-     for (unsigned int i=0;i<ampCount;i++) {
-      offsetC=(unsigned int)(acqCurData[dOffset].amp[i].offset); offsetP=ampChkP[i]; ampChkP[i]=offsetC;
-      if ((offsetC-offsetP)!=1)
-       qDebug() << "octopus_acq_client: <AcqMaster> <AcqReadData> Offset leak!!! Amp " << i << " OffsetC->" << offsetC << " OffsetP->" << offsetP;
+   if (acqMcastSocket) { // Datagrams: ordered by sample index, gaps refilled by retransmission or given up
+    qint64 len; const mcastheader *h=(const mcastheader*)acqRawData.constData();
+    while (acqMcastSocket->hasPendingDatagrams()) {
+     len=acqMcastSocket->readDatagram(acqRawData.data(),acqRawData.size());
+     if (len<(qint64)sizeof(mcastheader) || h->magic!=MCAST_MAGIC || h->frameSize!=acqSubscription.frameSize ||
+         len!=(qint64)(sizeof(mcastheader)+(quint64)h->count*h->frameSize)) { mcastBad++; continue; }
+     if (h->session!=mcastSession) { // Daemon restarted; its sample indices start over
+      qDebug() << "octopus_acq_client: <AcqMaster> <AcqReadData> New ACQ multicast session, restarting stream.";
+      mcastSession=h->session; mcastReorder.reset(acqSubscription.frameSize); mcastStarted=false;
+     }
+     if (mcastStarted && h->seq!=mcastSeq+1) {
+      if ((int)(h->seq-mcastSeq)>1) mcastSeqGaps+=h->seq-mcastSeq-1; else mcastSeqLate++;
      }
+     if (!mcastStarted || (int)(h->seq-mcastSeq)>0) mcastSeq=h->seq;
+     mcastStarted=true;
+     mcastReorder.insert(h->smpIdx,acqRawData.constData()+sizeof(mcastheader),h->count);
+    }
+    acqDeliverMcast(); return;
+   }
 
-     if (!(globalCounter%10000)) { // Sort ampChkP and print
-      qDebug() << "octopus_acq_client: <AcqMaster> <AcqReadData> Interamp actual sample count Delta span ->" << abs((int)ampChkP[1]-(int)ampChkP[0]);
-     } globalCounter++;
+   if (acqResuming) { // The daemon's answer to a resumed subscription comes first
+    if (acqDataSocket->bytesAvailable()<(qint64)sizeof(tcpsubscription)) return;
+    acqResuming=false; acqResumeTimer->stop();
+    if (!acqTakeSubscription(true)) { acqDataSocket->abort(); acqResumeTimer->start(ACQ_RESUME_MSECS); return; }
+   }
 
-     // STREAMING/RECORDING, 50Hz COMPUTATION and ONLINE AVG is enabled..
+   if (acqSubscription.packed()) { acqReadBlocks(); return; }
 
-     acqCurEvent=(int)(acqCurData[dOffset].trigger); // Event
+   QDataStream acqDataStream(acqDataSocket);
+   while (acqDataSocket->bytesAvailable() >= acqRawData.size()) {
+    acqDataStream.readRawData(acqRawData.data(),acqRawData.size());
+    acqHandleFrames(acqRawData.constData(),acqProbeFrames); acqStreamIdx+=acqProbeFrames;
+   } // bytesAvailable
+  } // acqReadData
 
-     if (recording) { // .. to disk ..
-      for (int i=0;i<cntRecChns.size();i++) {
-       curChn=acqChannels[0][cntRecChns[0][i]];
-       //if (curChn->ampNo==1) cntStream << acqCurData[dOffset].amp[0].data[curChn->physChn];
-       //else cntStream << acqCurData[dOffset].amp[1].data[curChn->physChn];
-      }
-      cntStream << acqCurEvent;
-      recCounter++; if (!(recCounter%sampleRate)) updateRecTime();
-     }
+  // Packed TCP stream: whole blocks only, each unpacked and handed over in EEGPROBEMS chunks.
+  // The block header tells exactly which stretch of the stream it stands for.
+  void acqReadBlocks() { tcpblock h; unsigned int chunk=acqCurData.size();
+   while (acqDataSocket->bytesAvailable()>=(qint64)sizeof(tcpblock)) {
+    acqDataSocket->peek((char*)&h,sizeof(tcpblock));
+    if (h.magic!=TCP_SUB_BLOCK_MAGIC || h.bytes<sizeof(tcpblock) || h.count>h.span) {
+     qDebug() << "octopus_acq_client: <AcqMaster> Corrupt ACQ data block, dropping the connection!";
+     acqDataSocket->abort(); return;
+    }
+    if (acqDataSocket->bytesAvailable()<(qint64)h.bytes) return; // Rest of the block yet to come
+    if (acqRawData.size()<(int)h.bytes) acqRawData.resize(h.bytes);
+    if (acqBlockFrames.size()<(int)qMax(h.count,1u)*acqSubscription.frameSize) acqBlockFrames.resize(qMax(h.count,1u)*acqSubscription.frameSize);
+    acqDataSocket->read(acqRawData.data(),h.bytes);
+    if (!acqSubscription.unpackBlock(acqRawData.constData(),acqBlockFrames.data())) {
+     qDebug() << "octopus_acq_client: <AcqMaster> Undecodable ACQ data block, dropping the connection!";
+     acqDataSocket->abort(); return;
+    }
+    if (h.lost>0) { QByteArray g(acqSubscription.frameSize,0); acqSubscription.packGap(h.lost,g.data()); acqHandleFrames(g.constData(),1); }
+    if (h.count>0 && h.span/h.count!=acqStep) { acqStep=h.span/h.count; acqGapResync=true; } // DECIMATE: frames are span/count apart
+    for (unsigned int i=0;i<h.count;i+=chunk)
+     acqHandleFrames(acqBlockFrames.constData()+(size_t)i*acqSubscription.frameSize,qMin(h.count-i,chunk));
+    acqStreamIdx=h.firstIdx+h.span;
+   }
+  }
 
-     // Handle backward data..
-     //  Put data into suitable offset for backward online averaging..
-     float dummyAvg; int notchCount=notchN*(chnInfo.sampleRate/50); int notchStart=(cp.cntPastSize+cp.cntPastIndex-notchCount)%cp.cntPastSize; // -1 ?
-     for (int j=0;j<acqChannels.size();j++) {
-      curChn=acqChannels[0][j];
-      //curChn->pastData[cp.cntPastIndex] = (curChn->ampNo==1) ? acqCurData[dOffset].amp[0].data[curChn->physChn] : acqCurData[dOffset].amp[1].data[curChn->physChn];
-      //curChn->pastFilt[cp.cntPastIndex] = (curChn->ampNo==1) ? acqCurData[dOffset].amp[0].dataF[curChn->physChn] : acqCurData[dOffset].amp[1].dataF[curChn->physChn];
-
-      // Compute Absolute "50Hz+Harmonics" Level of that channel..
-      dummyAvg=0.; for (int k=0;k<notchCount;k++) dummyAvg+=abs(curChn->pastFilt[(notchStart+k)%cp.cntPastSize]);
-      dummyAvg/=(float)notchCount; //dummyAvg/=0.6; // Level of avg of sine..
-      curChn->notchLevel=dummyAvg; // /10.; // Normalization
-      if (curChn->notchLevel < notchThreshold) curChn->notchColor=QColor(0,255,0,144); else curChn->notchColor=QColor(255,0,0,144); // Green vs. Red
-     }
+  // Data connection dropped: take what already arrived, then reconnect and resume.
+  void slotAcqDataLost() {
+   if (!clientRunning || acqResuming) return; // A resume attempt retries on its own timeout
+   slotAcqReadData(); acqDataSocket->readAll(); // A partial block is asked for again
+   qDebug() << "octopus_acq_client: <AcqMaster> ACQ data connection lost at sample" << acqStreamIdx << "-- resuming..";
+   acqResumeTimer->start(ACQ_RESUME_MSECS);
+  }
 
-     // Handle Incoming Event..
-     if (acqCurEvent) { event=true; curEventName="STIM event #"; curEventName+=dummyString.setNum(acqCurEvent);
-      int idx=eventIndex(acqCurEvent,1);
-      if (idx>=0) { eIndex=idx; curEventName=acqEvents[eIndex]->name;
-       qDebug() << "octopus_acq_client: <AcqMaster> <AcqReadData> <IncomingEvent> Avg! (Index,Name)->" << eIndex << curEventName;
-       if (withinAvgEpoch) {
-        qDebug() << "octopus_acq_client: <AcqMaster> <AcqReadData> <IncomingEvent> Event collision!.. (already within process of averaging).." << avgCounter << cp.rejCount;
-       } else { withinAvgEpoch=true; avgCounter=0; }
-      }
-     }
+  // Reconnecting without blocking the GUI: connected() sends the subscription, readyRead()
+  // takes the answer; should either not come in time, the timer starts over from here.
+  void slotAcqResume() {
+   if (!clientRunning) return;
+   acqResuming=true; acqDataSocket->abort(); acqDataSocket->connectToHost(acqHost,acqDataPort);
+   acqResumeTimer->start(ACQ_RESUME_MSECS+TCP_SUB_TIMEOUT_MSECS);
+  }
 
-     if (withinAvgEpoch) {
-      if (avgCounter==cp.bwCount) { withinAvgEpoch=false;
-       qDebug() << "octopus_acq_client: <AcqMaster> <AcqReadData> <WithinEpoch> Computing for Event! (iIndex,Name)->" << eIndex << acqEvents[eIndex]->name;
- 
-       // Check rejection backwards on pastdata
-       bool rejFlag=false; int rejChn=0;
-       for (int i=0;i<acqChannels.size();i++) for (int j=0;j<acqChannels[i].size();j++) {
-        if (acqChannels[i][j]->rejLev>0) {
-         for (int j=0;j<cp.rejCount;j++) { unsigned int idx=(cp.cntPastSize+cp.cntPastIndex-cp.rejCount+j)%cp.cntPastSize;
-          unsigned int ref=acqChannels[i][j]->rejRef;
-          float chRejLev=abs(acqChannels[i][j]->pastData[idx]-acqChannels[i][ref]->pastData[idx]);
-          if (chRejLev > acqChannels[i][j]->rejLev) { rejFlag=true; rejChn=i; break; }
-         }
-        } if (rejFlag==true) break;
-       }
+  void slotAcqDataConnected() { if (acqResuming) acqSendSubscription(true); }
 
-       if (rejFlag) { // Rejected, increment rejected count
-        acqEvents[eIndex]->rejected++;
-        qDebug() << "octopus_acq_client: <AcqMaster> <AcqReadData> <Reject> Rejected because of" << acqChannels[0][rejChn]->name << "..";
-       } else { // Not rejected: compute average and increment accepted for the event
-        acqEvents[eIndex]->accepted++; eventOccured=true;
-        qDebug() << "octopus_acq_client: <AcqMaster> <AcqReadData> <Reject> Computing average for eventIndex and updating GUI..";
- 
-        for (int i=0;i<acqChannels.size();i++) for (int j=0;j<acqChannels[i].size();j++) {
-         avgStartOffset=(cp.cntPastSize+cp.cntPastIndex-cp.avgCount-cp.postRejCount)%cp.cntPastSize;
-         avgInChn=&(acqChannels[i][j]->avgData)[eIndex];
-	 //stdInChn=&(acqChannels[i][j]->stdData)[eIndex];
-         n1=(float)(acqEvents[eIndex]->accepted); //n2=1
-         avgDataCount=avgInChn->size();
-         for (unsigned int k=0;k<avgDataCount;k++) { k1=(*avgInChn)[k]; k2=acqChannels[i][j]->pastData[(avgStartOffset+j)%cp.cntPastSize]; (*avgInChn)[k]=(k1*n1+k2)/(n1+1.); }
-        } emit repaintGL(16); emit repaintHeadWindow();
-       }
-      }
-     } // averaging
-     
-     avgCounter++;
-
-     cp.cntPastIndex++; cp.cntPastIndex%=cp.cntPastSize;
-
-     if (!scrCounter) {
-      for (unsigned int i=0;i<ampCount;i++) for (int j=0;j<scrCurData[i].size();j++) { curChn=acqChannels[i][j];
-       scrPrvData[i][j]=scrCurData[i][j]; scrCurData[i][j]=acqCurData[dOffset].amp[i].data[curChn->physChn];
-       scrPrvDataF[i][j]=scrCurDataF[i][j]; scrCurDataF[i][j]=acqCurData[dOffset].amp[i].dataF[curChn->physChn];
-      } emit scrData(tick,event); tick=event=false; // Update CntFrame
-     } scrCounter++; scrCounter%=cntSpeedX;
-     if (!seconds) emit repaintGL(2+4); // Update 50Hz visualization..
-     seconds++; seconds%=sampleRate; if (seconds==0) tick=true;
-    } // dOffset
-   } // bytesAvailable
-  } // acqReadData
+  void slotAcqShmGone() {
+   qDebug() << "octopus_acq_client: <AcqMaster> ACQ daemon closed its shared memory ring; restart to reconnect.";
+  }
+
+  // Reply to a retransmission request: cs_command header, then the frames of the span.
+  void slotAcqRetransmitData() { quint64 from,count;
+   if (!retxHaveHdr) {
+    if (acqRetxSocket->bytesAvailable()<(qint64)sizeof(cs_command)) return;
+    acqRetxSocket->read((char*)(&retxCmd),sizeof(cs_command)); retxHaveHdr=true;
+   }
+   count=(retxCmd.cmd==CS_ACQ_RETRANSMIT_RESULT && retxCmd.iparam[2]>0) ? retxCmd.iparam[2] : 0;
+   if (acqRetxSocket->bytesAvailable()<(qint64)(count*acqSubscription.frameSize)) return;
+   from=(quint64)(quint32)retxCmd.iparam[0]|((quint64)(quint32)retxCmd.iparam[1]<<32);
+   QByteArray frames=acqRetxSocket->read(count*acqSubscription.frameSize);
+   if (count) { mcastReorder.insert(from,frames.constData(),count); mcastRecovered+=count; }
+   retxHaveHdr=retxBusy=false; acqRetxSocket->disconnectFromHost();
+   acqDeliverMcast();
+  }
 
   void slotReboot() { acqSendCommand(CS_REBOOT,0,0,0); guiStatusBar->showMessage("ACQ server is rebooting..",5000); }
   void slotShutdown() { acqSendCommand(CS_SHUTDOWN,0,0,0); guiStatusBar->showMessage("ACQ server is shutting down..",5000); }
   
-  void slotQuit() {
+  void slotQuit() { clientRunning=false; // No resuming from here on
+   if (shmWaiter) { shmWaiter->stopRequested=true; shmWaiter->wait(); }
    if (digitizer->connected) digitizer->serialClose();
    acqDataSocket->disconnectFromHost();
    if (acqDataSocket->state()==QAbstractSocket::UnconnectedState || acqDataSocket->waitForDisconnected(1000)) application->exit(0);
@@ -831,11 +918,14 @@ class AcqMaster : QObject {
     
     // Here continuous data begins..
     timeLabel->setText("Rec.Time: 00:00:00"); recCounter=0; recording=true;
-   } else { recording=false; cntStream.setDevice(0); cntFile.close(); }
+    if (acqRecServer) acqSendRecStart(cntFN+".ocr"); // The same session, safe on the daemon's side
+   } else { recording=false; cntStream.setDevice(0); cntFile.close();
+    if (acqRecServer) acqSendCommand(CS_ACQ_REC_STOP,0,0,0);
+   }
   }
 
   void slotToggleNotch() { if (!notch) notch=true; else notch=false; }
-  void slotManualTrig() { acqSendCommand(CS_ACQ_MANUAL_TRIG,AMP_SIMU_TRIG,0,0); }
+  void slotManualTrig() { acqSendTimedTrig(AMP_SIMU_TRIG); }
   void slotManualSync() { acqSendCommand(CS_ACQ_MANUAL_SYNC,AMP_SYNC_TRIG,0,0); }
 
   // *** TCP HANDLERS
@@ -852,11 +942,208 @@ class AcqMaster : QObject {
    switch (socketError) {
     case QAbstractSocket::HostNotFoundError: qDebug() << "octopus_acq_client: <AcqMaster> <AcqDataErr> ACQuisition data server does not exist!"; break;
     case QAbstractSocket::ConnectionRefusedError: qDebug() << "octopus_acq_client: <AcqMaster> <AcqDataErr> ACQuisition data server refused connection!"; break;
+    case QAbstractSocket::RemoteHostClosedError: qDebug() << "octopus_acq_client: <AcqMaster> <AcqDataErr> ACQuisition data server closed the connection!"; break;
     default: qDebug() << "octopus_acq_client: <AcqMaster> <AcqDataErr> ACQuisition data server unknown error!"; break;
    }
   }
 
  private: // Used Just-In-Time..
+  // Send our subscription over the (connected) data socket and wait for the daemon's echo;
+  // the first one only, a resume goes through acqSendSubscription()/acqTakeSubscription().
+  bool acqSubscribe() { acqSendSubscription(false);
+   while (acqDataSocket->bytesAvailable()<(qint64)sizeof(tcpsubscription))
+    if (!acqDataSocket->waitForReadyRead(TCP_SUB_TIMEOUT_MSECS)) break;
+   return acqTakeSubscription(false);
+  }
+
+  // When resuming, the stream is asked for from acqStreamIdx on.
+  void acqSendSubscription(bool resume) { tcpsubscription acqSub; memset(&acqSub,0,sizeof(tcpsubscription));
+   acqSub.magic=TCP_SUB_MAGIC; acqSub.fields=TCP_SUB_RAW|TCP_SUB_FLT|(acqPacked ? TCP_SUB_LPC : 0); acqSub.policy=acqOverrun;
+   acqSub.rate=(sampleRate<acqFullRate) ? sampleRate : 0;
+   for (unsigned int i=0;i<ampCount;i++) for (int j=0;j<acqChannels[i].size();j++)
+    if (acqChannels[i][j]->physChn>=0 && acqChannels[i][j]->physChn<PHYS_CHN_COUNT)
+     TcpSubscription::select(acqSub,i,acqChannels[i][j]->physChn);
+   if (resume) { acqSub.resume=1; acqSub.session=acqSession; acqSub.startIdx=acqStreamIdx; }
+   acqDataSocket->write((const char*)(&acqSub),sizeof(tcpsubscription)); acqDataSocket->flush();
+  }
+
+  // The daemon's echo, once all of it is there: what it grants, and from where.
+  bool acqTakeSubscription(bool resume) { tcpsubscription acqSub;
+   if (acqDataSocket->read((char*)(&acqSub),sizeof(tcpsubscription))!=sizeof(tcpsubscription) ||
+       acqSub.ampCount!=ampCount || (acqSub.rate && (int)acqSub.rate!=sampleRate) || !acqSubscription.set(acqSub,ampCount)) return false;
+   if (resume) {
+    if (acqSub.resume) qDebug() << "octopus_acq_client: <AcqMaster> ACQ data stream resumed at sample" << acqStreamIdx << "without loss.";
+    else if (acqSub.session==acqSession)
+     qDebug() << "octopus_acq_client: <AcqMaster> ACQ data stream resumed live, history gone:" << (quint64)(acqSub.startIdx-acqStreamIdx) << "samples lost!";
+    else qDebug() << "octopus_acq_client: <AcqMaster> ACQ daemon was restarted, data stream starts over!";
+   }
+   acqSession=acqSub.session; acqStreamIdx=acqSub.startIdx; acqStep=1;
+   return true;
+  }
+
+  // Unpack and process count (<=EEGPROBEMS) consecutive frames of the stream. Over TCP a
+  // frame may be a gap frame instead, telling how many samples the daemon had to skip, or
+  // a step frame, telling how many samples each of the frames after it stands for. The
+  // caller has counted one sample per frame; the stream index is corrected for both here.
+  void acqHandleFrames(const char *frames,unsigned int count) {
+   unsigned int acqCurEvent,avgDataCount,avgStartOffset; QVector<float> *avgInChn; //,*stdInChn;
+   float n1,k1,k2; unsigned int offsetC,offsetP,offsetStep; quint64 gap;
+
+   for (unsigned int dOffset=0;dOffset<count;dOffset++)
+    acqSubscription.unpack(frames+dOffset*acqSubscription.frameSize,acqCurData[dOffset]);
+
+   for (unsigned int dOffset=0;dOffset<count;dOffset++) {
+    if (acqCurData[dOffset].trigger==TCP_SUB_GAP) { // In place of the skipped samples; the stream index moves over them
+     gap=(quint64)acqCurData[dOffset].amp[0].offset|((quint64)acqCurData[dOffset].amp[0].trigger<<32);
+     acqGapFrames++; acqGapLost+=gap; acqStreamIdx+=gap-1; acqGapResync=true;
+     RTLOG("octopus_acq_client: <AcqMaster> <AcqReadData> ACQ daemon overrun, %llu samples skipped!",(unsigned long long)gap); continue;
+    }
+    if (acqCurData[dOffset].trigger==TCP_SUB_STEP) { // Stands for no sample; the frames after it are step apart
+     acqStep=qMax(1u,(unsigned int)acqCurData[dOffset].amp[0].offset); acqStreamIdx--; acqGapResync=true; continue;
+    }
+    acqStreamIdx+=acqStep-1; offsetStep=acqStep*(unsigned int)(acqFullRate/qMax(1,sampleRate));
+
+    // Check Sample Offset Delta for all amps
+    for (unsigned int i=0;i<ampCount;i++) {
+     offsetC=(unsigned int)(acqCurData[dOffset].amp[i].offset); offsetP=ampChkP[i]; ampChkP[i]=offsetC;
+     if (acqGapResync) continue; // Offsets restart after a gap
+     // The daemon resamples drifting amps onto a common clock, so their own sample# may
+     // repeat or skip one now and then; anything else is a real leak. Below the full
+     // rate they advance by the decimation factor (as do the thinned out frames by their step).
+     if (offsetC-offsetP==offsetStep-1 || offsetC-offsetP==offsetStep+1) ampSlips++;
+     else if ((offsetC-offsetP)!=offsetStep)
+      RTLOG("octopus_acq_client: <AcqMaster> <AcqReadData> Offset leak!!! Amp %u OffsetC-> %u OffsetP-> %u",i,offsetC,offsetP);
+    }
+    acqGapResync=false;
+
+    if (!(globalCounter%10000)) { // Sort ampChkP and print
+     qDebug() << "octopus_acq_client: <AcqMaster> <AcqReadData> Interamp actual sample count Delta span ->" << abs((int)ampChkP[1]-(int)ampChkP[0])
+              << "Drift slips:" << ampSlips;
+     if (acqGapFrames)
+      qDebug() << "octopus_acq_client: <AcqMaster> <AcqReadData> Daemon overruns:" << acqGapFrames << "samples skipped:" << acqGapLost;
+     if (shmWaiter)
+      qDebug() << "octopus_acq_client: <AcqMaster> <AcqReadData> Shared memory overruns:" << shmOverruns << "lost:" << shmLost;
+     if (acqMcastSocket)
+      qDebug() << "octopus_acq_client: <AcqMaster> <AcqReadData> Multicast datagrams lost:" << mcastSeqGaps << "reordered:" << mcastSeqLate
+               << "bad:" << mcastBad << "Samples recovered:" << mcastRecovered << "given up:" << (quint64)mcastReorder.lost;
+    } globalCounter++;
+
+    // STREAMING/RECORDING, 50Hz COMPUTATION and ONLINE AVG is enabled..
+
+    acqCurEvent=(int)(acqCurData[dOffset].trigger); // Event
+
+    if (recording) { // .. to disk ..
+     for (int i=0;i<cntRecChns.size();i++) {
+      curChn=acqChannels[0][cntRecChns[0][i]];
+      //if (curChn->ampNo==1) cntStream << acqCurData[dOffset].amp[0].data[curChn->physChn];
+      //else cntStream << acqCurData[dOffset].amp[1].data[curChn->physChn];
+     }
+     cntStream << acqCurEvent;
+     recCounter++; if (!(recCounter%sampleRate)) updateRecTime();
+    }
+
+    // Handle backward data..
+    //  Put data into suitable offset for backward online averaging..
+    float dummyAvg; int notchCount=notchN*(chnInfo.sampleRate/50); int notchStart=(cp.cntPastSize+cp.cntPastIndex-notchCount)%cp.cntPastSize; // -1 ?
+    for (int j=0;j<acqChannels.size();j++) {
+     curChn=acqChannels[0][j];
+     //curChn->pastData[cp.cntPastIndex] = (curChn->ampNo==1) ? acqCurData[dOffset].amp[0].data[curChn->physChn] : acqCurData[dOffset].amp[1].data[curChn->physChn];
+     //curChn->pastFilt[cp.cntPastIndex] = (curChn->ampNo==1) ? acqCurData[dOffset].amp[0].dataF[curChn->physChn] : acqCurData[dOffset].amp[1].dataF[curChn->physChn];
+
+     // Compute Absolute "50Hz+Harmonics" Level of that channel..
+     dummyAvg=0.; for (int k=0;k<notchCount;k++) dummyAvg+=abs(curChn->pastFilt[(notchStart+k)%cp.cntPastSize]);
+     dummyAvg/=(float)notchCount; //dummyAvg/=0.6; // Level of avg of sine..
+     curChn->notchLevel=dummyAvg; // /10.; // Normalization
+     if (curChn->notchLevel < notchThreshold) curChn->notchColor=QColor(0,255,0,144); else curChn->notchColor=QColor(255,0,0,144); // Green vs. Red
+    }
+
+    // Handle Incoming Event..
+    if (acqCurEvent) { event=true; curEventName="STIM event #"; curEventName+=dummyString.setNum(acqCurEvent);
+     int idx=eventIndex(acqCurEvent,1);
+     if (idx>=0) { eIndex=idx; curEventName=acqEvents[eIndex]->name;
+      qDebug() << "octopus_acq_client: <AcqMaster> <AcqReadData> <IncomingEvent> Avg! (Index,Name)->" << eIndex << curEventName;
+      if (withinAvgEpoch) {
+       RTLOG("octopus_acq_client: <AcqMaster> <AcqReadData> <IncomingEvent> Event collision!.. (already within process of averaging).. %d %d",(int)avgCounter,(int)cp.rejCount);
+      } else { withinAvgEpoch=true; avgCounter=0; }
+     }
+    }
+
+    if (withinAvgEpoch) {
+     if (avgCounter==cp.bwCount) { withinAvgEpoch=false;
+      qDebug() << "octopus_acq_client: <AcqMaster> <AcqReadData> <WithinEpoch> Computing for Event! (iIndex,Name)->" << eIndex << acqEvents[eIndex]->name;
+
+      // Check rejection backwards on pastdata
+      bool rejFlag=false; int rejChn=0;
+      for (int i=0;i<acqChannels.size();i++) for (int j=0;j<acqChannels[i].size();j++) {
+       if (acqChannels[i][j]->rejLev>0) {
+        for (int j=0;j<cp.rejCount;j++) { unsigned int idx=(cp.cntPastSize+cp.cntPastIndex-cp.rejCount+j)%cp.cntPastSize;
+         unsigned int ref=acqChannels[i][j]->rejRef;
+         float chRejLev=abs(acqChannels[i][j]->pastData[idx]-acqChannels[i][ref]->pastData[idx]);
+         if (chRejLev > acqChannels[i][j]->rejLev) { rejFlag=true; rejChn=i; break; }
+        }
+       } if (rejFlag==true) break;
+      }
+
+      if (rejFlag) { // Rejected, increment rejected count
+       acqEvents[eIndex]->rejected++;
+       qDebug() << "octopus_acq_client: <AcqMaster> <AcqReadData> <Reject> Rejected because of" << acqChannels[0][rejChn]->name << "..";
+      } else { // Not rejected: compute average and increment accepted for the event
+       acqEvents[eIndex]->accepted++; eventOccured=true;
+       qDebug() << "octopus_acq_client: <AcqMaster> <AcqReadData> <Reject> Computing average for eventIndex and updating GUI..";
+
+       for (int i=0;i<acqChannels.size();i++) for (int j=0;j<acqChannels[i].size();j++) {
+        avgStartOffset=(cp.cntPastSize+cp.cntPastIndex-cp.avgCount-cp.postRejCount)%cp.cntPastSize;
+        avgInChn=&(acqChannels[i][j]->avgData)[eIndex];
+	 //stdInChn=&(acqChannels[i][j]->stdData)[eIndex];
+        n1=(float)(acqEvents[eIndex]->accepted); //n2=1
+        avgDataCount=avgInChn->size();
+        for (unsigned int k=0;k<avgDataCount;k++) { k1=(*avgInChn)[k]; k2=acqChannels[i][j]->pastData[(avgStartOffset+j)%cp.cntPastSize]; (*avgInChn)[k]=(k1*n1+k2)/(n1+1.); }
+       } emit repaintGL(16); emit repaintHeadWindow();
+      }
+     }
+    } // averaging
+    
+    avgCounter++;
+
+    cp.cntPastIndex++; cp.cntPastIndex%=cp.cntPastSize;
+
+    if (!scrCounter) {
+     for (unsigned int i=0;i<ampCount;i++) for (int j=0;j<scrCurData[i].size();j++) { curChn=acqChannels[i][j];
+      scrPrvData[i][j]=scrCurData[i][j]; scrCurData[i][j]=acqCurData[dOffset].amp[i].data[curChn->physChn];
+      scrPrvDataF[i][j]=scrCurDataF[i][j]; scrCurDataF[i][j]=acqCurData[dOffset].amp[i].dataF[curChn->physChn];
+     } emit scrData(tick,event); tick=event=false; // Update CntFrame
+    } scrCounter++; scrCounter%=cntSpeedX;
+    if (!seconds) emit repaintGL(2+4); // Update 50Hz visualization..
+    seconds++; seconds%=sampleRate; if (seconds==0) tick=true;
+   } // dOffset
+  }
+
+  // Hand over whatever is contiguous; at a gap ask the daemon for it once, and after
+  // MCAST_GAP_MSECS give up on it (the offset check then reports the leak).
+  void acqDeliverMcast() { const char *frames; unsigned int n,chunk=acqCurData.size(); uint64_t from,to;
+   for (;;) {
+    while ((n=mcastReorder.front(frames))>0) {
+     for (unsigned int i=0;i<n;i+=chunk) acqHandleFrames(frames+i*acqSubscription.frameSize,qMin(n-i,chunk));
+     mcastReorder.pop();
+    }
+    if (!mcastReorder.gap(from,to)) break;
+    if (from!=mcastGapFrom || !mcastGapTimer.isValid()) { // A new gap
+     mcastGapFrom=from; mcastGapTimer.start();
+     if (acqRetransmit) {
+      if (retxBusy && retxTimer.elapsed()>(qint64)MCAST_GAP_MSECS) { acqRetxSocket->abort(); retxBusy=retxHaveHdr=false; }
+      if (!retxBusy) { cs_command req; memset(&req,0,sizeof(cs_command)); retxBusy=true; retxTimer.start();
+       req.cmd=CS_ACQ_RETRANSMIT; req.iparam[0]=(int)(from&0xffffffff); req.iparam[1]=(int)(from>>32);
+       req.iparam[2]=(int)qMin(to-from,(uint64_t)MCAST_RETX_MAX);
+       acqRetxSocket->connectToHost(acqHost,acqCommPort); acqRetxSocket->write((const char*)(&req),sizeof(cs_command));
+      }
+     }
+    }
+    if (mcastGapTimer.elapsed()<(qint64)MCAST_GAP_MSECS) break;
+    qDebug() << "octopus_acq_client: <AcqMaster> <AcqReadData> Multicast gap of" << (quint64)(to-from) << "samples given up.";
+    mcastReorder.skip(); mcastGapTimer.invalidate();
+   }
+  }
+
   void updateRecTime() { int s,m,h; s=recCounter/sampleRate; m=s/60; h=m/60;
    if (h<10) rHour="0"; else rHour=""; rHour+=dummyString.setNum(h);
    if (m<10) rMin="0"; else rMin=""; rMin+=dummyString.setNum(m);
@@ -867,7 +1154,7 @@ class AcqMaster : QObject {
   bool tick,event; int seconds,cntBufIndex,scrCounter,recCounter,avgCounter; QObject *recorder; unsigned int ampCount; QString rHour,rMin,rSec,dummyString;
 
   QFile cfgFile,cntFile,avgFile; QTextStream cfgStream; QDataStream cntStream,avgStream;
-  serial_device serial; Digitizer *digitizer; Event *dummyEvt; Channel *dummyChn,*curChn; QVector<unsigned int> ampChkP; quint64 globalCounter;
+  serial_device serial; Digitizer *digitizer; Event *dummyEvt; Channel *dummyChn,*curChn; QVector<unsigned int> ampChkP; quint64 globalCounter,ampSlips;
 };
 
 #endif
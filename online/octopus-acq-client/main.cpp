@@ -49,10 +49,10 @@ Octopus-ReEL - Realtime Encephalography Laboratory Network
 #include "acqcontrol.h"
 #include "acqclient.h"
 
-int main(int argc,char** argv) { AcqClient *acqClient;
- QApplication app(argc,argv); AcqMaster *acqM=new AcqMaster(&app);
+int main(int argc,char** argv) { AcqClient *acqClient; int ret;
+ QApplication app(argc,argv); rtLog().start(); AcqMaster *acqM=new AcqMaster(&app);
  AcqControl *acqControl=new AcqControl(acqM); acqControl->show();
  for (unsigned int i=0;i<acqM->getAmpCount();i++) { acqClient=new AcqClient(acqM,i); acqClient->show(); }
  acqM->acqSendCommand(CS_ACQ_MANUAL_TRIG,AMP_SIMU_TRIG,0,0);
- return app.exec();
+ ret=app.exec(); rtLog().stop(); return ret;
 }
@@ -22,7 +22,7 @@
 TEMPLATE = app
 TARGET = octopus-acq-client
 INCLUDEPATH += .
-LIBS += -lGLU
+LIBS += -lGLU -lrt
 QT += widgets network multimedia opengl
 
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
@@ -38,5 +38,8 @@ HEADERS += acqmaster.h \
            digitizer.h \
            headglwidget.h \
            legendframe.h \
+           shmwaiter.h \
+           ../lpccodec.h \
+           ../rtlog.h \
            ../serial_device.h
 SOURCES += main.cpp
@@ -0,0 +1,64 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* Sleeps on the daemon's shared memory ring (../shmring.h) in its own thread and
+   tells AcqMaster when there is something new; AcqMaster then reads the frames out of
+   the mapping itself. While a notification is still pending no further one is queued,
+   so a busy GUI thread is not flooded. */
+
+#ifndef SHMWAITER_H
+#define SHMWAITER_H
+
+#include <QThread>
+#include <atomic>
+
+#include "../shmring.h"
+
+const unsigned int SHM_WAIT_MSECS=100; // Max. sleep w/o new data (stop checks)
+
+class ShmWaiter : public QThread {
+ Q_OBJECT
+ public:
+  ShmWaiter(const ShmRing *r,QObject *parent=0) : QThread(parent) { ring=r; stopRequested=pending=false; }
+
+  virtual void run() { uint64_t seen=ring->published();
+   while (!stopRequested && ring->running()) {
+    if (!ring->wait(seen,SHM_WAIT_MSECS)) continue;
+    seen=ring->published();
+    if (!pending.exchange(true)) emit shmData();
+   }
+   if (!stopRequested) emit shmGone();
+  }
+
+  void consumed() { pending=false; } // Called by the reader before it looks at the ring
+
+  std::atomic<bool> stopRequested;
+
+ signals:
+  void shmData(); void shmGone();
+
+ private:
+  const ShmRing *ring; std::atomic<bool> pending;
+};
+
+#endif
@@ -33,7 +33,14 @@ Octopus-ReEL - Realtime Encephalography Laboratory Network
 #include <QThread>
 #include <QVector>
 #include <QMutex>
+#include <QWaitCondition>
+#include <QDir>
+#include <QFileInfo>
+#include <atomic>
+#include <vector>
+#include <sched.h>
 #include <unistd.h>
+#include <grp.h>
 
 #include "../acqglobals.h"
 
@@ -41,23 +48,41 @@ Octopus-ReEL - Realtime Encephalography Laboratory Network
 #include "../tcpsample.h"
 #include "../chninfo.h"
 #include "chntopo.h"
-#include "tcpthread.h"
 #include "clienthandler.h"
+#include "acqstats.h"
+#include "sampleclock.h"
+#include "../rtlog.h"
+#include "mcastsender.h"
+#include "recordsink.h"
+#include "../shmring.h"
+#include "iirbank.h"
+#include "triggerout.h"
+#ifndef EEMAGINE
+#include "eesynth.h"
+#endif
 
 class AcqDaemon : public QTcpServer {
  Q_OBJECT
  public:
-  AcqDaemon(QApplication *app,QObject *parent=0): QTcpServer(parent) {
-   application=app;
+  AcqDaemon(QCoreApplication *app,QString cfgPath="/etc/octopus_acqd.conf",QObject *parent=0): QTcpServer(parent) {
+   application=app; confAmpCount=EE_AMPCOUNT; confAudioDevice="default";
+   confSchedFifo=0; confMlockAll=false; confSyncSecs=30;
+#ifndef EEMAGINE
+   confSynth=eesynth::synthDefaults();
+#endif
+   confTrigDevice="/dev/ttyACM0"; confTrigBaud=B115200; confTrigSettle=1000; confInjectLagUs=0; trigOut=0;
+   confZeroCopy=0; // NET|ZEROCOPY is optional, whether or not the .conf loads
+   confOverrun=TCP_SUB_DROP; confMetricsP=0; metricsServer=0; confMcastPort=0; confMcastTtl=1; confMcastPayload=MCAST_PAYLOAD; mcastSender=0; shmRing=0; confShmGid=-1;
+   confRecDir="."; confRecFields=TCP_SUB_RAW|TCP_SUB_AUX; confRecBufferMB=32; confRecPreallocMB=256; confRecFsyncSecs=2; confRecCodec=REC_CODEC_RAW; confRecIndexSecs=10; confRecAuto=false; confRecGid=-1; recSink=0;
 
    qDebug() << "---------------------------------------------------------------";
 
    // Parse system config file for variables
-   QStringList cfgValidLines,opts,opts2,ampSection,netSection,chnTopoSection,guiSection;
+   QStringList cfgValidLines,opts,opts2,ampSection,netSection,chnTopoSection,guiSection,fltSection,audSection,schedSection,trigSection,synthSection,recSection;
    QFile cfgFile; QTextStream cfgStream;
-   QString cfgLine; QStringList cfgLines; cfgFile.setFileName("/etc/octopus_acqd.conf");
+   QString cfgLine; QStringList cfgLines; cfgFile.setFileName(cfgPath);
    if (!cfgFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
-    qDebug() << "octopus_acqd: <.conf> cannot load /etc/octopus_acqd.conf.";
+    qDebug() << "octopus_acqd: <.conf> cannot load" << cfgPath;
     qDebug() << "octopus_acqd: <.conf> Falling back to hardcoded defaults.";
     confTcpBufSize=10; confHost="127.0.0.1";  confCommP=65002;  confDataP=65003;
    } else { cfgStream.setDevice(&cfgFile);
@@ -75,6 +100,12 @@ class AcqDaemon : public QTcpServer {
      else if (opts[0].trimmed()=="NET") netSection.append(opts[1]);
      else if (opts[0].trimmed()=="CHNTOPO") chnTopoSection.append(opts[1]);
      else if (opts[0].trimmed()=="GUI") guiSection.append(opts[1]);
+     else if (opts[0].trimmed()=="FLT") fltSection.append(opts[1]);
+     else if (opts[0].trimmed()=="AUD") audSection.append(opts[1]);
+     else if (opts[0].trimmed()=="SCHED") schedSection.append(opts[1]);
+     else if (opts[0].trimmed()=="TRIG") trigSection.append(opts[1]);
+     else if (opts[0].trimmed()=="REC") recSection.append(opts[1]);
+     else if (opts[0].trimmed()=="SYNTH") synthSection.append(opts[1]); // Synthetic amps only
      else { qDebug() << "octopus_acqd: <.conf> Unknown section in .conf file!";
       app->quit();
      }
@@ -95,13 +126,19 @@ class AcqDaemon : public QTcpServer {
         app->quit();
        }
       } else if (opts[0].trimmed()=="SAMPLERATE") { confSampleRate=opts[1].toInt();
-       if (!(confSampleRate == 500 || confSampleRate == 1000)) {
-        qDebug() << "octopus_acqd: <.conf> AMP|SAMPLERATE not among {500,1000}!";
+       if (!(confSampleRate == 500 || confSampleRate == 1000 || confSampleRate == 2000 ||
+             confSampleRate == 4000 || confSampleRate == 8000 || confSampleRate == 16000)) {
+        qDebug() << "octopus_acqd: <.conf> AMP|SAMPLERATE not among {500,1000,2000,4000,8000,16000}!";
         app->quit();
        }
       } else if (opts[0].trimmed()=="EEGPROBEMS") { confEEGProbeMsecs=opts[1].toInt();
-       if (!(confEEGProbeMsecs >= 20 && confEEGProbeMsecs <= 1000)) {
-        qDebug() << "octopus_acqd: <.conf> AMP|EEGPROBEMS not within [20,1000] msecs range!";
+       if (!(confEEGProbeMsecs >= 10 && confEEGProbeMsecs <= 1000)) {
+        qDebug() << "octopus_acqd: <.conf> AMP|EEGPROBEMS not within [10,1000] msecs range!";
+        app->quit();
+       }
+      } else if (opts[0].trimmed()=="SYNCSECS") { confSyncSecs=opts[1].toInt();
+       if (!(confSyncSecs <= 3600)) {
+        qDebug() << "octopus_acqd: <.conf> AMP|SYNCSECS not within [0,3600] seconds range!";
         app->quit();
        }
       } else if (opts[0].trimmed()=="CMPROBEMS") { confCMProbeMsecs=opts[1].toInt();
@@ -116,6 +153,134 @@ class AcqDaemon : public QTcpServer {
      }
     }
 
+    // AUD
+    for (int i=0;i<audSection.size();i++) { opts=audSection[i].split("=");
+     if (opts[0].trimmed()=="DEVICE") confAudioDevice=opts[1].trimmed();
+     else {
+      qDebug() << "octopus_acqd: <.conf> Unknown subsection in AUD section!";
+      app->quit();
+     }
+    }
+
+    // TRIG
+    for (int i=0;i<trigSection.size();i++) { opts=trigSection[i].split("=");
+     if (opts[0].trimmed()=="DEVICE") confTrigDevice=opts[1].trimmed();
+     else if (opts[0].trimmed()=="BAUDRATE") {
+      switch (opts[1].toInt()) {
+       case   9600: confTrigBaud=B9600;   break;
+       case  19200: confTrigBaud=B19200;  break;
+       case  38400: confTrigBaud=B38400;  break;
+       case  57600: confTrigBaud=B57600;  break;
+       case 115200: confTrigBaud=B115200; break;
+       default: qDebug() << "octopus_acqd: <.conf> TRIG|BAUDRATE not among {9600,19200,38400,57600,115200}!";
+                app->quit();
+      }
+     } else if (opts[0].trimmed()=="SETTLEMSECS") { confTrigSettle=opts[1].toInt();
+      if (!(confTrigSettle<=5000)) {
+       qDebug() << "octopus_acqd: <.conf> TRIG|SETTLEMSECS not within [0,5000] msecs range!";
+       app->quit();
+      }
+     } else if (opts[0].trimmed()=="INJECTLAGUS") { confInjectLagUs=opts[1].toInt(); // Amp-side latency of a sample
+      if (!(confInjectLagUs>=0 && confInjectLagUs<=100000)) {
+       qDebug() << "octopus_acqd: <.conf> TRIG|INJECTLAGUS not within [0,100000] usecs range!";
+       app->quit();
+      }
+     } else {
+      qDebug() << "octopus_acqd: <.conf> Unknown subsection in TRIG section!";
+      app->quit();
+     }
+    }
+
+    // REC
+    for (int i=0;i<recSection.size();i++) { opts=recSection[i].split("=");
+     if (opts[0].trimmed()=="DIR") confRecDir=opts[1].trimmed();
+     else if (opts[0].trimmed()=="FIELDS") { opts2=opts[1].split(","); confRecFields=0;
+      for (int j=0;j<opts2.size();j++) {
+            if (opts2[j].trimmed()=="RAW") confRecFields|=TCP_SUB_RAW;
+       else if (opts2[j].trimmed()=="FLT") confRecFields|=TCP_SUB_FLT;
+       else if (opts2[j].trimmed()=="CM") confRecFields|=TCP_SUB_CM;
+       else if (opts2[j].trimmed()=="AUX") confRecFields|=TCP_SUB_AUX;
+       else { qDebug() << "octopus_acqd: <.conf> REC|FIELDS not a list of RAW,FLT,CM,AUX!"; app->quit(); }
+      }
+     } else if (opts[0].trimmed()=="BUFFERMB") { confRecBufferMB=opts[1].toInt();
+      if (!(confRecBufferMB>=4 && confRecBufferMB<=1024)) {
+       qDebug() << "octopus_acqd: <.conf> REC|BUFFERMB not within [4,1024] MB range!";
+       app->quit();
+      }
+     } else if (opts[0].trimmed()=="PREALLOCMB") { confRecPreallocMB=opts[1].toInt();
+      if (!(confRecPreallocMB<=4096)) {
+       qDebug() << "octopus_acqd: <.conf> REC|PREALLOCMB not within [0,4096] MB range!";
+       app->quit();
+      }
+     } else if (opts[0].trimmed()=="FSYNCSECS") { confRecFsyncSecs=opts[1].toInt();
+      if (!(confRecFsyncSecs<=60)) {
+       qDebug() << "octopus_acqd: <.conf> REC|FSYNCSECS not within [0,60] secs range!";
+       app->quit();
+      }
+     } else if (opts[0].trimmed()=="CODEC") {
+      if (opts[1].trimmed()=="RAW") confRecCodec=REC_CODEC_RAW;
+      else if (opts[1].trimmed()=="ZLIB") confRecCodec=REC_CODEC_ZLIB;
+      else if (opts[1].trimmed()=="LPC") confRecCodec=REC_CODEC_LPC;
+      else { qDebug() << "octopus_acqd: <.conf> REC|CODEC is not one of RAW,ZLIB,LPC!"; app->quit(); }
+     } else if (opts[0].trimmed()=="INDEXSECS") { confRecIndexSecs=opts[1].toInt();
+      if (!(confRecIndexSecs>=1 && confRecIndexSecs<=600)) {
+       qDebug() << "octopus_acqd: <.conf> REC|INDEXSECS not within [1,600] secs range!";
+       app->quit();
+      }
+     } else if (opts[0].trimmed()=="AUTOSTART") confRecAuto=(opts[1].toInt()!=0);
+     else if (opts[0].trimmed()=="GROUP") { struct group *gr=getgrnam(opts[1].trimmed().toLocal8Bit().constData());
+      if (!gr) { qDebug() << "octopus_acqd: <.conf> REC|GROUP" << opts[1].trimmed() << "is not a group!"; app->quit(); }
+      else confRecGid=gr->gr_gid;
+     } else {
+      qDebug() << "octopus_acqd: <.conf> Unknown subsection in REC section!";
+      app->quit();
+     }
+    }
+
+#ifndef EEMAGINE
+    // SYNTH
+    for (int i=0;i<synthSection.size();i++) { opts=synthSection[i].split("="); double v=opts[1].toDouble(); bool ok=(v>=0.);
+          if (opts[0].trimmed()=="NOISEUV") confSynth.noiseUV=v;
+     else if (opts[0].trimmed()=="ALPHAUV") confSynth.alphaUV=v;
+     else if (opts[0].trimmed()=="LINEFREQ") { confSynth.lineFreq=v; ok=(v==50. || v==60.); }
+     else if (opts[0].trimmed()=="LINEUV") confSynth.lineUV=v;
+     else if (opts[0].trimmed()=="HARMONICS") { confSynth.harmonics=(unsigned int)v; ok=(v>=1. && v<=16.); }
+     else if (opts[0].trimmed()=="BLINKUV") confSynth.blinkUV=v;
+     else if (opts[0].trimmed()=="ERPUV") confSynth.erpUV=v;
+     else if (opts[0].trimmed()=="STIMSECS") { confSynth.stimSecs=v; ok=(v==0. || (v>=0.2 && v<=60.)); }
+     else if (opts[0].trimmed()=="DRIFTPPM") { confSynth.driftPpm=v; ok=(v<=1000.); }
+     else {
+      qDebug() << "octopus_acqd: <.conf> Unknown subsection in SYNTH section!";
+      app->quit();
+     }
+     if (!ok) {
+      qDebug() << "octopus_acqd: <.conf> SYNTH|" << opts[0].trimmed() << "out of range!";
+      app->quit();
+     }
+    }
+#endif
+
+    // SCHED
+    for (int i=0;i<schedSection.size();i++) { opts=schedSection[i].split("=");
+     if (opts[0].trimmed()=="FIFO") { confSchedFifo=opts[1].toInt();
+      if (!(confSchedFifo>=0 && confSchedFifo<=99)) {
+       qDebug() << "octopus_acqd: <.conf> SCHED|FIFO priority not within [0,99]!";
+       app->quit();
+      }
+     } else if (opts[0].trimmed()=="AFFINITY") { opts2=opts[1].split(",");
+      for (int j=0;j<opts2.size();j++) { int c=opts2[j].toInt();
+       if (!(c>=0 && c<CPU_SETSIZE)) {
+        qDebug() << "octopus_acqd: <.conf> SCHED|AFFINITY CPU index out of range!";
+        app->quit();
+       } else confSchedCpus.push_back(c);
+      }
+     } else if (opts[0].trimmed()=="MLOCKALL") { confMlockAll=(opts[1].toInt()!=0);
+     } else {
+      qDebug() << "octopus_acqd: <.conf> Unknown subsection in SCHED section!";
+      app->quit();
+     }
+    }
+
     // NET
     if (netSection.size()>0) {
      for (int i=0;i<netSection.size();i++) { opts=netSection[i].split("=");
@@ -135,6 +300,37 @@ class AcqDaemon : public QTcpServer {
          qDebug() << "octopus_acqd: <.conf> CommPort ->" << confCommP << "DataPort ->" << confDataP;
 	}
        }
+      } else if (opts[0].trimmed()=="MCAST") { opts2=opts[1].split(","); // group,port[,ttl[,payload]]
+       confMcastGroup=opts2[0].trimmed(); confMcastPort=(opts2.size()>1) ? opts2[1].toInt() : 0;
+       if (opts2.size()>2) confMcastTtl=opts2[2].toInt();
+       if (opts2.size()>3) confMcastPayload=opts2[3].toInt();
+       if (QHostAddress(confMcastGroup).protocol()!=QAbstractSocket::IPv4Protocol ||
+           !(confMcastPort>=1024 && confMcastPort<=65535) || confMcastTtl<1 || confMcastTtl>255 ||
+           !(confMcastPayload>=1024 && confMcastPayload<=(int)MCAST_DATAGRAM_MAX)) {
+        qDebug() << "octopus_acqd: <.conf> NET|MCAST must be IPv4 group,port(1024..65535)[,ttl(1..255)[,payload(1024..65507)]]!";
+        app->quit();
+       } else qDebug() << "octopus_acqd: <.conf> Multicast data stream ->" << confMcastGroup << confMcastPort << "TTL" << confMcastTtl;
+      } else if (opts[0].trimmed()=="SHM") { confShmName=opts[1].trimmed(); // Same-host shared memory ring
+       if (!confShmName.startsWith('/') || confShmName.indexOf('/',1)>=0 || confShmName.size()>200) {
+        qDebug() << "octopus_acqd: <.conf> NET|SHM must be a POSIX shm name like /octopus_acqd!"; app->quit();
+       } else qDebug() << "octopus_acqd: <.conf> Shared memory data ring ->" << confShmName;
+      } else if (opts[0].trimmed()=="SHMGROUP") { struct group *gr=getgrnam(opts[1].trimmed().toLocal8Bit().constData());
+       if (!gr) { qDebug() << "octopus_acqd: <.conf> NET|SHMGROUP" << opts[1].trimmed() << "is not a group!"; app->quit(); }
+       else { confShmGid=gr->gr_gid; qDebug() << "octopus_acqd: <.conf> Shared memory ring readable by group ->" << opts[1].trimmed(); }
+      } else if (opts[0].trimmed()=="ZEROCOPY") { confZeroCopy=opts[1].trimmed().toInt();
+       if (confZeroCopy>1) {
+        qDebug() << "octopus_acqd: <.conf> NET|ZEROCOPY must be 0 or 1!"; app->quit();
+       } else qDebug() << "octopus_acqd: <.conf> Data port zero-copy sends ->" << confZeroCopy;
+      } else if (opts[0].trimmed()=="METRICS") { confMetricsP=opts[1].trimmed().toInt(); // Prometheus text, localhost only
+       if (confMetricsP!=0 && !(confMetricsP>=1024 && confMetricsP<=65535)) {
+        qDebug() << "octopus_acqd: <.conf> NET|METRICS must be 0 or a port (1024..65535)!"; app->quit();
+       } else qDebug() << "octopus_acqd: <.conf> Metrics endpoint port ->" << confMetricsP;
+      } else if (opts[0].trimmed()=="OVERRUN") { opts[1]=opts[1].trimmed(); // Default for clients not asking
+       if (opts[1]=="DROP") confOverrun=TCP_SUB_DROP;
+       else if (opts[1]=="DECIMATE") confOverrun=TCP_SUB_DECIMATE;
+       else if (opts[1]=="DISCONNECT") confOverrun=TCP_SUB_DISCONNECT;
+       else { qDebug() << "octopus_acqd: <.conf> NET|OVERRUN must be DROP, DECIMATE or DISCONNECT!"; app->quit(); }
+       if (acqPolicyName[confOverrun]==opts[1]) qDebug() << "octopus_acqd: <.conf> Data client overrun policy ->" << opts[1];
       } else {
        qDebug() << "octopus_acqd: <.conf> Parse error in Hostname/IP(v4) Address!";
        app->quit();
@@ -162,8 +358,7 @@ class AcqDaemon : public QTcpServer {
 	 dummyChnTopo.chnName=opts2[1];         // Channel name
 	 dummyChnTopo.topoX=opts2[2].toInt();   // TopoXY - X
 	 dummyChnTopo.topoY=opts2[3].toInt();   // TopoXY - Y
-	 dummyChnTopo.cmLevel[0]=128.0;		// Reset CM Level
-	 dummyChnTopo.cmLevel[1]=128.0;		// Reset CM Level
+	 for (unsigned int a=0;a<EE_MAX_AMPCOUNT;a++) dummyChnTopo.cmLevel[a]=128.0; // Reset CM Levels
          chnTopo.append(dummyChnTopo); // add channel to info table
         }
        } else {
@@ -207,17 +402,19 @@ class AcqDaemon : public QTcpServer {
 
    confRefChnCount=64;
    confBipChnCount=2;
-   chnInfo.sampleRate=confSampleRate; // 1000sps
+   chnInfo.sampleRate=confSampleRate; // Clients may take it decimated, see decimator.h
    chnInfo.refChnCount=confRefChnCount; chnInfo.refChnMaxCount=REF_CHN_MAXCOUNT;
    chnInfo.bipChnCount=confBipChnCount; chnInfo.bipChnMaxCount=BIP_CHN_MAXCOUNT;
    chnInfo.physChnCount=confRefChnCount+confBipChnCount;
    chnInfo.totalChnCount=chnInfo.physChnCount+2;
+   chnInfo.ampCount=confAmpCount;
    chnInfo.totalCount=confAmpCount*chnInfo.totalChnCount;
    chnInfo.probe_eeg_msecs=confEEGProbeMsecs; // 100ms probetime
    chnInfo.probe_cm_msecs=confCMProbeMsecs; // 1000ms probetime
 
    qDebug() << "---------------------------------------------------------------";
    qDebug() << "octopus_acqd: ---> Datahandling Info <---";
+   qDebug() << "octopus_acqd: Amplifier#:" << chnInfo.ampCount;
    qDebug() << "octopus_acqd: Sample Rate:" << chnInfo.sampleRate;
    qDebug() << "octopus_acqd: EEG probe every (ms):" << chnInfo.probe_eeg_msecs;
    qDebug() << "octopus_acqd: CM probe every (ms):" << chnInfo.probe_cm_msecs;
@@ -227,6 +424,30 @@ class AcqDaemon : public QTcpServer {
    qDebug() << "octopus_acqd: Total Channel# from all amps:" << chnInfo.totalCount;
    qDebug() << "---------------------------------------------------------------";
 
+   // FLT -- designed here, as the sample rate is known only now
+   for (int i=0;i<fltSection.size();i++) { opts=fltSection[i].split("=");
+    if (opts[0].trimmed()=="APPEND") { opts2=opts[1].split(",");
+     if (opts2.size()!=5 || !iirBank.append(opts2[0].trimmed().toStdString(),opts2[1].trimmed().toStdString(),
+                                            opts2[2].toInt(),opts2[3].toDouble(),opts2[4].toDouble(),chnInfo.sampleRate)) {
+      qDebug() << "octopus_acqd: <.conf> Syntax/range error in FLT|APPEND parameters!";
+      app->quit();
+     }
+    } else if (opts[0].trimmed()=="DEFAULT") { confFilter=opts[1].trimmed();
+    } else {
+     qDebug() << "octopus_acqd: <.conf> Unknown subsection in FLT section!";
+     app->quit();
+    }
+   }
+   if (!confFilter.isEmpty() && confFilter!="NONE") { int f=iirBank.find(confFilter.toStdString());
+    if (f<0 || !iirBank.select(f)) {
+     qDebug() << "octopus_acqd: <.conf> FLT|DEFAULT is not among the FLT|APPEND designs!";
+     app->quit();
+    }
+   }
+   for (unsigned int i=0;i<iirBank.designs.size();i++)
+    qDebug("octopus_acqd: IIR design #%u: %s (%u sections)%s",i,iirBank.designs[i].name.c_str(),iirBank.designs[i].secCount,
+           ((int)i==iirBank.active) ? " -- active" : "");
+
    cmLevelFrameW=confCMCellSize*11; cmLevelFrameH=confCMCellSize*12;
    acqGuiW=(cmLevelFrameW+10)*confAmpCount+80; acqGuiH=cmLevelFrameH+60;
 
@@ -243,7 +464,7 @@ class AcqDaemon : public QTcpServer {
    commandServer->setMaxPendingConnections(1);
    connect(commandServer,SIGNAL(newConnection()),this,SLOT(slotIncomingCommand()));
 
-   setMaxPendingConnections(1);
+   setMaxPendingConnections(ACQ_MAX_DATA_CLIENTS);
 
    if (!commandServer->listen(hostAddress,confCommP) || !listen(hostAddress,confDataP)) {
     qDebug() << "octopus_acqd: Error starting command and/or data server(s)!";
@@ -253,44 +474,266 @@ class AcqDaemon : public QTcpServer {
     qDebug() << "octopus_acqd: Waiting for client connection..";
    }
 
-   tcpBuffer.resize(confTcpBufSize*chnInfo.sampleRate); tcpBufPIdx=tcpBufCIdx=0;
+   tcpBuffer.resize(confTcpBufSize*chnInfo.sampleRate); tcpBufPIdx=0;
+   for (tcpsample &t:tcpBuffer) { t.amp.resize(chnInfo.ampCount); t.trigger=0; } // Once; no allocation on the hot path
+   // Senders keep this many samples (two EEG probe blocks) away from the producer's write head,
+   // which AcqThread never takes further than that past tcpBufPIdx
+   tcpBufGuard=2*chnInfo.sampleRate*chnInfo.probe_eeg_msecs/1000;
+   if (tcpBufGuard>(quint64)tcpBuffer.size()/2) tcpBufGuard=tcpBuffer.size()/2;
+   decimators.init(chnInfo.sampleRate,chnInfo.ampCount,&tcpBuffer,&tcpBufPIdx,tcpBufGuard,&tcpDataMutex,&tcpDataReady,&daemonRunning);
+
+   daemonRunning=true; eegImpedanceMode=false; clientCounter=0;
+   session=(unsigned int)(QDateTime::currentMSecsSinceEpoch()^((qint64)getpid()<<16)); // Tells restarts apart
+
+   // Trigger output; the port is opened by the worker itself, nothing waits for it here
+   trigOut=new TriggerOut(confTrigDevice,confTrigBaud,confTrigSettle);
+   trigOut->start(QThread::HighPriority);
+
+   // Optional shared memory ring for clients on this host, as deep as tcpBuffer
+   if (!confShmName.isEmpty()) { shmRing=new ShmRing();
+    if (!shmRing->create(confShmName.toStdString(),chnInfo.ampCount,chnInfo.sampleRate,tcpBuffer.size(),tcpBufGuard,
+                         session,confShmGid)) {
+     qDebug() << "octopus_acqd: Cannot create shared memory ring" << confShmName << "-- local clients will use TCP.";
+     delete shmRing; shmRing=0;
+    } else qDebug() << "octopus_acqd: Shared memory ring" << confShmName << "ready," << shmRing->header()->frameSize << "bytes/sample.";
+   }
+
+   // Optional multicast/UDP stream, one sender for any number of receivers
+   if (confMcastPort) {
+    mcastSender=new McastSender(confMcastGroup,confMcastPort,confMcastTtl,confMcastPayload,confHost,chnInfo.ampCount,
+                                &tcpBuffer,&tcpBufPIdx,tcpBufGuard,&tcpDataMutex,&tcpDataReady,&daemonRunning,session);
+    mcastSender->start(QThread::HighPriority);
+   }
+
+   // Recording from the start, independent of any client
+   if (confRecAuto) recStart(0,QString());
+
+   // Optional metrics endpoint, for scraping while a session runs
+   if (confMetricsP) { metricsServer=new QTcpServer(this);
+    connect(metricsServer,SIGNAL(newConnection()),this,SLOT(slotIncomingMetrics()));
+    if (!metricsServer->listen(QHostAddress::LocalHost,confMetricsP))
+     qDebug() << "octopus_acqd: Cannot listen on metrics port" << confMetricsP << "-- no metrics endpoint.";
+   }
+
+   // Periodic per-client lag/overrun report
+   clientReportTimer=new QTimer(this);
+   connect(clientReportTimer,SIGNAL(timeout()),this,SLOT(slotReportClients()));
+   clientReportTimer->start(ACQ_CLIENT_REPORT_MSECS);
+  }
 
-   daemonRunning=true; eegImpedanceMode=false; clientConnected=false;
+  ~AcqDaemon() { daemonRunning=false;
+   for (ClientHandler *client:clients) { client->requestStop(); client->wait(); }
+   decimators.stop();
+   if (mcastSender) { mcastSender->requestStop(); mcastSender->wait(); delete mcastSender; }
+   recStop();
+   if (trigOut) { trigOut->stop(); delete trigOut; }
+   if (shmRing) delete shmRing; // Tells the mapped clients, unlinks
   }
   
-  chninfo chnInfo; int acqGuiX,acqGuiY,cmLevelFrameW,cmLevelFrameH;
-  unsigned int confAmpCount,extTrig,acqGuiW,acqGuiH,confCMCellSize;
-  QMutex tcpMutex,guiMutex; QVector<ChnTopo> chnTopo;
-  QVector<tcpsample> tcpBuffer; quint64 tcpBufPIdx;
-  bool daemonRunning,eegImpedanceMode,clientConnected;
+  chninfo chnInfo; int acqGuiX,acqGuiY,cmLevelFrameW,cmLevelFrameH; IIRBank iirBank;
+  unsigned int confAmpCount,confSyncSecs,extTrig,acqGuiW,acqGuiH,confCMCellSize;
+  QMutex tcpMutex,guiMutex; QVector<ChnTopo> chnTopo; QString confAudioDevice;
+  int confSchedFifo; std::vector<int> confSchedCpus; bool confMlockAll;
+#ifndef EEMAGINE
+  eesynth::synthparams confSynth;
+#endif
+  TriggerOut *trigOut; QString confTrigDevice; int confTrigBaud; unsigned int confTrigSettle; int confInjectLagUs;
+  TimedTrigQueue timedTrigs; // CS_ACQ_TIMED_TRIG, to AcqThread
+  QVector<tcpsample> tcpBuffer; std::atomic<quint64> tcpBufPIdx; quint64 tcpBufGuard; // Producer writes at most this far ahead
+  bool daemonRunning,eegImpedanceMode; unsigned int session; AcqStats stats;
+  DecimatorBank decimators; // Lower output rates, one shared decimator each
 
   void registerCMLevelHandler(QObject *sh) {
    connect(this,SIGNAL(cmLevelsReady(void)),sh,SLOT(slotCMLevelsReady(void)));
   }
 
-  void registerSendTriggerHandler(QObject *sh) {
-   connect(this,SIGNAL(sendTrigger(unsigned char)),sh,SLOT(sendTrigger(unsigned char)));
-  }
-
   void registerSendSynthTriggerHandler(QObject *sh) {
    connect(this,SIGNAL(sendSynthTrigger(unsigned char)),sh,SLOT(sendSynthTrigger(unsigned char)));
   }
 
   void updateCMLevels() { emit cmLevelsReady(); }
 
+  // Overruns and lost samples summed over the connected data clients
+  void clientTotals(quint64 &overruns,quint64 &lost) { overruns=lost=0;
+   for (ClientHandler *client:clients) { overruns+=client->overruns; lost+=client->lostCount; }
+  }
+
+  // Counters of the slot'th connected data client, as a CS_ACQ_CLIENT_STATS_RESULT; clientId 0 if there is none.
+  void clientStats(QTcpSocket *commandSocket,int slot) { ClientHandler *client=(slot>=0 && slot<clients.size()) ? clients[slot] : 0;
+   quint64 v[5]={0,0,0,0,0}; int sr=(client && client->rate>0) ? client->rate : 1;
+   QDataStream commandStream(commandSocket);
+   std::memset(&csCmd,0,sizeof(cs_command)); csCmd.cmd=CS_ACQ_CLIENT_STATS_RESULT;
+   csCmd.iparam[0]=clients.size(); csCmd.iparam[1]=slot;
+   if (client) { v[0]=client->sentCount; v[1]=client->overruns; v[2]=client->lostCount; v[3]=client->gapFrames; v[4]=client->decimated;
+    csCmd.iparam[2]=client->clientId; csCmd.iparam[3]=client->policy; csCmd.iparam[4]=client->connected ? 1 : 0;
+    for (int i=0;i<5;i++) { csCmd.iparam[5+2*i]=(int)(v[i]&0xffffffff); csCmd.iparam[6+2*i]=(int)(v[i]>>32); }
+    csCmd.iparam[15]=(int)((quint64)(client->lag)*1000/sr); csCmd.iparam[16]=(int)((quint64)(client->maxLag)*1000/sr);
+   }
+   commandStream.writeRawData((const char*)(&csCmd),sizeof(cs_command)); commandSocket->flush();
+  }
+
+  // Pipeline stage counters and sender totals, as a CS_ACQ_STATS_RESULT: per stage s (acqstats.h)
+  // iparam[s] calls (lo 32 bits), fparam[2s,2s+1] mean/max us; iparam[8,9] bytes sent (lo,hi),
+  // [10] clients, [11] max. client lag (samples), [12] queued bytes, [13,14] samples published, [15] rate,
+  // [16..18] timed triggers placed on time, after the fact and missed.
+  void pipelineStats(QTcpSocket *commandSocket,bool reset) { quint64 bytes=0,lagMax=0,queued=0,pIdx=tcpBufPIdx;
+   QDataStream commandStream(commandSocket);
+   std::memset(&csCmd,0,sizeof(cs_command)); csCmd.cmd=CS_ACQ_STATS_RESULT;
+   for (unsigned int i=0;i<ACQ_STAGE_COUNT;i++) { csCmd.iparam[i]=(int)(stats.stage[i].calls&0xffffffff);
+    csCmd.fparam[2*i]=stats.stage[i].meanUs(); csCmd.fparam[2*i+1]=stats.stage[i].maxUs();
+   }
+   for (ClientHandler *client:clients) { bytes+=client->bytesSent; queued+=client->queued; lagMax=qMax(lagMax,(quint64)(client->lag)); }
+   csCmd.iparam[8]=(int)(bytes&0xffffffff); csCmd.iparam[9]=(int)(bytes>>32); csCmd.iparam[10]=clients.size();
+   csCmd.iparam[11]=(int)lagMax; csCmd.iparam[12]=(int)queued;
+   csCmd.iparam[13]=(int)(pIdx&0xffffffff); csCmd.iparam[14]=(int)(pIdx>>32); csCmd.iparam[15]=chnInfo.sampleRate;
+   csCmd.iparam[16]=(int)(stats.trigPlaced); csCmd.iparam[17]=(int)(stats.trigRetro); csCmd.iparam[18]=(int)(stats.trigMissed);
+   commandStream.writeRawData((const char*)(&csCmd),sizeof(cs_command)); commandSocket->flush();
+   if (reset) stats.reset();
+  }
+
+  // The same in Prometheus text exposition format.
+  QByteArray metricsText() { QString m;
+   m+="# TYPE octopus_acqd_samples_published_total counter\n";
+   m+=QString("octopus_acqd_samples_published_total %1\n").arg((quint64)tcpBufPIdx);
+   m+="# TYPE octopus_acqd_stage_calls_total counter\n# TYPE octopus_acqd_stage_items_total counter\n";
+   m+="# TYPE octopus_acqd_stage_seconds_total counter\n# TYPE octopus_acqd_stage_max_seconds gauge\n";
+   for (unsigned int i=0;i<ACQ_STAGE_COUNT;i++) { const StageStat &st=stats.stage[i]; QString l=QString("{stage=\"%1\"} ").arg(acqStageName[i]);
+    m+="octopus_acqd_stage_calls_total"+l+QString::number((quint64)st.calls)+"\n";
+    m+="octopus_acqd_stage_items_total"+l+QString::number((quint64)st.items)+"\n";
+    m+="octopus_acqd_stage_seconds_total"+l+QString::number(st.totalNs/1e9,'g',12)+"\n";
+    m+="octopus_acqd_stage_max_seconds"+l+QString::number(st.maxNs/1e9,'g',9)+"\n";
+   }
+   m+="# TYPE octopus_acqd_timed_triggers_total counter\n";
+   m+=QString("octopus_acqd_timed_triggers_total{placed=\"ontime\"} %1\n").arg((quint64)(stats.trigPlaced));
+   m+=QString("octopus_acqd_timed_triggers_total{placed=\"retro\"} %1\n").arg((quint64)(stats.trigRetro));
+   m+=QString("octopus_acqd_timed_triggers_total{placed=\"missed\"} %1\n").arg((quint64)(stats.trigMissed));
+   m+="# TYPE octopus_acqd_clients gauge\n"+QString("octopus_acqd_clients %1\n").arg(clients.size());
+   m+="# TYPE octopus_acqd_client_bytes_sent_total counter\n# TYPE octopus_acqd_client_samples_sent_total counter\n";
+   m+="# TYPE octopus_acqd_client_lag_samples gauge\n# TYPE octopus_acqd_client_queued_bytes gauge\n";
+   m+="# TYPE octopus_acqd_client_overruns_total counter\n# TYPE octopus_acqd_client_lost_samples_total counter\n";
+   for (ClientHandler *client:clients) { QString l=QString("{client=\"%1\"} ").arg(client->clientId);
+    m+="octopus_acqd_client_bytes_sent_total"+l+QString::number((quint64)(client->bytesSent))+"\n";
+    m+="octopus_acqd_client_samples_sent_total"+l+QString::number((quint64)(client->sentCount))+"\n";
+    m+="octopus_acqd_client_lag_samples"+l+QString::number((quint64)(client->lag))+"\n";
+    m+="octopus_acqd_client_queued_bytes"+l+QString::number((quint64)(client->queued))+"\n";
+    m+="octopus_acqd_client_overruns_total"+l+QString::number((quint64)(client->overruns))+"\n";
+    m+="octopus_acqd_client_lost_samples_total"+l+QString::number((quint64)(client->lostCount))+"\n";
+   }
+   m+="# TYPE octopus_acqd_decimator_clients gauge\n# TYPE octopus_acqd_decimator_lost_samples_total counter\n";
+   for (Decimator *d:decimators.decimators()) { QString l=QString("{rate=\"%1\"} ").arg(d->rate);
+    m+="octopus_acqd_decimator_clients"+l+QString::number((quint64)(d->clients))+"\n";
+    m+="octopus_acqd_decimator_lost_samples_total"+l+QString::number((quint64)(d->lostCount))+"\n";
+   }
+   if (recSink) {
+    m+="# TYPE octopus_acqd_rec_active gauge\n"+QString("octopus_acqd_rec_active %1\n").arg(recSink->isRunning() ? 1 : 0);
+    m+="# TYPE octopus_acqd_rec_bytes_total counter\n"+QString("octopus_acqd_rec_bytes_total %1\n").arg((quint64)(recSink->writer->bytes));
+    m+="# TYPE octopus_acqd_rec_lost_samples_total counter\n"+QString("octopus_acqd_rec_lost_samples_total %1\n").arg((quint64)(recSink->lostCount));
+   }
+   if (mcastSender) {
+    m+="# TYPE octopus_acqd_mcast_datagrams_total counter\n"+QString("octopus_acqd_mcast_datagrams_total %1\n").arg((quint64)(mcastSender->packets));
+    m+="# TYPE octopus_acqd_mcast_lost_samples_total counter\n"+QString("octopus_acqd_mcast_lost_samples_total %1\n").arg((quint64)(mcastSender->lostCount));
+    m+="# TYPE octopus_acqd_mcast_overruns_total counter\n"+QString("octopus_acqd_mcast_overruns_total %1\n").arg((quint64)(mcastSender->overruns));
+   }
+   return m.toLatin1();
+  }
+
+  // Resend a span of the multicast stream out of the BUFPAST ring, on the asking client's command socket;
+  // a span that is not (or no longer) in the ring is answered with a count of 0.
+  void retransmit(QTcpSocket *commandSocket,quint64 from,int count) { quint64 size=tcpBuffer.size(),span=size-tcpBufGuard,pIdx=tcpBufPIdx;
+   QByteArray frames; QDataStream commandStream(commandSocket);
+   if (!mcastSender || count<=0 || count>(int)MCAST_RETX_MAX || from+count>pIdx || pIdx-from>span) count=0;
+   else { unsigned int fs=mcastSender->subscription.frameSize; frames.resize(count*fs);
+    for (int i=0;i<count;i++) mcastSender->subscription.pack(tcpBuffer[(from+i)%size],frames.data()+i*fs);
+    if (tcpBufPIdx-from>span) count=0; // Overwritten meanwhile
+    mcastSender->retxRequests++; mcastSender->retxFrames+=count;
+   }
+   std::memset(&csCmd,0,sizeof(cs_command)); csCmd.cmd=CS_ACQ_RETRANSMIT_RESULT; csCmd.iparam[0]=(int)(from&0xffffffff); csCmd.iparam[1]=(int)(from>>32); csCmd.iparam[2]=count;
+   commandStream.writeRawData((const char*)(&csCmd),sizeof(cs_command));
+   if (count>0) commandStream.writeRawData(frames.constData(),frames.size());
+   commandSocket->flush();
+  }
+
+  // A trigger for the sample acquired at a given host time, handed to AcqThread. A
+  // CLOCK_REALTIME stamp (another host, NTP/PTP disciplined) is taken to our monotonic
+  // clock by the current difference of the two.
+  void timedTrig(unsigned int code,qint64 ns,int clock) { timedtrig tt; timespec r,m;
+   if (clock==1) { clock_gettime(CLOCK_REALTIME,&r); clock_gettime(CLOCK_MONOTONIC,&m);
+    ns+=((qint64)m.tv_sec-(qint64)r.tv_sec)*1000000000LL+(qint64)m.tv_nsec-(qint64)r.tv_nsec;
+   }
+   tt.code=code; tt.ns=ns;
+   if (code==0 || clock<0 || clock>1) qDebug("octopus_acqd: <TCPcmd> Malformed timed trigger, ignored.");
+   else if (!timedTrigs.push(tt)) { stats.trigMissed++; qDebug("octopus_acqd: <TCPcmd> Timed trigger queue full, trigger %u dropped!",code); }
+  }
+
+  // Starts a recording sink (recordsink.h) under REC|DIR. The name is taken as is if it is a
+  // plain file name, else rec-<date>-<time>; fields 0 means REC|FIELDS.
+  bool recStart(unsigned int fields,QString name) { QStringList chnNames;
+   if (recSink && !recSink->isFinished()) { qDebug() << "octopus_acqd: <Rec> Already recording to" << recSink->path; return false; }
+   delete recSink; recSink=0;
+   if (name.isEmpty() || name.contains('/') || name.startsWith('.'))
+    name="rec-"+QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss-zzz");
+   if (!name.contains('.')) name+=".ocr";
+   for (unsigned int i=0;i<chnInfo.physChnCount;i++) chnNames.append(i<(unsigned int)chnTopo.size() ? chnTopo[i].chnName : QString::number(i+1));
+   recSink=new RecordSink(chnInfo.ampCount,chnInfo.sampleRate,&tcpBuffer,&tcpBufPIdx,tcpBufGuard,&tcpDataMutex,&tcpDataReady,
+                          &daemonRunning,session);
+   if (!recSink->open(QDir(confRecDir).filePath(name),fields ? fields : confRecFields,confRecCodec,chnNames,confRecIndexSecs,
+                      confRecBufferMB,confRecPreallocMB,confRecFsyncSecs,confRecGid)) {
+    qDebug() << "octopus_acqd: <Rec> Cannot record to" << QDir(confRecDir).filePath(name) << "--" << strerror(errno);
+    delete recSink; recSink=0; return false;
+   }
+   recSink->start(QThread::HighPriority);
+   qDebug() << "octopus_acqd: <Rec> Recording to" << recSink->path << "Channels:" << recSink->channelCount();
+   return true;
+  }
+
+  void recStop() { if (recSink) { recSink->requestStop(); recSink->wait(); } }
+
+  // CS_ACQ_REC_STATUS_RESULT: iparam[0] 1 if recording, [1,2] samples recorded (lo,hi), [3] overruns,
+  // [4,5] samples lost (lo,hi), [6] write errors, [7] fsyncs, [8..19] file name (NUL-terminated, up to
+  // 47 chars); fparam[0] MB written, [1] slowest write in ms.
+  void recStatus(QTcpSocket *commandSocket) { QDataStream commandStream(commandSocket); quint64 s,l; QByteArray n;
+   std::memset(&csCmd,0,sizeof(cs_command)); csCmd.cmd=CS_ACQ_REC_STATUS_RESULT;
+   if (recSink) { s=recSink->samples; l=recSink->lostCount; n=QFileInfo(recSink->path).fileName().toLocal8Bit().left(47);
+    csCmd.iparam[0]=recSink->isRunning() ? 1 : 0; csCmd.iparam[1]=(int)(s&0xffffffff); csCmd.iparam[2]=(int)(s>>32);
+    csCmd.iparam[3]=(int)(recSink->overruns); csCmd.iparam[4]=(int)(l&0xffffffff); csCmd.iparam[5]=(int)(l>>32);
+    csCmd.iparam[6]=(int)(recSink->writer->writeErrors); csCmd.iparam[7]=(int)(recSink->writer->fsyncs);
+    std::memcpy(&csCmd.iparam[8],n.constData(),n.size());
+    csCmd.fparam[0]=recSink->writer->bytes/1e6; csCmd.fparam[1]=recSink->writer->maxWriteNs/1e6;
+   }
+   commandStream.writeRawData((const char*)(&csCmd),sizeof(cs_command)); commandSocket->flush();
+  }
+
+  // Producer side: a trigger placed after the fact on published sample idx, if still in the
+  // ring (a guard's margin off the block being filled). The shared memory ring gets the frame
+  // repacked; TCP clients see it if they have not sent it yet.
+  bool retroTrigger(quint64 idx,unsigned int code) { tcpsample &t=tcpBuffer[idx%tcpBuffer.size()];
+   if (tcpBufPIdx-idx>(quint64)tcpBuffer.size()-2*tcpBufGuard) return false;
+   t.trigger=code; if (shmRing) shmRing->put(idx,t);
+   return true;
+  }
+
+  // Producer side: samples up to the new index are in tcpBuffer, wake all client senders.
+  // The shared memory ring gets its frames packed right here, in the producer's thread.
+  void publishTcpData(quint64 count) { quint64 pIdx=tcpBufPIdx;
+   if (shmRing) for (quint64 i=0;i<count;i++) shmRing->put(pIdx+i,tcpBuffer[(pIdx+i)%tcpBuffer.size()]);
+   tcpDataMutex.lock(); tcpBufPIdx+=count; stats.publishNs=monoNs(); tcpDataReady.wakeAll(); tcpDataMutex.unlock();
+   if (shmRing) shmRing->commit(pIdx+count);
+  }
+
  signals:
   void repaintGUI(int ampNo);
   void cmLevelsReady(void);
-  void sendTrigger(unsigned char trigger);
   void sendSynthTrigger(unsigned int trigger);
 
  public slots:
-  void slotIncomingCommand() {
-   if ((commandSocket=commandServer->nextPendingConnection()))
-    connect(commandSocket,SIGNAL(readyRead()),this,SLOT(slotHandleCommand()));
+  // Any number of command connections; each is answered on its own socket.
+  void slotIncomingCommand() { QTcpSocket *s;
+   while ((s=commandServer->nextPendingConnection())) {
+    connect(s,SIGNAL(readyRead()),this,SLOT(slotHandleCommand())); connect(s,SIGNAL(disconnected()),s,SLOT(deleteLater()));
+   }
   }
 
-  void slotHandleCommand() {
+  void slotHandleCommand() { QTcpSocket *commandSocket=qobject_cast<QTcpSocket*>(sender()); if (!commandSocket) return;
    QDataStream commandStream(commandSocket);
    if ((quint64)commandSocket->bytesAvailable() >= sizeof(cs_command)) {
     commandStream.readRawData((char*)(&csCmd),sizeof(cs_command));
@@ -310,6 +753,14 @@ class AcqDaemon : public QTcpServer {
                        csCmd.iparam[8]=chnInfo.totalCount;
                        csCmd.iparam[9]=chnInfo.probe_eeg_msecs;
                        csCmd.iparam[10]=chnInfo.probe_cm_msecs;
+                       csCmd.iparam[11]=chnInfo.ampCount;
+                       csCmd.iparam[12]=iirBank.designs.size();
+                       csCmd.iparam[13]=iirBank.active;
+                       csCmd.iparam[14]=mcastSender ? mcastSender->port : 0; // Multicast stream, if any
+                       csCmd.iparam[15]=mcastSender ? (int)QHostAddress(mcastSender->group).toIPv4Address() : 0;
+                       csCmd.iparam[16]=mcastSender ? (int)mcastSender->session : 0;
+                       csCmd.iparam[17]=shmRing ? 1 : 0; // Shared memory ring (name in the clients' .conf)
+                       csCmd.iparam[18]=shmRing ? (int)shmRing->header()->session : 0;
                        commandStream.writeRawData((const char*)(&csCmd),
                                                   sizeof(cs_command));
                        //dataSocket.flush();
@@ -318,15 +769,39 @@ class AcqDaemon : public QTcpServer {
 		       if (csCmd.iparam[0]==0) eegImpedanceMode=true;
 		       else eegImpedanceMode=false;
 		       break;
+     case CS_ACQ_SETFILTER: // iparam[0]: IIR design index, -1 for none
+		       if (iirBank.select(csCmd.iparam[0]))
+		        qDebug("octopus_acqd: <TCPcmd> IIR filter bank switched to design #%d.",csCmd.iparam[0]);
+		       else qDebug("octopus_acqd: <TCPcmd> No IIR design #%d, filter unchanged.",csCmd.iparam[0]);
+		       break;
      case CS_ACQ_MANUAL_TRIG:
 		       extTrig=csCmd.iparam[0]; emit sendSynthTrigger(extTrig);
                        qDebug() << "octopus_acqd: <TCPcmd> External Trigger acknownledged. TCode: "
                                 << extTrig;
 		       break;
+     case CS_ACQ_TIMED_TRIG: // iparam[0]: code, iparam[1,2]: ns (lo,hi), iparam[3]: 0 CLOCK_MONOTONIC (this host), 1 CLOCK_REALTIME
+		       timedTrig(csCmd.iparam[0],(qint64)((quint64)(quint32)csCmd.iparam[1]|((quint64)(quint32)csCmd.iparam[2]<<32)),csCmd.iparam[3]);
+		       break;
      case CS_ACQ_MANUAL_SYNC:
-		       emit sendTrigger(AMP_SYNC_TRIG);
-                       qDebug() << "octopus_acqd: <TCPcmd> External SYNC acknownledged.";
+		       if (trigOut->push(AMP_SYNC_TRIG)) qDebug() << "octopus_acqd: <TCPcmd> External SYNC acknownledged.";
+		       else qDebug() << "octopus_acqd: <TCPcmd> Trigger queue full, external SYNC dropped!";
+		       break;
+     case CS_ACQ_RETRANSMIT: // iparam[0,1]: first sample index (lo,hi), iparam[2]: count
+		       retransmit(commandSocket,(quint64)(quint32)csCmd.iparam[0]|((quint64)(quint32)csCmd.iparam[1]<<32),csCmd.iparam[2]);
 		       break;
+     case CS_ACQ_CLIENT_STATS: // iparam[0]: client slot, 0..count-1
+		       clientStats(commandSocket,csCmd.iparam[0]); break;
+     case CS_ACQ_STATS: // iparam[0]: 1 to reset the stage counters after reading
+		       pipelineStats(commandSocket,csCmd.iparam[0]==1); break;
+     case CS_ACQ_LOG_DUMP: // Recent real-time log records, to our own log
+		       rtLog().requestDump(); break;
+     case CS_ACQ_REC_START: // iparam[0]: TCP_SUB_* fields, 0 for REC|FIELDS; iparam[4..19]: file name, NUL-terminated
+		       ((char*)&csCmd.iparam[4])[REC_NAME_MAX-1]=0; recStart(csCmd.iparam[0]&TCP_SUB_ALL,QString::fromLocal8Bit((const char*)&csCmd.iparam[4]));
+		       recStatus(commandSocket); break;
+     case CS_ACQ_REC_STOP:
+		       recStop(); recStatus(commandSocket); break;
+     case CS_ACQ_REC_STATUS:
+		       recStatus(commandSocket); break;
      case CS_REBOOT:   qDebug("octopus_acqd: <privileged cmd received> System rebooting..");
                        system("/sbin/shutdown -r now"); commandSocket->close(); break;
      case CS_SHUTDOWN: qDebug("octopus_acqd: <privileged cmd received> System shutting down..");
@@ -338,79 +813,76 @@ class AcqDaemon : public QTcpServer {
   }
 
  protected:
-  // Data port "connection handler"..
+  // Data port "connection handler".. each client is served by its own sender thread.
   void incomingConnection(qintptr socketDescriptor) override {
+   if (clients.size()>=(int)ACQ_MAX_DATA_CLIENTS) {
+    qDebug("octopus_acqd: <TCP incoming> Max. number of data clients reached, connection NOT accepted.");
+    QTcpSocket rejected; rejected.setSocketDescriptor(socketDescriptor); rejected.close(); return;
+   }
+   ClientHandler *client=new ClientHandler(socketDescriptor,++clientCounter,chnInfo.ampCount,&tcpBuffer,&tcpBufPIdx,tcpBufGuard,
+                                           &tcpDataMutex,&tcpDataReady,&daemonRunning,session,confOverrun,confZeroCopy,&stats,
+                                           &decimators,chnInfo.sampleRate,this);
+   connect(client,SIGNAL(finished()),this,SLOT(slotClientFinished()));
+   clients.append(client);
+   qDebug("octopus_acqd: <TCP incoming> New client connection #%u (%d active).",clientCounter,clients.size());
+   client->start(QThread::HighPriority);
+  }
 
-   //auto handler = std::make_shared<ClientHandler>(socketDescriptor, &buffer);
-   //clients.append(handler);
-   //handler->start();  // Runs in its own thread or event loop
-
-
-   if (!clientConnected) {
-    qDebug("octopus_acqd: <TCP incoming> New client connection..");
-    if (!dataSocket.setSocketDescriptor(socketDescriptor)) {
-     qDebug("octopus_acqd: <TCP incoming> Socket Error!"); clientConnected=false; return;
-    } else {
-     qDebug("octopus_acqd: <TCP incoming> ..accepted.. connecting..");
-     connect(&dataSocket,SIGNAL(disconnected()),this,SLOT(slotDisconnected()));
-     if (dataSocket.waitForConnected()) {
-      //qDebug() << dataSocket.peerAddress();
-      clientConnected=true;
-      qDebug("octopus_acqd: <TCP incoming> Client connection established.");
-      // Launch thread responsible for sending acq.data asynchronously..
- 
-      tcpBufCIdx=tcpBufPIdx; // Previous data is assumed to be gone..
-
-      tcpThread=new TcpThread(this,&tcpBuffer,&tcpBufPIdx,&tcpBufCIdx,&daemonRunning,&clientConnected,&tcpMutex);
-      // Delete thread if communication breaks..
-      connect(tcpThread,SIGNAL(finished()),tcpThread,SLOT(deleteLater()));
-      tcpThread->start(QThread::HighestPriority);
-     } else {
-      qDebug("octopus_acqd: <TCP incoming> Cannot connect to client socket!!!");
-     }
-    }
-   } else qDebug("octopus_acqd: <TCP incoming> Already connected, connection NOT accepted.");
+ private slots:
+  void slotClientFinished() {
+   ClientHandler *client=qobject_cast<ClientHandler*>(sender()); if (!client) return;
+   clients.removeAll(client); client->deleteLater();
+   qDebug("octopus_acqd: <TCP disconnection> Client #%u gone! (%d active)",client->clientId,clients.size());
+  }
 
+  // One scrape per connection: whatever the request, the current metrics are the answer.
+  void slotIncomingMetrics() { QTcpSocket *s;
+   while ((s=metricsServer->nextPendingConnection())) {
+    connect(s,SIGNAL(readyRead()),this,SLOT(slotMetricsRequest())); connect(s,SIGNAL(disconnected()),s,SLOT(deleteLater()));
+   }
   }
 
- private slots:
-  void slotDisconnected() {
-   disconnect(&dataSocket,SIGNAL(disconnected()),this,SLOT(slotDisconnected()));
-   clientConnected=false;
-   while (tcpThread->isRunning()); // Wait for thread termination
-   dataSocket.close();
-   qDebug("octopus_acqd: <TCP disconnection> Client gone!");
+  void slotMetricsRequest() { QTcpSocket *s=qobject_cast<QTcpSocket*>(sender()); if (!s) return;
+   s->readAll(); if (s->property("answered").toBool()) return;
+   QByteArray body=metricsText();
+   s->write("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "+QByteArray::number(body.size())+"\r\n\r\n");
+   s->write(body); s->setProperty("answered",true); s->disconnectFromHost();
   }
 
-  void slotSendData() {
-   quint64 tcpBufSize=tcpBuffer.size();
-   QDataStream outputStream(&dataSocket);
-   //qDebug() << outputStream.status();
-   tcpMutex.lock();
-    quint64 tcpDataCount=tcpBufPIdx-tcpBufCIdx; outBuffer.resize(tcpDataCount);
-    for (quint64 i=0;i<tcpDataCount;i++) outBuffer[i]=tcpBuffer[(tcpBufCIdx+i)%tcpBufSize];
-    outputStream.writeRawData((const char*)((char *)(outBuffer.data())),outBuffer.size()*sizeof(tcpsample));
-    tcpBufCIdx=tcpBufPIdx;
-    dataSocket.flush();
-   tcpMutex.unlock();
-   //qDebug() << "octopus_acqd: <TCP datasend> Data sent.";
+  void slotReportClients() {
+   for (ClientHandler *client:clients) if (client->connected) {
+    qDebug() << "octopus_acqd: <ClientStats> Client #" << client->clientId << "(" << client->peer << ")"
+             << "Rate:" << client->rate << "Lag(ms):" << (quint64)(client->lag)*1000/client->rate
+             << "MaxLag(ms):" << (quint64)(client->maxLag)*1000/client->rate
+             << "Overruns:" << (quint64)(client->overruns) << "Lost:" << (quint64)(client->lostCount)
+             << "Gaps:" << (quint64)(client->gapFrames) << "Decimated:" << (quint64)(client->decimated);
+   }
+   for (Decimator *d:decimators.decimators())
+    qDebug() << "octopus_acqd: <ClientStats> Decimator" << d->rate << "sps Clients:" << (quint64)(d->clients)
+             << "Overruns:" << (quint64)(d->overruns) << "Lost:" << (quint64)(d->lostCount);
+   if (mcastSender)
+    qDebug() << "octopus_acqd: <ClientStats> Multicast" << mcastSender->group << "Datagrams:" << (quint64)(mcastSender->packets)
+             << "Overruns:" << (quint64)(mcastSender->overruns) << "Send errors:" << (quint64)(mcastSender->sendErrors)
+             << "Retransmits:" << (quint64)(mcastSender->retxRequests) << "(" << (quint64)(mcastSender->retxFrames) << "samples)";
   }
 
  private:
   QCoreApplication *application; QTcpServer *commandServer;
-  QTcpSocket *commandSocket; QTcpSocket dataSocket;
-  quint64 tcpBufCIdx; QVector<tcpsample> outBuffer;
+  QMutex tcpDataMutex; QWaitCondition tcpDataReady;
 
   //AcqThread *acqThread;
-  TcpThread *tcpThread; cs_command csCmd;
+  cs_command csCmd;
 
-  QString confHost;
-  unsigned int confTcpBufSize,confCommP,confDataP;
+  QString confHost,confFilter;
+  unsigned int confTcpBufSize,confCommP,confDataP,confZeroCopy,confOverrun,confMetricsP; QTcpServer *metricsServer;
+  QString confMcastGroup; int confMcastPort,confMcastTtl,confMcastPayload; McastSender *mcastSender;
+  QString confShmName; int confShmGid; ShmRing *shmRing;
+  QString confRecDir; unsigned int confRecFields,confRecBufferMB,confRecPreallocMB,confRecFsyncSecs,confRecCodec,confRecIndexSecs; bool confRecAuto; int confRecGid; RecordSink *recSink;
 
   unsigned int confSampleRate,confRefChnCount,confBipChnCount,confEEGProbeMsecs,confCMProbeMsecs;
 
   // Multiple clients
-  QVector<std::shared_ptr<ClientHandler> > clients;
+  QVector<ClientHandler*> clients; unsigned int clientCounter; QTimer *clientReportTimer;
 };
 
 #endif
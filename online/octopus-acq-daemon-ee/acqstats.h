@@ -0,0 +1,85 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* Per-stage counters of the acquisition pipeline, cheap enough to stay on during
+   sessions: a stage is timed once per block (never per sample) with the monotonic clock
+   and adds its duration and item count with relaxed atomics. Any thread may feed a
+   stage -- the amp workers share getdata/filter -- and the command port (CS_ACQ_STATS)
+   or the metrics endpoint (NET|METRICS) read them at any time without a lock; a read
+   is not a snapshot across stages, which does not matter for watching rates live.
+   publish_to_send is the time from a block being published to a caught-up client
+   handing it to the kernel. The timed trigger counters (CS_ACQ_TIMED_TRIG) are totals
+   of the session and are not reset with the stages. */
+
+#ifndef ACQSTATS_H
+#define ACQSTATS_H
+
+#include <QtGlobal>
+#include <atomic>
+
+#include "rtsched.h"
+
+enum { ACQ_STAGE_GETDATA=0,ACQ_STAGE_FILTER,ACQ_STAGE_PACK,ACQ_STAGE_PUBLISH,ACQ_STAGE_CMUPDATE,ACQ_STAGE_CYCLE,
+       ACQ_STAGE_SEND,ACQ_STAGE_LATENCY,ACQ_STAGE_COUNT };
+
+const char* const acqStageName[ACQ_STAGE_COUNT]={"getdata","filter","pack","publish","cmupdate","cycle","send","publish_to_send"};
+
+class StageStat {
+ public:
+  StageStat() { reset(); }
+
+  void add(qint64 ns,quint64 n=1) { quint64 d=(ns>0) ? (quint64)ns : 0,m=maxNs.load(std::memory_order_relaxed);
+   calls.fetch_add(1,std::memory_order_relaxed); items.fetch_add(n,std::memory_order_relaxed);
+   totalNs.fetch_add(d,std::memory_order_relaxed);
+   while (d>m && !maxNs.compare_exchange_weak(m,d,std::memory_order_relaxed));
+  }
+
+  double meanUs() const { quint64 c=calls; return c ? totalNs/1e3/c : 0.; }
+  double maxUs() const { return maxNs/1e3; }
+
+  void reset() { calls=items=totalNs=maxNs=0; }
+
+  std::atomic<quint64> calls,items,totalNs,maxNs;
+};
+
+// Times a scope into a stage.
+class StageTimer {
+ public:
+  StageTimer(StageStat &s,quint64 n=1) : stat(s) { items=n; t0=monoNs(); }
+  ~StageTimer() { stat.add(monoNs()-t0,items); }
+  quint64 items;
+ private:
+  StageStat &stat; qint64 t0;
+};
+
+class AcqStats {
+ public:
+  AcqStats() { publishNs=0; trigPlaced=trigRetro=trigMissed=0; }
+  void reset() { for (unsigned int i=0;i<ACQ_STAGE_COUNT;i++) stage[i].reset(); }
+
+  StageStat stage[ACQ_STAGE_COUNT];
+  std::atomic<qint64> publishNs; // When the last block was published
+  std::atomic<quint64> trigPlaced,trigRetro,trigMissed; // Timed triggers: on time, after the fact, too late
+};
+
+#endif
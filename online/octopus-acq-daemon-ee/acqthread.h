@@ -32,15 +32,14 @@ Octopus-ReEL - Realtime Encephalography Laboratory Network
 #include <iostream>
 #include <chrono>
 #include <thread>
+#include <atomic>
 #include <cmath>
 #include <stdio.h>
 
-#include <alsa/asoundlib.h>
 #include <vector>
 #include <cstring>
 
 #include "../acqglobals.h"
-#include "../serial_device.h"
 
 #ifdef EEMAGINE
 #define _UNICODE
@@ -55,102 +54,18 @@ Octopus-ReEL - Realtime Encephalography Laboratory Network
 #include "../sample.h"
 #include "../tcpsample.h"
 #include "eex.h"
+#include "mafilter.h"
+#include "iirbank.h"
+#include "ampworker.h"
+#include "ampalign.h"
+#include "sampleclock.h"
+#include "audiothread.h"
+#include "rtsched.h"
+#include "../rtlog.h"
+#include <sys/mman.h>
 
 #include "acqdaemon.h"
 
-// Audio settings
-const int AUDIO_SAMPLE_RATE=48000;
-const int AUDIO_NUM_CHANNELS=2;
-const int AUDIO_BUFFER_SIZE=4800;
-
-/*
-const int CIRCULAR_BUFFER_SIZE=8192;
-
-// Circular buffer structure
-struct CircularBuffer {
-    std::vector<int16_t> buffer;
-    size_t head = 0, tail = 0, size;
-
-    CircularBuffer(size_t s) : buffer(s), size(s) {}
-
-    void push(const int16_t* data, size_t frames) {
-        for (size_t i = 0; i < frames * NUM_CHANNELS; ++i) {
-            buffer[head] = data[i];
-            head = (head + 1) % size;
-            if (head == tail) { // Overwrite oldest data
-                tail = (tail + 1) % size;
-            }
-        }
-    }
-};
-*/
-
-class HighPassFilter {
- private:
-  std::array<double,3> b={ 0.9956,-1.9911, 0.9956};
-  std::array<double,3> a={ 1.0   ,-1.9911, 0.9912};
-  //std::array<double,3> b; // Numerator coefficients
-  //std::array<double,3> a; // Denominator coefficients
-  std::array<double,2> xh={0,0}; // Input history
-  std::array<double,2> yh={0,0}; // Output history
- public:
-  //HighPassFilter(const std::array<double,3>& b_coeffs,const std::array<double,3>& a_coeffs):b(b_coeffs),a(a_coeffs) {}
-  HighPassFilter() {}
-  double process(double x) { // Process single sample
-   double y=(b[0]*x+b[1]*xh[0]+b[2]*xh[1])-(a[1]*yh[0]+a[2]*yh[1]);
-   // Update history
-   xh[1]=xh[0]; xh[0]=x;
-   yh[1]=yh[0]; yh[0]=y;
-   return y;
-  }
-  void processBuffer(std::vector<double>& signal) { // Process chunk - forward filtering
-   for (size_t i=0;i<signal.size();i++) { signal[i]=process(signal[i]); }
-  }
-  void processFiltFilt(std::vector<double>& signal,eex& e,int chn) {
-   for (unsigned int i=0;i<2;i++) { xh[i]=e.fX[chn][i]; yh[i]=e.fX[chn][i]; }
-   processBuffer(signal); // Forward
-   std::reverse(signal.begin(),signal.end()); processBuffer(signal); // Reverse
-   std::reverse(signal.begin(),signal.end());
-   for (unsigned int i=0;i<2;i++) { e.fX[chn][i]=xh[i]; e.fX[chn][i]=yh[i]; }
-  }
-};
-
-class BandPassFilter {
- private:
-  std::array<double,5> b={ 0.0127, 0.0   ,-0.0255, 0.0   , 0.0127};
-  std::array<double,5> a={ 1.0000,-3.6533, 5.0141,-3.0680, 0.7071};
-  //std::array<double,5> b; // Numerator coefficients
-  //std::array<double,5> a; // Denominator coefficients
-  std::array<double,4> xh={0,0,0,0}; // Input history
-  std::array<double,4> yh={0,0,0,0}; // Output history
- public:
-  //BandPassFilter(const std::array<double,5>& b_coeffs,const std::array<double,5>& a_coeffs):b(b_coeffs),a(a_coeffs) {}
-  BandPassFilter() {}
-  double process(double x) { // Process single sample
-   double y=(b[0]*x+b[1]*xh[0]+b[2]*xh[1]+b[3]*xh[2]+b[4]*xh[3])-(a[1]*yh[0]+a[2]*yh[1]+a[3]*yh[2]+a[4]*yh[3]);
-   // Update history
-   xh[3]=xh[2]; xh[2]=xh[1]; xh[1]=xh[0]; xh[0]=x;
-   yh[3]=yh[2]; yh[2]=yh[1]; yh[1]=yh[0]; yh[0]=y;
-   return y;
-  }
-  void processBuffer(std::vector<double>& signal) { // Process chunk - forward filtering
-   for (size_t i=0;i<signal.size();i++) { signal[i]=process(signal[i]); }
-  }
-  void processFiltFilt(std::vector<double>& signal,eex& e,int chn) {
-   //if (e.idx==0 && chn==0) { for (unsigned int i=0;i<signal.size();i++) printf("%f ",signal[i]); printf("\n"); }
-   if (e.idx==0 && chn==0) {
-    for (unsigned int i=0;i<e.fX[0].size();i++) printf("%f ",e.fX[chn][i]);
-    for (unsigned int i=0;i<e.fY[0].size();i++) printf("%f ",e.fY[chn][i]);
-    printf("\n");
-   }
-   for (unsigned int i=0;i<4;i++) { xh[i]=e.fX[chn][i]; yh[i]=e.fY[chn][i]; }
-   processBuffer(signal); // Forward
-   //std::reverse(signal.begin(),signal.end()); processBuffer(signal); // Reverse
-   //std::reverse(signal.begin(),signal.end());
-   for (unsigned int i=0;i<4;i++) { e.fX[chn][i]=xh[i]; e.fY[chn][i]=yh[i]; }
-  }
-};
-
 class AcqThread : public QThread {
  Q_OBJECT
  public:
@@ -161,61 +76,22 @@ class AcqThread : public QThread {
    tcpBuffer=&(acqD->tcpBuffer); tcpBufPivot=&(acqD->tcpBufPIdx);
    daemonRunning=&(acqD->daemonRunning); eegImpedanceMode=&(acqD->eegImpedanceMode);
    tcpMutex=&(acqD->tcpMutex); guiMutex=&(acqD->guiMutex);
-   extTrig=&(acqD->extTrig);
-   tcpS.trigger=0;
+   extTrig=&(acqD->extTrig); iirBank=&(acqD->iirBank);
    convN=chnInfo->sampleRate/50; convN2=convN/2;
    convL=4*chnInfo->sampleRate; // 4 seconds MA for high pass
    cmL=chnInfo->sampleRate/2; // 0.5s
 
-   filterIIR_1_40=false;
+   firstRound=false;
 
    toff=0;
 
-   //CircularBuffer circBuffer(CIRCULAR_BUFFER_SIZE);
-   audioOK=false; audioBuffer.resize(AUDIO_BUFFER_SIZE*AUDIO_NUM_CHANNELS);
+   audioThread=0;
 
    counter0=counter1=synthTrigger=0;
-   acqD->registerSendTriggerHandler(this);
    acqD->registerSendSynthTriggerHandler(this);
-  }
-
-  void initAlsa() {
-   // Open ALSA capture device
-   if (snd_pcm_open(&audioPCMHandle,"default",SND_PCM_STREAM_CAPTURE,0)==0) {
-    // Configure hardware parameters
-    snd_pcm_hw_params_alloca(&audioParams);
-    snd_pcm_hw_params_any(audioPCMHandle,audioParams);
-    snd_pcm_hw_params_set_access(audioPCMHandle,audioParams,SND_PCM_ACCESS_RW_INTERLEAVED);
-    snd_pcm_hw_params_set_format(audioPCMHandle,audioParams,SND_PCM_FORMAT_S16_LE);
-    snd_pcm_hw_params_set_channels(audioPCMHandle,audioParams,AUDIO_NUM_CHANNELS);
-    snd_pcm_hw_params_set_rate(audioPCMHandle,audioParams,AUDIO_SAMPLE_RATE,0);
-    snd_pcm_hw_params_set_buffer_size(audioPCMHandle,audioParams,AUDIO_BUFFER_SIZE);
-    if (snd_pcm_hw_params(audioPCMHandle,audioParams)==0) audioOK=true;
-    else qDebug() << "octopus_acqd: <AlsaAudioInit> Error setting PCM parameters.";
-   } else qDebug() << "octopus_acqd: <AlsaAudioInit> Error opening PCM device.";
-
-   if (audioOK) qDebug() << "octopus_acqd: <AlsaAudioInit> Alsa Audio Input successfully activated, audio streaming started.";
-  }
-
-  void instreamAudio() { // Call regularly within main loopthread
-   int err = snd_pcm_readi(audioPCMHandle,audioBuffer.data(),AUDIO_BUFFER_SIZE);
-   if (err==-EPIPE) {
-    qDebug() << "octopus_acqd: <AlsaAudioStream> BUFFER OVERRUN!!! Recovering...";
-    snd_pcm_prepare(audioPCMHandle);
-   } else if (err<0) {
-    qDebug() << "octopus_acqd: <AlsaAudioStream> ERROR READING AUDIO! Err.No:" << snd_strerror(err);
-   } else {
-	   ;
-    //circBuffer.push(buffer, BUFFER_SIZE);
-//    qDebug() << "octopus_acqd: <AlsaAudioStream> Instreamed" << AUDIO_BUFFER_SIZE << "frames (48kHz, Stereo)";
-   }
-  }
-   
-  void stopAudio() {
-   // Cleanup
-   snd_pcm_drain(audioPCMHandle);
-   snd_pcm_close(audioPCMHandle);
-   std::cout << "Instreaming stopped.\n";
+#ifndef EEMAGINE
+   acqD->trigOut->setLoopback([](unsigned char c) { eesynth::synthTrigLine().post(c); }); // Wire the synthetic amps
+#endif
   }
 
   // --------
@@ -257,149 +133,129 @@ class AcqThread : public QThread {
     try {
      e.buf=e.str->getData();
     } catch (const exceptions::internalError& ex) {
-     std::cout << "Exception:" << ex.what() << std::endl;
+     RTLOG("octopus_acqd: <fetchImpedanceData> Exception: %s",ex.what());
     }
    }
   }
 
-  void fetchEegData0() { float sum0,sum1,data0;
+  // Fetch the pending block of amp #i into its history and filter it. Runs in the AmpWorker
+  // thread of that amp, so it touches nothing but ee[i] and its own slots of cBufIdxList and
+  // syncRow/syncSeen. In the very first round the epoch is set and the filter state is reset.
+  void fetchAmpData(unsigned int i) {
 #ifdef EEMAGINE
    using namespace eemagine::sdk;
 #else
    using namespace eesynth;
 #endif
-   std::vector<double> v;
-   for (unsigned int i=0;i<ee.size();i++) {
-    try {
-     ee[i].buf=ee[i].str->getData(); chnCount=ee[i].buf.getChannelCount();
-     ee[i].smpCount=ee[i].buf.getSampleCount();
-     if (chnCount!=chnInfo->totalChnCount) qDebug() << "octopus_acqd: <fetchEegData> Channel count mismatch!!!";
-    } catch (const exceptions::internalError& ex) {
-     std::cout << "Exception" << ex.what() << std::endl;
-    }
-    cBufIdxList[i]=ee[i].cBufIdx;
-    for (unsigned int j=0;j<ee[i].smpCount;j++) { smp.marker=M_PI;
-     for (unsigned int k=0;k<chnCount-2;k++) smp.data[k]=ee[i].buf.getSample(k,j);
-     smp.trigger=ee[i].buf.getSample(chnCount-2,j); // dummy - as no practical possibility for a trigger yet.
-     // The very first sample is set as the Epoch
-     if (j==0) ee[i].baseSmpIdx=ee[i].buf.getSample(chnCount-1,j);
-     smp.offset=ee[i].smpIdx=ee[i].buf.getSample(chnCount-1,j)-ee[i].baseSmpIdx; // Sample# after Epoch
-     ee[i].cBuf[(ee[i].cBufIdx+j)%cBufSz]=smp;
-    }
-    // MA sums -- first computation
-    for (unsigned int j=0;j<chnCount-2;j++) {
-     for (int k=-convN2;k<(int)(ee[i].smpCount)-convN2;k++) {
-      sum0=0.; for (int m=-convN2;m<convN2;m++) sum0+=ee[i].cBuf[(ee[i].cBufIdx+k+m)%cBufSz].data[j];
-      ee[i].cBuf[(ee[i].cBufIdx+k)%cBufSz].sum0[j]=sum0;
-      data0=fabs(ee[i].cBuf[(ee[i].cBufIdx+k)%cBufSz].data[j]-sum0/convN);
-      ee[i].cBuf[(ee[i].cBufIdx+k)%cBufSz].com0[j]=data0*data0;
-
-      // Hi-pass
-      sum1=0.; for (int m=k-convL;m<k;m++) sum1+=ee[i].cBuf[(ee[i].cBufIdx+k+m)%cBufSz].data[j];
-      ee[i].cBuf[(ee[i].cBufIdx+k)%cBufSz].sum1[j]=sum1;
-
-      ee[i].cBuf[(ee[i].cBufIdx+k+convN2)%cBufSz].dataF[j]=sum0/convN-sum1/convL;
-     }
-     for (int k=-convN2;k<(int)(ee[i].smpCount)-convN2;k++) {
-      // Current CM value
-      sum1=0.; for (int m=k-cmL;m<k;m++) sum1+=ee[i].cBuf[(ee[i].cBufIdx+k+m)%cBufSz].com0[j];
-      ee[i].cBuf[(ee[i].cBufIdx+k)%cBufSz].curCM[j]=sum1;
-      //if (i==0 && j==0) qDebug() << sum1/cmL;
+   eex &e=ee[i]; unsigned int chnCount,cRow,trig,offset; float *d; qint64 t0=monoNs();
+   try {
+    e.buf=e.str->getData(); e.smpCount=e.buf.getSampleCount(); e.fetchNs=monoNs();
+    acqD->stats.stage[ACQ_STAGE_GETDATA].add(e.fetchNs-t0,e.smpCount);
+    if (e.buf.getChannelCount()!=chnInfo->totalChnCount) RTLOG("octopus_acqd: <fetchEegData> Channel count mismatch!!!");
+   } catch (const exceptions::internalError& ex) {
+    RTLOG("octopus_acqd: <fetchEegData> Exception: %s",ex.what());
+   }
+   chnCount=e.buf.getChannelCount();
+   for (unsigned int j=0;j<e.smpCount;j++) { cRow=(e.cBufIdx+j)%cBufSz; d=e.cBuf.dataAt(cRow);
+    for (unsigned int k=0;k<chnCount-2;k++) d[k]=e.buf.getSample(k,j);
+    trig=e.cBuf.trigger[cRow]=e.buf.getSample(chnCount-2,j);
+    if (firstRound && j==0) e.baseSmpIdx=e.buf.getSample(chnCount-1,j); // The very first sample is set as the Epoch
+    offset=e.cBuf.offset[cRow]=e.smpIdx=e.buf.getSample(chnCount-1,j)-e.baseSmpIdx; // Sample# after Epoch
+    if (trig!=0 && !firstRound) { // No practical possibility for a trigger in the first round yet.
+     if (trig==(unsigned int)(AMP_SYNC_TRIG)) {
+      RTLOG("octopus_acqd: <AmpSync> SYNC received by @AMP# %u -- %u",i+1,offset);
+      syncRow[i]=e.cBufIdx+j; syncSeen[i]=1;
+     } else {
+      RTLOG("octopus_acqd: <AmpSync> Trigger # %u arrived at AMP# %u -- %u",trig,i+1,offset);
      }
     }
-    ee[i].cBufIdx+=ee[i].smpCount;
    }
-   cBufPivotP=cBufPivot; cBufPivot=*std::min_element(cBufIdxList.begin(),cBufIdxList.end());
 
-   sendTrigger(AMP_SYNC_TRIG);
-   qDebug() << "octopus_acqd: <AmpSync> SYNC sent..";
+   if (firstRound) { // History before the first block is all zeros, so are the running sums.
+    std::fill(e.maSum0.begin(),e.maSum0.end(),0.);
+    std::fill(e.maSum1.begin(),e.maSum1.end(),0.);
+    std::fill(e.maCM.begin(),e.maCM.end(),0.);
+    std::fill(e.maCom0.begin(),e.maCom0.end(),0.);
+    std::fill(e.iirZ.begin(),e.iirZ.end(),0.);
+   }
+
+   // ----- ONLINE FILTERING -----
+   { StageTimer st(acqD->stats.stage[ACQ_STAGE_FILTER],e.smpCount); filterBlock(e); }
+
+   // Derive the minimum index among # of samples fetched via any amp (to use later in circular buffer updates)
+   cBufIdxList[i]=e.cBufIdx; e.cBufIdx+=e.smpCount;
   }
 
-  void fetchEegData() { float sum0,sum1,data0;
-#ifdef EEMAGINE
-   using namespace eemagine::sdk;
-#else
-   using namespace eesynth;
-#endif
-   std::vector<double> v;
+  // Online filtering of the block just appended to e.cBuf -- Past average subtraction for
+  // High Pass + Moving Average for 50Hz and harmonics + Common Mode level -- one O(1)
+  // running-sum step (mafilter.h) per sample, across all channels at once. Each finished
+  // dataF row is then cascaded through the active design of the IIR bank (iirbank.h).
+  void filterBlock(eex &e) { quint64 b=e.cBufIdx+cBufSz; marow r; // b: keeps negative offsets positive
+   const double invN=1./convN,invL=1./convL; const unsigned int n=chnInfo->physChnCount,cs=e.maCom0Size;
+   float *com0=e.maCom0.data(); const int fd=iirBank->active;
+   const iirdesign *iir=(fd>=0) ? &(iirBank->designs[fd]) : 0;
+   if (fd!=e.iirDesign) { std::fill(e.iirZ.begin(),e.iirZ.end(),0.); e.iirDesign=fd; } // Switched: start from rest
+   for (int k=-convN2;k<(int)(e.smpCount)-convN2;k++) {
+    r.dHead0=e.cBuf.dataAt(b+k+convN2-1); r.dTail0=e.cBuf.dataAt(b+k-convN2-1);
+    r.dCur=e.cBuf.dataAt(b+k);
+    r.dHead1=e.cBuf.dataAt(b+k-1); r.dTail1=e.cBuf.dataAt(b+k-convL-1);
+    r.cHead=com0+((b+k-1)%cs)*n; r.cTail=com0+((b+k-cmL-1)%cs)*n; r.com0=com0+((b+k)%cs)*n;
+    r.dataF=e.cBuf.dataFAt(b+k+convN2); r.curCM=e.cBuf.curCMAt(b+k+convN2);
+    maFilterStep(r,n,invN,invL,e.maSum0.data(),e.maSum1.data(),e.maCM.data());
+    if (iir) iirRowStep(*iir,r.dataF,e.iirZ.data(),n);
+   }
+  }
 
-   for (unsigned int i=0;i<ee.size();i++) {
-    try {
-     ee[i].buf=ee[i].str->getData(); chnCount=ee[i].buf.getChannelCount();
-     ee[i].smpCount=ee[i].buf.getSampleCount();
-     if (chnCount!=chnInfo->totalChnCount) qDebug() << "octopus_acqd: <fetchEegData> Channel count mismatch!!!";
-    } catch (const exceptions::internalError& ex) {
-     std::cout << "Exception" << ex.what() << std::endl;
-    }
-    for (unsigned int j=0;j<ee[i].smpCount;j++) { smp.marker=M_PI;
-     for (unsigned int k=0;k<chnCount-2;k++) smp.data[k]=ee[i].buf.getSample(k,j);
-     smp.trigger=ee[i].buf.getSample(chnCount-2,j);
-     smp.offset=ee[i].smpIdx=ee[i].buf.getSample(chnCount-1,j)-ee[i].baseSmpIdx; // Sample# after Epoch
-     if (smp.trigger != 0) {
-      if (smp.trigger == (unsigned int)(AMP_SYNC_TRIG)) {
-       qDebug() << "octopus_acqd: <AmpSync> SYNC received by @AMP#" << i+1 << " -- " << smp.offset;
-       arrivedTrig[i]=smp.offset; syncTrig++;
-      } else {
-       qDebug() << "octopus_acqd: <AmpSync> Trigger #" << smp.trigger << " arrived at AMP#" << i+1 << " -- " << smp.offset;
-      }
-     }
-     ee[i].cBuf[(ee[i].cBufIdx+j)%cBufSz]=smp;
-    }
+  // One acquisition round: all amps are fetched and filtered in parallel by their workers,
+  // which are joined here before the common pivot is derived.
+  void fetchEegRound() {
+   for (AmpWorker *w:ampWorkers) w->startRound();
+   for (AmpWorker *w:ampWorkers) w->waitRound();
+   cBufPivotP=cBufPivot; cBufPivot=*std::min_element(cBufIdxList.begin(),cBufIdxList.end());
+   if (ee[0].smpCount>0 && !sampleClock.add(ee[0].fetchNs,ee[0].cBufIdx-1))
+    RTLOG("octopus_acqd: <SampleClock> AMP#1 stepped against the host clock; fit restarted.");
+  }
 
-    // ----- ONLINE FILTERING -----
-    // Past average subtraction for High Pass + Moving Average for 50Hz and harmonics
-    for (unsigned int j=0;j<chnCount-2;j++) {
-     for (int k=-convN2;k<(int)(ee[i].smpCount)-convN2;k++) {
-      sum0=0.; for (int m=-convN2;m<convN2;m++) sum0+=ee[i].cBuf[(ee[i].cBufIdx+k+m)%cBufSz].data[j];
-      ee[i].cBuf[(ee[i].cBufIdx+k)%cBufSz].sum0[j]=sum0;
-      data0=fabs(ee[i].cBuf[(ee[i].cBufIdx+k)%cBufSz].data[j]-sum0/convN);
-      ee[i].cBuf[(ee[i].cBufIdx+k)%cBufSz].com0[j]=data0*data0;
-
-      // Current CM value
-      //sum0b=ee[i].cBuf[(ee[i].cBufIdx+k)%cBufSz].sum0b[j];
-      //data0=ee[i].cBuf[(ee[i].cBufIdx+k-cmL-1)%cBufSz].data[j]-ee[i].cBuf[(ee[i].cBufIdx+k-cmL-1)%cBufSz].sum0[j]/convN;
-      //sum0b-=data0*data0;
-      //data0=ee[i].cBuf[(ee[i].cBufIdx+k-1)%cBufSz].data[j]-sum0/convN;
-      //sum0b+=data0*data0;
-      //ee[i].cBuf[(ee[i].cBufIdx+k+convN2)%cBufSz].sum0b[j]=sum0b;
-      //if (i==0 && j==0) qDebug() << sum0b;
-      //ee[i].cBuf[(ee[i].cBufIdx+k+convN2)%cBufSz].curCM[j]=sqrt(sum0b)/cmL;
-
-      // Hi-pass
-      sum1=ee[i].cBuf[(ee[i].cBufIdx+k+convN2-1)%cBufSz].sum1[j];
-      sum1-=ee[i].cBuf[(ee[i].cBufIdx+k-convL-1)%cBufSz].data[j];
-      sum1+=ee[i].cBuf[(ee[i].cBufIdx+k-1)%cBufSz].data[j];
-      ee[i].cBuf[(ee[i].cBufIdx+k+convN2)%cBufSz].sum1[j]=sum1;
-
-      ee[i].cBuf[(ee[i].cBufIdx+k+convN2)%cBufSz].dataF[j]=sum0/convN-sum1/convL;
-     }
-     for (int k=-convN2;k<(int)(ee[i].smpCount)-convN2;k++) {
-      // Current CM value
-      sum1=ee[i].cBuf[(ee[i].cBufIdx+k+convN2-1)%cBufSz].curCM[j];
-      sum1-=ee[i].cBuf[(ee[i].cBufIdx+k-cmL-1)%cBufSz].com0[j];
-      sum1+=ee[i].cBuf[(ee[i].cBufIdx+k-1)%cBufSz].com0[j];
-      ee[i].cBuf[(ee[i].cBufIdx+k+convN2)%cBufSz].curCM[j]=sum1;
-      //if (i==0 && j==0) qDebug() << sum1/cmL;
-     }
-    }
-    if (filterIIR_1_40) { // Cascade to MA50Hz
-     for (unsigned int j=0;j<chnCount-2;j++) {
-      v.resize(0);
-      for (int k=0;k<(int)(ee[i].smpCount);k++) v.push_back(ee[i].cBuf[(ee[i].cBufIdx+k)%cBufSz].data[j]);
-      bpf.processFiltFilt(v,ee[i],j);
-      for (int k=0;k<(int)(ee[i].smpCount);k++) ee[i].cBuf[(ee[i].cBufIdx+k)%cBufSz].dataF[j]=v[k];
-     }
+  // Timed triggers (CS_ACQ_TIMED_TRIG) to output sample indices. Output sample p+i is packed
+  // from AMP#1 row cBufPivotP+i-convN2-shift (see the packing loop), so that row r is sample
+  // r+shift-d. One falling into the block about to be packed, or later, waits in pending;
+  // one already published is put into the ring after the fact, if it is still there.
+  void takeTimedTrigs() { timedtrig tt; long long k; quint64 p=*tcpBufPivot; bool placed;
+   long long d=(long long)cBufPivotP-convN2-(long long)p,ahead=(long long)p+tcpBuffer->size(); const char *why;
+   while (acqD->timedTrigs.pop(tt)) {
+    k=sampleClock.valid() ? llround(sampleClock.rowAt(tt.ns))+ampAlign.commonShift()-d : -1;
+    if (k>=(long long)p && k<ahead && pendCount<TIMED_TRIG_PENDING) { pendIdx[pendCount]=k; pendCode[pendCount++]=tt.code; continue; }
+    placed=false;
+    if (k>=0 && k<(long long)p) for (quint64 j=k;j<p && j<(quint64)k+TIMED_TRIG_SEARCH && !placed;j++) // Next free sample
+     if ((*tcpBuffer)[j%tcpBuffer->size()].trigger==0) placed=acqD->retroTrigger(j,tt.code);
+    if (placed) { acqD->stats.trigRetro++;
+     RTLOG("octopus_acqd: <TimedTrig> Trigger %u placed %lld sample(s) back.",tt.code,(long long)p-k);
+    } else { acqD->stats.trigMissed++;
+     why=(k<0) ? "no sample clock yet" : (k<(long long)p) ? "out of the ring" : (k>=ahead) ? "too far ahead" : "too many pending";
+     RTLOG("octopus_acqd: <TimedTrig> Trigger %u missed (%s).",tt.code,why);
     }
-
-    // Derive the minimum index among # of samples fetched via any amp (to use later in circular buffer updates)
-    cBufIdxList[i]=ee[i].cBufIdx; ee[i].cBufIdx+=ee[i].smpCount;
    }
+  }
 
-   // ---------------------
+  // Stamps the pending timed triggers that are due by output sample idx; a sample that
+  // already carries a trigger passes them on to the next one.
+  void stampTimedTrigs(quint64 idx,tcpsample &tcpS) {
+   for (unsigned int j=0;j<pendCount && tcpS.trigger==0;j++) if (pendIdx[j]<=idx) {
+    tcpS.trigger=pendCode[j]; acqD->stats.trigPlaced++;
+    if (idx>pendIdx[j]) RTLOG("octopus_acqd: <TimedTrig> Trigger %u moved by %llu sample(s) off another.",pendCode[j],
+                              (unsigned long long)(idx-pendIdx[j]));
+    pendCount--; pendIdx[j]=pendIdx[pendCount]; pendCode[j]=pendCode[pendCount];
+   }
+  }
 
-   cBufPivotP=cBufPivot; cBufPivot=*std::min_element(cBufIdxList.begin(),cBufIdxList.end());
+  void fetchEegData0() {
+   firstRound=true; fetchEegRound(); firstRound=false;
+   if (acqD->trigOut->push(AMP_SYNC_TRIG)) qDebug() << "octopus_acqd: <AmpSync> SYNC sent..";
+   else qDebug() << "octopus_acqd: <AmpSync> Trigger queue full, SYNC dropped!";
   }
 
+  void fetchEegData() { fetchEegRound(); }
+
 // ------------------------------------------------
 // ------------------------------------------------
 // ------------------------------------------------
@@ -409,16 +265,19 @@ class AcqThread : public QThread {
 #ifdef EEMAGINE
    using namespace eemagine::sdk; factory eeFact("libeego-SDK.so");
 #else
-   using namespace eesynth; factory eeFact;
+   using namespace eesynth; factory eeFact(acqD->confSynth);
 #endif
 
    // --- Initial setup ---
 
-   initAlsa();
+   if (acqD->confAudioDevice!="NONE") { // Audio latency: one EEG probe block on top of the ring's own slack
+    audioThread=new AudioThread(acqD->confAudioDevice,chnInfo->sampleRate,chnInfo->sampleRate*chnInfo->probe_eeg_msecs/1000);
+    audioThread->start(QThread::HighPriority);
+   }
 
    std::vector<amplifier*> eeAmpsU,eeAmps; std::vector<unsigned int> snosU,snos; // Unsorted vs. sorted
    eeAmpsU=eeFact.getAmplifiers();
-   if (eeAmpsU.size()<EE_AMPCOUNT) {
+   if (eeAmpsU.size()<chnInfo->ampCount) {
     qDebug() << "octopus_acqd: <acqthread_amp_setup> At least one  of the amplifiers is offline!"; *daemonRunning=false; return;
    }
 
@@ -433,98 +292,148 @@ class AcqThread : public QThread {
    rMask=0; for (int i=0;i<REF_CHN_COUNT;i++) { rMask<<=1; rMask|=1; }
    bMask=0; for (int i=0;i<BIP_CHN_COUNT;i++) { bMask<<=1; bMask|=1; }
    //qDebug("%llx %llx",rMask,bMask);
+   // The first AMP|COUNT amps (in serial order) are used, any others are released.
+   for (unsigned int i=chnInfo->ampCount;i<eeAmps.size();i++) delete eeAmps[i];
+   eeAmps.resize(chnInfo->ampCount);
    for (unsigned int i=0;i<eeAmps.size();i++) { eex e; e.idx=i; e.amp=eeAmps[i];
     e.chnList=e.amp->getChannelList(rMask,bMask);
     // Select same channels for all eeAmps (i.e. All 64/64 referentials and 2/24 of bipolars)
     //e.chnList=e.amp->getChannelList(0xffffffffffffffff,0x0000000000000003);
     //e.chnList=e.amp->getChannelList(0x0000000000000000,0x0000000000000001);
     cBufSz=chnInfo->sampleRate*CBUF_SIZE_IN_SECS; e.cBufIdx=cBufSz/2; //+convN;
-    //e.cBufF.resize(cBufSz);
-    e.cBuf.resize(cBufSz); e.imps.resize(chnInfo->physChnCount);
-    e.fX.resize(chnInfo->physChnCount); for (unsigned int i=0;i<e.fX.size();i++) for (unsigned int j=0;j<e.fX[i].size();j++) e.fX[i][j]=0.;
-    e.fY.resize(chnInfo->physChnCount); for (unsigned int i=0;i<e.fY.size();i++) for (unsigned int j=0;j<e.fY[i].size();j++) e.fY[i][j]=0.;
+    e.cBuf.resize(cBufSz,chnInfo->physChnCount); e.imps.resize(chnInfo->physChnCount);
+    e.maSum0.resize(chnInfo->physChnCount); e.maSum1.resize(chnInfo->physChnCount); e.maCM.resize(chnInfo->physChnCount);
+    e.maCom0Size=cmL+2; e.maCom0.resize(e.maCom0Size*chnInfo->physChnCount); // com0 is read back up to cmL+1 samples later
+    e.iirZ.resize(2*IIR_MAX_SECTIONS*chnInfo->physChnCount); e.iirDesign=-1; // Room for any design of the bank
     ee.push_back(e);
-    arrivedTrig.push_back(0); // Zero trigger for each amp.
+    syncRow.push_back(0); syncSeen.push_back(0);
    }
-   cBufIdxList.resize(ee.size()); syncTrig=0;
+   cBufIdxList.resize(ee.size()); ampAlign.init(ee.size());
+   sampleClock.init(chnInfo->sampleRate,(qint64)(acqD->confInjectLagUs)*1000LL); pendCount=0;
+   syncCycles=acqD->confSyncSecs*1000/chnInfo->probe_eeg_msecs; syncCounter=0;
 
    // ----- List unsorted vs. sorted
    for (unsigned int i=0;i<ee.size();i++) qDebug() << "octopus_acqd: <AmpSerial> Amp#" << i+1 << ":" << stoi(ee[i].amp->getSerialNumber());
 
+   // Per-amp fetch/filter workers; ee must not be resized from here on.
+   for (unsigned int i=0;i<ee.size();i++) {
+    ampWorkers.push_back(new AmpWorker(i,[this](unsigned int a) { fetchAmpData(a); }));
+    ampWorkers.back()->setRealtime(acqD->confSchedFifo,acqD->confSchedCpus);
+    ampWorkers.back()->start(QThread::HighestPriority);
+   }
+
+   // Real-time setup -- everything the loop needs is allocated by now
+   rtSetThread("AcqThread",acqD->confSchedFifo,acqD->confSchedCpus);
+   if (acqD->confMlockAll) {
+    if (mlockall(MCL_CURRENT|MCL_FUTURE)==0) qDebug("octopus_acqd: <Sched> All memory locked.");
+    else qDebug("octopus_acqd: <Sched> mlockall failed (%s).",strerror(errno));
+   }
+   const qint64 periodNs=(qint64)(chnInfo->probe_eeg_msecs)*1000000LL;
+   const unsigned int reportCycles=ACQ_SCHED_REPORT_MSECS/chnInfo->probe_eeg_msecs;
+   const unsigned int nominalBlock=chnInfo->sampleRate*chnInfo->probe_eeg_msecs/1000;
+   RTHistogram histJitter("wakeup",  "us",10.,1000),
+               histBlock ("blocksize","smp",1.,4*nominalBlock),
+               histProc  ("proctime","ms",.05,40*chnInfo->probe_eeg_msecs); // Up to two periods
+   qint64 deadline,wakeNs,doneNs,stageNs; quint64 missed=0,missedTotal=0,cycles=0;
+
    switchToEEGMode();
 
    // Main Loop
 
    if (!(*eegImpedanceMode)) fetchEegData0(); // The first round of acquisition - to preadjust certain things
+   deadline=monoNs();
    while (*daemonRunning) {
     if (*eegImpedanceMode) {
      fetchImpedanceData();
      for (eex& e:ee) for (unsigned int j=0;j<e.chnList.size();j++) e.imps[j]=e.buf.getSample(j,0);
      std::this_thread::sleep_for(std::chrono::milliseconds(chnInfo->probe_cm_msecs));
+     deadline=monoNs(); // Re-arm the EEG period
     } else {
+     // Absolute deadlines: the period does not drift by the processing time
+     deadline+=periodNs; sleepUntilNs(deadline); wakeNs=monoNs();
+     histJitter.add((wakeNs-deadline)/1e3);
+
      fetchEegData();
 
-     // If all amps have received the SYNC trigger already, align their buffers according to the trigger instant
-     if (syncTrig==ee.size()) {
-      qDebug() << "octopus_acqd: <AmpSync> SYNC received by all amps.. validating offsets.. ";
-      unsigned int trigOffsetMin=*std::min_element(arrivedTrig.begin(),arrivedTrig.end());
-      for (unsigned int i=0;i<ee.size();i++) arrivedTrig[i]-=trigOffsetMin;
-      unsigned int trigOffsetMax=*std::max_element(arrivedTrig.begin(),arrivedTrig.end());
-      if (trigOffsetMax>chnInfo->sampleRate) {
-       qDebug() << "octopus_acqd: <AmpSync> ERROR! SYNC is not recvd within a second for at least one amp!";
-      } else {
-       qDebug() << "octopus_acqd: <AmpSync> SYNC retro-adjustments to be made: AMP#1->" << arrivedTrig[0] << " AMP#2->" << arrivedTrig[1];
-       qDebug() << "octopus_acqd: <AmpSync> SUCCESS. Offsets are now being synced on-the-fly to the earliest amp at TCPsample package level.";
+     // A complete SYNC (one arrival per amp) refines the alignment; a partial one expires after a second
+     syncArrived=std::count(syncSeen.begin(),syncSeen.end(),1);
+     if (syncArrived==ee.size()) { ampAlign.update(syncRow); std::fill(syncSeen.begin(),syncSeen.end(),0); }
+     else if (syncArrived>0) { quint64 first=~0ULL;
+      for (unsigned int a=0;a<ee.size();a++) if (syncSeen[a]) first=std::min(first,syncRow[a]);
+      if (cBufPivot>first+chnInfo->sampleRate) { char miss[12*EE_MAX_AMPCOUNT+1]=""; int l=0;
+       for (unsigned int a=0;a<ee.size();a++) if (!syncSeen[a]) l+=snprintf(miss+l,sizeof(miss)-l," AMP#%u",a+1);
+       RTLOG("octopus_acqd: <AmpSync> ERROR! SYNC not received within a second by%s -- ignored.",miss);
+       std::fill(syncSeen.begin(),syncSeen.end(),0);
       }
-      syncTrig=0; // Ready for future SYNCing to update arrivedTrig[i] values
      }
+     if (syncCycles && ++syncCounter>=syncCycles) { syncCounter=0; acqD->trigOut->push(AMP_SYNC_TRIG); } // Periodic SYNC
 
-     instreamAudio();
-
+     stageNs=monoNs();
+     quint64 tcpDataSize=cBufPivot-cBufPivotP,n; // qDebug() << cBufPivotP << " " << cBufPivot;
      tcpMutex->lock();
-      quint64 tcpDataSize=cBufPivot-cBufPivotP; // qDebug() << cBufPivotP << " " << cBufPivot;
-      for (quint64 i=0;i<tcpDataSize;i++) {
-       // Baseline alignment to the latest offset by (+arrivedTrig[i]
-       tcpS.amp[0]=ee[0].cBuf[(cBufPivotP+i-convN2+arrivedTrig[0])%cBufSz];
-       tcpS.amp[1]=ee[1].cBuf[(cBufPivotP+i-convN2+arrivedTrig[1])%cBufSz];
-       tcpS.trigger=0;
-       if (synthTrigger) {
-        tcpS.trigger=synthTrigger; synthTrigger=0;
-       }
+      if (audioThread) audioThread->beginBlock(tcpDataSize);
+      takeTimedTrigs();
+     tcpMutex->unlock();
+     // Whatever the amps returned this round (a stall makes it several periods), it is packed
+     // and published in sub-blocks of at most tcpBufGuard samples: the lock-free readers rely
+     // on nothing beyond that being written past the published index.
+     for (quint64 b=0;b<tcpDataSize;b+=n) { n=qMin(tcpDataSize-b,acqD->tcpBufGuard);
+      tcpMutex->lock();
+       for (quint64 i=b;i<b+n;i++) { tcpsample &tcpS=(*tcpBuffer)[(*tcpBufPivot+i-b)%tcpBufSize];
+        // Each amp resampled onto the common sample clock (ampalign.h)
+        for (unsigned int a=0;a<ee.size();a++) ampAlign.get(a,ee[a].cBuf,cBufPivotP+i-convN2,tcpS.amp[a]);
+        tcpS.trigger=0;
+        if (synthTrigger) {
+         tcpS.trigger=synthTrigger; synthTrigger=0;
+        }
 
-       // Trigger timing check in between amps
-       trig0=tcpS.amp[0].trigger; trig1=tcpS.amp[1].trigger; toff++;
-       if (trig0!=0 && trig1!=0) qDebug() << "octopus_acqd: <AmpSync> Yay! Syncronized triggers received!";
-       else if (trig0!=0 || trig1!=0) {
-        qDebug() << "octopus_acqd: <AmpSync> That's bad. Single offset lag.." << trig0 << "vs." << trig1 << "-> Offset:" << toff; toff=0;
-       }
+        // Trigger timing check in between amps
+        trigCount=0; for (unsigned int a=0;a<ee.size();a++) if (tcpS.amp[a].trigger!=0) trigCount++;
+        toff++;
+        if (trigCount==ee.size()) RTLOG("octopus_acqd: <AmpSync> Yay! Syncronized triggers received!");
+        else if (trigCount>0) { char trigs[24*EE_MAX_AMPCOUNT+1]=""; int l=0;
+         for (unsigned int a=0;a<ee.size();a++) l+=snprintf(trigs+l,sizeof(trigs)-l," AMP#%u:%u",a+1,tcpS.amp[a].trigger);
+         RTLOG("octopus_acqd: <AmpSync> That's bad. Single offset lag..%s -> Offset: %u",trigs,toff); toff=0;
+        }
 
-       // Copy Audio L and Audio R in tcpS from Audio Circular Buffer
+        // Audio L and Audio R from the audio thread, at the EEG sample clock
+        if (audioThread) audioThread->pop(tcpS.aux); else for (unsigned int c=0;c<AUX_CHN_COUNT;c++) tcpS.aux[c]=0.;
 
-       // Update cmLevels
-       if ((counter0%(chnInfo->probe_cm_msecs/chnInfo->probe_eeg_msecs)==0)) {
-        for (int i=0;i<acqD->chnTopo.size();i++) {
-         (acqD->chnTopo)[i].cmLevel[0]=1.0*1e5*(tcpS.amp[0].curCM[i])/cmL;
-         (acqD->chnTopo)[i].cmLevel[1]=1.0*1e5*(tcpS.amp[1].curCM[i])/cmL;
+        // Update cmLevels
+        if ((counter0%(chnInfo->probe_cm_msecs/chnInfo->probe_eeg_msecs)==0)) {
+         for (int c=0;c<acqD->chnTopo.size();c++) for (unsigned int a=0;a<ee.size();a++)
+          (acqD->chnTopo)[c].cmLevel[a]=1.0*1e5*(tcpS.amp[a].curCM[c])/cmL;
         }
-       }
-       counter0++;
+        counter0++;
 
-       if (*extTrig) { tcpS.trigger=*extTrig; *extTrig=0; }
-       (*tcpBuffer)[(*tcpBufPivot+i)%tcpBufSize]=tcpS;
-      }
+        if (*extTrig) { tcpS.trigger=*extTrig; *extTrig=0; }
+        if (pendCount) stampTimedTrigs(*tcpBufPivot+i-b,tcpS);
+       }
 
-      (*tcpBufPivot)+=tcpDataSize; // Update producer index
-     tcpMutex->unlock();
+      tcpMutex->unlock();
+      acqD->stats.stage[ACQ_STAGE_PACK].add(monoNs()-stageNs,n); stageNs=monoNs();
+      acqD->publishTcpData(n); // Update producer index and wake up the senders
+      acqD->stats.stage[ACQ_STAGE_PUBLISH].add(monoNs()-stageNs,n); stageNs=monoNs();
+     }
 
      // Common Mode Level estimation for both amps; copy to dedicated buffer
      if ((counter1%(chnInfo->probe_cm_msecs/chnInfo->probe_eeg_msecs)==0)) {
+      StageTimer st(acqD->stats.stage[ACQ_STAGE_CMUPDATE]);
       guiMutex->lock(); acqD->updateCMLevels(); guiMutex->unlock();
      }
 
      cBufPivotP=cBufPivot;
 
-     std::this_thread::sleep_for(std::chrono::milliseconds(chnInfo->probe_eeg_msecs));
+     doneNs=monoNs(); histProc.add((doneNs-wakeNs)/1e6); histBlock.add(tcpDataSize);
+     acqD->stats.stage[ACQ_STAGE_CYCLE].add(doneNs-wakeNs,tcpDataSize);
+     while (doneNs>=deadline+periodNs) { deadline+=periodNs; missed++; } // Overran; skip the deadline(s) already gone
+     if (++cycles%reportCycles==0) { missedTotal+=missed;
+      qDebug("octopus_acqd: <Sched> %u ms period, last %u cycles -- missed deadlines: %llu (total %llu)",
+             chnInfo->probe_eeg_msecs,reportCycles,(unsigned long long)missed,(unsigned long long)missedTotal);
+      histJitter.report(); histBlock.report(); histProc.report();
+      if (sampleClock.valid()) qDebug("octopus_acqd: <SampleClock> AMP#1 vs. host clock: %+.1f ppm",sampleClock.ppm());
+      histJitter.reset(); histBlock.reset(); histProc.reset(); missed=0;
+     }
     } // eegImpedanceMode or not
     counter1++;
    } // daemonRunning
@@ -532,44 +441,18 @@ class AcqThread : public QThread {
    // Stop EEG Stream
    //tcpMutex->lock(); tcpMutex->unlock();
 
+   for (AmpWorker *w:ampWorkers) { w->stop(); delete w; }
+   if (audioThread) { audioThread->stop();
+    qDebug() << "octopus_acqd: <AudioThread> Stopped. Slips:" << (quint64)(audioThread->slips) << "Underruns:" << (quint64)(audioThread->underruns)
+             << "Overruns:" << (quint64)(audioThread->overruns) << "ALSA xruns:" << (quint64)(audioThread->xruns);
+    delete audioThread;
+   }
    for (eex& e:ee) { delete e.str; delete e.amp; }
 
    qDebug("octopus_acqd: <acqthread> Exiting thread..");
   }
 
  public slots:
-  void sendTrigger(unsigned char t) {
-   unsigned char trig=t;
-   serial.devname="/dev/ttyACM0"; serial.baudrate=B115200;
-   serial.databits=CS8; serial.parity=serial.par_on=0; serial.stopbit=1;
-   if ((serial.device=open(serial.devname.toLatin1().data(),O_RDWR|O_NOCTTY))>0) {
-    tcgetattr(serial.device,&oldtio);     // Save current port settings..
-    bzero(&newtio,sizeof(newtio)); // Clear struct for new settings..
-
-    // CLOCAL: Local connection, no modem control
-    // CREAD:  Enable receiving chars
-    newtio.c_cflag=serial.baudrate | serial.databits |
-                   serial.parity   | serial.par_on   |
-                   serial.stopbit  | CLOCAL |CREAD;
-
-    newtio.c_iflag=IGNPAR | ICRNL;  // Ignore bytes with parity errors,
-                                    // map CR to NL, as it will terminate the
-                                    // input for canonical mode..
-
-    newtio.c_oflag=0;               // Raw Output
-
-    newtio.c_lflag=ICANON;          // Enable Canonical Input
-
-    tcflush(serial.device,TCIFLUSH); // Clear line and activate settings..
-    tcsetattr(serial.device,TCSANOW,&newtio); sleep(1);
-
-    write(serial.device,&trig,sizeof(unsigned char));
-
-    tcsetattr(serial.device,TCSANOW,&oldtio); // Restore old serial context..
-    close(serial.device);
-   }
-  }
-
   void sendSynthTrigger(unsigned int t) { synthTrigger=t; }
 
  private:
@@ -579,35 +462,26 @@ class AcqThread : public QThread {
 #else
   std::vector<eesynth::amplifier*> eeAmpsU;
 #endif
-  QVector<tcpsample> *tcpBuffer; quint64 *tcpBufPivot,*tcpBufCIdx; tcpsample tcpS; sample smp;
-  std::vector<eex> ee; chninfo *chnInfo; unsigned int cBufSz,smpCount,chnCount;
+  QVector<tcpsample> *tcpBuffer; std::atomic<quint64> *tcpBufPivot;
+  std::vector<eex> ee; chninfo *chnInfo; unsigned int cBufSz,smpCount; std::vector<AmpWorker*> ampWorkers;
   std::vector<unsigned int> cBufIdxList;
 
   int convN,convN2,convL,cmL; quint64 cBufPivot,cBufPivotP;
 
   QMutex *tcpMutex,*guiMutex; bool *daemonRunning,*eegImpedanceMode; unsigned int *extTrig;
 
-  bool filterIIR_1_40;
-
-  // Butterworth coefficients (replace with MATLAB-generated values)
-  HighPassFilter hpf;
-  BandPassFilter bpf;
-
-  serial_device serial;
-  int sDevice; // Actual serial dev..
-  struct termios oldtio,newtio; // place for old & new serial port settings..
+  bool firstRound; IIRBank *iirBank;
 
-  QVector<unsigned int> arrivedTrig; // Trigger offsets for syncronization.
-  unsigned int syncTrig;
+  // SYNC arrival rows -- one slot per amp worker, read between rounds
+  std::vector<quint64> syncRow; std::vector<unsigned char> syncSeen;
+  AmpAlign ampAlign; unsigned int syncArrived,syncCycles,syncCounter;
 
-  unsigned int trig0,trig1,toff;
+  // Host time to AMP#1 row, and the timed triggers waiting for their sample to be packed
+  SampleClock sampleClock; quint64 pendIdx[TIMED_TRIG_PENDING]; unsigned int pendCode[TIMED_TRIG_PENDING],pendCount;
 
-  // Alsa Audio
-  snd_pcm_t* audioPCMHandle;
-  snd_pcm_hw_params_t* audioParams;
-  std::vector<int16_t> audioBuffer;
+  unsigned int trigCount,toff;
 
-  bool audioOK;
+  AudioThread *audioThread;
 
   quint64 counter0,counter1;
   unsigned int synthTrigger;
@@ -0,0 +1,119 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* Continuous inter-amp alignment. The SYNC byte reaches the trigger inputs of all amps at
+   the same instant; the history row at which each amp reports it therefore pins the amps'
+   sample clocks to each other. Every complete SYNC (one row per amp) adds a point to a
+   least-squares line per amp of its lag relative to amp #1 (the reference) over the last
+   ALIGN_FIT_POINTS pulses, i.e. an offset and a drift. With SYNC repeated periodically
+   (AMP|SYNCSECS) the offset is tracked to well below one sample and follows the drift
+   of the amp clocks.
+
+   On the packing side, each output sample of amp a is read at a fractional position of
+   its history and interpolated by a cubic Lagrange fractional-delay filter in Farrow
+   form: the four tap weights are polynomials of the fractional part mu, computed once
+   per sample and applied across all channels and fields. Its passband error stays below
+   0.01dB up to a tenth of the sample rate. Trigger and offset come from the nearest row;
+   a trigger on a row skipped by the drift is carried over, so that none is lost or
+   doubled. A point off the current line by more than ALIGN_STEP_SMPS (lost samples, amp
+   restart) restarts that amp's fit. */
+
+#ifndef AMPALIGN_H
+#define AMPALIGN_H
+
+#include <QDebug>
+#include <vector>
+#include <deque>
+#include <cmath>
+#include <algorithm>
+
+#include "../sample.h"
+#include "cbuf.h"
+#include "../rtlog.h"
+
+const unsigned int ALIGN_FIT_POINTS=16; // SYNC pulses in the drift fit
+const double ALIGN_STEP_SMPS=2.;        // Deviation from the fit taken as a step rather than drift
+
+class AmpAlign {
+ public:
+  void init(unsigned int ac) { ampCount=ac; shift=0; pulses=0;
+   pts.assign(ac,std::deque<std::pair<double,double> >()); lag0.assign(ac,0.); drift.assign(ac,0.); xMean.assign(ac,0.);
+   lastRow.assign(ac,0); started.assign(ac,0);
+  }
+
+  // One complete SYNC; rows[a] is the history row of amp a at which it arrived.
+  void update(const std::vector<quint64> &rows) { double x=(double)rows[0],y,res,minL=0.;
+   pulses++;
+   for (unsigned int a=1;a<ampCount;a++) { std::deque<std::pair<double,double> > &p=pts[a];
+    y=(double)rows[a]-x;
+    if (p.size()>=2 && fabs(res=y-lag(a,x))>ALIGN_STEP_SMPS) {
+     RTLOG("octopus_acqd: <AmpAlign> AMP#%u stepped by %.1f samples; drift fit restarted.",a+1,res); p.clear();
+    }
+    p.push_back(std::make_pair(x,y)); if (p.size()>ALIGN_FIT_POINTS) p.pop_front();
+    fit(a);
+   }
+   // Keep every read at or after the output index; the earliest amp defines the shift
+   for (unsigned int a=1;a<ampCount;a++) minL=std::min(minL,lag(a,x));
+   long long m=(long long)floor(minL);
+   if (pulses>1 && m!=shift) RTLOG("octopus_acqd: <AmpAlign> Common shift changed by %lld sample(s).",m-shift);
+   shift=m;
+   for (unsigned int a=1;a<ampCount;a++)
+    RTLOG("octopus_acqd: <AmpAlign> SYNC #%llu AMP#%u vs. AMP#1: lag %.2f samples, drift %.2f ppm (%u pulses)",
+           (unsigned long long)pulses,a+1,lag(a,x),drift[a]*1e6,(unsigned int)pts[a].size());
+  }
+
+  // Output sample n of amp a, from its history c.
+  void get(unsigned int a,const cbuf &c,quint64 n,sample &s) { double pos,mu; quint64 p,r; float h[4];
+   if (pulses==0) { c.get(n,s); return; } // Not synced yet: as acquired
+   pos=(double)n-(double)shift; pos+=lag(a,pos); p=(quint64)floor(pos); mu=pos-(double)p;
+   // Cubic Lagrange weights for rows p-1..p+2 (Farrow: polynomials in mu)
+   h[0]=(float)(-mu*(mu-1.)*(mu-2.)/6.); h[1]=(float)((mu+1.)*(mu-1.)*(mu-2.)/2.);
+   h[2]=(float)(-(mu+1.)*mu*(mu-2.)/2.); h[3]=(float)((mu+1.)*mu*(mu-1.)/6.);
+   if (mu==0.) c.get(p,s); else c.getInterp(p,h,s);
+   r=(mu<.5) ? p : p+1; s.offset=c.offset[r%c.size]; s.trigger=0;
+   if (!started[a]) { lastRow[a]=r-1; started[a]=1; }
+   for (quint64 k=lastRow[a]+1;k<=r;k++) if (c.trigger[k%c.size]) { s.trigger=c.trigger[k%c.size]; break; } // Skipped rows too
+   if (r>lastRow[a]) lastRow[a]=r;
+  }
+
+  // Rows by which the output runs behind AMP#1's history (0 until synced).
+  long long commonShift() const { return pulses ? shift : 0; }
+
+  quint64 pulses;
+
+ private:
+  double lag(unsigned int a,double x) const { return (a==0) ? 0. : lag0[a]+drift[a]*(x-xMean[a]); }
+
+  void fit(unsigned int a) { const std::deque<std::pair<double,double> > &p=pts[a]; double sx=0.,sy=0.,sxx=0.,sxy=0.,n=p.size();
+   for (const auto &q:p) { sx+=q.first; sy+=q.second; }
+   xMean[a]=sx/n; lag0[a]=sy/n;
+   for (const auto &q:p) { sxx+=(q.first-xMean[a])*(q.first-xMean[a]); sxy+=(q.first-xMean[a])*(q.second-lag0[a]); }
+   drift[a]=(sxx>0.) ? sxy/sxx : 0.;
+  }
+
+  unsigned int ampCount; long long shift;
+  std::vector<std::deque<std::pair<double,double> > > pts; std::vector<double> lag0,drift,xMean;
+  std::vector<quint64> lastRow; std::vector<unsigned char> started;
+};
+
+#endif
@@ -0,0 +1,76 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* One thread per amplifier. Every EEG probe round AcqThread starts all workers at once;
+   each fetches the pending block of its own amp and runs it through the filter stage
+   (the job handed in, AcqThread::fetchAmpData()), which only touches that amp's eex.
+   The acquisition thread then waits for all of them -- the cBufPivot barrier -- before
+   packing the aligned samples of all amps into tcpBuffer. The round of an N-amp setup
+   hence takes as long as its slowest amp instead of the sum of all. */
+
+#ifndef AMPWORKER_H
+#define AMPWORKER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <functional>
+#include <vector>
+
+#include "rtsched.h"
+
+class AmpWorker : public QThread {
+ public:
+  AmpWorker(unsigned int i,std::function<void(unsigned int)> j,QObject *parent=0) : QThread(parent) {
+   idx=i; job=j; round=doneRound=0; stopRequested=false; fifoPrio=0; setObjectName("AmpWorker");
+  }
+
+  // Scheduling of the worker thread itself, applied when it starts (SCHED|FIFO, SCHED|AFFINITY).
+  void setRealtime(int prio,const std::vector<int> &c) { fifoPrio=prio; cpus=c; }
+
+  void startRound() { mutex.lock(); round++; roundReady.wakeOne(); mutex.unlock(); }
+
+  void waitRound() { mutex.lock(); while (doneRound!=round) roundDone.wait(&mutex); mutex.unlock(); }
+
+  void stop() { mutex.lock(); stopRequested=true; roundReady.wakeOne(); mutex.unlock(); wait(); }
+
+  virtual void run() { quint64 r;
+   rtSetThread("AmpWorker",fifoPrio,cpus);
+   while (true) {
+    mutex.lock();
+     while (doneRound==round && !stopRequested) roundReady.wait(&mutex);
+     if (stopRequested) { doneRound=round; roundDone.wakeAll(); mutex.unlock(); break; }
+     r=round;
+    mutex.unlock();
+    job(idx);
+    mutex.lock(); doneRound=r; roundDone.wakeAll(); mutex.unlock();
+   }
+  }
+
+ private:
+  unsigned int idx; std::function<void(unsigned int)> job;
+  QMutex mutex; QWaitCondition roundReady,roundDone; quint64 round,doneRound; bool stopRequested;
+  int fifoPrio; std::vector<int> cpus;
+};
+
+#endif
@@ -0,0 +1,156 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* ALSA audio capture, off the EEG acquisition loop. The thread reads short periods from
+   the capture device (non-blocking, waiting at most AUDIO_WAIT_MSECS at a time so that
+   a stalled device cannot hold up stop()), lowpass-filters and decimates them to the
+   EEG sample rate with a polyphase windowed-sinc FIR, and pushes the resulting frames
+   into a single-producer/single-consumer lock-free ring. AcqThread pops one frame per
+   packed tcpsample into tcpsample.aux, so audio goes out as AUX_CHN_COUNT extra channels
+   (TCP_SUB_AUX).
+
+   The sound card and the amplifiers run on different clocks. The consumer therefore
+   calls beginBlock() once per packed block: whatever exceeds the block plus a fixed
+   latency is dropped (slip), and a short ring repeats the last frame (underrun). Audio
+   thus stays locked to the amplifier clock at a constant delay, with every correction
+   counted. The "null" ALSA device or a snd-aloop loopback can stand in for a real
+   card (AUD|DEVICE). */
+
+#ifndef AUDIOTHREAD_H
+#define AUDIOTHREAD_H
+
+#include <QThread>
+#include <QString>
+#include <QDebug>
+#include <alsa/asoundlib.h>
+#include <vector>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <cerrno>
+
+#include "../acqglobals.h"
+#include "../rtlog.h"
+
+const unsigned int AUDIO_SAMPLE_RATE=48000;
+const unsigned int AUDIO_PERIOD_FRAMES=480; // 10ms per read
+const unsigned int AUDIO_BUFFER_FRAMES=8*AUDIO_PERIOD_FRAMES;
+const unsigned int AUDIO_FIR_PERIODS=4; // Decimation FIR length in output samples
+const unsigned int AUDIO_RING_SECS=2;
+const int AUDIO_WAIT_MSECS=100; // Longest wait for the device before looking at running again
+
+class AudioThread : public QThread {
+ public:
+  AudioThread(QString dev,unsigned int eegRate,unsigned int lat,QObject *parent=0) : QThread(parent) {
+   device=dev; decim=AUDIO_SAMPLE_RATE/eegRate; latency=lat; running=true; pcm=0; setObjectName("AudioThread");
+   // Windowed-sinc lowpass at 0.4 x EEG rate, Hamming window, unity DC gain
+   firLen=AUDIO_FIR_PERIODS*decim; fir.resize(firLen); double x,sum=0.,fc=0.4/(double)decim;
+   for (unsigned int i=0;i<firLen;i++) { x=(double)i-(double)(firLen-1)/2.;
+    fir[i]=((x==0.) ? 2.*fc : sin(2.*M_PI*fc*x)/(M_PI*x))*(0.54-0.46*cos(2.*M_PI*i/(double)(firLen-1)));
+    sum+=fir[i];
+   }
+   for (unsigned int i=0;i<firLen;i++) fir[i]/=sum;
+   // Input history twice as long, so that a window is always contiguous
+   hist.resize(2*firLen*AUX_CHN_COUNT,0.f); histIdx=phase=0;
+   pcmBuffer.resize(AUDIO_PERIOD_FRAMES*AUX_CHN_COUNT);
+   ring.resize(AUDIO_RING_SECS*eegRate*AUX_CHN_COUNT,0.f); ringSize=AUDIO_RING_SECS*eegRate;
+   wIdx=rIdx=0; overruns=underruns=slips=xruns=0; for (unsigned int c=0;c<AUX_CHN_COUNT;c++) last[c]=0.f;
+  }
+
+  virtual void run() { snd_pcm_sframes_t n; int err;
+   if (!open()) return; // running is set from construction on, so a stop() before this is not lost
+   qDebug() << "octopus_acqd: <AudioThread> Capturing from" << device << "--" << AUDIO_SAMPLE_RATE << "Hz, decimated by" << decim;
+   while (running) {
+    // Reading first (re)starts a prepared stream; a stalled one only costs a wait timeout
+    if ((n=snd_pcm_readi(pcm,pcmBuffer.data(),AUDIO_PERIOD_FRAMES))==-EAGAIN) {
+     if ((err=snd_pcm_wait(pcm,AUDIO_WAIT_MSECS))>=0) continue; else n=err;
+    }
+    if (n<0) { xruns++;
+     if ((err=snd_pcm_recover(pcm,n,1))<0) {
+      RTLOG("octopus_acqd: <AudioThread> Error reading audio: %s",snd_strerror(err)); msleep(AUDIO_PERIOD_FRAMES*1000/AUDIO_SAMPLE_RATE);
+     }
+     continue;
+    }
+    for (snd_pcm_sframes_t f=0;f<n;f++) push(&pcmBuffer[f*AUX_CHN_COUNT]);
+   }
+   snd_pcm_drop(pcm); snd_pcm_close(pcm); pcm=0;
+  }
+
+  void stop() { running=false; wait(); }
+
+  // Consumer side (AcqThread): once per block of n EEG samples to be packed.
+  void beginBlock(quint64 n) { quint64 avail=wIdx.load(std::memory_order_acquire)-rIdx;
+   if (avail>n+latency) { slips+=avail-n-latency; rIdx.store(rIdx+avail-n-latency,std::memory_order_release); }
+  }
+
+  // Consumer side: one decimated frame per EEG sample; repeats the last one if none is due yet.
+  void pop(float *aux) { quint64 r=rIdx;
+   if (r==wIdx.load(std::memory_order_acquire)) { underruns++; std::memcpy(aux,last,sizeof(last)); return; }
+   std::memcpy(last,&ring[(r%ringSize)*AUX_CHN_COUNT],sizeof(last)); std::memcpy(aux,last,sizeof(last));
+   rIdx.store(r+1,std::memory_order_release);
+  }
+
+  std::atomic<quint64> overruns,underruns,slips,xruns;
+
+ private:
+  bool open() { snd_pcm_hw_params_t *hw; unsigned int rate=AUDIO_SAMPLE_RATE; snd_pcm_uframes_t bs=AUDIO_BUFFER_FRAMES;
+   if (snd_pcm_open(&pcm,device.toLatin1().data(),SND_PCM_STREAM_CAPTURE,SND_PCM_NONBLOCK)<0) {
+    qDebug() << "octopus_acqd: <AudioThread> Error opening PCM device" << device; pcm=0; return false;
+   }
+   snd_pcm_hw_params_alloca(&hw); snd_pcm_hw_params_any(pcm,hw);
+   snd_pcm_hw_params_set_access(pcm,hw,SND_PCM_ACCESS_RW_INTERLEAVED);
+   snd_pcm_hw_params_set_format(pcm,hw,SND_PCM_FORMAT_S16_LE);
+   snd_pcm_hw_params_set_channels(pcm,hw,AUX_CHN_COUNT);
+   snd_pcm_hw_params_set_rate_near(pcm,hw,&rate,0);
+   snd_pcm_hw_params_set_buffer_size_near(pcm,hw,&bs);
+   if (snd_pcm_hw_params(pcm,hw)<0 || rate!=AUDIO_SAMPLE_RATE) {
+    qDebug() << "octopus_acqd: <AudioThread> Error setting PCM parameters (rate" << rate << ")";
+    snd_pcm_close(pcm); pcm=0; return false;
+   }
+   return true;
+  }
+
+  // One 48kHz input frame; every decim-th one yields an output frame into the ring.
+  void push(const int16_t *in) { float out[AUX_CHN_COUNT]; quint64 w;
+   for (unsigned int c=0;c<AUX_CHN_COUNT;c++)
+    hist[histIdx*AUX_CHN_COUNT+c]=hist[(histIdx+firLen)*AUX_CHN_COUNT+c]=(float)in[c]/32768.f;
+   histIdx=(histIdx+1)%firLen;
+   if (++phase<decim) return;
+   phase=0;
+   for (unsigned int c=0;c<AUX_CHN_COUNT;c++) { double acc=0.; const float *h=&hist[histIdx*AUX_CHN_COUNT+c];
+    for (unsigned int i=0;i<firLen;i++) acc+=fir[i]*h[i*AUX_CHN_COUNT]; // Oldest to newest; fir is symmetric
+    out[c]=(float)acc;
+   }
+   w=wIdx.load(std::memory_order_relaxed);
+   if (w-rIdx.load(std::memory_order_acquire)>=ringSize) { overruns++; return; } // Consumer is gone; drop
+   std::memcpy(&ring[(w%ringSize)*AUX_CHN_COUNT],out,sizeof(out));
+   wIdx.store(w+1,std::memory_order_release);
+  }
+
+  QString device; snd_pcm_t *pcm; std::atomic<bool> running;
+  unsigned int decim,latency,firLen,histIdx,phase; quint64 ringSize;
+  std::vector<double> fir; std::vector<float> hist,ring; std::vector<int16_t> pcmBuffer;
+  std::atomic<quint64> wIdx,rIdx; float last[AUX_CHN_COUNT];
+};
+
+#endif
@@ -0,0 +1,41 @@
+# Octopus-ReEL - Realtime Encephalography Laboratory Network
+#       Copyright (C) 2007-2025 Barkin Ilhan
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#
+# Contact info:
+# E-Mail:  barkin@unrlabs.org
+# Website: http://icon.unrlabs.org/staff/barkin/
+# Repo:    https://github.com/4e0n/
+
+
+# The same as codecbench.pro, built for plain x86-64 so that the codec runs its scalar
+# fallbacks (no AVX2), for hosts without it and to check them against the vector paths:
+#  qmake -o Makefile.scalar codecbench-scalar.pro && make -f Makefile.scalar && ./octopus-acq-codecbench-scalar [sampleRate] [seconds] [file.ocr]
+
+TEMPLATE = app
+TARGET = octopus-acq-codecbench-scalar
+QT = core
+CONFIG += console c++11 release
+INCLUDEPATH += . ..
+LIBS += -lz
+QMAKE_CXXFLAGS += -march=x86-64
+OBJECTS_DIR = scalar
+
+# Input
+HEADERS += ../eesynth.h \
+           ../../lpccodec.h \
+           ../../recfile.h \
+           ../../acqglobals.h
+SOURCES += codecbench.cpp
@@ -0,0 +1,96 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* Lossless codec (lpccodec.h) on EEG: the first synthetic amp (eesynth.h) at the given
+   rate for the given wall-clock seconds, and, if given, every channel of a recording
+   (recfile.h) -- the data of real amps. Columns of blocks of 100ms are coded one by one
+   as the stream and the recordings do, and checked to come back bit for bit as they
+   were; zlib on the same blocks is the baseline. Reports the ratio, the cost per
+   channel-sample and what 8 amps x 66 channels at 16 kHz would take of one core. */
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <zlib.h>
+
+#include "../eesynth.h"
+#include "../../lpccodec.h"
+#include "../../recfile.h"
+
+typedef std::vector<std::vector<float> > columns;
+
+static double now() { return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
+
+static void bench(const char *name,const columns &cols,unsigned int blk) {
+ LpcCodec enc,dec; std::vector<unsigned char> buf(std::max(lpcBound(blk),(size_t)compressBound(blk*sizeof(float))));
+ std::vector<float> out(blk);
+ size_t raw=0,lpcBytes=0,zBytes=0,bad=0,nv=0,blocks=0,preds[LPC_PRED_LPC+1]={0}; double te=0.,td=0.,tz=0.,t; uLongf zl;
+ for (const std::vector<float> &c:cols) for (size_t o=0;o+blk<=c.size();o+=blk) { const float *x=c.data()+o; size_t l;
+  t=now(); l=enc.encode(x,blk,LPC_KIND_NV,buf.data()); te+=now()-t; lpcBytes+=l; if (buf[1]<=LPC_PRED_LPC) preds[buf[1]]++;
+  blocks++; if (buf[0]==LPC_KIND_NV) nv++;
+  t=now(); if (!dec.decode(buf.data(),l,blk,out.data())) bad++; td+=now()-t;
+  if (std::memcmp(out.data(),x,blk*sizeof(float))) bad++;
+  zl=buf.size(); t=now(); compress2(buf.data(),&zl,(const Bytef*)x,blk*sizeof(float),1); tz+=now()-t; zBytes+=zl;
+  raw+=blk*sizeof(float);
+ }
+ if (!raw) { printf(" %s: no data\n",name); return; }
+ double smps=raw/sizeof(float),core=8.*PHYS_CHN_COUNT*16000.;
+ printf(" %s: %.3g channel-samples in blocks of %u\n",name,smps,blk);
+ printf("  LPC : ratio %.2f (%.2f bits/sample), encode %.1f ns, decode %.1f ns per sample; 8x%d at 16kHz: %.1f%%+%.1f%% of one core\n",
+        (double)raw/lpcBytes,8.*lpcBytes/smps,1e9*te/smps,1e9*td/smps,PHYS_CHN_COUNT,100.*core*te/smps,100.*core*td/smps);
+ printf("  zlib: ratio %.2f (%.2f bits/sample), encode %.1f ns per sample\n",(double)raw/zBytes,8.*zBytes/smps,1e9*tz/smps);
+ printf("  predictors (fixed 0..3, LPC): %zu %zu %zu %zu %zu; %zu of %zu columns in nanovolts; %s\n",
+        preds[0],preds[1],preds[2],preds[3],preds[4],nv,blocks,bad ? "ROUNDTRIP FAILED" : "roundtrip exact");
+}
+
+int main(int argc,char *argv[]) {
+ using namespace eesynth;
+ unsigned int sr=(argc>1) ? atoi(argv[1]) : 16000,secs=(argc>2) ? atoi(argv[2]) : 5;
+ factory fact; std::vector<amplifier*> amps=fact.getAmplifiers(); columns cols(PHYS_CHN_COUNT);
+ stream *str=amps[0]->OpenEegStream(sr,EE_REF_GAIN,EE_BIP_GAIN,amps[0]->getChannelList(0xffffffffffffffff,0x3));
+
+ printf("octopus-acq-codecbench: %d chns at %u sps for %u s",PHYS_CHN_COUNT,sr,secs);
+#ifdef __AVX2__
+ printf(" [AVX2]\n");
+#else
+ printf(" [scalar]\n");
+#endif
+ auto t0=std::chrono::steady_clock::now();
+ while (std::chrono::steady_clock::now()-t0<std::chrono::seconds(secs)) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(50)); buffer b=str->getData();
+  for (unsigned int s=0;s<b.getSampleCount();s++) for (int c=0;c<PHYS_CHN_COUNT;c++) cols[c].push_back((float)b.getSample(c,s));
+ }
+ delete str;
+ bench("eesynth",cols,std::max(sr/10,1u));
+
+ if (argc>3) { RecFile f; std::vector<uint32_t> ch(1); uint64_t len; uint32_t rsr;
+  if (!f.open(argv[3])) { printf(" %s: cannot open\n",argv[3]); return 1; }
+  len=f.length(); rsr=f.header().sampleRate; cols.assign(f.channelCount(),std::vector<float>(len));
+  for (uint32_t c=0;c<f.channelCount();c++) { ch[0]=c; f.read(0,len,ch,cols[c].data()); }
+  bench(argv[3],cols,std::max(rsr/10,1u));
+ }
+ return 0;
+}
@@ -0,0 +1,254 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* Headless end-to-end benchmark of the acquisition daemon: the real AcqDaemon/AcqThread
+   pipeline (amp workers, filter stage, alignment, packing, per-client senders) runs on
+   the synthetic amps without the GUI, while a number of consumer clients subscribe to
+   the full stream over the data port. Marker bytes are pushed through the trigger output
+   at a fixed rate; the synthetic amps see them at once, so the time until a client
+   unpacks the marker is the end-to-end latency (including up to one EEGPROBEMS of
+   waiting for the next probe, as for real amps). After a warm-up, the run reports as
+   JSON: sustained producer and per-client sample rates, CPU per thread kind, latency
+   percentiles, gaps seen by the clients and the daemon's overrun counts. The exit
+   code is non-zero when the stream could not be sustained, so it can gate regressions.
+   orates lists output rates the clients ask for in turn (0: the full rate), e.g.
+   orates=0,1000,250 with clients=6 has two clients on each of two shared decimators.
+
+    ./octopus-acq-e2ebench [amps=2] [rate=1000] [probe=100] [clients=2] [secs=30]
+                           [warmup=5] [markers=10] [conf=../octopus_acqd.conf]
+                           [port=65102] [out=result.json] [orates=0] */
+
+#include <QCoreApplication>
+#include <QTimer>
+#include <QFile>
+#include <QTextStream>
+#include <QStringList>
+#include <QMap>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include <map>
+#include <string>
+#include <atomic>
+#include <algorithm>
+#include <dirent.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "../../acqglobals.h"
+#ifdef EEMAGINE
+#error "The end-to-end benchmark runs on the synthetic amps; build without EEMAGINE."
+#endif
+#include "../acqdaemon.h"
+#include "../acqthread.h"
+
+const unsigned int BENCH_MARKER_FIRST=0x10,BENCH_MARKER_COUNT=0xe0; // Codes clear of stimuli and SYNC
+
+static std::atomic<qint64> markerNs[256];
+static std::atomic<bool> measuring(false);
+
+// A data port consumer: full subscription, frame accounting, marker latency.
+class BenchClient {
+ public:
+  BenchClient(unsigned int i,quint16 p,unsigned int r) { id=i; port=p; asked=r; rate=0; stop=false; frames=gaps=lost=slips=0; frameSize=0; ok=false; }
+
+  void run() { int fd=-1,one=1; sockaddr_in sa; tcpsubscription req=TcpSubscription::full(),ack; std::vector<char> buf(1<<20);
+   size_t have=0; ssize_t n; pollfd pfd; std::vector<unsigned int> prev;
+   pthread_setname_np(pthread_self(),"BenchClient");
+   std::memset(&sa,0,sizeof(sa)); sa.sin_family=AF_INET; sa.sin_port=htons(port); sa.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+   for (int t=0;t<50 && !stop;t++) { fd=socket(AF_INET,SOCK_STREAM,0);
+    if (::connect(fd,(sockaddr*)&sa,sizeof(sa))==0) break;
+    ::close(fd); fd=-1; std::this_thread::sleep_for(std::chrono::milliseconds(100));
+   }
+   if (fd<0) return;
+   setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one)); req.rate=asked;
+   if (!sendAll(fd,(const char*)&req,sizeof(req)) || !recvAll(fd,(char*)&ack,sizeof(ack)) || ack.frameSize==0) { ::close(fd); return; }
+   frameSize=ack.frameSize; ampCount=ack.ampCount; rate=ack.rate; prev.assign(ampCount,0); ok=true; lat.reserve(1<<16);
+   pfd.fd=fd; pfd.events=POLLIN; bool first=true; unsigned int step=std::max(1u,fullRate/std::max(1u,(unsigned int)rate)),base=step; // Offsets advance by it
+   while (!stop) {
+    if (poll(&pfd,1,100)<=0) continue;
+    if ((n=recv(fd,buf.data()+have,buf.size()-have,0))<=0) break;
+    have+=n; size_t off=0;
+    for (;have-off>=frameSize;off+=frameSize) { unsigned int h[1+2*EE_MAX_AMPCOUNT];
+     std::memcpy(h,buf.data()+off,sizeof(unsigned int)*(1+2*ampCount));
+     if (h[0]==TCP_SUB_GAP) { gaps++; lost+=(quint64)h[1]|((quint64)h[2]<<32); first=true; continue; } // Daemon-side overrun
+     if (h[0]==TCP_SUB_STEP) { step=base*std::max(1u,h[1]); first=true; continue; } // Backlog thinned out (DECIMATE)
+     for (unsigned int a=0;a<ampCount;a++) { unsigned int o=h[1+2*a],d=o-prev[a]; prev[a]=o;
+      if (first || d==step) continue;
+      if (d==step-1 || d==step+1) slips++; // Drift resampling, see ampalign.h
+      else { gaps++; if (d>step+1 && d<0x80000000u) lost+=d/step-1; }
+     }
+     first=false; frames++;
+     unsigned int code=h[2]; // Trigger of the first amp
+     if (measuring && code>=BENCH_MARKER_FIRST && code<BENCH_MARKER_FIRST+BENCH_MARKER_COUNT && markerNs[code]>0) {
+      lat.push_back((monoNs()-markerNs[code])/1e3); markerNs[code]=0;
+     }
+    }
+    std::memmove(buf.data(),buf.data()+off,have-off); have-=off;
+   }
+   ::close(fd);
+  }
+
+  static bool sendAll(int fd,const char *d,size_t n) { ssize_t w;
+   while (n>0) { if ((w=::send(fd,d,n,MSG_NOSIGNAL))<=0) return false; d+=w; n-=w; }
+   return true;
+  }
+  static bool recvAll(int fd,char *d,size_t n) { ssize_t r;
+   while (n>0) { if ((r=::recv(fd,d,n,0))<=0) return false; d+=r; n-=r; }
+   return true;
+  }
+
+  unsigned int id,frameSize,ampCount,asked; quint16 port; std::atomic<bool> stop,ok; std::atomic<unsigned int> rate;
+  static unsigned int fullRate;
+  std::atomic<quint64> frames,gaps,lost,slips; std::vector<double> lat; std::thread thread;
+};
+
+unsigned int BenchClient::fullRate=1000;
+
+// CPU seconds per thread name (comm) of this process; the main thread is "daemon-main".
+static std::map<std::string,double> threadCpu() { std::map<std::string,double> m; DIR *d; dirent *e; double tck=sysconf(_SC_CLK_TCK);
+ if (!(d=opendir("/proc/self/task"))) return m;
+ while ((e=readdir(d))) { if (e->d_name[0]=='.') continue;
+  QFile f(QString("/proc/self/task/%1/stat").arg(e->d_name)); if (!f.open(QIODevice::ReadOnly)) continue;
+  QString st=QString::fromLatin1(f.readAll()); int l=st.indexOf('('),r=st.lastIndexOf(')');
+  QString comm=st.mid(l+1,r-l-1); QStringList fld=st.mid(r+2).split(' ');
+  if (fld.size()<13) continue;
+  if (atoi(e->d_name)==getpid()) comm="daemon-main";
+  m[comm.toStdString()]+=(fld[11].toDouble()+fld[12].toDouble())/tck; // utime+stime
+ }
+ closedir(d); return m;
+}
+
+// The template .conf with the benchmark's settings replacing (or added to) its own.
+static bool writeConf(const QString &tmpl,const QString &out,QMap<QString,QString> ov) { QFile fi(tmpl),fo(out); QStringList lines;
+ if (!fi.open(QIODevice::ReadOnly|QIODevice::Text) || !fo.open(QIODevice::WriteOnly|QIODevice::Text)) return false;
+ QTextStream in(&fi),os(&fo);
+ while (!in.atEnd()) { QString l=in.readLine(),k=l.section('=',0,0).trimmed();
+  if (!l.startsWith('#') && l.contains('|') && ov.contains(k)) { l=k+" = "+ov[k]; ov.remove(k); }
+  os << l << "\n";
+ }
+ for (auto i=ov.constBegin();i!=ov.constEnd();++i) os << i.key() << " = " << i.value() << "\n";
+ return true;
+}
+
+static double pct(std::vector<double> &v,double p) { if (v.empty()) return 0.;
+ std::sort(v.begin(),v.end()); return v[std::min(v.size()-1,(size_t)(p*v.size()))];
+}
+
+int main(int argc,char *argv[]) {
+ QCoreApplication app(argc,argv); QMap<QString,QString> arg; rtLog().start();
+ arg["amps"]="2"; arg["rate"]="1000"; arg["probe"]="100"; arg["clients"]="2"; arg["secs"]="30"; arg["warmup"]="5";
+ arg["markers"]="10"; arg["conf"]="../octopus_acqd.conf"; arg["port"]="65102"; arg["out"]=""; arg["orates"]="0";
+ for (int i=1;i<argc;i++) { QString a(argv[i]); if (a.contains('=')) arg[a.section('=',0,0)]=a.section('=',1); }
+ const unsigned int clientCount=arg["clients"].toUInt(),secs=arg["secs"].toUInt(),warmup=arg["warmup"].toUInt();
+ const quint16 port=arg["port"].toUShort();
+
+ // Trigger output into a pty, drained here
+ int ptm=posix_openpt(O_RDWR|O_NOCTTY|O_NONBLOCK);
+ if (ptm<0 || grantpt(ptm)<0 || unlockpt(ptm)<0) { perror("octopus-acq-e2ebench: pty"); return 2; }
+ std::atomic<bool> draining(true);
+ std::thread drain([&]() { char b[256]; while (draining) { if (read(ptm,b,sizeof(b))<=0) std::this_thread::sleep_for(std::chrono::milliseconds(5)); } });
+
+ QMap<QString,QString> ov; QString cfg=QString("/tmp/octopus-acq-e2ebench-%1.conf").arg(getpid());
+ ov["AMP|COUNT"]=arg["amps"]; ov["AMP|SAMPLERATE"]=arg["rate"]; ov["AMP|EEGPROBEMS"]=arg["probe"];
+ ov["NET|ACQ"]=QString("127.0.0.1,%1,%2").arg(port-1).arg(port);
+ ov["AUD|DEVICE"]="NONE"; ov["TRIG|DEVICE"]=ptsname(ptm); ov["TRIG|SETTLEMSECS"]="0"; ov["SYNTH|STIMSECS"]="0";
+ if (!writeConf(arg["conf"],cfg,ov)) { fprintf(stderr,"octopus-acq-e2ebench: cannot read %s\n",qPrintable(arg["conf"])); return 2; }
+
+ AcqDaemon acqDaemon(&app,cfg);
+ AcqThread acqThread(&acqDaemon);
+ acqThread.start(QThread::HighestPriority);
+
+ std::vector<BenchClient*> clients;
+ QStringList orates=arg["orates"].split(','); BenchClient::fullRate=acqDaemon.chnInfo.sampleRate;
+ for (unsigned int i=0;i<clientCount;i++) { BenchClient *c=new BenchClient(i+1,port,orates[i%orates.size()].toUInt()); c->thread=std::thread(&BenchClient::run,c); clients.push_back(c); }
+
+ // Markers
+ unsigned int markerCount=0,markerPeriod=1000/std::max(1u,arg["markers"].toUInt());
+ QTimer markerTimer; QObject::connect(&markerTimer,&QTimer::timeout,[&]() { unsigned int c=BENCH_MARKER_FIRST+markerCount%BENCH_MARKER_COUNT;
+  markerNs[c]=monoNs(); acqDaemon.trigOut->push(c); if (measuring) markerCount++;
+ });
+ markerTimer.start(markerPeriod);
+
+ // Warm-up, then the measured span
+ std::map<std::string,double> cpu0,cpu1; quint64 pIdx0=0,pIdx1=0,ovr=0,lost=0; std::vector<quint64> fr0(clientCount),fr1(clientCount);
+ qint64 t0=0,t1=0;
+ QTimer::singleShot(warmup*1000,[&]() {
+  cpu0=threadCpu(); pIdx0=acqDaemon.tcpBufPIdx; for (unsigned int i=0;i<clientCount;i++) fr0[i]=clients[i]->frames;
+  for (BenchClient *c:clients) { c->gaps=0; c->lost=0; c->slips=0; }
+  acqDaemon.stats.reset();
+  t0=monoNs(); measuring=true;
+ });
+ QTimer::singleShot((warmup+secs)*1000,[&]() {
+  measuring=false; t1=monoNs(); cpu1=threadCpu(); pIdx1=acqDaemon.tcpBufPIdx;
+  for (unsigned int i=0;i<clientCount;i++) fr1[i]=clients[i]->frames;
+  acqDaemon.clientTotals(ovr,lost);
+  markerTimer.stop(); for (BenchClient *c:clients) c->stop=true;
+  acqDaemon.daemonRunning=false;
+  QTimer::singleShot(500,&app,SLOT(quit()));
+ });
+ app.exec(); rtLog().stop();
+ for (BenchClient *c:clients) c->thread.join();
+ acqThread.wait();
+ draining=false; drain.join(); ::close(ptm); QFile::remove(cfg);
+
+ // Report
+ double span=(t1-t0)/1e9,nominal=acqDaemon.chnInfo.sampleRate,prodRate=(pIdx1-pIdx0)/span; bool sustained=(prodRate>=0.99*nominal);
+ QString js; QTextStream j(&js); j.setRealNumberNotation(QTextStream::FixedNotation); j.setRealNumberPrecision(1);
+ j << "{\n \"config\": {\"amps\": " << acqDaemon.chnInfo.ampCount << ", \"channels\": " << acqDaemon.chnInfo.physChnCount
+   << ", \"rate\": " << acqDaemon.chnInfo.sampleRate << ", \"probe_ms\": " << acqDaemon.chnInfo.probe_eeg_msecs
+   << ", \"clients\": " << clientCount << ", \"secs\": " << span << ", \"frame_bytes\": " << (clientCount ? clients[0]->frameSize : 0) << "},\n";
+ j << " \"producer\": {\"samples_per_s\": " << prodRate << ", \"nominal\": " << nominal << "},\n";
+ j << " \"server\": {\"overruns\": " << ovr << ", \"lost\": " << lost << "},\n";
+ j << " \"markers\": {\"pushed\": " << markerCount << ", \"trigout_dropped\": " << (quint64)acqDaemon.trigOut->dropped << "},\n";
+ j << " \"clients\": [\n";
+ for (unsigned int i=0;i<clientCount;i++) { BenchClient *c=clients[i]; double rate=(fr1[i]-fr0[i])/span;
+  if (!c->ok || rate<0.99*(c->rate ? c->rate : nominal) || c->gaps) sustained=false;
+  j << "  {\"id\": " << c->id << ", \"connected\": " << (c->ok ? "true" : "false") << ", \"rate\": " << (unsigned int)c->rate
+    << ", \"samples_per_s\": " << rate
+    << ", \"mbit_per_s\": " << rate*c->frameSize*8./1e6 << ", \"gaps\": " << (quint64)c->gaps << ", \"lost\": " << (quint64)c->lost
+    << ", \"drift_slips\": " << (quint64)c->slips << ", \"latency_us\": {\"n\": " << (quint64)c->lat.size()
+    << ", \"p50\": " << pct(c->lat,.5) << ", \"p90\": " << pct(c->lat,.9) << ", \"p99\": " << pct(c->lat,.99)
+    << ", \"max\": " << pct(c->lat,1.) << "}}" << ((i+1<clientCount) ? ",\n" : "\n");
+ }
+ j << " ],\n \"stages_us\": {";
+ for (unsigned int i=0;i<ACQ_STAGE_COUNT;i++) { const StageStat &st=acqDaemon.stats.stage[i];
+  j << (i ? ", " : "") << "\"" << acqStageName[i] << "\": {\"mean\": " << st.meanUs() << ", \"max\": " << st.maxUs() << "}";
+ }
+ j << "},\n \"cpu_percent\": {";
+ bool firstK=true;
+ for (const auto &k:cpu1) { double d=k.second-(cpu0.count(k.first) ? cpu0[k.first] : 0.);
+  j << (firstK ? "" : ", ") << "\"" << QString::fromStdString(k.first) << "\": " << 100.*d/span; firstK=false;
+ }
+ j << "},\n \"sustained\": " << (sustained ? "true" : "false") << "\n}\n";
+ j.flush();
+ printf("%s",qPrintable(js));
+ if (!arg["out"].isEmpty()) { QFile o(arg["out"]); if (o.open(QIODevice::WriteOnly|QIODevice::Text)) o.write(js.toUtf8()); }
+ for (BenchClient *c:clients) delete c;
+ return sustained ? 0 : 1;
+}
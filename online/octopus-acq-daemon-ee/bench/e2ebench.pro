@@ -0,0 +1,66 @@
+# Octopus-ReEL - Realtime Encephalography Laboratory Network
+#       Copyright (C) 2007-2025 Barkin Ilhan
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#
+# Contact info:
+# E-Mail:  barkin@unrlabs.org
+# Website: http://icon.unrlabs.org/staff/barkin/
+# Repo:    https://github.com/4e0n/
+
+
+# Headless end-to-end benchmark of the daemon pipeline on the synthetic amps (no GUI,
+# no amps, no sound card needed); prints JSON, non-zero exit if the stream is not sustained:
+#  qmake e2ebench.pro && make && ./octopus-acq-e2ebench amps=4 rate=1000 probe=20 clients=4 secs=60
+
+TEMPLATE = app
+TARGET = octopus-acq-e2ebench
+INCLUDEPATH += . ..
+QT += widgets network
+CONFIG += console release
+LIBS += -lasound -lrt -lz
+QMAKE_CXXFLAGS += -march=native
+
+# Input
+HEADERS += ../acqdaemon.h \
+           ../acqthread.h \
+           ../clienthandler.h \
+           ../mcastsender.h \
+           ../decimator.h \
+           ../recordsink.h \
+           ../eex.h \
+           ../cbuf.h \
+           ../mafilter.h \
+           ../ampworker.h \
+           ../ampalign.h \
+           ../sampleclock.h \
+           ../iirbank.h \
+           ../audiothread.h \
+           ../rtsched.h \
+           ../acqstats.h \
+           ../../rtlog.h \
+           ../triggerout.h \
+           ../eesynth.h \
+           ../chntopo.h \
+           ../../acqglobals.h \
+           ../../chninfo.h \
+           ../../sample.h \
+           ../../tcpsample.h \
+           ../../tcpsubscription.h \
+           ../../mcastpacket.h \
+           ../../shmring.h \
+           ../../recfile.h \
+           ../../lpccodec.h \
+           ../../cs_command.h
+SOURCES += e2ebench.cpp
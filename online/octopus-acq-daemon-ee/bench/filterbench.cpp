@@ -0,0 +1,136 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* Cost of the AcqThread online filtering stage per amp-second, before and after the
+   running-sum rewrite. "legacy" is the former per-sample recomputation of fetchEegData()
+   (sum0 over convN, recursive sum1/curCM read back from the ring) over the former
+   array-of-struct history, "mafilter" is maFilterStep() over the per-field cbuf history
+   as called by AcqThread::filterBlock(). Both run over the same synthetic 66-channel data
+   in EEGPROBEMS-sized blocks, and their outputs are compared. */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "../../sample.h"
+#include "../cbuf.h"
+#include "../mafilter.h"
+
+const unsigned int PROBE_MSECS=100;
+
+typedef struct _legacysample { // struct sample as it was before cbuf.h
+ float marker,data[PHYS_CHN_COUNT],dataF[PHYS_CHN_COUNT],curCM[PHYS_CHN_COUNT];
+ float sum0[PHYS_CHN_COUNT],com0[PHYS_CHN_COUNT],sum1[PHYS_CHN_COUNT];
+ unsigned int trigger,offset;
+} legacysample;
+
+static float synthValue(unsigned int c,double t) {
+ return 0.001+0.0001*cos(2.*M_PI*(10.+c*0.1)*t)+0.00005*sin(2.*M_PI*50.*t)+0.00001*(float)(c%7);
+}
+
+static void synthBlock(std::vector<legacysample> &cBuf,cbuf &cB,uint64_t base,unsigned int n,unsigned int sr,uint64_t t0) {
+ for (unsigned int j=0;j<n;j++) { legacysample &s=cBuf[(base+j)%cBuf.size()]; float *d=cB.dataAt(base+j);
+  double t=(double)(t0+j)/(double)sr;
+  for (int c=0;c<PHYS_CHN_COUNT;c++) d[c]=s.data[c]=synthValue(c,t);
+ }
+}
+
+static void legacyBlock(std::vector<legacysample> &cBuf,uint64_t base,int n,int convN,int convN2,int convL,int cmL) {
+ float sum0,sum1,data0; uint64_t cBufSz=cBuf.size();
+ for (int j=0;j<PHYS_CHN_COUNT;j++) {
+  for (int k=-convN2;k<n-convN2;k++) {
+   sum0=0.; for (int m=-convN2;m<convN2;m++) sum0+=cBuf[(base+k+m)%cBufSz].data[j];
+   cBuf[(base+k)%cBufSz].sum0[j]=sum0;
+   data0=fabs(cBuf[(base+k)%cBufSz].data[j]-sum0/convN);
+   cBuf[(base+k)%cBufSz].com0[j]=data0*data0;
+   sum1=cBuf[(base+k+convN2-1)%cBufSz].sum1[j];
+   sum1-=cBuf[(base+k-convL-1)%cBufSz].data[j];
+   sum1+=cBuf[(base+k-1)%cBufSz].data[j];
+   cBuf[(base+k+convN2)%cBufSz].sum1[j]=sum1;
+   cBuf[(base+k+convN2)%cBufSz].dataF[j]=sum0/convN-sum1/convL;
+  }
+  for (int k=-convN2;k<n-convN2;k++) {
+   sum1=cBuf[(base+k+convN2-1)%cBufSz].curCM[j];
+   sum1-=cBuf[(base+k-cmL-1)%cBufSz].com0[j];
+   sum1+=cBuf[(base+k-1)%cBufSz].com0[j];
+   cBuf[(base+k+convN2)%cBufSz].curCM[j]=sum1;
+  }
+ }
+}
+
+static void maBlock(cbuf &cB,std::vector<float> &com0,uint64_t base,int n,int convN,int convN2,int convL,int cmL,
+                    std::vector<double> &s0,std::vector<double> &s1,std::vector<double> &cm) {
+ uint64_t b=base+cB.size,cs=com0.size()/PHYS_CHN_COUNT; marow r; float *c0=com0.data();
+ for (int k=-convN2;k<n-convN2;k++) {
+  r.dHead0=cB.dataAt(b+k+convN2-1); r.dTail0=cB.dataAt(b+k-convN2-1);
+  r.dCur=cB.dataAt(b+k);
+  r.dHead1=cB.dataAt(b+k-1); r.dTail1=cB.dataAt(b+k-convL-1);
+  r.cHead=c0+((b+k-1)%cs)*PHYS_CHN_COUNT; r.cTail=c0+((b+k-cmL-1)%cs)*PHYS_CHN_COUNT; r.com0=c0+((b+k)%cs)*PHYS_CHN_COUNT;
+  r.dataF=cB.dataFAt(b+k+convN2); r.curCM=cB.curCMAt(b+k+convN2);
+  maFilterStep(r,PHYS_CHN_COUNT,1./convN,1./convL,s0.data(),s1.data(),cm.data());
+ }
+}
+
+int main(int argc,char *argv[]) {
+ unsigned int sr=(argc>1) ? atoi(argv[1]) : 1000,secs=(argc>2) ? atoi(argv[2]) : 60;
+ int convN=sr/50,convN2=convN/2,convL=4*sr,cmL=sr/2,n=sr*PROBE_MSECS/1000;
+ uint64_t cBufSz=sr*CBUF_SIZE_IN_SECS;
+ std::vector<legacysample> bufA(cBufSz); cbuf bufB; bufB.resize(cBufSz,PHYS_CHN_COUNT);
+ std::vector<float> com0((cmL+2)*PHYS_CHN_COUNT,0.);
+ std::vector<double> s0(PHYS_CHN_COUNT,0.),s1(PHYS_CHN_COUNT,0.),cm(PHYS_CHN_COUNT,0.);
+ double tA=0.,tB=0.,dF=0.,dCM=0.,peakF=0.,peakCM=0.; uint64_t base=cBufSz/2,t0=0;
+
+ for (unsigned int blk=0;blk<secs*1000/PROBE_MSECS;blk++,base+=n,t0+=n) {
+  synthBlock(bufA,bufB,base,n,sr,t0);
+  auto c0=std::chrono::steady_clock::now();
+  legacyBlock(bufA,base,n,convN,convN2,convL,cmL);
+  auto c1=std::chrono::steady_clock::now();
+  maBlock(bufB,com0,base,n,convN,convN2,convL,cmL,s0,s1,cm);
+  auto c2=std::chrono::steady_clock::now();
+  tA+=std::chrono::duration<double>(c1-c0).count(); tB+=std::chrono::duration<double>(c2-c1).count();
+  for (int k=-convN2;k<n-convN2;k++) { const legacysample &a=bufA[(base+k)%cBufSz];
+   const float *bF=bufB.dataFAt(base+k),*bCM=bufB.curCMAt(base+k);
+   for (int c=0;c<PHYS_CHN_COUNT;c++) {
+    dF=std::max(dF,(double)fabs(a.dataF[c]-bF[c])); peakF=std::max(peakF,(double)fabs(a.dataF[c]));
+    dCM=std::max(dCM,(double)fabs(a.curCM[c]-bCM[c])); peakCM=std::max(peakCM,(double)fabs(a.curCM[c]));
+   }
+  }
+ }
+
+ printf("octopus-acq-filterbench: %u sps, %d chns, %u s, convN=%d convL=%d cmL=%d",sr,PHYS_CHN_COUNT,secs,convN,convL,cmL);
+#ifdef __AVX2__
+ printf(" [AVX2]\n");
+#else
+ printf(" [scalar]\n");
+#endif
+ printf(" legacy   : %9.1f us per amp-second\n",1e6*tA/secs);
+ printf(" mafilter : %9.1f us per amp-second (x%.1f)\n",1e6*tB/secs,tA/tB);
+ printf(" history  : %.1f MB -> %.1f MB per amp\n",cBufSz*sizeof(legacysample)/1e6,
+        (cBufSz*(3*PHYS_CHN_COUNT*sizeof(float)+2*sizeof(unsigned int))+com0.size()*sizeof(float))/1e6);
+ printf(" max |dataF diff| = %.3g (peak %.3g), max |curCM diff| = %.3g (peak %.3g)\n",dF,peakF,dCM,peakCM);
+ return 0;
+}
@@ -0,0 +1,128 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* Recording container (../../recfile.h) at the size it is meant for: writes a synthetic
+   recording of chns channels at rate for the given hours, in chunks and index blocks
+   exactly as RecordSink lays them out (RAW, ZLIB or LPC), with an event every ~1s (codes
+   1..4). Then, as a fresh reader, times open(), a range of random time windows of 8
+   channels, and all epochs of one event code, and checks the data read back against
+   the generator. Run it on the disk the daemon records to; the file is left in place.
+
+    ./octopus-acq-recbench [file=/tmp/recbench.ocr] [hours=2] [codec=RAW|ZLIB|LPC] [chns=132] [rate=1000] */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "../../recfile.h"
+
+// Deterministic, mildly EEG-like: a per-channel tone plus a slow drift, in volts, as floats
+// of whatever value (amps give doubles, not multiples of any step), so LPC is put to its bit path
+static float synthValue(uint32_t c,uint64_t i,uint32_t sr) { double t=(double)i/sr;
+ return (float)((20.*sin(2.*M_PI*(8.+c*0.05)*t)+5.*sin(2.*M_PI*50.*t)+300.*sin(2.*M_PI*0.01*t+c))*1e-6);
+}
+
+static double secsSince(std::chrono::steady_clock::time_point t0) {
+ return std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+}
+
+static std::string arg(int argc,char *argv[],const char *key,const char *def) { std::string k=std::string(key)+"=";
+ for (int i=1;i<argc;i++) if (std::string(argv[i]).compare(0,k.size(),k)==0) return argv[i]+k.size();
+ return def;
+}
+
+int main(int argc,char *argv[]) {
+ std::string path=arg(argc,argv,"file","/tmp/recbench.ocr");
+ double hours=atof(arg(argc,argv,"hours","2").c_str());
+ std::string cn=arg(argc,argv,"codec","RAW");
+ uint32_t codec=(cn=="ZLIB") ? REC_CODEC_ZLIB : (cn=="LPC") ? REC_CODEC_LPC : REC_CODEC_RAW;
+ uint32_t chnCount=atoi(arg(argc,argv,"chns","132").c_str()),sr=atoi(arg(argc,argv,"rate","1000").c_str());
+ uint32_t cs=sr,indexEvery=10,seq=0; uint64_t total=(uint64_t)(hours*3600.*sr),start=1000000,off,lastIndex=0,next=0;
+ std::vector<recchannel> chns(chnCount); std::vector<float> cols((size_t)chnCount*cs); std::vector<recevent> ev,evNew,evAll;
+ std::vector<recindexentry> idxNew,idxAll; std::vector<unsigned char> work; std::vector<char> blk(recChunkBound(chnCount,cs));
+ recfileheader h; FILE *f; srand(1);
+
+ // Write
+ std::memset(&h,0,sizeof(h));
+ for (uint32_t c=0;c<chnCount;c++) { std::memset(&chns[c],0,sizeof(recchannel));
+  snprintf(chns[c].name,REC_CHN_NAME,"E%u",c%66+1); chns[c].amp=c/66; chns[c].physChn=c%66; chns[c].field=REC_FIELD_RAW;
+ }
+ h.magic=REC_MAGIC; h.version=REC_VERSION; h.headerSize=recPad(sizeof(h)+chnCount*sizeof(recchannel)); h.sampleRate=sr;
+ h.chnCount=chnCount; h.chunkSamples=cs; h.startIdx=start; h.ampCount=(chnCount+65)/66; h.codec=codec; h.indexEvery=indexEvery;
+ if (!(f=fopen(path.c_str(),"wb"))) { perror(path.c_str()); return 1; }
+ std::vector<char> head(h.headerSize,0); fwrite(head.data(),1,head.size(),f); off=h.headerSize;
+ auto t0=std::chrono::steady_clock::now(); double tEnc=0.;
+ next=start+sr/2;
+ for (uint64_t i=start;i<start+total;i+=cs) { uint32_t n=(uint32_t)std::min((uint64_t)cs,start+total-i); recindexentry e;
+  for (uint32_t c=0;c<chnCount;c++) for (uint32_t j=0;j<n;j++) cols[(size_t)c*cs+j]=synthValue(c,i+j,sr);
+  ev.clear(); for (;next<i+n;next+=sr/2+rand()%sr) { recevent x; x.idx=next; x.code=1+rand()%4; x.reserved=0; ev.push_back(x); }
+  auto e0=std::chrono::steady_clock::now();
+  size_t len=recEncodeChunk(blk.data(),seq++,i,cols.data(),chns.data(),chnCount,cs,n,ev.data(),ev.size(),codec,work);
+  tEnc+=secsSince(e0);
+  fwrite(blk.data(),1,len,f); e.off=off; e.firstIdx=i; e.n=n; e.reserved=0; off+=len;
+  idxNew.push_back(e); idxAll.push_back(e); evNew.insert(evNew.end(),ev.begin(),ev.end()); evAll.insert(evAll.end(),ev.begin(),ev.end());
+  if (idxNew.size()==indexEvery) { std::vector<char> x(recIndexSize(idxNew.size(),evNew.size()));
+   fwrite(x.data(),1,recEncodeIndex(x.data(),lastIndex,false,idxNew.data(),idxNew.size(),evNew.data(),evNew.size()),f);
+   lastIndex=off; off+=x.size(); idxNew.clear(); evNew.clear();
+  }
+ }
+ std::vector<char> x(recIndexSize(idxAll.size(),evAll.size()));
+ fwrite(x.data(),1,recEncodeIndex(x.data(),lastIndex,true,idxAll.data(),idxAll.size(),evAll.data(),evAll.size()),f);
+ h.indexOff=off; off+=x.size(); h.dataEnd=off; h.sampleCount=total; h.closed=1;
+ std::memcpy(head.data(),&h,sizeof(h)); std::memcpy(head.data()+sizeof(h),chns.data(),chnCount*sizeof(recchannel));
+ fseek(f,0,SEEK_SET); fwrite(head.data(),1,head.size(),f); fclose(f);
+ double tWrite=secsSince(t0);
+
+ printf("octopus-acq-recbench: %u chns, %u sps, %.2f h, %s, %zu chunks, %zu events\n",chnCount,sr,hours,
+        cn.c_str(),idxAll.size(),evAll.size());
+ printf(" write    : %8.1f MB in %.1f s (encode %.1f s), %.2f of raw size, %.0fx real time\n",off/1e6,tWrite,tEnc,
+        off/(total*chnCount*4.),hours*3600./tWrite);
+
+ // Read back
+ RecFile r; std::vector<uint32_t> sel; std::vector<float> out; uint64_t bad=0; size_t windows=100,win=10*sr;
+ for (uint32_t c=0;c<8;c++) sel.push_back(c*chnCount/8);
+ t0=std::chrono::steady_clock::now();
+ if (!r.open(path)) { printf(" open failed!\n"); return 1; }
+ printf(" open     : %8.3f ms (%zu chunks, %zu events indexed)\n",1e3*secsSince(t0),r.chunkCount(),r.allEvents().size());
+
+ out.resize(sel.size()*win); t0=std::chrono::steady_clock::now();
+ for (size_t w=0;w<windows;w++) { uint64_t from=((uint64_t)rand()*RAND_MAX+rand())%(r.length()-win);
+  r.read(from,win,sel,out.data());
+  for (size_t c=0;c<sel.size();c++) for (size_t i=0;i<win;i+=97) if (out[c*win+i]!=synthValue(sel[c],start+from+i,sr)) bad++;
+ }
+ printf(" range    : %8.3f ms per %zu s window of %zu chns (%zu random windows)\n",1e3*secsSince(t0)/windows,win/sr,sel.size(),windows);
+
+ std::vector<uint64_t> at=r.events(1); size_t ne; uint32_t pre=sr/5,post=4*sr/5;
+ t0=std::chrono::steady_clock::now();
+ ne=r.epochs(1,pre,post,sel,out);
+ printf(" epochs   : %8.3f ms for %zu epochs of code 1, -%u..%u samples, %zu chns\n",1e3*secsSince(t0),ne,pre,post,sel.size());
+ for (size_t e=0;e<ne;e++) for (size_t c=0;c<sel.size();c++)
+  if (out[(e*sel.size()+c)*(pre+post)+pre]!=synthValue(sel[c],start+at[e],sr)) bad++;
+ printf(" check    : %s (%llu mismatches)\n",bad ? "FAILED" : "ok",(unsigned long long)bad);
+ return bad ? 1 : 0;
+}
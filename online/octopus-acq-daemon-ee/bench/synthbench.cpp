@@ -0,0 +1,83 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* Cost of the synthetic amps (eesynth.h): AMP|COUNT amps x 66 channels at the given rate,
+   each polled every 10ms for the given wall-clock seconds as AcqThread's workers would,
+   all from one thread. Reports the CPU share of one core spent in getData() and a few
+   sanity figures of the first amp's data (RMS, alpha and line noise content, triggers). */
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cmath>
+
+#include "../eesynth.h"
+
+// Power at frequency f of x[0..n) (Goertzel), as the amplitude of a sinusoid
+static double tone(const std::vector<double> &x,double f,double fs) { double w=2.*M_PI*f/fs,c=2.*cos(w),s0,s1=0.,s2=0.;
+ for (double v:x) { s0=v+c*s1-s2; s2=s1; s1=s0; }
+ return 2.*sqrt(std::max(0.,s1*s1+s2*s2-c*s1*s2))/x.size();
+}
+
+int main(int argc,char *argv[]) {
+ using namespace eesynth;
+ unsigned int sr=(argc>1) ? atoi(argv[1]) : 16000,secs=(argc>2) ? atoi(argv[2]) : 10,ampCount=(argc>3) ? atoi(argv[3]) : EE_MAX_AMPCOUNT;
+ factory fact; std::vector<amplifier*> amps=fact.getAmplifiers(); std::vector<stream*> strs;
+ std::vector<double> chn0,chnN; quint64 smps=0,trigs=0; double busy=0.,mean=0.;
+ if (ampCount>amps.size()) ampCount=amps.size();
+ for (unsigned int a=0;a<ampCount;a++)
+  strs.push_back(amps[a]->OpenEegStream(sr,EE_REF_GAIN,EE_BIP_GAIN,amps[a]->getChannelList(0xffffffffffffffff,0x3)));
+
+ auto t0=std::chrono::steady_clock::now();
+ while (std::chrono::steady_clock::now()-t0<std::chrono::seconds(secs)) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  for (unsigned int a=0;a<ampCount;a++) {
+   auto c0=std::chrono::steady_clock::now(); buffer b=strs[a]->getData(); auto c1=std::chrono::steady_clock::now();
+   busy+=std::chrono::duration<double>(c1-c0).count(); smps+=b.getSampleCount();
+   if (a==0) for (unsigned int s=0;s<b.getSampleCount();s++) {
+    chn0.push_back(b.getSample(30,s)); chnN.push_back(b.getSample(0,s));
+    if (b.getSample(b.getChannelCount()-2,s)!=0.) trigs++;
+   }
+  }
+ }
+ for (double v:chn0) mean+=v/chn0.size();
+ for (double &v:chn0) v-=mean;
+ double rms=0.; for (double v:chn0) rms+=v*v; rms=sqrt(rms/chn0.size());
+
+ printf("octopus-acq-synthbench: %u amps x %d chns at %u sps for %u s",ampCount,PHYS_CHN_COUNT,sr,secs);
+#ifdef __AVX2__
+ printf(" [AVX2]\n");
+#else
+ printf(" [scalar]\n");
+#endif
+ printf(" %.3g channel-samples/s synthesized, %.1f%% of one core, %.1f ns per channel-sample\n",
+        (double)smps*PHYS_CHN_COUNT/secs,100.*busy/secs,1e9*busy/((double)smps*PHYS_CHN_COUNT));
+ printf(" amp#1 posterior chn: %.1f uV RMS, 10Hz band %.2f uV, 50Hz %.2f uV, 150Hz %.2f uV; frontal chn 50Hz %.2f uV\n",
+        rms*1e6,std::max(tone(chn0,9.5,sr),std::max(tone(chn0,10.,sr),tone(chn0,10.5,sr)))*1e6,tone(chn0,50.,sr)*1e6,
+        tone(chn0,150.,sr)*1e6,tone(chnN,50.,sr)*1e6);
+ printf(" amp#1 trigger samples: %llu\n",(unsigned long long)trigs);
+ for (stream *s:strs) delete s;
+ return 0;
+}
@@ -0,0 +1,65 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* Software latency of TriggerOut with a pty standing in for the trigger multiplexer:
+   a burst of marker bytes is pushed at the given rate, read back on the master side
+   and checked for order and content. Latency is push() -> byte available on the pty
+   master, on CLOCK_MONOTONIC. */
+
+#include <QCoreApplication>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <poll.h>
+
+#include "../triggerout.h"
+
+int main(int argc,char *argv[]) {
+ QCoreApplication app(argc,argv);
+ unsigned int count=(argc>1) ? atoi(argv[1]) : 10000,rate=(argc>2) ? atoi(argv[2]) : 1000;
+ int master; unsigned char b; unsigned int got=0,bad=0; pollfd pfd; trigstamp ts;
+ std::vector<qint64> pushNs(count); RTHistogram lat("pty","us",5.,2000);
+
+ if ((master=posix_openpt(O_RDWR|O_NOCTTY))<0 || grantpt(master)<0 || unlockpt(master)<0) { perror("pty"); return 1; }
+ TriggerOut trigOut(QString(ptsname(master)),B115200,0); trigOut.start(QThread::HighPriority);
+ QThread::msleep(200); // Let it open the port
+
+ pfd.fd=master; pfd.events=POLLIN;
+ qint64 t0=monoNs(),period=1000000000LL/rate;
+ for (unsigned int i=0;i<count;i++) {
+  sleepUntilNs(t0+i*period); pushNs[i]=monoNs(); trigOut.push((unsigned char)(1+i%254));
+  while (got<=i && poll(&pfd,1,100)>0 && read(master,&b,1)==1) {
+   lat.add((monoNs()-pushNs[got])/1e3); if (b!=(unsigned char)(1+got%254)) bad++; got++;
+  }
+ }
+ trigOut.last(ts); trigOut.stop();
+
+ printf("octopus-acq-trigbench: %u triggers at %u/s over %s\n",count,rate,ptsname(master));
+ printf(" received %u, out of order/corrupt %u, dropped %llu, write errors %llu\n",got,bad,
+        (unsigned long long)trigOut.dropped,(unsigned long long)trigOut.errors);
+ printf(" push -> pty master latency: mean %.1f us, p50 < %.1f us, p99 < %.1f us, p99.9 < %.1f us\n",
+        lat.mean(),lat.percentile(.5),lat.percentile(.99),lat.percentile(.999));
+ printf(" last byte 0x%02x queued -> written %.1f us\n",ts.code,(ts.writtenNs-ts.queuedNs)/1e3);
+ close(master);
+ return (got==count && bad==0) ? 0 : 1;
+}
@@ -0,0 +1,36 @@
+# Octopus-ReEL - Realtime Encephalography Laboratory Network
+#       Copyright (C) 2007-2025 Barkin Ilhan
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#
+# Contact info:
+# E-Mail:  barkin@unrlabs.org
+# Website: http://icon.unrlabs.org/staff/barkin/
+# Repo:    https://github.com/4e0n/
+
+
+# Trigger output latency over a pty stand-in for the trigger multiplexer (no hardware needed):
+#  qmake trigbench.pro && make && ./octopus-acq-trigbench [count] [perSecond]
+
+TEMPLATE = app
+TARGET = octopus-acq-trigbench
+QT = core
+CONFIG += console c++17 release
+INCLUDEPATH += . ..
+
+# Input
+HEADERS += ../triggerout.h \
+           ../rtsched.h \
+           ../../serial_device.h
+SOURCES += trigbench.cpp
@@ -0,0 +1,77 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* Per-amp acquisition history (eex::cBuf). Instead of an array of struct sample, every
+   retained field has its own block of size rows x chnCount floats; within a row the
+   channels are contiguous, which is what the cross-channel kernels of mafilter.h (and
+   the per-row copies on the packing side) stream through. Only what is consumed later
+   -- raw, filtered and CM level, plus per-sample trigger and offset -- is kept; the
+   accumulators of the filter stage live in eex as plain filter state. */
+
+#ifndef CBUF_H
+#define CBUF_H
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+
+#include "../sample.h"
+
+typedef struct _cbuf {
+ unsigned int size,chnCount; // Rows (samples) and floats per row
+ std::vector<float> data,dataF,curCM; // [size][chnCount]
+ std::vector<unsigned int> trigger,offset; // [size]
+
+ void resize(unsigned int sz,unsigned int cc) { size=sz; chnCount=cc;
+  data.assign((size_t)size*chnCount,0.); dataF.assign((size_t)size*chnCount,0.); curCM.assign((size_t)size*chnCount,0.);
+  trigger.assign(size,0); offset.assign(size,0);
+ }
+
+ // Rows by absolute (ever increasing) sample index
+ float *dataAt(uint64_t idx) { return data.data()+(idx%size)*chnCount; }
+ float *dataFAt(uint64_t idx) { return dataF.data()+(idx%size)*chnCount; }
+ float *curCMAt(uint64_t idx) { return curCM.data()+(idx%size)*chnCount; }
+
+ // Gather one row into the struct sample sent to the clients
+ void get(uint64_t idx,sample &s) const { const size_t r=idx%size,o=r*chnCount,n=chnCount*sizeof(float);
+  s.marker=M_PI;
+  std::memcpy(s.data,data.data()+o,n); std::memcpy(s.dataF,dataF.data()+o,n); std::memcpy(s.curCM,curCM.data()+o,n);
+  s.trigger=trigger[r]; s.offset=offset[r];
+ }
+
+ // Same, with the float fields interpolated over rows idx-1..idx+2 by the 4-tap weights h
+ // (fractional delay, see ampalign.h); trigger/offset are left to the caller.
+ void getInterp(uint64_t idx,const float *h,sample &s) const { size_t o[4];
+  for (int k=0;k<4;k++) o[k]=((idx+size-1+k)%size)*chnCount;
+  s.marker=M_PI;
+  interpRows(data.data(),o,h,s.data); interpRows(dataF.data(),o,h,s.dataF); interpRows(curCM.data(),o,h,s.curCM);
+ }
+
+ void interpRows(const float *b,const size_t *o,const float *h,float *dst) const {
+  const float *r0=b+o[0],*r1=b+o[1],*r2=b+o[2],*r3=b+o[3];
+  for (unsigned int c=0;c<chnCount;c++) dst[c]=h[0]*r0[c]+h[1]*r1[c]+h[2]*r2[c]+h[3]*r3[c];
+ }
+} cbuf;
+
+#endif
@@ -6,7 +6,7 @@ typedef struct ChnTopo {
  QString chnName;
  unsigned int topoX;
  unsigned int topoY;
- float cmLevel[2]; // 255 is the most noisy
+ float cmLevel[EE_MAX_AMPCOUNT]; // 255 is the most noisy
 } _ChnTopo;
 
 #endif
@@ -21,46 +21,316 @@ Octopus-ReEL - Realtime Encephalography Laboratory Network
  Repo:    https://github.com/4e0n/
 */
 
+/* Per-client data sender. Every data connection accepted by AcqDaemon gets one
+   ClientHandler thread, which owns its socket and its own read cursor (tcpBufCIdx)
+   into the shared tcpBuffer ring. On connection the client first sends its
+   tcpsubscription (see ../tcpsubscription.h); only the fields and channels it asked
+   for are packed into its frames. The producer (AcqThread) publishes its new write
+   index through AcqDaemon::publishTcpData(), which wakes all handlers at once; a
+   handler then packs the pending span straight out of the ring without taking the
+   producer's tcpMutex. The producer fills at most tcpBufGuard samples beyond the
+   published index (it publishes a longer round in parts of that size), so a handler
+   keeps at least tcpBufGuard samples away from it and
+   re-validates its span after packing; a client that cannot keep up is never
+   waited for, its cursor is moved forward and the skipped span counts as an overrun.
+   What the client sees of it depends on its overrun policy (its subscription's, else
+   NET|OVERRUN): with DROP the next frame sent is a gap frame telling how many samples
+   were skipped, with DISCONNECT the connection is closed (the client may resume, if
+   it is quick enough), and with DECIMATE a lagging client -- a display, typically --
+   only gets every 2nd or 4th sample of its backlog until it has caught up, which
+   mostly keeps it from being lapped at all; a step frame goes ahead of every change
+   of that step, so that the client still knows which sample each frame is (a coded
+   block tells it in its span instead).
+   A new client starts at the live end of the ring, unless it asks to resume at a
+   sample that is still in it (and of this daemon session): the cursor then starts
+   there, and the backlog is simply sent as fast as the link takes it.
+   A client asking for a lower rate is attached to the decimator of that rate (see
+   decimator.h) and follows its ring instead of tcpBuffer, all of the above alike.
+
+   Frames are packed into a per-client ring (outBuffer) of ACQ_CLIENT_OUT_CHUNKS
+   chunks, which is allocated once and handed to the kernel as is: the pending bytes
+   form one or two contiguous segments of it, sent by a single sendmsg() each time
+   on the raw socket, i.e. without an extra copy into a socket-side write buffer.
+   TCP_NODELAY is on, so a single chunk leaves at once; when a backlog of several
+   chunks is sent, TCP_CORK is held over it so that it goes out in full segments.
+   With NET|ZEROCOPY the sends use MSG_ZEROCOPY: the kernel then transmits from the
+   ring's pages directly, and a part of the ring is only re-packed after its
+   completion was read back from the socket error queue. Where the kernel has to copy
+   nevertheless (e.g. loopback), it says so in the completions and zero-copy is
+   turned off for that client, as pinning pages then only costs.
+
+   A client that subscribed with TCP_SUB_LPC gets each chunk as one losslessly coded
+   block instead (see ../tcpsubscription.h); the frames are then packed into a staging
+   area first and the block is copied into the ring, which is byte- not frame-based.
+
+   Bytes sent, the queue depth (ring bytes not yet sent plus the socket's own send
+   queue) and the time spent in the sends are kept per client, and the sends and the
+   publish-to-send latency also go into the daemon's stage counters (acqstats.h). */
+
 #ifndef CLIENTHANDLER_H
 #define CLIENTHANDLER_H
 
-//#include <QObject>
-//#include <QApplication>
-//#include <QWidget>
-//#include <QStatusBar>
-//#include <QLabel>
-//#include <QtNetwork>
 #include <QThread>
-//#include <QVector>
-//#include <QMutex>
-//#include <unistd.h>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QVector>
+#include <QtNetwork>
+#include <atomic>
+#include <deque>
+#include <utility>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <linux/errqueue.h>
+
+#include "../acqglobals.h"
+#include "../tcpsample.h"
+#include "../tcpsubscription.h"
+#include "acqstats.h"
+#include "decimator.h"
+
+#ifndef SO_ZEROCOPY // Older libc headers
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+const unsigned int ACQ_CLIENT_ZC_PROBE=64; // Completions looked at before deciding on zero-copy
 
-//#include "../acqglobals.h"
+const char* const acqPolicyName[4]={"DEFAULT","DROP","DECIMATE","DISCONNECT"};
 
 class ClientHandler : public QThread {
+ Q_OBJECT
  public:
-  ClientHandler(qintptr socketDesc, void* buffer) : socketDescriptor(socketDesc), eegBuffer(buffer) {}
-
-  void run() override { ;
-   //QTcpSocket socket;
-   //socket.setSocketDescriptor(socketDescriptor);
-   //while (socket.state() == QTcpSocket::ConnectedState) {
-   // EEGFrame frame;
-   // if (eegBuffer->readNextFrame(clientCursor, &frame)) {
-   //  QByteArray data = frame.serialize();
-   //  socket.write(data);
-   //  socket.waitForBytesWritten(5);  // Or use socket.flush() + polling
-   // } else {
-   //  QThread::msleep(1); // Prevent tight spinning
-   // }
-   //}
+  ClientHandler(qintptr sd,unsigned int id,unsigned int ac,QVector<tcpsample> *tb,std::atomic<quint64> *pidx,quint64 g,
+                QMutex *dm,QWaitCondition *dr,bool *r,unsigned int ses,unsigned int op,bool zc=false,AcqStats *st=0,
+                DecimatorBank *db=0,unsigned int sr=0,QObject *parent=0) : QThread(parent) {
+   socketDescriptor=sd; clientId=id; ampCount=ac; tcpBuffer=tb; tcpBufPIdx=pidx; tcpBufGuard=g;
+   dataMutex=dm; dataReady=dr; daemonRunning=r; session=ses; policy=op; zeroCopy=zc; stats=st; decimators=db; rate=sr; decimator=0;
+   tcpBufCIdx=0; lag=maxLag=overruns=lostCount=sentCount=gapFrames=decimated=bytesSent=queued=0; connected=false; stopRequested=false;
+   outHead=outSent=outFreed=0; zcSeq=zcCompleted=zcCopied=0;
+  }
+
+  virtual void run() {
+   quint64 tcpBufSize,tcpBufSpan,pIdx,cIdx,count,gap=0,step,sentStep=1,k,m,behind,start; int one=1;
+   bool sendError=false,dropped=false,corked;
+   fd=(int)socketDescriptor; peer=peerName();
+   setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+
+   if (!subscribe()) { ::close(fd); if (decimators) decimators->detach(decimator); return; }
+   tcpBufSize=tcpBuffer->size(); tcpBufSpan=tcpBufSize-tcpBufGuard; // The decimator's ring, at a lower rate
+   qDebug() << "octopus_acqd: <ClientHandler> Client #" << clientId << "(" << peer << ") streaming started."
+            << "Fields:" << subscription.request().fields << "Bytes/sample:" << subscription.frameSize
+            << "(full:" << sizeof(tcpsample) << ")" << "Rate:" << rate << (subscription.packed() ? "LPC-coded" : "As is") << "On overrun:" << acqPolicyName[policy];
+   if (subscription.request().resume)
+    qDebug() << "octopus_acqd: <ClientHandler> Client #" << clientId << "resumed at sample" << tcpBufCIdx
+             << "replaying" << (quint64)(*tcpBufPIdx-tcpBufCIdx) << "samples.";
+   // Sender ring is sized once; spans are packed in chunks of tcpBufGuard samples (+1 gap, +1 step frame)
+   frameSize=subscription.frameSize; ringBytes=ACQ_CLIENT_OUT_CHUNKS*(tcpBufGuard+2)*frameSize;
+   if (subscription.packed()) { stage.resize(tcpBufGuard*frameSize); block.resize(subscription.blockBound(tcpBufGuard));
+    ringBytes=qMax(ringBytes,(quint64)ACQ_CLIENT_OUT_CHUNKS*block.size());
+   }
+   outBuffer.resize(ringBytes);
+   if (zeroCopy && setsockopt(fd,SOL_SOCKET,SO_ZEROCOPY,&one,sizeof(one))<0) {
+    qDebug("octopus_acqd: <ClientHandler> Client #%u: no MSG_ZEROCOPY on this kernel, copying.",clientId); zeroCopy=false;
+   }
+
+   connected=true;
+
+   while (*daemonRunning && !stopRequested) {
+    // Sleep until the producer publishes; the timeout only serves disconnection/stop checks
+    dataMutex->lock();
+     while ((pIdx=*tcpBufPIdx)==tcpBufCIdx && *daemonRunning && !stopRequested)
+      if (!dataReady->wait(dataMutex,ACQ_CLIENT_IDLE_MSECS)) break;
+    dataMutex->unlock();
+
+    start=tcpBufCIdx; corked=(pIdx-tcpBufCIdx>tcpBufGuard); // A backlog of chunks goes out in full segments
+    if (corked) setsockopt(fd,IPPROTO_TCP,TCP_CORK,&one,sizeof(one));
+    while (tcpBufCIdx<pIdx) {
+     if (*tcpBufPIdx-tcpBufCIdx>tcpBufSpan) { // Lapped by the producer; oldest part is already overwritten
+      pIdx=*tcpBufPIdx; overruns++; behind=pIdx-tcpBufCIdx-tcpBufSpan; lostCount+=behind; gap+=behind;
+      tcpBufCIdx=pIdx-tcpBufSpan; if (policy==TCP_SUB_DISCONNECT) { dropped=true; break; }
+     }
+     cIdx=tcpBufCIdx; count=qMin(pIdx-cIdx,tcpBufGuard); behind=*tcpBufPIdx-cIdx;
+     step=(policy!=TCP_SUB_DECIMATE || behind<=tcpBufSpan/4) ? 1 : (behind<=tcpBufSpan/2) ? 2 : 4;
+     if (count<step) step=1; else count-=count%step; // Every frame stands for exactly step samples
+     k=m=0;
+     if (subscription.packed()) { // Frames into the staging area, the block made of them into the ring
+      for (quint64 i=0;i<count;i+=step) subscription.pack((*tcpBuffer)[(cIdx+i)%tcpBufSize],stage.data()+(k++)*frameSize);
+     } else {
+      if (!reserve((count+2)*frameSize)) { sendError=true; break; }
+      if (gap>0) subscription.packGap(gap,outBuffer.data()+(outHead+(k++)*frameSize)%ringBytes);
+      if (step!=sentStep) { subscription.packStep(step,outBuffer.data()+(outHead+(k++)*frameSize)%ringBytes); m=1; }
+      for (quint64 i=0;i<count;i+=step)
+       subscription.pack((*tcpBuffer)[(cIdx+i)%tcpBufSize],outBuffer.data()+(outHead+(k++)*frameSize)%ringBytes);
+     }
+     // The chunk may have been overwritten while it was being packed..
+     if (*tcpBufPIdx-cIdx>tcpBufSpan) { overruns++; lostCount+=count; gap+=count;
+      if (policy==TCP_SUB_DISCONNECT) { dropped=true; break; }
+     } else {
+      if (subscription.packed()) { quint64 len=subscription.packBlock(stage.data(),k,count,cIdx,gap,block.data()),off;
+       if (!reserve(len)) { sendError=true; break; }
+       off=outHead%ringBytes; std::memcpy(outBuffer.data()+off,block.data(),qMin(len,ringBytes-off));
+       if (len>ringBytes-off) std::memcpy(outBuffer.data(),block.data()+(ringBytes-off),len-(ringBytes-off));
+       outHead+=len; if (gap>0) { gapFrames++; gap=0; }
+      } else { outHead+=k*frameSize; if (gap>0) { gapFrames++; gap=0; k--; } if (m) { sentStep=step; k--; } }
+      if (!flush()) { sendError=true; break; }
+      sentCount+=k; decimated+=count-k;
+     }
+     tcpBufCIdx+=count;
+    }
+    if (corked) { int zero=0; setsockopt(fd,IPPROTO_TCP,TCP_CORK,&zero,sizeof(zero)); }
+    if (sendError || dropped) break;
+
+    lag=*tcpBufPIdx-tcpBufCIdx; if (lag>maxLag) maxLag=(quint64)lag;
+    if (stats && lag==0 && tcpBufCIdx>start) stats->stage[ACQ_STAGE_LATENCY].add(monoNs()-stats->publishNs);
+    int sq=0; if (ioctl(fd,SIOCOUTQ,&sq)<0) sq=0;
+    queued=outHead-outSent+sq;
+
+    if (!alive()) break; // Client isn't expected to talk; reads only tell about disconnection
+   }
+
+   connected=false; shutdown(fd,SHUT_RDWR); ::close(fd); if (decimators) decimators->detach(decimator);
+   qDebug() << "octopus_acqd: <ClientHandler> Client #" << clientId << "(" << peer << ") gone."
+            << "Sent:" << (quint64)sentCount << "Overruns:" << (quint64)overruns << "Lost:" << (quint64)lostCount
+            << "Gaps:" << (quint64)gapFrames << "Decimated:" << (quint64)decimated;
+   if (dropped)
+    qDebug("octopus_acqd: <ClientHandler> Client #%u was lapped and disconnected by policy.",clientId);
   }
 
+  void requestStop() { stopRequested=true; }
+
+  unsigned int clientId,policy,rate; QString peer; // rate: samples/s of this client's stream
+  std::atomic<quint64> lag,maxLag,overruns,lostCount,sentCount,gapFrames,decimated; // In samples, for the daemon's report
+  std::atomic<quint64> bytesSent,queued; // Bytes; queued: packed but unsent + in the socket's send queue
+  std::atomic<bool> connected;
+
  private:
-  qintptr socketDescriptor;
-  void* eegBuffer;
-  //SharedEEGBuffer* eegBuffer;
-  //CircularCursor clientCursor;  // Each client tracks its position
+  QString peerName() { sockaddr_in sa; socklen_t l=sizeof(sa); char ip[INET_ADDRSTRLEN]="?";
+   if (getpeername(fd,(sockaddr*)&sa,&l)<0 || sa.sin_family!=AF_INET) return QString("?");
+   inet_ntop(AF_INET,&sa.sin_addr,ip,sizeof(ip));
+   return QString(ip)+":"+QString::number(ntohs(sa.sin_port));
+  }
+
+  // Wait for the client's subscription, validate it, decide where its stream starts and
+  // echo back the agreed frame layout.
+  bool subscribe() { tcpsubscription req; size_t got=0; ssize_t n; pollfd p={fd,POLLIN,0}; quint64 pIdx,span,first=0; bool resumed=false;
+   while (got<sizeof(tcpsubscription)) {
+    if (poll(&p,1,TCP_SUB_TIMEOUT_MSECS)<=0 || (n=recv(fd,(char*)(&req)+got,sizeof(tcpsubscription)-got,0))<=0) {
+     qDebug("octopus_acqd: <ClientHandler> Client #%u did not subscribe, dropped.",clientId); return false;
+    }
+    got+=n;
+   }
+   if (!subscription.set(req,ampCount)) {
+    qDebug("octopus_acqd: <ClientHandler> Client #%u sent a malformed subscription, dropped.",clientId); return false;
+   }
+   policy=(req.policy!=TCP_SUB_POLICY_DEFAULT) ? req.policy : policy; subscription.setPolicy(policy);
+   if (decimators && (req.rate=decimators->grant(req.rate))<rate) { // Lower rate: that decimator's ring instead
+    decimator=decimators->attach(req.rate); rate=req.rate; first=decimator->firstIdx;
+    tcpBuffer=&decimator->out; tcpBufPIdx=&decimator->outPIdx; tcpBufGuard=decimator->outGuard;
+    dataMutex=&decimator->outMutex; dataReady=&decimator->outReady;
+   }
+   subscription.setRate(rate);
+   pIdx=*tcpBufPIdx; span=tcpBuffer->size()-2*tcpBufGuard; // A guard's margin, not to be lapped at once
+   if (req.resume && req.session==session && req.startIdx>=first && req.startIdx<=pIdx && pIdx-req.startIdx<=span) { tcpBufCIdx=req.startIdx; resumed=true; }
+   else {
+    if (req.resume) qDebug("octopus_acqd: <ClientHandler> Client #%u cannot resume (%s), starting live.",clientId,
+                           req.session==session ? "out of BUFPAST" : "other session");
+    tcpBufCIdx=pIdx; // Previous data is assumed to be gone..
+   }
+   subscription.grant(session,resumed,tcpBufCIdx);
+   const char *d=(const char*)(&subscription.request()); size_t size=sizeof(tcpsubscription);
+   while (size>0) { if ((n=send(fd,d,size,MSG_NOSIGNAL))<=0) return false; d+=n; size-=n; }
+   return true;
+  }
+
+  // Send everything packed so far: the unsent part of the ring is one or two segments.
+  bool flush() { quint64 end=outHead,off,len,from=outSent; iovec iov[2]; msghdr m; ssize_t n;
+   qint64 t0=monoNs();
+   while (outSent<end) { off=outSent%ringBytes; len=qMin(end-outSent,ringBytes-off);
+    iov[0].iov_base=outBuffer.data()+off; iov[0].iov_len=len;
+    iov[1].iov_base=outBuffer.data(); iov[1].iov_len=end-outSent-len;
+    std::memset(&m,0,sizeof(m)); m.msg_iov=iov; m.msg_iovlen=(iov[1].iov_len>0) ? 2 : 1;
+    if ((n=sendmsg(fd,&m,MSG_NOSIGNAL|MSG_DONTWAIT|(zeroCopy ? MSG_ZEROCOPY : 0)))>0) {
+     outSent+=n; if (zeroCopy) zcPending.push_back(std::make_pair(zcSeq++,outSent)); else if (zcPending.empty()) outFreed=outSent;
+    } else if (n<0 && (errno==EAGAIN || errno==EWOULDBLOCK || errno==ENOBUFS)) { // ENOBUFS: out of optmem for zero-copy
+     if (!waitSocket(POLLOUT)) return false;
+    } else if (n<0 && errno==EINTR) continue;
+    else return false;
+   }
+   bytesSent+=outSent-from; if (stats) stats->stage[ACQ_STAGE_SEND].add(monoNs()-t0,outSent-from);
+   return true;
+  }
+
+  // Make room for bytes in the ring; with zero-copy, sent bytes stay pinned until completed.
+  bool reserve(quint64 bytes) {
+   while (outHead+bytes-outFreed>ringBytes) {
+    if (zeroCopy || !zcPending.empty()) { reap(); if (outHead+bytes-outFreed<=ringBytes) break; }
+    if (outSent<outHead) { if (!flush()) return false; continue; }
+    if (!waitSocket(0)) return false;
+   }
+   return true;
+  }
+
+  // Read MSG_ZEROCOPY completions; TCP reports them in send order as [lo,hi] ranges of send calls.
+  void reap() { char ctrl[128]; msghdr m; cmsghdr *c; sock_extended_err *e;
+   for (;;) { std::memset(&m,0,sizeof(m)); m.msg_control=ctrl; m.msg_controllen=sizeof(ctrl);
+    if (recvmsg(fd,&m,MSG_ERRQUEUE|MSG_DONTWAIT)<0) break;
+    for (c=CMSG_FIRSTHDR(&m);c;c=CMSG_NXTHDR(&m,c)) {
+     if (!((c->cmsg_level==SOL_IP && c->cmsg_type==IP_RECVERR) || (c->cmsg_level==SOL_IPV6 && c->cmsg_type==IPV6_RECVERR))) continue;
+     e=(sock_extended_err*)CMSG_DATA(c);
+     if (e->ee_errno!=0 || e->ee_origin!=SO_EE_ORIGIN_ZEROCOPY) continue;
+     zcCompleted+=e->ee_data-e->ee_info+1; if (e->ee_code&SO_EE_CODE_ZEROCOPY_COPIED) zcCopied+=e->ee_data-e->ee_info+1;
+     while (!zcPending.empty() && (int)(e->ee_data-zcPending.front().first)>=0) {
+      outFreed=zcPending.front().second; zcPending.pop_front();
+     }
+    }
+   }
+   if (zeroCopy && zcCompleted>=ACQ_CLIENT_ZC_PROBE && zcCopied==zcCompleted) {
+    qDebug("octopus_acqd: <ClientHandler> Client #%u: kernel copies anyway (loopback?), zero-copy off.",clientId);
+    zeroCopy=false;
+   }
+   if (zcPending.empty()) outFreed=outSent;
+  }
+
+  // Block up to ACQ_CLIENT_IDLE_MSECS for writability and/or completions; false on stop or error.
+  bool waitSocket(short events) { pollfd p={fd,events,0};
+   if (poll(&p,1,ACQ_CLIENT_IDLE_MSECS)<0 && errno!=EINTR) return false;
+   if (p.revents&(POLLHUP|POLLNVAL)) return false;
+   if (p.revents&POLLERR) { if (zeroCopy || !zcPending.empty()) reap(); else return false; }
+   return *daemonRunning && !stopRequested;
+  }
+
+  // Drain whatever the client sent; false once it has disconnected.
+  bool alive() { char b[256]; ssize_t n; pollfd p={fd,POLLIN|POLLRDHUP,0};
+   if (zeroCopy || !zcPending.empty()) reap();
+   if (poll(&p,1,0)<=0) return true;
+   if (p.revents&(POLLHUP|POLLRDHUP|POLLNVAL)) return false;
+   while ((n=recv(fd,b,sizeof(b),MSG_DONTWAIT))>0);
+   return !(n==0 || (n<0 && errno!=EAGAIN && errno!=EWOULDBLOCK && errno!=EINTR));
+  }
+
+  qintptr socketDescriptor; int fd; unsigned int ampCount; const QVector<tcpsample> *tcpBuffer;
+  TcpSubscription subscription; QByteArray outBuffer,stage,block; quint64 frameSize,ringBytes;
+  quint64 outHead,outSent,outFreed; // Bytes packed, handed to the kernel, reusable
+  unsigned int session; bool zeroCopy; AcqStats *stats; DecimatorBank *decimators; Decimator *decimator; quint32 zcSeq; quint64 zcCompleted,zcCopied; std::deque<std::pair<quint32,quint64> > zcPending;
+  std::atomic<quint64> *tcpBufPIdx; quint64 tcpBufCIdx,tcpBufGuard;
+  QMutex *dataMutex; QWaitCondition *dataReady; bool *daemonRunning;
+  std::atomic<bool> stopRequested;
 };
 
 #endif
@@ -0,0 +1,232 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* Multi-rate output. The amps run at AMP|SAMPLERATE; a data client may ask for a
+   lower rate in its subscription (tcpsubscription.rate) and gets the nearest one at
+   or above it that divides the full rate. DecimatorBank keeps one Decimator per such
+   output rate, created when a client first asks for it and shared by every client at
+   that rate. A Decimator is a thread following the tcpBuffer ring like a ClientHandler
+   does (same publish wakeup, guard zone and lap rule), which fills a ring of its own
+   (out) at the output rate, as deep in seconds as tcpBuffer, and publishes it the same
+   way; the ClientHandlers of its clients follow that ring instead, overrun policy and
+   resume included. A decimator stays for the session once created, so that a client
+   at its rate can resume from its history. Output sample j stands for input sample
+   j*factor: stream indices at a rate are the full-rate ones divided by the factor.
+
+   Anti-aliasing is a linear-phase Kaiser-windowed sinc of 2*DEC_HALF_SPAN*factor+1
+   taps, cut off at the output Nyquist frequency (-6 dB at half the output rate, flat
+   to 0.4 of it, about 75 dB down at 0.6; the band between aliases onto 0.4..0.5 at
+   that much less), centered on input j*factor -- output j is not delayed
+   against its index, the decimator just runs DEC_HALF_SPAN output samples behind.
+   Only the retained outputs are computed, in transposed polyphase form: each input
+   row is added, weighted by the tap it falls on, to the accumulators of the outputs
+   it contributes to (2*DEC_HALF_SPAN+1 at most), so it is read once and the working
+   set is these few accumulator rows. RAW, FLT and AUX are filtered, across channels
+   (AVX2, 8 per step); CM levels and the amp offsets are those of input j*factor (so
+   the offsets advance by factor per output sample, as clients check), and a trigger
+   among the factor input samples nearest to j is put on j. Only the first one is
+   kept should there be several in that window; the others are lost. */
+
+#ifndef DECIMATOR_H
+#define DECIMATOR_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QVector>
+#include <QDebug>
+#include <atomic>
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "../acqglobals.h"
+#include "../sample.h"
+#include "../tcpsample.h"
+#include "../tcpsubscription.h"
+
+const unsigned int DEC_HALF_SPAN=12;     // Output samples each side of the anti-alias filter
+const double DEC_KAISER_BETA=7.5;        // ~75 dB stopband
+
+// acc+=h*x over n floats.
+inline void decAxpy(float *acc,const float *x,float h,unsigned int n) { unsigned int c=0;
+#ifdef __AVX2__
+ const __m256 vh=_mm256_set1_ps(h);
+ for (;c+8<=n;c+=8) _mm256_storeu_ps(acc+c,_mm256_add_ps(_mm256_loadu_ps(acc+c),_mm256_mul_ps(vh,_mm256_loadu_ps(x+c))));
+#endif
+ for (;c<n;c++) acc[c]+=h*x[c];
+}
+
+// Anti-alias taps for decimation by factor, unity gain at DC.
+inline std::vector<float> decTaps(unsigned int factor) { unsigned int d=DEC_HALF_SPAN*factor; std::vector<float> h(2*d+1);
+ auto i0=[](double x) { double s=1.,t=1.; for (int k=1;k<40;k++) { t*=(x/(2.*k))*(x/(2.*k)); s+=t; } return s; };
+ double fc=0.5/factor,sum=0.,r,w;
+ for (unsigned int k=0;k<=2*d;k++) { r=((double)k-d)/d; w=i0(DEC_KAISER_BETA*sqrt(std::max(0.,1.-r*r)))/i0(DEC_KAISER_BETA);
+  h[k]=(k==d) ? 2.*fc*w : sin(2.*M_PI*fc*((double)k-d))/(M_PI*((double)k-d))*w; sum+=h[k];
+ }
+ for (float &v:h) v/=sum;
+ return h;
+}
+
+class Decimator : public QThread {
+ Q_OBJECT
+ public:
+  Decimator(unsigned int fullRate,unsigned int r,unsigned int ac,const QVector<tcpsample> *tb,std::atomic<quint64> *pidx,quint64 g,
+            QMutex *dm,QWaitCondition *dr,bool *run,QObject *parent=0) : QThread(parent) {
+   rate=r; factor=fullRate/r; ampCount=ac; tcpBuffer=tb; tcpBufPIdx=pidx; tcpBufGuard=g; dataMutex=dm; dataReady=dr; daemonRunning=run;
+   half=DEC_HALF_SPAN*factor; taps=decTaps(factor);
+   stride=(ampCount*2*PHYS_CHN_COUNT+AUX_CHN_COUNT+7)&~7u; row.assign(stride,0.f);
+   accs.assign((size_t)(2*DEC_HALF_SPAN+2)*stride,0.f);
+   outGuard=tcpBufGuard/factor+1; out.resize(qMax((quint64)tcpBuffer->size()/factor,4*outGuard)); // Once, as tcpBuffer
+   for (tcpsample &t:out) { t.amp.resize(ampCount); t.trigger=0; }
+   clients=overruns=lostCount=0; stopRequested=false; jNext=0;
+   dataMutex->lock(); restart(*tcpBufPIdx); dataMutex->unlock(); // Index valid before the first client sees it
+   firstIdx=jNext; outPIdx=jNext;
+   setObjectName("Decimator");
+  }
+
+  virtual void run() {
+   quint64 inSize=tcpBuffer->size(),inSpan=inSize-tcpBufGuard,pIdx,count;
+   qDebug() << "octopus_acqd: <Decimator>" << rate << "sps (1/" << factor << "):" << taps.size() << "taps, starting at sample" << (quint64)jNext;
+   while (*daemonRunning && !stopRequested) {
+    dataMutex->lock();
+     while ((pIdx=*tcpBufPIdx)==cIdx && *daemonRunning && !stopRequested)
+      if (!dataReady->wait(dataMutex,ACQ_CLIENT_IDLE_MSECS)) break;
+    dataMutex->unlock();
+
+    while (cIdx<pIdx) {
+     if (*tcpBufPIdx-cIdx>inSpan) { overruns++; restart(*tcpBufPIdx); continue; } // Lapped; starts over from the live end
+     count=qMin(pIdx-cIdx,tcpBufGuard);
+     for (quint64 i=cIdx;i<cIdx+count;i++) feed(i);
+     if (*tcpBufPIdx-cIdx>inSpan) { overruns++; restart(*tcpBufPIdx); continue; } // Overwritten while being read
+     cIdx+=count;
+     outMutex.lock(); outPIdx=jNext; outReady.wakeAll(); outMutex.unlock();
+    }
+   }
+   qDebug() << "octopus_acqd: <Decimator>" << rate << "sps stopped. Overruns:" << (quint64)overruns << "Lost:" << (quint64)lostCount;
+  }
+
+  void requestStop() { stopRequested=true; }
+
+  // The output ring, followed by the ClientHandlers at this rate as they would tcpBuffer.
+  QVector<tcpsample> out; std::atomic<quint64> outPIdx; quint64 outGuard,firstIdx; QMutex outMutex; QWaitCondition outReady;
+  unsigned int rate,factor; std::atomic<quint64> clients,overruns,lostCount;
+
+ private:
+  // Go on from about the live end pIdx, with the filter's past taken from the ring. Outputs
+  // skipped since the last one published (after a lap) are blanked and count as lost.
+  void restart(quint64 pIdx) { quint64 s=(pIdx>2*half) ? pIdx-2*half : 0,j0=(s+half+factor-1)/factor;
+   if (jNext>0 && j0>jNext) { lostCount+=j0-jNext;
+    for (quint64 j=qMax(jNext,j0-qMin(j0-jNext,(quint64)out.size()));j<j0;j++) { tcpsample &t=out[j%out.size()];
+     t.trigger=0; for (sample &a:t.amp) std::memset(&a,0,sizeof(sample)); for (float &v:t.aux) v=0.f;
+    }
+   }
+   cIdx=s; jNext=jOpen=qMax(jNext,j0);
+  }
+
+  float *acc(quint64 j) { return accs.data()+(j%(2*DEC_HALF_SPAN+2))*stride; }
+
+  // Input sample i into the accumulators of the outputs around it; the one it completes is emitted.
+  void feed(quint64 i) { const tcpsample &t=(*tcpBuffer)[i%tcpBuffer->size()]; float *r=row.data(); quint64 jLo,jHi;
+   for (unsigned int a=0;a<ampCount;a++) { std::memcpy(r,t.amp[a].data,PHYS_CHN_COUNT*sizeof(float)); r+=PHYS_CHN_COUNT;
+    std::memcpy(r,t.amp[a].dataF,PHYS_CHN_COUNT*sizeof(float)); r+=PHYS_CHN_COUNT;
+   }
+   std::memcpy(r,t.aux,AUX_CHN_COUNT*sizeof(float));
+   jLo=qMax(jNext,(i>=half) ? (i-half+factor-1)/factor : 0); jHi=(i+half)/factor;
+   for (quint64 j=jLo;j<=jHi;j++) {
+    if (j==jOpen) { std::fill(acc(j),acc(j)+stride,0.f); jOpen++; }
+    decAxpy(acc(j),row.data(),taps[i+half-j*factor],stride);
+   }
+   if (i>=half && (i-half)%factor==0 && (i-half)/factor==jNext) output(jNext++);
+  }
+
+  void output(quint64 j) { const QVector<tcpsample> &in=*tcpBuffer; quint64 c=j*factor,first=c-qMin(c,(quint64)factor/2);
+   const tcpsample &s=in[c%in.size()]; tcpsample &t=out[j%out.size()]; const float *r=acc(j);
+   t.trigger=0;
+   for (unsigned int a=0;a<ampCount;a++) { sample &d=t.amp[a];
+    std::memcpy(d.data,r,PHYS_CHN_COUNT*sizeof(float)); r+=PHYS_CHN_COUNT;
+    std::memcpy(d.dataF,r,PHYS_CHN_COUNT*sizeof(float)); r+=PHYS_CHN_COUNT;
+    std::memcpy(d.curCM,s.amp[a].curCM,PHYS_CHN_COUNT*sizeof(float)); d.marker=s.amp[a].marker; d.offset=s.amp[a].offset; d.trigger=0;
+   }
+   std::memcpy(t.aux,r,AUX_CHN_COUNT*sizeof(float));
+   for (quint64 i=first;i<first+factor;i++) { const tcpsample &u=in[i%in.size()];
+    if (!t.trigger) t.trigger=u.trigger;
+    for (unsigned int a=0;a<ampCount;a++) if (!t.amp[a].trigger) t.amp[a].trigger=u.amp[a].trigger;
+   }
+  }
+
+  unsigned int ampCount,half,stride; std::vector<float> taps,row,accs; quint64 cIdx,jNext,jOpen;
+  const QVector<tcpsample> *tcpBuffer; std::atomic<quint64> *tcpBufPIdx; quint64 tcpBufGuard;
+  QMutex *dataMutex; QWaitCondition *dataReady; bool *daemonRunning;
+  std::atomic<bool> stopRequested;
+};
+
+// One decimator per output rate, shared by the clients at that rate.
+class DecimatorBank {
+ public:
+  DecimatorBank() { fullRate=ampCount=0; tcpBuffer=0; tcpBufPIdx=0; tcpBufGuard=0; dataMutex=0; dataReady=0; daemonRunning=0; }
+  ~DecimatorBank() { stop(); }
+
+  void init(unsigned int sr,unsigned int ac,const QVector<tcpsample> *tb,std::atomic<quint64> *pidx,quint64 g,
+            QMutex *dm,QWaitCondition *dr,bool *r) {
+   fullRate=sr; ampCount=ac; tcpBuffer=tb; tcpBufPIdx=pidx; tcpBufGuard=g; dataMutex=dm; dataReady=dr; daemonRunning=r;
+  }
+
+  // The rate a client asking for asked gets (see TcpSubscription::outputRate).
+  unsigned int grant(unsigned int asked) const { return TcpSubscription::outputRate(asked,fullRate); }
+
+  // The decimator of a granted rate below the full one, started on first use.
+  Decimator *attach(unsigned int rate) { Decimator *d=0;
+   mutex.lock();
+    for (Decimator *x:decs) if (x->rate==rate) d=x;
+    if (!d) { d=new Decimator(fullRate,rate,ampCount,tcpBuffer,tcpBufPIdx,tcpBufGuard,dataMutex,dataReady,daemonRunning);
+     d->start(QThread::HighPriority); decs.append(d);
+    }
+    d->clients++;
+   mutex.unlock();
+   return d;
+  }
+
+  void detach(Decimator *d) { if (d) d->clients--; }
+
+  QVector<Decimator*> decimators() { mutex.lock(); QVector<Decimator*> r=decs; mutex.unlock(); return r; }
+
+  void stop() {
+   mutex.lock();
+    for (Decimator *d:decs) { d->requestStop(); d->wait(); delete d; }
+    decs.clear();
+   mutex.unlock();
+  }
+
+ private:
+  unsigned int fullRate,ampCount; const QVector<tcpsample> *tcpBuffer; std::atomic<quint64> *tcpBufPIdx; quint64 tcpBufGuard;
+  QMutex *dataMutex; QWaitCondition *dataReady; bool *daemonRunning;
+  QMutex mutex; QVector<Decimator*> decs;
+};
+
+#endif
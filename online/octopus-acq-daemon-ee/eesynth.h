@@ -30,6 +30,20 @@ Octopus-ReEL - Realtime Encephalography Laboratory Network
    Due to copyright reasons, the respective Eemagine library isn't included in that project.
 
    This is the file of eesynth namespace and all classes that mimicks the overall system.
+
+   The synthetic EEG is a sum of per-channel 1/f background (white noise through a bank of
+   one-pole lowpasses at octave-ish spaced corners), posterior alpha bursts, line noise
+   with harmonics, frontal blinks and ERPs following each stimulus trigger, every source
+   with its own per-channel gain (a crude topography). All oscillators run as complex
+   phasor recurrences and the blink as a critically damped two-pole recurrence, so that
+   nothing trigonometric is evaluated per sample; the per-channel part (noise generators,
+   filters and mixing) is vectorized across channels. Each amp runs on its own clock,
+   off by up to SYNTH|DRIFTPPM, and delivers whatever has accumulated since the previous
+   getData() call. The trigger multiplexer is emulated by a trigline shared by all amps:
+   stimulus codes every ~SYNTH|STIMSECS, and every byte sent to the real trigger output
+   (SYNC, markers) appear on the trigger channels of all amps at the same instant.
+   Buffers are allocated once per stream; getData() hands out one of two alternating
+   buffers whose samples are shared (not copied) with the returned handle.
 */
 
 #ifndef EESYNTH
@@ -40,8 +54,16 @@ Octopus-ReEL - Realtime Encephalography Laboratory Network
 #include <ostream>
 #include <stdexcept>
 #include <iostream>
-#include <string>
 #include <algorithm>
+#include <chrono>
+#include <random>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <cmath>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 #include "../acqglobals.h"
 
@@ -51,23 +73,86 @@ namespace eesynth {
   class unknown : public std::runtime_error { public: explicit unknown(const std::string &msg) : std::runtime_error(msg) {} };
  }
 
+const unsigned int SYNTH_PINK_POLES=6;       // 1/f background: lowpass corners of the noise bank
+const unsigned int SYNTH_TRIGLINE_SIZE=64;    // Pending trigger events per trigline
+const unsigned int SYNTH_BLOCK_EVENTS=16;     // Trigger events within one getData() block
+const double SYNTH_ERP_SECS=0.8;
+
+typedef struct _synthparams {
+ double noiseUV;      // RMS of the 1/f background
+ double alphaUV;      // Alpha burst amplitude
+ double lineFreq;     // 50/60Hz
+ double lineUV;       // Line noise amplitude of the fundamental
+ unsigned int harmonics; // Line noise harmonics incl. the fundamental
+ double blinkUV;      // Blink amplitude on the frontal-most channel (0: none)
+ double erpUV;        // ERP peak amplitude (0: none)
+ double stimSecs;     // Mean stimulus trigger interval (0: none)
+ double driftPpm;     // Max. clock deviation of an amp from nominal
+} synthparams;
+
+inline synthparams synthDefaults() { synthparams p;
+ p.noiseUV=10.; p.alphaUV=20.; p.lineFreq=50.; p.lineUV=5.; p.harmonics=5;
+ p.blinkUV=150.; p.erpUV=8.; p.stimSecs=1.5; p.driftPpm=20.;
+ return p;
+}
+
+// Copies share the samples, as with the SDK's handle; see stream::getData().
 class buffer {
  public:
-  buffer(unsigned int channel_count=0,unsigned int sample_count=0):_data(channel_count*sample_count),_channel_count(channel_count),_sample_count(sample_count) {}
-  void setCounts(unsigned int channel_count,unsigned int sample_count) {
-   _data.resize(channel_count*sample_count); _channel_count=channel_count; _sample_count=sample_count;
+  buffer(unsigned int channel_count=0,unsigned int sample_count=0):_data(std::make_shared<std::vector<double> >(channel_count*sample_count)),_channel_count(channel_count),_sample_count(sample_count) {}
+  void setCounts(unsigned int channel_count,unsigned int sample_count) { // Reallocates only to grow
+   _data->resize(channel_count*sample_count); _channel_count=channel_count; _sample_count=sample_count;
   }
+  void reserve(size_t n) { _data->reserve(n); }
   const unsigned int& getChannelCount() const { return _channel_count; }
   const unsigned int& getSampleCount() const { return _sample_count; }
-  const double& getSample(unsigned int channel,unsigned int sample) const { return _data[channel+sample*_channel_count]; }
-  void setSample(unsigned int channel,unsigned int sample,double value) { _data[channel+sample*_channel_count]=value; }
-  size_t size() const { return _data.size(); }
-  double* data() { return _data.data(); }
+  const double& getSample(unsigned int channel,unsigned int sample) const { return (*_data)[channel+sample*_channel_count]; }
+  void setSample(unsigned int channel,unsigned int sample,double value) { (*_data)[channel+sample*_channel_count]=value; }
+  size_t size() const { return _data->size(); }
+  double* data() { return _data->data(); }
  private:
-  std::vector<double> _data;
+  std::shared_ptr<std::vector<double> > _data;
   unsigned int _channel_count,_sample_count;
 };
 
+// The trigger multiplexer as seen by the synthetic amps: codes with the instant they were
+// put on the line, read by each amp's stream at its own pace.
+class trigline {
+ public:
+  typedef std::chrono::steady_clock::time_point tpoint;
+  typedef struct _event { unsigned int code; tpoint t; } event;
+
+  trigline() { seq=0; stimSecs=0.; rng.seed(0x5eed); }
+
+  void post(unsigned int code) { post(code,std::chrono::steady_clock::now()); }
+
+  void setStimulus(double secs) { std::lock_guard<std::mutex> l(mutex);
+   stimSecs=secs; nextStim=std::chrono::steady_clock::now()+std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(secs));
+  }
+
+  // Events after sequence# s up to now (stimuli are scheduled here lazily); s is advanced.
+  unsigned int since(uint64_t &s,event *ev,unsigned int max) { unsigned int n=0; tpoint now=std::chrono::steady_clock::now();
+   std::lock_guard<std::mutex> l(mutex);
+   while (stimSecs>0. && nextStim<=now) { push(1+rng()%4,nextStim);
+    nextStim+=std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(stimSecs*(0.75+0.5*(rng()%1000)/1000.)));
+   }
+   if (seq-s>SYNTH_TRIGLINE_SIZE) s=seq-SYNTH_TRIGLINE_SIZE;
+   for (;s<seq && n<max;s++) ev[n++]=ring[s%SYNTH_TRIGLINE_SIZE];
+   return n;
+  }
+
+  uint64_t head() { std::lock_guard<std::mutex> l(mutex); return seq; }
+
+ private:
+  void post(unsigned int code,tpoint t) { std::lock_guard<std::mutex> l(mutex); push(code,t); }
+  void push(unsigned int code,tpoint t) { ring[seq%SYNTH_TRIGLINE_SIZE].code=code; ring[seq%SYNTH_TRIGLINE_SIZE].t=t; seq++; }
+
+  std::mutex mutex; event ring[SYNTH_TRIGLINE_SIZE]; uint64_t seq;
+  double stimSecs; tpoint nextStim; std::minstd_rand rng;
+};
+
+inline trigline& synthTrigLine() { static trigline t; return t; }
+
 class channel {
  public:
   enum channel_type {none,reference,bipolar,trigger,sample_counter,impedance_reference,impedance_ground };
@@ -101,44 +186,161 @@ inline std::ostream& operator<<(std::ostream &out,const channel &c) {
 
 class stream {
  public:
-  stream(unsigned int c,unsigned int smpRate) {
-   chnCount=c;
+  stream(const std::vector<channel> &cl,unsigned int smpRate,const synthparams &sp,unsigned int seed) {
+   chnCount=cl.size();
    if (smpRate==0) { impMode=true; smpCount=1; }
-   else { impMode=false; smpCount=100;
-    t=0.; // chnList=cl;
+   else { impMode=false; smpCount=0; produced=0; rate=smpRate; p=sp; counter=0.;
+    start=std::chrono::steady_clock::now();
+    rng.seed(seed); std::uniform_real_distribution<double> u(0.,1.);
+    clock=1.+p.driftPpm*1e-6*(2.*u(rng)-1.); // This amp's sample clock vs. nominal
     dc=0.001000; // to simulate High-Pass
-    a0=0.000100; // 100uV mimicks EEG
-    dt=1./(double)(smpRate); frqA=10.; frqB=48.;
-    trigger=counter=0.;
+    setup(cl,u);
    }
   }
   ~stream() {}
 
   buffer getData() {
-   buffer b;
-   if (impMode) {
+   if (impMode) { buffer b;
     b.setCounts(chnCount-2,1); // bipolars aren't counted for during imp mode?? Not handled currently!!!
-    for (unsigned int cc=0;cc<chnCount;cc++) b.setSample(0,cc,2.71);
-   } else {
-    b.setCounts(chnCount,smpCount);
-    for (unsigned int sc=0;sc<smpCount;sc++,t+=dt,counter+=1.) {
-     for (unsigned int cc=0;cc<chnCount-2;cc++) {
-      b.setSample(cc,sc,dc+(a0*1.0)*cos(2.0*M_PI*frqA*t)+(a0*1.0)*sin(2.0*M_PI*frqB*t));
-     }
-     b.setSample(chnCount-2,sc,trigger); b.setSample(chnCount-1,sc,counter);
-    }
+    for (unsigned int cc=0;cc<chnCount-2;cc++) b.setSample(cc,0,2.71);
+    return b;
    }
+   // As with a real amp: whatever has accumulated since the previous call (100 samples pending at start)
+   uint64_t due=100+(uint64_t)(std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count()*rate*clock);
+   smpCount=due-produced;
+   buffer &b=out[flip]; flip^=1; b.setCounts(chnCount,smpCount);
+   synthesize(b,smpCount);
+   produced=due;
    return b;
   }
 
-  bool impMode; double trigger,counter;
-  unsigned int chnCount,smpCount; double dc,a0,frqA,frqB,t,dt;
+  bool impMode; double counter;
+  unsigned int chnCount,smpCount,rate;
+
+ private:
+  void setup(const std::vector<channel> &cl,std::uniform_real_distribution<double> &u) {
+   unsigned int bip=0; double fs=rate,var=0.,x;
+   physCount=chnCount-2; padCount=(physCount+7)&~7u;
+   gA.assign(padCount,0.f); gL.assign(padCount,0.f); gB.assign(padCount,0.f); gE.assign(padCount,0.f);
+   mix.assign(padCount,0.f); rs.resize(padCount); pk.assign(SYNTH_PINK_POLES*padCount,0.f);
+   for (unsigned int c=0;c<physCount;c++) { rs[c]=(uint32_t)(rng()|1u);
+    if (cl[c].getType()==channel::bipolar) { // First bipolar taken as VEOG
+     gA[c]=0.1f; gB[c]=(bip==0) ? 1.5f : 0.3f; gE[c]=0.1f; bip++;
+    } else { x=(double)(c%32)/31.; // Frontal to posterior, crudely (both halves of the eego cap run so)
+     gA[c]=(float)(0.2+0.8*x); gB[c]=(float)exp(-6.*x); gE[c]=(float)(0.3+0.7*sin(M_PI*x));
+    }
+    gL[c]=(float)(0.5+u(rng)); // Electrode impedance dependent
+   }
+   for (unsigned int c=physCount;c<padCount;c++) rs[c]=1u;
+   // 1/f background: one-pole lowpasses at 0.25,1,4.. Hz, gains ~1/sqrt(corner), scaled to noiseUV RMS
+   for (unsigned int k=0;k<SYNTH_PINK_POLES;k++) { double fk=0.25*pow(4.,k);
+    pa[k]=(float)exp(-2.*M_PI*std::min(fk,0.45*fs)/fs); pc[k]=(float)((1.-pa[k])/sqrt(fk));
+   }
+   for (unsigned int j=0;j<SYNTH_PINK_POLES;j++) for (unsigned int k=0;k<SYNTH_PINK_POLES;k++)
+    var+=(double)pc[j]*pc[k]/(1.-(double)pa[j]*pa[k])/12.; // Uniform [-.5,.5) input
+   for (unsigned int k=0;k<SYNTH_PINK_POLES;k++) pc[k]*=(float)(p.noiseUV*1e-6/sqrt(var));
+   // Oscillators as phasors, rotated once per sample
+   aFreq=9.+2.*u(rng); aRe=1.; aIm=0.; aRotRe=cos(2.*M_PI*aFreq/fs); aRotIm=sin(2.*M_PI*aFreq/fs);
+   aEnv=0.; aTarget=0.; aLeft=(unsigned int)(fs*u(rng)); aK=1.-exp(-1./(0.1*fs));
+   lRe=1.; lIm=0.; lRotRe=cos(2.*M_PI*p.lineFreq/fs); lRotIm=sin(2.*M_PI*p.lineFreq/fs);
+   for (unsigned int h=1;h<=SYNTH_MAX_HARMONICS;h++)
+    lAmp[h-1]=(h<=p.harmonics && h*p.lineFreq<0.5*fs) ? p.lineUV*1e-6*((h%2) ? 1./h : 0.3/h) : 0.;
+   // Blink: critically damped two-pole, peaking ~100ms after the onset
+   bPole=exp(-1./(0.1*fs)); b1=b2=0.; bNorm=1./(0.1*fs*exp(-1.)); bLeft=(unsigned int)(fs*(2.+4.*u(rng)));
+   // ERP template: P1, N1, P2, P3 as Gaussians, unity peak
+   erp.resize((unsigned int)(SYNTH_ERP_SECS*fs)); double mx=0.;
+   for (unsigned int i=0;i<erp.size();i++) { double t=i/fs;
+    erp[i]=(float)(0.3*exp(-pow((t-.10)/.015,2)/2.)-0.5*exp(-pow((t-.17)/.02,2)/2.)+
+                   0.4*exp(-pow((t-.23)/.03,2)/2.)+1.0*exp(-pow((t-.35)/.06,2)/2.));
+    mx=std::max(mx,(double)fabs(erp[i]));
+   }
+   for (float &e:erp) e/=(float)mx;
+   erpPos=erp.size(); erpAmp=0.;
+   trigSeq=synthTrigLine().head();
+   // Both alternating output buffers sized for up to a second per call
+   out[0]=buffer(chnCount,0); out[1]=buffer(chnCount,0); flip=0;
+   out[0].reserve((size_t)chnCount*rate); out[1].reserve((size_t)chnCount*rate);
+  }
+
+  void synthesize(buffer &b,unsigned int n) { double *d=b.data(),aVal,lVal,bVal,eVal,re,hRe,hIm,trig;
+   unsigned int evCount,evNext=0; int64_t evIdx[SYNTH_BLOCK_EVENTS]; unsigned int evCode[SYNTH_BLOCK_EVENTS];
+   // Trigger events on the line, mapped onto this amp's own sample clock
+   evCount=synthTrigLine().since(trigSeq,evBuf,SYNTH_BLOCK_EVENTS);
+   for (unsigned int i=0;i<evCount;i++) {
+    evIdx[i]=100+(int64_t)(std::chrono::duration<double>(evBuf[i].t-start).count()*rate*clock); evCode[i]=evBuf[i].code;
+    if (evIdx[i]<(int64_t)produced) evIdx[i]=produced; // Late pickup; first sample of the block
+    for (unsigned int j=i;j>0 && evIdx[j]<evIdx[j-1];j--) { std::swap(evIdx[j],evIdx[j-1]); std::swap(evCode[j],evCode[j-1]); }
+   }
+   for (unsigned int sc=0;sc<n;sc++,counter+=1.,d+=chnCount) { trig=0.;
+    while (evNext<evCount && evIdx[evNext]<=(int64_t)(produced+sc)) { unsigned int c=evCode[evNext++];
+     trig=c; if (c!=AMP_SYNC_TRIG && p.erpUV>0.) { erpPos=0; erpAmp=p.erpUV*1e-6*erpScale[(c-1)%4]; }
+    }
+    // Alpha: phasor and burst envelope
+    re=aRe*aRotRe-aIm*aRotIm; aIm=aRe*aRotIm+aIm*aRotRe; aRe=re;
+    if (aLeft--==0) { aTarget=(aTarget>0.) ? 0. : 1.; aLeft=(unsigned int)(rate*(0.5+2.5*unit())); }
+    aEnv+=(aTarget-aEnv)*aK; aVal=p.alphaUV*1e-6*aEnv*aRe;
+    // Line noise: harmonics as powers of the fundamental phasor
+    re=lRe*lRotRe-lIm*lRotIm; lIm=lRe*lRotIm+lIm*lRotRe; lRe=re;
+    lVal=lAmp[0]*lRe; hRe=lRe; hIm=lIm;
+    for (unsigned int h=1;h<p.harmonics && h<SYNTH_MAX_HARMONICS;h++) { re=hRe*lRe-hIm*lIm; hIm=hRe*lIm+hIm*lRe; hRe=re; lVal+=lAmp[h]*hRe; }
+    // Blink
+    if (p.blinkUV>0. && bLeft--==0) { b1+=1.; bLeft=(unsigned int)(rate*(2.+6.*unit())); }
+    b1*=bPole; b2=b2*bPole+b1; bVal=p.blinkUV*1e-6*bNorm*b2;
+    // ERP
+    eVal=(erpPos<erp.size()) ? erpAmp*erp[erpPos++] : 0.;
+    mixRow(d,(float)(dc),(float)aVal,(float)lVal,(float)bVal,(float)eVal);
+    d[chnCount-2]=trig; d[chnCount-1]=counter;
+   }
+   // Keep the phasors on the unit circle
+   re=1.5-0.5*(aRe*aRe+aIm*aIm); aRe*=re; aIm*=re; re=1.5-0.5*(lRe*lRe+lIm*lIm); lRe*=re; lIm*=re;
+  }
+
+  // One sample of all channels: noise bank update and mixing of the common sources.
+  void mixRow(double *d,float vDC,float vA,float vL,float vB,float vE) { unsigned int c=0; uint32_t x; float u,s,v;
+#ifdef __AVX2__
+   const __m256 mDC=_mm256_set1_ps(vDC),mA=_mm256_set1_ps(vA),mL=_mm256_set1_ps(vL),mB=_mm256_set1_ps(vB),mE=_mm256_set1_ps(vE);
+   const __m256i one=_mm256_set1_epi32(0x3f800000); const __m256 half=_mm256_set1_ps(1.5f);
+   for (;c+8<=padCount;c+=8) { __m256i r=_mm256_loadu_si256((const __m256i*)&rs[c]); __m256 vu,vs,vp;
+    r=_mm256_xor_si256(r,_mm256_slli_epi32(r,13)); r=_mm256_xor_si256(r,_mm256_srli_epi32(r,17)); r=_mm256_xor_si256(r,_mm256_slli_epi32(r,5));
+    _mm256_storeu_si256((__m256i*)&rs[c],r);
+    vu=_mm256_sub_ps(_mm256_castsi256_ps(_mm256_or_si256(_mm256_srli_epi32(r,9),one)),half); // [-.5,.5)
+    vs=mDC;
+    for (unsigned int k=0;k<SYNTH_PINK_POLES;k++) { float *q=&pk[k*padCount+c];
+     vp=_mm256_fmadd_ps(_mm256_set1_ps(pa[k]),_mm256_loadu_ps(q),_mm256_mul_ps(_mm256_set1_ps(pc[k]),vu));
+     _mm256_storeu_ps(q,vp); vs=_mm256_add_ps(vs,vp);
+    }
+    vs=_mm256_fmadd_ps(_mm256_loadu_ps(&gA[c]),mA,vs); vs=_mm256_fmadd_ps(_mm256_loadu_ps(&gL[c]),mL,vs);
+    vs=_mm256_fmadd_ps(_mm256_loadu_ps(&gB[c]),mB,vs); vs=_mm256_fmadd_ps(_mm256_loadu_ps(&gE[c]),mE,vs);
+    _mm256_storeu_ps(&mix[c],vs);
+   }
+#endif
+   for (;c<padCount;c++) { x=rs[c]; x^=x<<13; x^=x>>17; x^=x<<5; rs[c]=x;
+    union { uint32_t i; float f; } bits; bits.i=(x>>9)|0x3f800000; u=bits.f-1.5f;
+    s=vDC; for (unsigned int k=0;k<SYNTH_PINK_POLES;k++) { v=pa[k]*pk[k*padCount+c]+pc[k]*u; pk[k*padCount+c]=v; s+=v; }
+    mix[c]=s+gA[c]*vA+gL[c]*vL+gB[c]*vB+gE[c]*vE;
+   }
+   for (c=0;c<physCount;c++) d[c]=mix[c];
+  }
+
+  double unit() { return (rng()>>11)*(1./9007199254740992.); } // [0,1)
+
+  static const unsigned int SYNTH_MAX_HARMONICS=16;
+  synthparams p; std::mt19937_64 rng;
+  std::chrono::steady_clock::time_point start; uint64_t produced; double clock,dc;
+  unsigned int physCount,padCount; buffer out[2]; unsigned int flip;
+  std::vector<float> gA,gL,gB,gE,mix,pk; std::vector<uint32_t> rs; float pa[SYNTH_PINK_POLES],pc[SYNTH_PINK_POLES];
+  double aFreq,aRe,aIm,aRotRe,aRotIm,aEnv,aTarget,aK; unsigned int aLeft;
+  double lRe,lIm,lRotRe,lRotIm,lAmp[SYNTH_MAX_HARMONICS];
+  double bPole,b1,b2,bNorm; unsigned int bLeft;
+  std::vector<float> erp; unsigned int erpPos; double erpAmp;
+  uint64_t trigSeq; trigline::event evBuf[SYNTH_BLOCK_EVENTS];
+  const double erpScale[4]={1.0,0.6,1.4,0.8}; // Per stimulus code
 };
 
 class amplifier {
  public:
-  amplifier(std::string s) {
-   serialNumber=s;
+  amplifier(std::string s,const synthparams &sp) {
+   serialNumber=s; params=sp;
   }
   ~amplifier() {}
 
@@ -158,25 +360,25 @@ class amplifier {
 
   stream* OpenEegStream(int sampling_rate,double reference_range,double bipolar_range,const std::vector<channel>& channel_list) {
    impedanceMode=false; smpRate=sampling_rate; refRange=reference_range; bipRange=bipolar_range; chnList=channel_list;
-   str=new stream(chnList.size(),smpRate);
+   str=new stream(chnList,smpRate,params,std::stoi(serialNumber));
    return str;
   }
 
   stream* OpenImpedanceStream(const std::vector<channel>& channel_list) {
    impedanceMode=true; chnList=channel_list;
-   str=new stream(chnList.size(),0);
+   str=new stream(chnList,0,params,0);
    return str;
   }
 
  private:
-  std::string serialNumber; bool impedanceMode;
+  std::string serialNumber; bool impedanceMode; synthparams params;
   unsigned int smpRate; float refRange,bipRange; std::vector<channel> chnList;
   stream *str;
 };
 
 class factory { // Creates any number of virtual amplifiers identical to EE.
  public:
-  factory() {
+  factory(const synthparams &sp=synthDefaults()) {
    // Create serial pool with shuffled order
    unsigned int i,no; amplifier *a;
    for (i=0,no=100071;i<EE_MAX_AMPCOUNT;i++) { sNos.push_back(std::to_string(no)); no++; }
@@ -185,8 +387,9 @@ class factory { // Creates any number of virtual amplifiers identical to EE.
    std::shuffle(sNos.begin(),sNos.end(),rng);
    for (std::string s:sNos) std::cout << s;
    
-   // Create desired number of amplifier
-   for (i=0;i<EE_AMPCOUNT;i++) { a=new amplifier(sNos[i]); amps.push_back(a); }
+   // Create the whole pool, as if all were plugged in; the daemon picks AMP|COUNT of them
+   for (i=0;i<EE_MAX_AMPCOUNT;i++) { a=new amplifier(sNos[i],sp); amps.push_back(a); }
+   synthTrigLine().setStimulus(sp.stimSecs);
   }
   std::vector<amplifier*> getAmplifiers() {
    return amps;
@@ -25,6 +25,7 @@ Octopus-ReEL - Realtime Encephalography Laboratory Network
 #define _EEX_H
 
 #include "../acqglobals.h"
+#include "cbuf.h"
 
 #ifdef EEMAGINE
 using namespace eemagine::sdk;
@@ -32,8 +33,6 @@ using namespace eemagine::sdk;
 using namespace eesynth;
 #endif
 
-const unsigned int IIR_HIST_SIZE=4;
-
 typedef struct _eex {
  unsigned int idx;
  amplifier *amp;
@@ -47,9 +46,11 @@ typedef struct _eex {
  unsigned int smpIdx; // Absolute Sample Index, as sent from the amplifier
  std::vector<float> imps;
  quint64 cBufIdx; //,cBufIdxP;
- std::vector<sample> cBuf;
- //std::vector<sample> cBufF;
- std::vector<std::array<double,IIR_HIST_SIZE> > fX,fY; // IIR filter History
+ qint64 fetchNs; // CLOCK_MONOTONIC when the last block was fetched
+ cbuf cBuf; // Acquisition history, per-field blocks (cbuf.h)
+ std::vector<double> iirZ; int iirDesign; // IIR bank section states [sec][2][chn], for design #iirDesign
+ std::vector<double> maSum0,maSum1,maCM; // Running sums of the MA/HP/CM stage (mafilter.h)
+ std::vector<float> maCom0; unsigned int maCom0Size; // Last maCom0Size rows of com0, [row][chn]
 } eex;
 
 #endif
@@ -0,0 +1,147 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* Runtime-designed IIR filter bank, cascaded onto the output (dataF) of the MA/high-pass
+   stage. Designs are built once at startup from the FLT|APPEND lines of the .conf file
+   as cascades of second-order sections:
+
+     LP/HP: Butterworth of the given order at f1 (bilinear transform, prewarped)
+     BP:    Butterworth HP at f1 followed by Butterworth LP at f2, each of the given order
+     NOTCH: f1 and its harmonics up to the given count, each f2 Hz wide
+
+   Several lines with the same name are cascaded into one design. Only the index of the
+   active design changes at runtime (CS_ACQ_SETFILTER), so switching never allocates; the
+   per-channel section state lives in eex and is cleared by the owning amp worker when it
+   sees a new design. Sections run in transposed direct form II, in double, across
+   channels (AVX2, 4 channels per step) like the kernels of mafilter.h. */
+
+#ifndef IIRBANK_H
+#define IIRBANK_H
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <atomic>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+const unsigned int IIR_MAX_DESIGNS=8;
+const unsigned int IIR_MAX_SECTIONS=16;
+const unsigned int IIR_MAX_ORDER=8;
+
+typedef struct _biquad {
+ double b0,b1,b2,a1,a2; // a0 normalized to 1
+} biquad;
+
+typedef struct _iirdesign {
+ std::string name;
+ unsigned int secCount;
+ biquad sec[IIR_MAX_SECTIONS];
+} iirdesign;
+
+// One sample row of n channels through the sections of design d, in place. z holds the
+// two state rows of every section, [sec][2][n].
+inline void iirRowStep(const iirdesign &d,float *x,double *z,unsigned int n) {
+ unsigned int c=0; double v,y; double *z1,*z2;
+#ifdef __AVX2__
+ __m256d vv,vy,vz1,vz2;
+ for (;c+4<=n;c+=4) { vv=_mm256_cvtps_pd(_mm_loadu_ps(x+c));
+  for (unsigned int s=0;s<d.secCount;s++) { const biquad &q=d.sec[s]; z1=z+2*s*n+c; z2=z1+n;
+   vz1=_mm256_loadu_pd(z1); vz2=_mm256_loadu_pd(z2);
+   vy=_mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(q.b0),vv),vz1);
+   vz1=_mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(_mm256_set1_pd(q.b1),vv),_mm256_mul_pd(_mm256_set1_pd(q.a1),vy)),vz2);
+   vz2=_mm256_sub_pd(_mm256_mul_pd(_mm256_set1_pd(q.b2),vv),_mm256_mul_pd(_mm256_set1_pd(q.a2),vy));
+   _mm256_storeu_pd(z1,vz1); _mm256_storeu_pd(z2,vz2); vv=vy;
+  }
+  _mm_storeu_ps(x+c,_mm256_cvtpd_ps(vv));
+ }
+#endif
+ for (;c<n;c++) { v=x[c];
+  for (unsigned int s=0;s<d.secCount;s++) { const biquad &q=d.sec[s]; z1=z+2*s*n+c; z2=z1+n;
+   y=q.b0*v+*z1; *z1=q.b1*v-q.a1*y+*z2; *z2=q.b2*v-q.a2*y; v=y;
+  }
+  x[c]=(float)v;
+ }
+}
+
+class IIRBank {
+ public:
+  IIRBank() { active=-1; }
+
+  // Appends the sections of one FLT|APPEND line to design "name" (created if new).
+  // Returns false if the parameters are out of range or the design would not fit.
+  bool append(const std::string &name,const std::string &kind,unsigned int order,double f1,double f2,double fs) {
+   iirdesign *d=0; biquad q[IIR_MAX_SECTIONS]; unsigned int n=0; double nyq=fs/2.;
+   if (order<1 || order>IIR_MAX_ORDER || f1<=0. || f1>=nyq) return false;
+   if (kind=="LP") n=butterworth(q,order,f1,fs,false);
+   else if (kind=="HP") n=butterworth(q,order,f1,fs,true);
+   else if (kind=="BP") { if (f2<=f1 || f2>=nyq) return false;
+    n=butterworth(q,order,f1,fs,true); n+=butterworth(q+n,order,f2,fs,false);
+   } else if (kind=="NOTCH") { if (f2<=0.) return false;
+    for (unsigned int h=1;h<=order && h*f1<nyq;h++) q[n++]=notch(h*f1,f2,fs);
+   } else return false;
+   for (iirdesign &x:designs) if (x.name==name) d=&x;
+   if (!d) { if (designs.size()>=IIR_MAX_DESIGNS) return false;
+    designs.push_back(iirdesign()); d=&designs.back(); d->name=name; d->secCount=0;
+   }
+   if (d->secCount+n>IIR_MAX_SECTIONS) return false;
+   for (unsigned int i=0;i<n;i++) d->sec[d->secCount++]=q[i];
+   return true;
+  }
+
+  int find(const std::string &name) const {
+   for (unsigned int i=0;i<designs.size();i++) if (designs[i].name==name) return i;
+   return -1;
+  }
+
+  // Design to be applied from the next block on; -1 switches the bank off.
+  bool select(int idx) { if (idx<-1 || idx>=(int)designs.size()) return false; active=idx; return true; }
+
+  std::vector<iirdesign> designs; // Fixed after startup
+  std::atomic<int> active;
+
+ private:
+  // Butterworth LP/HP of the given order as biquads (plus one first-order section if odd).
+  static unsigned int butterworth(biquad *q,unsigned int order,double fc,double fs,bool hp) {
+   unsigned int n=0; double k=tan(M_PI*fc/fs),k2=k*k,qk,norm;
+   for (unsigned int i=0;i<order/2;i++,n++) { qk=1./(2.*sin(M_PI*(2*i+1)/(2.*order)));
+    norm=1./(1.+k/qk+k2);
+    q[n].b0=hp ? norm : k2*norm; q[n].b1=hp ? -2.*q[n].b0 : 2.*q[n].b0; q[n].b2=q[n].b0;
+    q[n].a1=2.*(k2-1.)*norm; q[n].a2=(1.-k/qk+k2)*norm;
+   }
+   if (order%2) { norm=1./(1.+k);
+    q[n].b0=hp ? norm : k*norm; q[n].b1=hp ? -norm : k*norm; q[n].b2=0.;
+    q[n].a1=(k-1.)*norm; q[n].a2=0.; n++;
+   }
+   return n;
+  }
+
+  static biquad notch(double f0,double bw,double fs) { biquad q; double w0=2.*M_PI*f0/fs,alpha=sin(w0)*bw/(2.*f0),a0=1.+alpha;
+   q.b0=1./a0; q.b1=-2.*cos(w0)/a0; q.b2=1./a0; q.a1=-2.*cos(w0)/a0; q.a2=(1.-alpha)/a0;
+   return q;
+  }
+};
+
+#endif
@@ -0,0 +1,81 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* The online filtering stage of AcqThread -- centered convN moving average (50Hz and
+   harmonics), past convL mean subtraction (high-pass) and the running common-mode
+   noise level over cmL samples -- as O(1)-per-sample running sums.
+
+   One maFilterStep() call advances all channels of one amp by one sample. Within
+   every row handed in, the channels are contiguous, hence the update is vectorized
+   across channels (AVX2, 4 channels per step in double) with a plain scalar loop as
+   fallback/tail. The running sums are kept in double, so that hours of add/subtract
+   recursion do not drift; the per-sample outputs stay float as in struct sample.
+   com0 is the only intermediate read back (cmL samples later), so the caller keeps a
+   short ring of it outside the acquisition history. */
+
+#ifndef MAFILTER_H
+#define MAFILTER_H
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+typedef struct _marow {
+ const float *dHead0,*dTail0; // data entering/leaving the centered convN window
+ const float *dCur;           // data at the window center
+ const float *dHead1,*dTail1; // data entering/leaving the past convL window
+ const float *cHead,*cTail;   // com0 entering/leaving the cmL window
+ float *com0;                 // output at the window center
+ float *dataF,*curCM;         // outputs at the (delayed) filtered sample
+} marow;
+
+inline void maFilterStep(const marow &r,unsigned int n,double invN,double invL,
+                         double *s0,double *s1,double *cm) {
+ unsigned int c=0; double m,d;
+#ifdef __AVX2__
+ const __m256d vInvN=_mm256_set1_pd(invN),vInvL=_mm256_set1_pd(invL);
+ __m256d a0,a1,a2,vm,vd;
+ for (;c+4<=n;c+=4) {
+  a0=_mm256_add_pd(_mm256_loadu_pd(s0+c),_mm256_sub_pd(_mm256_cvtps_pd(_mm_loadu_ps(r.dHead0+c)),
+                                                       _mm256_cvtps_pd(_mm_loadu_ps(r.dTail0+c))));
+  a1=_mm256_add_pd(_mm256_loadu_pd(s1+c),_mm256_sub_pd(_mm256_cvtps_pd(_mm_loadu_ps(r.dHead1+c)),
+                                                       _mm256_cvtps_pd(_mm_loadu_ps(r.dTail1+c))));
+  a2=_mm256_add_pd(_mm256_loadu_pd(cm+c),_mm256_sub_pd(_mm256_cvtps_pd(_mm_loadu_ps(r.cHead+c)),
+                                                       _mm256_cvtps_pd(_mm_loadu_ps(r.cTail+c))));
+  _mm256_storeu_pd(s0+c,a0); _mm256_storeu_pd(s1+c,a1); _mm256_storeu_pd(cm+c,a2);
+  vm=_mm256_mul_pd(a0,vInvN); vd=_mm256_sub_pd(_mm256_cvtps_pd(_mm_loadu_ps(r.dCur+c)),vm);
+  _mm_storeu_ps(r.com0+c,_mm256_cvtpd_ps(_mm256_mul_pd(vd,vd)));
+  _mm_storeu_ps(r.dataF+c,_mm256_cvtpd_ps(_mm256_sub_pd(vm,_mm256_mul_pd(a1,vInvL))));
+  _mm_storeu_ps(r.curCM+c,_mm256_cvtpd_ps(a2));
+ }
+#endif
+ for (;c<n;c++) {
+  s0[c]+=(double)r.dHead0[c]-(double)r.dTail0[c];
+  s1[c]+=(double)r.dHead1[c]-(double)r.dTail1[c];
+  cm[c]+=(double)r.cHead[c]-(double)r.cTail[c];
+  m=s0[c]*invN; d=(double)r.dCur[c]-m;
+  r.com0[c]=(float)(d*d); r.dataF[c]=(float)(m-s1[c]*invL); r.curCM[c]=(float)cm[c];
+ }
+}
+
+#endif
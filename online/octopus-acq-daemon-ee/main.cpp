@@ -58,11 +58,11 @@ Octopus-ReEL - Realtime Encephalography Laboratory Network
 #include "acqdaemongui.h"
 #include "acqthread.h"
 
-int main(int argc,char *argv[]) {
- QApplication app(argc,argv);
+int main(int argc,char *argv[]) { int ret;
+ QApplication app(argc,argv); rtLog().start();
  AcqDaemon acqDaemon(&app);
  AcqThread acqThread(&acqDaemon);
  AcqDaemonGUI acqDaemonGUI(&acqDaemon); acqDaemonGUI.show();
  acqThread.start(QThread::HighestPriority);
- return app.exec();
+ ret=app.exec(); rtLog().stop(); return ret;
 }
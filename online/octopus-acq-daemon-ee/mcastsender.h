@@ -0,0 +1,129 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* Multicast/UDP sender (NET|MCAST). One thread for all receivers: it follows the
+   tcpBuffer ring like a ClientHandler does (same publish wakeup, same guard zone and
+   overrun rule) and sends the MCAST_FIELDS frames of each published span in
+   sequence-numbered datagrams of up to payload bytes, header and frames gathered by
+   sendmsg() without an intermediate copy. Datagrams are sent as soon as a span is
+   published, not held back to fill up. See ../mcastpacket.h for the format and the
+   receiver side. */
+
+#ifndef MCASTSENDER_H
+#define MCASTSENDER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QVector>
+#include <QtNetwork>
+#include <atomic>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../acqglobals.h"
+#include "../tcpsample.h"
+#include "../mcastpacket.h"
+
+class McastSender : public QThread {
+ Q_OBJECT
+ public:
+  McastSender(QString grp,quint16 p,int t,unsigned int pl,QString ifc,unsigned int ac,QVector<tcpsample> *tb,
+              std::atomic<quint64> *pidx,quint64 g,QMutex *dm,QWaitCondition *dr,bool *r,unsigned int ses,QObject *parent=0) : QThread(parent) {
+   group=grp; port=p; ttl=t; iface=ifc; tcpBuffer=tb; tcpBufPIdx=pidx; tcpBufGuard=g;
+   dataMutex=dm; dataReady=dr; daemonRunning=r; session=ses;
+   subscription.set(mcastSubscription(),ac);
+   framesPerPacket=qMax(1u,qMin(pl,MCAST_DATAGRAM_MAX-(unsigned int)sizeof(mcastheader))/subscription.frameSize);
+   seq=0; packets=overruns=lostCount=sendErrors=retxRequests=retxFrames=0; stopRequested=false;
+   setObjectName("McastSender");
+  }
+
+  virtual void run() {
+   quint64 tcpBufSize=tcpBuffer->size(),tcpBufSpan=tcpBufSize-tcpBufGuard,pIdx,cIdx,count;
+   int fd,one=1,sndBuf=4<<20; sockaddr_in sa; in_addr ifa; unsigned char mttl=ttl; mcastheader h; iovec iov[2]; msghdr m; ssize_t n;
+   QByteArray out; out.resize(framesPerPacket*subscription.frameSize);
+
+   std::memset(&sa,0,sizeof(sa)); sa.sin_family=AF_INET; sa.sin_port=htons(port);
+   if ((fd=socket(AF_INET,SOCK_DGRAM,0))<0 || inet_pton(AF_INET,group.toLatin1().constData(),&sa.sin_addr)!=1) {
+    qDebug() << "octopus_acqd: <McastSender> Cannot set up UDP socket for" << group; return;
+   }
+   setsockopt(fd,SOL_SOCKET,SO_SNDBUF,&sndBuf,sizeof(sndBuf));
+   if (IN_MULTICAST(ntohl(sa.sin_addr.s_addr))) {
+    setsockopt(fd,IPPROTO_IP,IP_MULTICAST_TTL,&mttl,sizeof(mttl));
+    setsockopt(fd,IPPROTO_IP,IP_MULTICAST_LOOP,&one,sizeof(one)); // Receivers on this host, too
+    if (inet_pton(AF_INET,iface.toLatin1().constData(),&ifa)==1) setsockopt(fd,IPPROTO_IP,IP_MULTICAST_IF,&ifa,sizeof(ifa));
+   } else setsockopt(fd,SOL_SOCKET,SO_BROADCAST,&one,sizeof(one));
+   if (::connect(fd,(sockaddr*)&sa,sizeof(sa))<0) {
+    qDebug() << "octopus_acqd: <McastSender> Cannot reach" << group; ::close(fd); return;
+   }
+   qDebug() << "octopus_acqd: <McastSender> Streaming to" << group << ":" << port << "Bytes/sample:" << subscription.frameSize
+            << "Samples/datagram:" << framesPerPacket << "Session:" << session;
+
+   std::memset(&h,0,sizeof(h)); h.magic=MCAST_MAGIC; h.session=session; h.frameSize=subscription.frameSize;
+   iov[0].iov_base=&h; iov[0].iov_len=sizeof(h); iov[1].iov_base=out.data();
+   std::memset(&m,0,sizeof(m)); m.msg_iov=iov; m.msg_iovlen=2;
+   tcpBufCIdx=*tcpBufPIdx;
+
+   while (*daemonRunning && !stopRequested) {
+    dataMutex->lock();
+     while ((pIdx=*tcpBufPIdx)==tcpBufCIdx && *daemonRunning && !stopRequested)
+      if (!dataReady->wait(dataMutex,ACQ_CLIENT_IDLE_MSECS)) break;
+    dataMutex->unlock();
+
+    while (tcpBufCIdx<pIdx) {
+     if (*tcpBufPIdx-tcpBufCIdx>tcpBufSpan) { // Lapped by the producer
+      pIdx=*tcpBufPIdx; overruns++; lostCount+=pIdx-tcpBufCIdx-tcpBufSpan; tcpBufCIdx=pIdx-tcpBufSpan;
+     }
+     cIdx=tcpBufCIdx; count=qMin(pIdx-cIdx,(quint64)framesPerPacket);
+     for (quint64 i=0;i<count;i++)
+      subscription.pack((*tcpBuffer)[(cIdx+i)%tcpBufSize],out.data()+i*subscription.frameSize);
+     if (*tcpBufPIdx-cIdx>tcpBufSpan) { overruns++; lostCount+=count; }
+     else {
+      h.seq=seq++; h.count=count; h.smpIdx=cIdx; iov[1].iov_len=count*subscription.frameSize;
+      while ((n=sendmsg(fd,&m,MSG_NOSIGNAL))<0 && errno==EINTR);
+      if (n<0) sendErrors++; else packets++; // A lost datagram is just a gap for the receivers
+     }
+     tcpBufCIdx+=count;
+    }
+   }
+   ::close(fd);
+   qDebug() << "octopus_acqd: <McastSender> Stopped. Datagrams:" << (quint64)packets << "Overruns:" << (quint64)overruns << "Send errors:" << (quint64)sendErrors;
+  }
+
+  void requestStop() { stopRequested=true; }
+
+  TcpSubscription subscription; QString group; quint16 port; unsigned int session,framesPerPacket;
+  std::atomic<quint64> packets,overruns,lostCount,sendErrors,retxRequests,retxFrames;
+
+ private:
+  int ttl; QString iface; const QVector<tcpsample> *tcpBuffer;
+  std::atomic<quint64> *tcpBufPIdx; quint64 tcpBufCIdx,tcpBufGuard; unsigned int seq;
+  QMutex *dataMutex; QWaitCondition *dataReady; bool *daemonRunning;
+  std::atomic<bool> stopRequested;
+};
+
+#endif
@@ -24,7 +24,9 @@ TARGET = octopus_acqd
 INCLUDEPATH += .
 QT += widgets network
 #LIBS += -leego-SDK
-LIBS += -lasound
+LIBS += -lasound -lrt -lz
+# Built on the acquisition box itself; enables the AVX2 paths of the filter kernels where available
+QMAKE_CXXFLAGS += -march=native
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 # Input
@@ -32,14 +34,32 @@ HEADERS += acqthread.h \
            acqdaemon.h \
            acqdaemongui.h \
            cmlevelframe.h \
-           tcpthread.h \
 	   clienthandler.h \
+           mcastsender.h \
+           decimator.h \
+           recordsink.h \
            eex.h \
+           cbuf.h \
+           mafilter.h \
+           ampworker.h \
+           ampalign.h \
+           sampleclock.h \
+           iirbank.h \
+           audiothread.h \
+           rtsched.h \
+           acqstats.h \
+           ../rtlog.h \
+           triggerout.h \
            ../serial_device.h \
            ../acqglobals.h \
 	   ../chninfo.h \
 	   chntopo.h \
 	   ../sample.h \
 	   ../tcpsample.h \
+	   ../tcpsubscription.h \
+           ../mcastpacket.h \
+           ../shmring.h \
+           ../recfile.h \
+           ../lpccodec.h \
            ../cs_command.h
 SOURCES += main.cpp
@@ -0,0 +1,280 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* Server-side recording (REC section, CS_ACQ_REC_* commands) into the chunked, indexed
+   container of ../recfile.h. A RecordSink follows the tcpBuffer ring like a
+   ClientHandler does -- same publish wakeup, same guard zone and overrun rule -- and
+   gathers REC_CHUNK_MSECS of the selected columns (amp x field x channel, then aux)
+   channel-major, with the triggers as events. A complete chunk is encoded
+   (REC|CODEC) straight into a page-aligned block of the pool; so is an index block
+   every REC|INDEXSECS. The sink never touches the disk itself: blocks go in order to
+   its RecordWriter thread, which writes them at aligned offsets (O_DIRECT where the
+   filesystem has it), keeps REC|PREALLOCMB of the file preallocated ahead of the data
+   and fdatasync()s every REC|FSYNCSECS -- and after each index block, before it
+   points the header at it. A disk that stalls therefore only fills the block pool
+   (REC|BUFFERMB); once that is exhausted the sink is lapped like a slow client, and
+   the recording gets a gap (a chunk boundary), which the sample indices keep exact.
+   Files are created readable by the daemon's user only, or 0640 for REC|GROUP. */
+
+#ifndef RECORDSINK_H
+#define RECORDSINK_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QVector>
+#include <QString>
+#include <QStringList>
+#include <QDebug>
+#include <atomic>
+#include <vector>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../acqglobals.h"
+#include "../tcpsample.h"
+#include "../recfile.h"
+#include "rtsched.h"
+#include "../rtlog.h"
+
+const unsigned int REC_CHUNK_MSECS=1000;  // Samples per chunk, in time
+const unsigned int REC_NAME_MAX=64;       // File name in a cs_command, iparam[4..19]
+
+typedef struct _recblock {
+ char *data; size_t cap,used;
+ bool index; uint64_t indexOff,samples,lost; bool last; // Index blocks: header update after the write
+} recblock;
+
+class RecordWriter : public QThread {
+ Q_OBJECT
+ public:
+  RecordWriter(int f,const char *page0,unsigned int blocks,size_t blockBytes,quint64 headerBytes,quint64 prealloc,
+               unsigned int fsyncSecs,QObject *parent=0) : QThread(parent) { void *p=0;
+   fd=f; preallocBytes=prealloc; fsyncNs=(qint64)fsyncSecs*1000000000LL; pool.resize(blocks);
+   for (recblock &b:pool) { b.data=0; b.cap=0; ensure(b,blockBytes); }
+   if (posix_memalign(&p,REC_PAGE,REC_PAGE)==0) std::memcpy(p,page0,REC_PAGE);
+   header=(char*)p; hdr=(recfileheader*)header;
+   filled=written=0; fileOff=headerBytes; allocEnd=0; finishing=false;
+   bytes=fsyncs=writeErrors=maxWriteNs=0; setObjectName("RecordWriter");
+  }
+  ~RecordWriter() { for (recblock &b:pool) free(b.data); free(header); }
+
+  bool ok() const { for (const recblock &b:pool) if (!b.data) return false; return header!=0; }
+
+  // A block big enough for n bytes; the pool's blocks only ever grow (the final index).
+  static bool ensure(recblock &b,size_t n) { void *p=0;
+   if (b.cap>=n) return true;
+   if (posix_memalign(&p,REC_PAGE,n)) return false;
+   free(b.data); b.data=(char*)p; b.cap=n; return true;
+  }
+
+  // Packer side: the next empty block, waiting up to ms for the writer to free one.
+  recblock* emptyBlock(unsigned int ms) { recblock *b=0; mutex.lock();
+   if (filled-written>=pool.size()) freed.wait(&mutex,ms);
+   if (filled-written<pool.size()) { b=&pool[filled%pool.size()]; b->used=0; b->index=b->last=false; }
+   mutex.unlock(); return b;
+  }
+  void submit() { mutex.lock(); filled++; ready.wakeAll(); mutex.unlock(); } // The block from emptyBlock()
+  void finish() { mutex.lock(); finishing=true; ready.wakeAll(); mutex.unlock(); }
+
+  virtual void run() { qint64 lastSync=monoNs(),t0; recblock *b; bool more;
+   while (true) {
+    mutex.lock();
+     if (written==filled && !finishing) ready.wait(&mutex,ACQ_CLIENT_IDLE_MSECS);
+     more=(written<filled); b=more ? &pool[written%pool.size()] : 0;
+    mutex.unlock();
+    if (more && writeErrors==0) {
+     if (preallocBytes && fileOff+b->used>allocEnd) { // Keep the file's extents ahead of the data
+      if (fallocate(fd,FALLOC_FL_KEEP_SIZE,fileOff,qMax(preallocBytes,(quint64)b->used))==0) allocEnd=fileOff+qMax(preallocBytes,(quint64)b->used);
+      else preallocBytes=0;
+     }
+     t0=monoNs();
+     if (!put(b->data,b->used,fileOff)) { writeErrors++; RTLOG("octopus_acqd: <RecordWriter> Write failed (%s); recording stopped.",strerror(errno)); }
+     t0=monoNs()-t0; if ((quint64)t0>maxWriteNs) maxWriteNs=t0;
+     fileOff+=b->used; bytes+=b->used;
+     if (b->index && writeErrors==0) { // Durable first, then pointed at
+      fdatasync(fd); fsyncs++; lastSync=monoNs();
+      hdr->indexOff=b->indexOff; hdr->dataEnd=fileOff; hdr->sampleCount=b->samples; hdr->lostCount=b->lost; hdr->closed=b->last;
+      if (!put(header,REC_PAGE,0)) writeErrors++;
+     }
+    }
+    if (more) { mutex.lock(); written++; freed.wakeAll(); mutex.unlock(); }
+    if (fsyncNs>0 && monoNs()-lastSync>=fsyncNs && writeErrors==0) { fdatasync(fd); fsyncs++; lastSync=monoNs(); }
+    if (!more && finishing) break;
+   }
+   if (writeErrors==0) fdatasync(fd);
+  }
+
+  quint64 fileSize() const { return fileOff; }
+
+  std::atomic<quint64> bytes,fsyncs,writeErrors,maxWriteNs;
+
+ private:
+  bool put(const char *d,size_t len,quint64 off) { ssize_t n;
+   for (size_t o=0;o<len;o+=n) {
+    while ((n=pwrite(fd,d+o,len-o,off+o))<0 && errno==EINTR);
+    if (n<=0) return false;
+   }
+   return true;
+  }
+
+  int fd; quint64 preallocBytes,allocEnd,fileOff; qint64 fsyncNs; char *header; recfileheader *hdr;
+  std::vector<recblock> pool; quint64 filled,written; bool finishing;
+  QMutex mutex; QWaitCondition ready,freed;
+};
+
+class RecordSink : public QThread {
+ Q_OBJECT
+ public:
+  RecordSink(unsigned int ac,unsigned int sr,QVector<tcpsample> *tb,std::atomic<quint64> *pidx,quint64 g,
+             QMutex *dm,QWaitCondition *dr,bool *r,unsigned int ses,QObject *parent=0) : QThread(parent) {
+   ampCount=ac; sampleRate=sr; tcpBuffer=tb; tcpBufPIdx=pidx; tcpBufGuard=g; dataMutex=dm; dataReady=dr; daemonRunning=r; session=ses;
+   fd=-1; writer=0; samples=overruns=lostCount=0; stopRequested=false;
+   setObjectName("RecordSink");
+  }
+  ~RecordSink() { delete writer; if (fd>=0) ::close(fd); }
+
+  // Creates the file (never over an existing one) and its writer; the recording starts at
+  // the live end of the ring. names: one per physical channel in use, in topology order;
+  // gid>=0 lets that group read the file as well.
+  bool open(const QString &p,unsigned int fields,unsigned int codec,const QStringList &names,unsigned int indexSecs,
+            unsigned int bufferMB,unsigned int preallocMB,unsigned int fsyncSecs,int gid=-1) {
+   recfileheader h; recchannel ch; timespec t; QByteArray fn=p.toLocal8Bit(); std::vector<char> head;
+   path=p; std::memset(&h,0,sizeof(h)); std::memset(&ch,0,sizeof(ch));
+   for (unsigned int a=0;a<ampCount;a++) for (unsigned int f=REC_FIELD_RAW;f<=REC_FIELD_CM;f<<=1) if (fields&f)
+    for (int c=0;c<qMin(names.size(),PHYS_CHN_COUNT);c++) { ch.amp=a; ch.physChn=c; ch.field=f;
+     std::strncpy(ch.name,names[c].toLatin1().constData(),REC_CHN_NAME-1); chns.push_back(ch);
+    }
+   if (fields&REC_FIELD_AUX) for (unsigned int c=0;c<AUX_CHN_COUNT;c++) {
+    std::memset(&ch,0,sizeof(ch)); ch.amp=0xffff; ch.physChn=c; ch.field=REC_FIELD_AUX; snprintf(ch.name,REC_CHN_NAME,"AUX%u",c+1); chns.push_back(ch);
+   }
+   if (chns.empty()) return false;
+   chunkSamples=sampleRate*REC_CHUNK_MSECS/1000; indexEvery=qMax(1u,indexSecs*1000/REC_CHUNK_MSECS);
+   h.magic=REC_MAGIC; h.version=REC_VERSION; h.headerSize=recPad(sizeof(recfileheader)+chns.size()*sizeof(recchannel));
+   h.session=session; h.sampleRate=sampleRate; h.chnCount=chns.size(); h.chunkSamples=chunkSamples;
+   h.startIdx=firstIdx=tcpBufCIdx=*tcpBufPIdx; clock_gettime(CLOCK_REALTIME,&t); h.startNs=(uint64_t)t.tv_sec*1000000000ULL+t.tv_nsec;
+   h.ampCount=ampCount; h.codec=codec; h.indexEvery=indexEvery;
+   head.assign(h.headerSize,0); std::memcpy(head.data(),&h,sizeof(h)); std::memcpy(head.data()+sizeof(h),chns.data(),chns.size()*sizeof(recchannel));
+
+   if ((fd=::open(fn.constData(),O_WRONLY|O_CREAT|O_EXCL|O_DIRECT,0600))>=0) direct=true;
+   else if (errno==EINVAL && (fd=::open(fn.constData(),O_WRONLY|O_CREAT|O_EXCL,0600))>=0) direct=false; // No O_DIRECT here
+   else return false;
+   if (gid>=0 && (fchown(fd,-1,gid)<0 || fchmod(fd,0640)<0)) { ::close(fd); fd=-1; unlink(fn.constData()); return false; }
+   blockBytes=recChunkBound(chns.size(),chunkSamples);
+   writer=new RecordWriter(fd,head.data(),qMax(3u,(unsigned int)(((quint64)bufferMB<<20)/blockBytes)),blockBytes,h.headerSize,
+                           (quint64)preallocMB<<20,fsyncSecs);
+   if (!writer->ok() || !writeHead(head)) { delete writer; writer=0; ::close(fd); fd=-1; unlink(fn.constData()); return false; }
+   this->codec=codec; nextOff=h.headerSize; lastIndex=0; seq=0; n=0; sinceIndex=0;
+   cols.assign(chns.size()*chunkSamples,0.f); ev.reserve(chunkSamples);
+   writer->start(QThread::NormalPriority);
+   return true;
+  }
+
+  virtual void run() { quint64 tcpBufSize=tcpBuffer->size(),tcpBufSpan=tcpBufSize-tcpBufGuard,pIdx;
+   while (*daemonRunning && !stopRequested && writer->writeErrors==0) {
+    dataMutex->lock();
+     while ((pIdx=*tcpBufPIdx)==tcpBufCIdx && *daemonRunning && !stopRequested)
+      if (!dataReady->wait(dataMutex,ACQ_CLIENT_IDLE_MSECS)) break;
+    dataMutex->unlock();
+
+    while (tcpBufCIdx<pIdx && !stopRequested && writer->writeErrors==0) {
+     if (*tcpBufPIdx-tcpBufCIdx>tcpBufSpan) { // Lapped by the producer -- the disk is far behind
+      pIdx=*tcpBufPIdx; overruns++; lostCount+=pIdx-tcpBufCIdx-tcpBufSpan; tcpBufCIdx=pIdx-tcpBufSpan;
+     }
+     if (n==chunkSamples || (n>0 && tcpBufCIdx!=firstIdx+n)) { if (!flushChunk()) continue; } // Full, or a gap after it
+     if (sinceIndex>=indexEvery && !writeIndex(false)) continue;
+     if (n==0) firstIdx=tcpBufCIdx;
+     const tcpsample &t=(*tcpBuffer)[tcpBufCIdx%tcpBufSize];
+     for (size_t k=0;k<chns.size();k++) { const recchannel &c=chns[k]; float &v=cols[k*chunkSamples+n];
+      switch (c.field) {
+       case REC_FIELD_RAW: v=t.amp[c.amp].data[c.physChn]; break;
+       case REC_FIELD_FLT: v=t.amp[c.amp].dataF[c.physChn]; break;
+       case REC_FIELD_CM:  v=t.amp[c.amp].curCM[c.physChn]; break;
+       default:            v=t.aux[c.physChn];
+      }
+     }
+     unsigned int trig=t.trigger;
+     if (*tcpBufPIdx-tcpBufCIdx>tcpBufSpan) continue; // Overwritten while being read: lapped, above
+     if (trig) { recevent e; e.idx=tcpBufCIdx; e.code=trig; e.reserved=0; ev.push_back(e); }
+     n++; tcpBufCIdx++; samples++;
+    }
+   }
+   while (n>0 && writer->writeErrors==0 && !flushChunk());
+   while (writer->writeErrors==0 && !writeIndex(true));
+   writer->finish(); writer->wait();
+   ftruncate(fd,writer->fileSize()); // Cuts the preallocation
+   ::close(fd); fd=-1;
+   qDebug() << "octopus_acqd: <RecordSink> Closed" << path << "Samples:" << (quint64)samples << "Lost:" << (quint64)lostCount
+            << "Chunks:" << seq << "MB:" << writer->bytes/1e6 << "Write errors:" << (quint64)(writer->writeErrors);
+  }
+
+  void requestStop() { stopRequested=true; }
+  unsigned int channelCount() const { return chns.size(); }
+
+  QString path; unsigned int session; RecordWriter *writer;
+  std::atomic<quint64> samples,overruns,lostCount;
+
+ private:
+  // The gathered chunk into the next block; false if the writer has none free in time.
+  bool flushChunk() { recblock *b; recindexentry e;
+   if (!(b=writer->emptyBlock(ACQ_CLIENT_IDLE_MSECS))) return false;
+   b->used=recEncodeChunk(b->data,seq,firstIdx,cols.data(),chns.data(),chns.size(),chunkSamples,n,ev.data(),ev.size(),codec,work);
+   e.off=nextOff; e.firstIdx=firstIdx; e.n=n; e.reserved=0; nextOff+=b->used;
+   writer->submit();
+   idxNew.push_back(e); idxAll.push_back(e); evNew.insert(evNew.end(),ev.begin(),ev.end()); evAll.insert(evAll.end(),ev.begin(),ev.end());
+   seq++; sinceIndex++; n=0; ev.clear();
+   return true;
+  }
+
+  // An index block of the chunks since the last one, or of all (on close).
+  bool writeIndex(bool full) { recblock *b; const std::vector<recindexentry> &x=full ? idxAll : idxNew; const std::vector<recevent> &v=full ? evAll : evNew;
+   if (!(b=writer->emptyBlock(ACQ_CLIENT_IDLE_MSECS))) return false;
+   if (!RecordWriter::ensure(*b,recIndexSize(x.size(),v.size()))) { writer->writeErrors++; return false; }
+   b->used=recEncodeIndex(b->data,lastIndex,full,x.data(),x.size(),v.data(),v.size());
+   b->index=true; b->indexOff=nextOff; b->samples=samples; b->lost=lostCount; b->last=full;
+   lastIndex=nextOff; nextOff+=b->used;
+   writer->submit();
+   idxNew.clear(); evNew.clear(); sinceIndex=0;
+   return true;
+  }
+
+  bool writeHead(const std::vector<char> &head) { void *p=0; ssize_t w=-1; // Aligned copy, for O_DIRECT
+   if (posix_memalign(&p,REC_PAGE,head.size())) return false;
+   std::memcpy(p,head.data(),head.size());
+   while ((w=pwrite(fd,p,head.size(),0))<0 && errno==EINTR);
+   free(p); return w==(ssize_t)head.size();
+  }
+
+  unsigned int ampCount,sampleRate,chunkSamples,indexEvery,codec,seq,n,sinceIndex; int fd; bool direct; size_t blockBytes;
+  std::vector<recchannel> chns; std::vector<float> cols; std::vector<recevent> ev,evNew,evAll; std::vector<recindexentry> idxNew,idxAll;
+  std::vector<unsigned char> work; quint64 firstIdx,nextOff,lastIndex;
+  QVector<tcpsample> *tcpBuffer; std::atomic<quint64> *tcpBufPIdx; quint64 tcpBufCIdx,tcpBufGuard;
+  QMutex *dataMutex; QWaitCondition *dataReady; bool *daemonRunning;
+  std::atomic<bool> stopRequested;
+};
+
+#endif
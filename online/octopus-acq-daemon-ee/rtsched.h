@@ -0,0 +1,93 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* Real-time scheduling helpers of the acquisition loop: monotonic clock in ns, SCHED_FIFO
+   and CPU affinity for the calling thread (SCHED|FIFO, SCHED|AFFINITY), and a fixed-bin
+   histogram the loop feeds every cycle with its wakeup jitter, block size and processing
+   time. Nothing here allocates after construction. */
+
+#ifndef RTSCHED_H
+#define RTSCHED_H
+
+#include <QDebug>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+const unsigned int ACQ_SCHED_REPORT_MSECS=10000; // Histogram report (and reset) period
+
+inline qint64 monoNs() { timespec t; clock_gettime(CLOCK_MONOTONIC,&t); return (qint64)t.tv_sec*1000000000LL+t.tv_nsec; }
+
+inline void sleepUntilNs(qint64 ns) { timespec t; t.tv_sec=ns/1000000000LL; t.tv_nsec=ns%1000000000LL;
+ while (clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&t,0)==EINTR);
+}
+
+// SCHED_FIFO at prio (0: leave the default policy) and pinning to cpus (empty: any).
+inline bool rtSetThread(const char *who,int prio,const std::vector<int> &cpus) { bool ok=true; int err;
+ if (prio>0) { sched_param sp; sp.sched_priority=prio;
+  if ((err=pthread_setschedparam(pthread_self(),SCHED_FIFO,&sp))!=0) { ok=false;
+   qDebug("octopus_acqd: <Sched> %s: SCHED_FIFO %d not granted (%s).",who,prio,strerror(err));
+  }
+ }
+ if (!cpus.empty()) { cpu_set_t cs; CPU_ZERO(&cs); for (int c:cpus) CPU_SET(c,&cs);
+  if ((err=pthread_setaffinity_np(pthread_self(),sizeof(cpu_set_t),&cs))!=0) { ok=false;
+   qDebug("octopus_acqd: <Sched> %s: CPU affinity not set (%s).",who,strerror(err));
+  }
+ }
+ return ok;
+}
+
+class RTHistogram {
+ public:
+  RTHistogram(const char *n,const char *u,double w,unsigned int nb,const char *t="Sched") { name=n; tag=t; unit=u; width=w; bins.assign(nb+1,0); reset(); }
+
+  void add(double v) { unsigned int b=(v<=0.) ? 0 : (unsigned int)(v/width);
+   if (b>=bins.size()) b=bins.size()-1; // Last bin collects everything beyond
+   bins[b]++; count++; sum+=v; if (v<minV) minV=v; if (v>maxV) maxV=v;
+  }
+
+  // Upper edge of the bin holding the p-th fraction of the samples
+  double percentile(double p) const { quint64 n=0,k=(quint64)(p*count);
+   for (unsigned int b=0;b<bins.size();b++) { n+=bins[b]; if (n>k) return std::min((b+1)*width,maxV); }
+   return maxV;
+  }
+
+  void report() const {
+   if (count) qDebug("octopus_acqd: <%s> %-10s n=%-6llu mean=%9.3f p50<%9.3f p99<%9.3f p99.9<%9.3f max=%9.3f %s",
+                     tag.c_str(),name.c_str(),(unsigned long long)count,sum/count,percentile(.5),percentile(.99),percentile(.999),maxV,unit.c_str());
+  }
+
+  double mean() const { return count ? sum/count : 0.; }
+
+  void reset() { std::fill(bins.begin(),bins.end(),0); count=0; sum=0.; minV=1e300; maxV=-1e300; }
+
+ private:
+  std::string tag,name,unit; double width,sum,minV,maxV; quint64 count; std::vector<quint64> bins;
+};
+
+#endif
@@ -0,0 +1,123 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* Host time <-> sample mapping, for triggers that arrive with a timestamp
+   (CS_ACQ_TIMED_TRIG) rather than "now". The sample clock is that of AMP#1 (its history
+   rows, i.e. its eex::smpIdx counter since the epoch), which AmpAlign maps the others
+   onto. Every acquisition round adds one point: the CLOCK_MONOTONIC time at which the
+   fetch of AMP#1 returned and the newest row it brought. A row can only have been
+   acquired before it was fetched, so the rounds that waited least tell best: the last
+   CLOCK_FIT_POINTS rounds are split into CLOCK_FIT_SEGS spans, the host-clock sample
+   period is a least-squares line through the earliest point of each span (the lower
+   envelope, free of the scheduling and USB jitter the others carry), and the offset is
+   the earliest point of all on that slope, less the amps' own transfer latency
+   (TRIG|INJECTLAGUS), which no host-side measurement can see. A point off the line by
+   more than CLOCK_STEP_NS (the stream paused for impedance mode, an amp restart)
+   restarts the fit.
+
+   Timed triggers cross from the command thread to AcqThread in a small lock-free
+   single-producer queue; AcqThread converts and places them itself. */
+
+#ifndef SAMPLECLOCK_H
+#define SAMPLECLOCK_H
+
+#include <QtGlobal>
+#include <atomic>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+
+const unsigned int CLOCK_FIT_POINTS=600;  // Rounds fitted (a minute at 100ms EEGPROBEMS)
+const unsigned int CLOCK_FIT_SEGS=12;     // Lower envelope points of the slope fit
+const unsigned int CLOCK_MIN_POINTS=2*CLOCK_FIT_SEGS; // Nominal rate until then
+const qint64 CLOCK_STEP_NS=1000000000LL;  // Deviation from the line taken as a step
+const unsigned int TIMED_TRIG_QUEUE=64;   // Timed triggers in flight to AcqThread (power of 2)
+const unsigned int TIMED_TRIG_PENDING=16; // Triggers waiting for a sample yet to be packed
+const unsigned int TIMED_TRIG_SEARCH=8;   // Samples looked ahead for a free trigger slot
+
+class SampleClock {
+ public:
+  SampleClock() { init(1000.,0); }
+
+  void init(double rate,qint64 lagNs) { nominal=rate; lag=lagNs; period=1e9/rate; base=0.; anchor=0; n=head=0;
+   t.assign(CLOCK_FIT_POINTS,0.); r.assign(CLOCK_FIT_POINTS,0.);
+  }
+
+  // Returns false if the point restarted the fit.
+  bool add(qint64 ns,quint64 row) { bool cont=true;
+   if (n>=2 && llabs(ns-anchor-(qint64)(base+period*(double)(row-anchorRow)))>CLOCK_STEP_NS) { n=head=0; cont=false; }
+   if (n==0) { anchor=ns; anchorRow=row; }
+   t[head]=(double)(ns-anchor); r[head]=(double)(row-anchorRow); head=(head+1)%CLOCK_FIT_POINTS; if (n<CLOCK_FIT_POINTS) n++;
+   fit(); return cont;
+  }
+
+  bool valid() const { return n>=2; }
+
+  // Fractional AMP#1 row acquired at host time ns (and fetched lag later at the earliest).
+  double rowAt(qint64 ns) const { return (double)anchorRow+((double)(ns-anchor+lag)-base)/period; }
+
+  double ppm() const { return (1e9/period/nominal-1.)*1e6; } // Amp clock vs. host clock
+
+ private:
+  void fit() { double et[CLOCK_FIT_SEGS],er[CLOCK_FIT_SEGS],st=0.,sr=0.,srr=0.,srt=0.,m,mMin; unsigned int i,j=0,k,o;
+   if (n>=CLOCK_MIN_POINTS) { // Earliest point of each span, on the current slope
+    for (k=0;k<CLOCK_FIT_SEGS;k++) { mMin=HUGE_VAL;
+     for (o=k*n/CLOCK_FIT_SEGS;o<(k+1)*n/CLOCK_FIT_SEGS;o++) { i=(head+CLOCK_FIT_POINTS-n+o)%CLOCK_FIT_POINTS;
+      if ((m=t[i]-period*r[i])<mMin) { mMin=m; j=i; }
+     }
+     et[k]=t[j]; er[k]=r[j]; st+=et[k]; sr+=er[k];
+    }
+    st/=CLOCK_FIT_SEGS; sr/=CLOCK_FIT_SEGS;
+    for (k=0;k<CLOCK_FIT_SEGS;k++) { srr+=(er[k]-sr)*(er[k]-sr); srt+=(er[k]-sr)*(et[k]-st); }
+    if (srr>0. && fabs(srt/srr*nominal/1e9-1.)<1e-3) period=srt/srr; // Implausible fits (a stall) are not taken
+   }
+   base=t[0]-period*r[0];
+   for (i=1;i<n;i++) if ((m=t[i]-period*r[i])<base) base=m;
+  }
+
+  double nominal,period,base; qint64 lag,anchor; quint64 anchorRow; unsigned int n,head;
+  std::vector<double> t,r; // ns and row since the anchor point
+};
+
+typedef struct _timedtrig {
+ unsigned int code;
+ qint64 ns; // CLOCK_MONOTONIC
+} timedtrig;
+
+// Single producer (command handler), single consumer (AcqThread).
+class TimedTrigQueue {
+ public:
+  TimedTrigQueue() { head=tail=0; }
+  bool push(const timedtrig &tt) { quint64 h=head.load(std::memory_order_relaxed);
+   if (h-tail.load(std::memory_order_acquire)>=TIMED_TRIG_QUEUE) return false;
+   q[h%TIMED_TRIG_QUEUE]=tt; head.store(h+1,std::memory_order_release); return true;
+  }
+  bool pop(timedtrig &tt) { quint64 tl=tail.load(std::memory_order_relaxed);
+   if (tl==head.load(std::memory_order_acquire)) return false;
+   tt=q[tl%TIMED_TRIG_QUEUE]; tail.store(tl+1,std::memory_order_release); return true;
+  }
+ private:
+  timedtrig q[TIMED_TRIG_QUEUE]; std::atomic<quint64> head,tail;
+};
+
+#endif
@@ -1,69 +0,0 @@
-/*
-Octopus-ReEL - Realtime Encephalography Laboratory Network
-   Copyright (C) 2007-2025 Barkin Ilhan
-
- This program is free software: you can redistribute it and/or modify
- it under the terms of the GNU General Public License as published by
- the Free Software Foundation, either version 3 of the License, or
- (at your option) any later version.
-
- This program is distributed in the hope that it will be useful,
- but WITHOUT ANY WARRANTY; without even the implied warranty of
- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- GNU General Public License for more details.
-
- You should have received a copy of the GNU General Public License
- along with this program.  If not, see <https://www.gnu.org/licenses/>.
-
- Contact info:
- E-Mail:  barkin@unrlabs.org
- Website: http://icon.unrlabs.org/staff/barkin/
- Repo:    https://github.com/4e0n/
-*/
-
-#ifndef TCPTHREAD_H
-#define TCPTHREAD_H
-
-#include <QThread>
-#include <QMutex>
-#include <QtNetwork>
-#include <unistd.h>
-#include <cstdint>
-#include <iostream>
-#include <chrono>
-#include <thread>
-#include <cmath>
-
-#include "../acqglobals.h"
-
-#include "../tcpsample.h"
-
-class TcpThread : public QThread {
- Q_OBJECT
- public:
-  TcpThread(QObject* parent,QVector<tcpsample> *tb,quint64 *pidx,quint64 *cidx,
-            bool *r,bool *c,QMutex *m) : QThread(parent) {
-   mutex=m; tcpBuffer=tb; tcpBufPivotP=pidx; tcpBufPivotC=cidx; daemonRunning=r; clientConnected=c;
-   connect(this,SIGNAL(sendData()),parent,SLOT(slotSendData()));
-  }
-
-  virtual void run() {
-   while (*clientConnected) {
-    mutex->lock();
-     if (*tcpBufPivotP>*tcpBufPivotC) emit sendData();
-    mutex->unlock();
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-   }
-
-   qDebug("octopus_acqd: <tcpthread> Exiting thread..");
-  }
-
- signals:
-  void sendData();
-
- private:
-  QVector<tcpsample> *tcpBuffer; quint64 *tcpBufPivotP,*tcpBufPivotC;
-  bool *daemonRunning,*clientConnected; QMutex *mutex;
-};
-
-#endif
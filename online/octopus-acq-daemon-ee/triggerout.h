@@ -0,0 +1,148 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* Trigger output to the amplifiers' trigger inputs over the (Arduino-based) serial
+   trigger multiplexer. The device is opened and configured once, by the thread itself;
+   afterwards sending a SYNC or marker byte is just a push() into a short bounded queue,
+   which never blocks the caller (command handler, acquisition loop). The thread writes
+   the bytes in order, drains each one out of the port and stamps it with
+   CLOCK_MONOTONIC both when queued and when written; the latest stamps are kept in a
+   small log. If the port goes away it is reopened periodically, queued bytes are
+   dropped in the meantime and counted. Any tty works as the device, hence a pty can
+   stand in for the hardware (see bench/trigbench.cpp). */
+
+#ifndef TRIGGEROUT_H
+#define TRIGGEROUT_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QString>
+#include <QDebug>
+#include <atomic>
+#include <functional>
+#include <cstring>
+#include <cerrno>
+
+#include "../serial_device.h"
+#include "rtsched.h"
+
+const unsigned int TRIG_QUEUE_SIZE=64;      // Pending bytes; pushes beyond are dropped
+const unsigned int TRIG_LOG_SIZE=64;        // Most recent written bytes with their stamps
+const unsigned int TRIG_REOPEN_MSECS=2000;  // Retry period while the port is unavailable
+const unsigned int TRIG_IDLE_MSECS=100;
+
+typedef struct _trigstamp {
+ unsigned char code;
+ qint64 queuedNs,writtenNs; // CLOCK_MONOTONIC
+} trigstamp;
+
+class TriggerOut : public QThread {
+ public:
+  // s: termios baud rate constant (B115200..), settle: wait after opening (the
+  // multiplexer's bootloader runs on each open), 0 for a pty.
+  TriggerOut(QString dev,int s,unsigned int settle,QObject *parent=0) : QThread(parent),latency("latency","us",10.,1000,"TriggerOut") {
+   serial.devname=dev; serial.baudrate=s; serial.databits=CS8; serial.parity=serial.par_on=0; serial.stopbit=0;
+   serial.device=-1; settleMsecs=settle; running=false; setObjectName("TriggerOut");
+   qHead=qTail=0; logIdx=0; sent=dropped=errors=0;
+  }
+
+  virtual void run() { trigstamp t; qint64 lastOpen=0; bool pending;
+   running=true;
+   while (running) {
+    if (serial.device<0 && monoNs()-lastOpen>=(qint64)TRIG_REOPEN_MSECS*1000000LL) { lastOpen=monoNs(); open(); }
+    qMutex.lock();
+     while (qHead==qTail && running) if (!qReady.wait(&qMutex,TRIG_IDLE_MSECS)) break;
+     if ((pending=(qHead!=qTail))) { t=queue[qTail%TRIG_QUEUE_SIZE]; qTail++; }
+    qMutex.unlock();
+    if (!pending) continue;
+    if (serial.device<0) { dropped++; continue; }
+    if (::write(serial.device,&t.code,1)!=1) { errors++; dropped++;
+     qDebug("octopus_acqd: <TriggerOut> Write error on %s (%s), reopening.",serial.devname.toLatin1().data(),strerror(errno));
+     ::close(serial.device); serial.device=-1; continue;
+    }
+    tcdrain(serial.device); t.writtenNs=monoNs();
+    log[logIdx%TRIG_LOG_SIZE]=t; logIdx.store(logIdx+1,std::memory_order_release); sent++;
+    latency.add((t.writtenNs-t.queuedNs)/1e3);
+   }
+   if (serial.device>=0) { ::close(serial.device); serial.device=-1; }
+   qDebug("octopus_acqd: <TriggerOut> Stopped. Sent: %llu Dropped: %llu Errors: %llu",
+          (unsigned long long)sent,(unsigned long long)dropped,(unsigned long long)errors);
+   latency.report();
+  }
+
+  void stop() { running=false; qMutex.lock(); qReady.wakeAll(); qMutex.unlock(); wait(); }
+
+  // Any thread; returns at once. False if the queue is full (the byte is dropped).
+  bool push(unsigned char code) { bool ok;
+   qMutex.lock();
+    if ((ok=(qHead-qTail<TRIG_QUEUE_SIZE))) {
+     trigstamp &t=queue[qHead%TRIG_QUEUE_SIZE]; t.code=code; t.queuedNs=monoNs(); t.writtenNs=0; qHead++;
+     qReady.wakeOne();
+    }
+   qMutex.unlock();
+   if (!ok) dropped++;
+   else if (loopback) loopback(code);
+   return ok;
+  }
+
+  // Also hands every accepted byte to f, as it goes out (synthetic amps' trigger inputs).
+  // To be set before the first push().
+  void setLoopback(std::function<void(unsigned char)> f) { loopback=f; }
+
+  // The most recently written byte with its stamps; false if nothing was written yet.
+  bool last(trigstamp &t) const { quint64 i=logIdx.load(std::memory_order_acquire);
+   if (i==0) return false;
+   t=log[(i-1)%TRIG_LOG_SIZE]; return true;
+  }
+
+  std::atomic<quint64> sent,dropped,errors;
+
+ private:
+  bool open() { termios tio;
+   if ((serial.device=::open(serial.devname.toLatin1().data(),O_RDWR|O_NOCTTY|O_NONBLOCK))<0) {
+    qDebug("octopus_acqd: <TriggerOut> Cannot open %s (%s).",serial.devname.toLatin1().data(),strerror(errno)); return false;
+   }
+   fcntl(serial.device,F_SETFL,0); // Blocking writes from here on; only this thread waits on them
+   bzero(&tio,sizeof(tio));
+   // Raw 8N1, no modem control; keep DTR up on close so that the multiplexer is not reset again
+   tio.c_cflag=serial.databits|serial.parity|serial.par_on|serial.stopbit|CLOCAL|CREAD;
+   cfsetispeed(&tio,serial.baudrate); cfsetospeed(&tio,serial.baudrate);
+   tio.c_iflag=IGNPAR; tio.c_oflag=0; tio.c_lflag=0; tio.c_cc[VMIN]=0; tio.c_cc[VTIME]=0;
+   tcflush(serial.device,TCIOFLUSH);
+   if (tcsetattr(serial.device,TCSANOW,&tio)<0) {
+    qDebug("octopus_acqd: <TriggerOut> Cannot configure %s (%s).",serial.devname.toLatin1().data(),strerror(errno));
+    ::close(serial.device); serial.device=-1; return false;
+   }
+   if (settleMsecs) msleep(settleMsecs);
+   qDebug("octopus_acqd: <TriggerOut> %s opened.",serial.devname.toLatin1().data());
+   return true;
+  }
+
+  serial_device serial; unsigned int settleMsecs; std::atomic<bool> running; std::function<void(unsigned char)> loopback;
+  QMutex qMutex; QWaitCondition qReady; trigstamp queue[TRIG_QUEUE_SIZE]; quint64 qHead,qTail;
+  trigstamp log[TRIG_LOG_SIZE]; std::atomic<quint64> logIdx;
+  RTHistogram latency; // Queued -> drained out of the port; worker only
+};
+
+#endif
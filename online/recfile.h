@@ -0,0 +1,299 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* Recording container (.ocr), as written by the daemon's RecordSink and read back by
+   RecFile through a read-only mapping. All structures are page-aligned in the file:
+
+     header    recfileheader, then chnCount recchannel entries, padded to pages
+     chunk     recchunk, payload, the chunk's recevent list, padded to a page
+     ...
+     index     recindex, recindexentry per chunk, recevent per event, padded
+     chunk ...
+
+   A chunk holds up to chunkSamples consecutive samples, channel-major: chnCount
+   columns of n floats each, so that a channel subset of a time range is a few
+   contiguous runs. A recording gap (the sink lapped) ends a chunk early; chunks carry
+   the running sample index of their first sample, so time stays exact across gaps.
+   The payload is stored as is (REC_CODEC_RAW), hence readable in place in the
+   mapping, or compressed per column (REC_CODEC_ZLIB: a table of chnCount stream ends,
+   then each column's byte planes deflated on their own), so a reader inflates only the
+   channels it asks for; REC_CODEC_LPC is the same with lpccodec.h in place of deflate
+   (bit-exact; in nanovolts only where they give the floats back as they were). Every
+   chunk has a CRC of its stored payload.
+
+   Every indexEvery chunks the writer appends an index block of the chunks and events
+   since the previous one (a backward chain through prev), syncs, and only then points
+   the header (indexOff, dataEnd) at it; on close one full index of everything ends
+   the file. Opening thus reads the header, the final index -- or after a crash walks
+   the chain and scans the chunks written after its last link, up to the first torn
+   one -- and touches no sample data. */
+
+#ifndef _RECFILE_H
+#define _RECFILE_H
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "lpccodec.h"
+
+const uint32_t REC_MAGIC=0x4f435246; // "OCRF"
+const uint32_t REC_VERSION=2;
+const uint32_t REC_PAGE=4096;
+const uint32_t REC_CHUNK_MAGIC=0x4b4e4843; // "CHNK"
+const uint32_t REC_INDEX_MAGIC=0x58444e49; // "INDX"
+const uint32_t REC_CODEC_RAW=0;
+const uint32_t REC_CODEC_ZLIB=1;
+const uint32_t REC_CODEC_LPC=2;
+const uint32_t REC_CODEC_COUNT=3;
+const uint32_t REC_CHN_NAME=16;
+
+const uint32_t REC_FIELD_RAW=0x01; // Same bits as TCP_SUB_RAW/FLT/CM/AUX
+const uint32_t REC_FIELD_FLT=0x02;
+const uint32_t REC_FIELD_CM =0x04;
+const uint32_t REC_FIELD_AUX=0x08;
+
+typedef struct _recfileheader {
+ uint32_t magic,version,headerSize,session;
+ uint32_t sampleRate,chnCount,chunkSamples,closed; // closed: 1 once the counts are final
+ uint64_t startIdx;           // Daemon running index of the first sample
+ uint64_t startNs;            // CLOCK_REALTIME of the start
+ uint64_t sampleCount,lostCount; // Recorded; lost in gaps -- as of the last index
+ uint64_t indexOff;           // Last index block (0: none yet)
+ uint64_t dataEnd;            // End of that index block; chunks after it are scanned on open
+ uint32_t ampCount,codec,indexEvery,reserved[5];
+} recfileheader;
+
+typedef struct _recchannel {
+ char name[REC_CHN_NAME];
+ uint16_t amp,physChn; // physChn: 0-based; AUX channels: amp 0xffff, physChn the aux index
+ uint32_t field;       // REC_FIELD_*
+} recchannel;
+
+typedef struct _recchunk {
+ uint32_t magic,seq;
+ uint64_t firstIdx;    // Daemon running index of the first sample
+ uint32_t n,codec;     // Samples, codec of the payload
+ uint32_t stored,crc;  // Payload bytes as stored, CRC-32 of them
+ uint32_t events,size; // Events after the payload; bytes of the whole chunk incl. padding
+} recchunk;
+
+typedef struct _recevent {
+ uint64_t idx; // Daemon running index
+ uint32_t code,reserved;
+} recevent;
+
+typedef struct _recindex {
+ uint32_t magic,full; // full: everything of the file, the chain ends here
+ uint64_t prev;       // Previous index block, 0 if none
+ uint32_t chunks,events;
+ uint32_t size,reserved;
+} recindex;
+
+typedef struct _recindexentry {
+ uint64_t off,firstIdx;
+ uint32_t n,reserved;
+} recindexentry;
+
+inline uint64_t recPad(uint64_t n) { return (n+REC_PAGE-1)/REC_PAGE*REC_PAGE; }
+
+// Upper bound of an encoded chunk, for buffer sizing.
+inline size_t recChunkBound(uint32_t chnCount,uint32_t chunkSamples) {
+ size_t col=std::max((size_t)compressBound(chunkSamples*sizeof(float)),lpcBound(chunkSamples));
+ return recPad(sizeof(recchunk)+chnCount*(sizeof(uint32_t)+col)+(size_t)chunkSamples*sizeof(recevent));
+}
+
+// Encodes n samples of cols (chnCount columns of chns, chunkSamples apart) and their events
+// into dst, which holds recChunkBound(); returns the padded size. work: scratch of a column.
+inline size_t recEncodeChunk(char *dst,uint32_t seq,uint64_t firstIdx,const float *cols,const recchannel *chns,uint32_t chnCount,
+                             uint32_t chunkSamples,uint32_t n,const recevent *ev,uint32_t evCount,uint32_t codec,
+                             std::vector<unsigned char> &work) {
+ recchunk *c=(recchunk*)dst; char *p=dst+sizeof(recchunk); size_t raw=(size_t)chnCount*n*sizeof(float),len=0;
+ c->magic=REC_CHUNK_MAGIC; c->seq=seq; c->firstIdx=firstIdx; c->n=n; c->codec=codec; c->events=evCount;
+ if (codec==REC_CODEC_ZLIB) { const unsigned char *s; uint32_t *end=(uint32_t*)p; uLongf dl; work.resize(n*sizeof(float));
+  len=chnCount*sizeof(uint32_t);
+  for (uint32_t k=0;k<chnCount && len<raw;k++) { s=(const unsigned char*)(cols+(size_t)k*chunkSamples); // Byte planes: exponents compress, noise does not
+   for (uint32_t i=0;i<n;i++) for (uint32_t b=0;b<4;b++) work[(size_t)b*n+i]=s[4*i+b];
+   dl=compressBound(n*sizeof(float));
+   if (compress2((Bytef*)p+len,&dl,work.data(),n*sizeof(float),Z_BEST_SPEED)!=Z_OK) { len=raw; break; }
+   len+=dl; end[k]=len;
+  }
+  if (len>=raw) codec=c->codec=REC_CODEC_RAW;
+ } else if (codec==REC_CODEC_LPC) { uint32_t *end=(uint32_t*)p; LpcCodec lpc;
+  len=chnCount*sizeof(uint32_t);
+  for (uint32_t k=0;k<chnCount && len<raw;k++) {
+   len+=lpc.encode(cols+(size_t)k*chunkSamples,n,(chns[k].field==REC_FIELD_CM) ? LPC_KIND_BITS : LPC_KIND_NV,(unsigned char*)p+len); end[k]=len;
+  }
+  if (len>=raw) codec=c->codec=REC_CODEC_RAW;
+ }
+ if (codec==REC_CODEC_RAW) { for (uint32_t k=0;k<chnCount;k++) std::memcpy(p+(size_t)k*n*sizeof(float),cols+(size_t)k*chunkSamples,n*sizeof(float)); len=raw; }
+ c->stored=len; c->crc=crc32(0,(const Bytef*)p,len); p+=len;
+ std::memcpy(p,ev,evCount*sizeof(recevent)); p+=evCount*sizeof(recevent);
+ len=p-dst; c->size=recPad(len); std::memset(p,0,c->size-len);
+ return c->size;
+}
+
+// Size of an index block of the given counts, padded.
+inline size_t recIndexSize(size_t chunks,size_t events) {
+ return recPad(sizeof(recindex)+chunks*sizeof(recindexentry)+events*sizeof(recevent));
+}
+
+inline size_t recEncodeIndex(char *dst,uint64_t prev,bool full,const recindexentry *e,uint32_t chunks,const recevent *ev,uint32_t events) {
+ recindex *x=(recindex*)dst; char *p=dst+sizeof(recindex); size_t len;
+ x->magic=REC_INDEX_MAGIC; x->full=full; x->prev=prev; x->chunks=chunks; x->events=events; x->reserved=0;
+ std::memcpy(p,e,chunks*sizeof(recindexentry)); p+=chunks*sizeof(recindexentry);
+ std::memcpy(p,ev,events*sizeof(recevent)); p+=events*sizeof(recevent);
+ len=p-dst; x->size=recPad(len); std::memset(p,0,x->size-len);
+ return x->size;
+}
+
+class RecFile {
+ public:
+  RecFile() { base=0; mapSize=0; hdr=0; cache[0].k=cache[1].k=(size_t)-1; lru=0; }
+  ~RecFile() { close(); }
+
+  // Maps the file and loads its chunk/event index; no sample data is touched.
+  bool open(const std::string &path) { int fd; struct stat st; void *p; close();
+   if ((fd=::open(path.c_str(),O_RDONLY))<0) return false;
+   if (fstat(fd,&st)<0 || st.st_size<(off_t)REC_PAGE || (p=mmap(0,st.st_size,PROT_READ,MAP_SHARED,fd,0))==MAP_FAILED) {
+    ::close(fd); return false;
+   }
+   ::close(fd); base=(const char*)p; mapSize=st.st_size; hdr=(const recfileheader*)base;
+   if (hdr->magic!=REC_MAGIC || hdr->version!=REC_VERSION || hdr->headerSize>mapSize || hdr->chunkSamples==0 ||
+       sizeof(recfileheader)+hdr->chnCount*sizeof(recchannel)>hdr->headerSize) { close(); return false; }
+   chns=(const recchannel*)(base+sizeof(recfileheader));
+   if (!loadIndex()) { close(); return false; }
+   return true;
+  }
+
+  void close() { if (base) munmap((void*)base,mapSize); base=0; mapSize=0; hdr=0; chunks.clear(); evs.clear(); cache[0].k=cache[1].k=(size_t)-1; }
+
+  const recfileheader &header() const { return *hdr; }
+  const recchannel &channel(uint32_t c) const { return chns[c]; }
+  uint32_t channelCount() const { return hdr->chnCount; }
+  size_t chunkCount() const { return chunks.size(); }
+  bool recovered() const { return !hdr->closed; }
+
+  // Samples spanned (gaps included), counted from header().startIdx
+  uint64_t length() const { return chunks.empty() ? 0 : chunks.back().firstIdx+chunks.back().n-hdr->startIdx; }
+
+  // Events, as sample indices from the start of the recording.
+  std::vector<uint64_t> events(uint32_t code) const { std::vector<uint64_t> r;
+   for (const recevent &e:evs) if (e.code==code) r.push_back(e.idx-hdr->startIdx);
+   return r;
+  }
+  const std::vector<recevent> &allEvents() const { return evs; }
+
+  // count samples from sample from (of the recording) of the channels chn into out, channel-
+  // major (out[c*count+i]); samples in gaps or outside the recording read as 0. Returns the
+  // samples that were in a chunk.
+  size_t read(uint64_t from,uint32_t count,const std::vector<uint32_t> &chn,float *out) {
+   uint64_t a=from+hdr->startIdx,b=a+count,s,e; size_t got=0; const float *col; bool any;
+   std::fill(out,out+(size_t)chn.size()*count,0.f);
+   size_t k=std::upper_bound(chunks.begin(),chunks.end(),a,[](uint64_t v,const recindexentry &x) { return v<x.firstIdx; })-chunks.begin();
+   if (k>0) k--;
+   for (;k<chunks.size() && chunks[k].firstIdx<b;k++) { const recindexentry &x=chunks[k];
+    s=std::max(a,x.firstIdx); e=std::min(b,x.firstIdx+x.n); if (s>=e) continue;
+    any=false;
+    for (size_t c=0;c<chn.size();c++) if (chn[c]<hdr->chnCount && (col=column(k,chn[c]))) {
+     std::memcpy(out+c*count+(s-a),col+(s-x.firstIdx),(e-s)*sizeof(float)); any=true;
+    }
+    if (any) got+=e-s;
+   }
+   return got;
+  }
+
+  // Epochs of pre samples before to post samples after each event of code, each as a read()
+  // block of pre+post samples into out (epoch-major); returns the epoch count.
+  size_t epochs(uint32_t code,uint32_t pre,uint32_t post,const std::vector<uint32_t> &chn,std::vector<float> &out) {
+   std::vector<uint64_t> ev=events(code); size_t len=(size_t)(pre+post)*chn.size(),n=0;
+   out.resize(ev.size()*len);
+   for (uint64_t t:ev) if (t>=pre) read(t-pre,pre+post,chn,out.data()+(n++)*len);
+   out.resize(n*len); return n;
+  }
+
+ private:
+  typedef struct _chunkcache { size_t k; std::vector<float> data; std::vector<char> done; } chunkcache;
+
+  // Column ch of chunk k: in place if stored raw, else decoded into the cache of the last
+  // two chunks touched (a read or epoch across a chunk boundary does not thrash).
+  const float *column(size_t k,uint32_t ch) {
+   const recchunk *c=(const recchunk*)(base+chunks[k].off); const char *p=(const char*)(c+1);
+   const uint32_t *end=(const uint32_t*)p; uint32_t beg; uLongf dl=c->n*sizeof(float); chunkcache *z;
+   if (c->codec==REC_CODEC_RAW) return (const float*)p+(size_t)ch*c->n;
+   if (c->codec!=REC_CODEC_ZLIB && c->codec!=REC_CODEC_LPC) return 0;
+   if (cache[0].k==k) z=&cache[0]; else if (cache[1].k==k) z=&cache[1];
+   else { z=&cache[lru]; z->k=k; z->data.resize((size_t)hdr->chnCount*c->n); z->done.assign(hdr->chnCount,0); }
+   lru=(z==&cache[0]); // The other one goes next
+   float *d=z->data.data()+(size_t)ch*c->n;
+   if (z->done[ch]) return d;
+   beg=ch ? end[ch-1] : hdr->chnCount*sizeof(uint32_t);
+   if (end[ch]<beg || end[ch]>c->stored) return 0;
+   if (c->codec==REC_CODEC_LPC) { if (!lpc.decode((const unsigned char*)p+beg,end[ch]-beg,c->n,d)) return 0; z->done[ch]=1; return d; }
+   work.resize(dl);
+   if (uncompress(work.data(),&dl,(const Bytef*)p+beg,end[ch]-beg)!=Z_OK || dl!=c->n*sizeof(float)) return 0;
+   unsigned char *b=(unsigned char*)d;
+   for (uint32_t i=0;i<c->n;i++) for (uint32_t j=0;j<4;j++) b[4*i+j]=work[(size_t)j*c->n+i];
+   z->done[ch]=1; return d;
+  }
+
+  bool validChunk(uint64_t off) const { const recchunk *c=(const recchunk*)(base+off);
+   return off+sizeof(recchunk)<=mapSize && c->magic==REC_CHUNK_MAGIC && c->size>=sizeof(recchunk) && off+c->size<=mapSize &&
+          sizeof(recchunk)+c->stored+(uint64_t)c->events*sizeof(recevent)<=c->size && c->n<=hdr->chunkSamples &&
+          c->codec<REC_CODEC_COUNT && crc32(0,(const Bytef*)(c+1),c->stored)==c->crc;
+  }
+
+  bool loadIndex() { std::vector<const recindex*> chain; uint64_t off=hdr->indexOff,end=hdr->headerSize; const recindex *x;
+   while (off) { // Newest first
+    if (off+sizeof(recindex)>mapSize || (x=(const recindex*)(base+off))->magic!=REC_INDEX_MAGIC || off+x->size>mapSize) return false;
+    chain.push_back(x); if (x->full) break; off=x->prev;
+   }
+   for (size_t i=chain.size();i-->0;) { x=chain[i]; const recindexentry *e=(const recindexentry*)(x+1);
+    chunks.insert(chunks.end(),e,e+x->chunks);
+    const recevent *v=(const recevent*)(e+x->chunks); evs.insert(evs.end(),v,v+x->events);
+   }
+   if (hdr->indexOff) end=hdr->dataEnd;
+   if (!(chain.size() && chain[0]->full)) // Not closed: chunks written after the last index
+    for (off=end;off+sizeof(recindex)<=mapSize;) { const recchunk *c=(const recchunk*)(base+off);
+     if (c->magic==REC_INDEX_MAGIC && off+((const recindex*)c)->size<=mapSize && ((const recindex*)c)->size) { off+=((const recindex*)c)->size; continue; }
+     if (!validChunk(off)) break; // Torn or never written
+     recindexentry e; e.off=off; e.firstIdx=c->firstIdx; e.n=c->n; e.reserved=0; chunks.push_back(e);
+     const recevent *v=(const recevent*)((const char*)(c+1)+c->stored); evs.insert(evs.end(),v,v+c->events);
+     off+=c->size;
+    }
+   return true;
+  }
+
+  const char *base; size_t mapSize; const recfileheader *hdr; const recchannel *chns;
+  std::vector<recindexentry> chunks; std::vector<recevent> evs;
+  chunkcache cache[2]; int lru; std::vector<unsigned char> work; LpcCodec lpc;
+};
+
+#endif
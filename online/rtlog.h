@@ -0,0 +1,152 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* Asynchronous logging for the real-time paths -- the acquisition loop, the amp workers
+   and the clients' per-sample loops -- where a synchronous qDebug() under a fault
+   condition (a trigger storm, an offset leak on every sample) would only make the
+   fault worse. RTLOG() takes printf-style arguments, formats them right away into a
+   fixed-size record and posts it to a bounded multi-producer ring: no allocation, no
+   lock and no system call on the calling thread. The RtLog thread prints the records
+   through qDebug() in its own time, so the output goes where it always did.
+
+   Every call site is rate limited on its own: past RTLOG_SITE_BURST records within a
+   second a site only counts, and its next record that gets through tells how many were
+   suppressed. A full ring drops the record, which is counted as well. The last
+   RTLOG_HISTORY records are kept binary, with their monotonic timestamps, and printed
+   on demand -- dump request, SIGUSR1 or the daemon's CS_ACQ_LOG_DUMP -- to see what
+   led to a fault after the fact. */
+
+#ifndef RTLOG_H
+#define RTLOG_H
+
+#include <QThread>
+#include <QDebug>
+#include <atomic>
+#include <vector>
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <csignal>
+#include <time.h>
+
+const unsigned int RTLOG_RING=1024;     // Records in flight (power of 2)
+const unsigned int RTLOG_HISTORY=4096;  // Records kept for dumps
+const unsigned int RTLOG_TEXT=180;      // Bytes per message, truncated beyond
+const unsigned int RTLOG_SITE_BURST=10; // Records per call site per second
+const unsigned int RTLOG_POLL_MSECS=20; // Producers never signal; the printer polls
+
+typedef struct _rtlogrecord {
+ qint64 ns;          // CLOCK_MONOTONIC at the call
+ quint32 suppressed; // Records of the same call site suppressed right before this one
+ char text[RTLOG_TEXT];
+} rtlogrecord;
+
+inline qint64 rtLogNs() { timespec t; clock_gettime(CLOCK_MONOTONIC,&t); return (qint64)t.tv_sec*1000000000LL+t.tv_nsec; }
+
+// Per call site rate limit, constant-initialized (one static per RTLOG() line).
+class RtLogSite {
+ public:
+  constexpr RtLogSite() : window(0),count(0),suppressed(0) {}
+
+  bool allow(qint64 ns) { qint64 w=ns/1000000000LL,cur=window.load(std::memory_order_relaxed);
+   if (w!=cur && window.compare_exchange_strong(cur,w,std::memory_order_relaxed)) count.store(0,std::memory_order_relaxed);
+   if (count.fetch_add(1,std::memory_order_relaxed)<RTLOG_SITE_BURST) return true;
+   suppressed.fetch_add(1,std::memory_order_relaxed); return false;
+  }
+
+  std::atomic<qint64> window; std::atomic<quint32> count,suppressed;
+};
+
+class RtLog : public QThread {
+ public:
+  RtLog() { ring=new rtlogslot[RTLOG_RING]; for (unsigned int i=0;i<RTLOG_RING;i++) ring[i].seq=i;
+   head=0; tail=0; dropped=0; stopRequested=false; dumpRequested=false; histCount=0; history.resize(RTLOG_HISTORY);
+   setObjectName("RtLog");
+  }
+
+  ~RtLog() { stop(); delete[] ring; }
+
+  // Any thread: claim a slot, format into it, hand it over. Drops (and counts) when full.
+  void post(RtLogSite &site,qint64 ns,const char *fmt,...) __attribute__((format(printf,4,5))) {
+   quint64 pos=head.load(std::memory_order_relaxed); rtlogslot *s; va_list a;
+   for (;;) { s=&ring[pos&(RTLOG_RING-1)]; qint64 d=(qint64)(s->seq.load(std::memory_order_acquire)-pos);
+    if (d==0) { if (head.compare_exchange_weak(pos,pos+1,std::memory_order_relaxed)) break; }
+    else if (d<0) { dropped.fetch_add(1,std::memory_order_relaxed); return; }
+    else pos=head.load(std::memory_order_relaxed);
+   }
+   s->rec.ns=ns; s->rec.suppressed=site.suppressed.exchange(0,std::memory_order_relaxed);
+   va_start(a,fmt); vsnprintf(s->rec.text,RTLOG_TEXT,fmt,a); va_end(a);
+   s->seq.store(pos+1,std::memory_order_release);
+  }
+
+  // SIGUSR1 asks for a dump of the history as well.
+  void start() { if (isRunning()) return;
+   struct sigaction sa; std::memset(&sa,0,sizeof(sa)); sa.sa_handler=onSignal; sigemptyset(&sa.sa_mask); sigaction(SIGUSR1,&sa,0);
+   QThread::start(QThread::LowPriority);
+  }
+
+  void stop() { if (isRunning()) { stopRequested=true; wait(); } }
+
+  void requestDump() { dumpRequested=true; }
+
+  virtual void run() {
+   while (!stopRequested) { drain(); if (dumpRequested.exchange(false)) dump(); msleep(RTLOG_POLL_MSECS); }
+   drain();
+  }
+
+ private:
+  typedef struct _rtlogslot { std::atomic<quint64> seq; rtlogrecord rec; } rtlogslot;
+
+  static void onSignal(int);
+
+  void drain() { rtlogslot *s; quint64 d;
+   for (;;) { s=&ring[tail&(RTLOG_RING-1)];
+    if (s->seq.load(std::memory_order_acquire)!=tail+1) break;
+    rtlogrecord &h=history[histCount++%RTLOG_HISTORY]; h=s->rec;
+    s->seq.store(tail+RTLOG_RING,std::memory_order_release); tail++;
+    if (h.suppressed) qDebug("%s (+%u similar suppressed)",h.text,h.suppressed); else qDebug("%s",h.text);
+   }
+   if ((d=dropped.exchange(0))) qDebug("rtlog: %llu record(s) dropped, ring full.",(unsigned long long)d);
+  }
+
+  void dump() { quint64 n=qMin(histCount,(quint64)RTLOG_HISTORY);
+   qDebug("rtlog: ---- last %llu record(s) ----",(unsigned long long)n);
+   for (quint64 i=histCount-n;i<histCount;i++) { const rtlogrecord &h=history[i%RTLOG_HISTORY];
+    qDebug("rtlog: [%.6f] %s",h.ns/1e9,h.text);
+   }
+   qDebug("rtlog: ---- end ----");
+  }
+
+  rtlogslot *ring; std::atomic<quint64> head,dropped; quint64 tail;
+  std::vector<rtlogrecord> history; quint64 histCount; // Printer thread only
+  std::atomic<bool> stopRequested,dumpRequested;
+};
+
+inline RtLog& rtLog() { static RtLog log; return log; }
+
+inline void RtLog::onSignal(int) { rtLog().requestDump(); }
+
+#define RTLOG(...) do { static RtLogSite rtLogSite; qint64 rtLogT=rtLogNs(); \
+                        if (rtLogSite.allow(rtLogT)) rtLog().post(rtLogSite,rtLogT,__VA_ARGS__); } while (0)
+
+#endif
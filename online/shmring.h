@@ -0,0 +1,146 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* Same-host data transport: a POSIX shared memory ring (NET|SHM, e.g. /octopus_acqd)
+   the daemon fills with every published sample, all channels and fields, in the frame
+   layout of tcpsubscription.h. Local clients map it read-only and process the frames
+   in place, instead of receiving them through the loopback TCP stack.
+
+   The first page holds the shmheader; frame idx (the daemon's running sample index,
+   same as in tcpBuffer) lives in slot idx%slots after it. The producer packs a span,
+   then advances pIdx (release) and bumps futexWord, waking every reader sleeping in
+   FUTEX_WAIT on it; a reader needs no write access to the mapping for that. As with
+   the TCP senders, a reader is lapped once the producer is more than slots-guard
+   ahead of it, and re-checks that after taking frames out. On shutdown the daemon
+   clears running and wakes everybody; a restarted daemon creates a new ring (new
+   session), which clients have to map again. The ring is readable by the daemon's
+   user only (0600), or also by one group (0640, NET|SHMGROUP) for clients running
+   as other users. */
+
+#ifndef _SHMRING_H
+#define _SHMRING_H
+
+#include <atomic>
+#include <new>
+#include <string>
+#include <climits>
+#include <cstdint>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "tcpsample.h"
+#include "tcpsubscription.h"
+
+const unsigned int SHM_MAGIC=0x4f43534d; // "OCSM"
+const unsigned int SHM_VERSION=1;
+const unsigned int SHM_HEADER_SIZE=4096; // Frames start at the next page
+
+typedef struct _shmheader {
+ unsigned int magic,version,session,running;
+ unsigned int ampCount,sampleRate,fields,frameSize;
+ uint64_t slots,guard;
+ alignas(64) std::atomic<uint64_t> pIdx; // Published up to (excl.)
+ alignas(64) std::atomic<uint32_t> futexWord; // Bumped on every publish
+} shmheader;
+
+class ShmRing {
+ public:
+  ShmRing() { hdr=0; base=0; mapSize=0; writer=false; }
+  ~ShmRing() { close(); }
+
+  // Daemon side: (re)create the ring, replacing a stale one of a previous run; gid>=0
+  // lets that group read it as well.
+  bool create(const std::string &n,unsigned int ac,unsigned int sr,uint64_t s,uint64_t g,unsigned int session,int gid=-1) {
+   int fd; void *p; close(); name=n;
+   if (!sub.set(TcpSubscription::full(),ac)) return false;
+   shm_unlink(name.c_str());
+   if ((fd=shm_open(name.c_str(),O_CREAT|O_EXCL|O_RDWR,0600))<0) return false;
+   mapSize=SHM_HEADER_SIZE+s*sub.frameSize;
+   if ((gid>=0 && (fchown(fd,-1,gid)<0 || fchmod(fd,0640)<0)) ||
+       ftruncate(fd,mapSize)<0 || (p=mmap(0,mapSize,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0))==MAP_FAILED) {
+    ::close(fd); shm_unlink(name.c_str()); return false;
+   }
+   ::close(fd); writer=true;
+   hdr=new (p) shmheader; base=(char*)p+SHM_HEADER_SIZE;
+   hdr->version=SHM_VERSION; hdr->session=session; hdr->running=1; hdr->ampCount=ac; hdr->sampleRate=sr;
+   hdr->fields=sub.request().fields; hdr->frameSize=sub.frameSize; hdr->slots=s; hdr->guard=g;
+   hdr->pIdx.store(0); hdr->futexWord.store(0);
+   std::atomic_thread_fence(std::memory_order_release); hdr->magic=SHM_MAGIC;
+   return true;
+  }
+
+  // Producer: pack sample idx into its slot; commit() then makes everything before p visible.
+  void put(uint64_t idx,const tcpsample &t) { sub.pack(t,base+(idx%hdr->slots)*hdr->frameSize); }
+  void commit(uint64_t p) {
+   hdr->pIdx.store(p,std::memory_order_release); hdr->futexWord.fetch_add(1,std::memory_order_release); wake();
+  }
+
+  // Client side: map an existing ring read-only; false if there is none or it is not ours.
+  bool open(const std::string &n) { int fd; void *p; struct stat st; close(); name=n;
+   if ((fd=shm_open(name.c_str(),O_RDONLY,0))<0) return false;
+   if (fstat(fd,&st)<0 || st.st_size<(off_t)SHM_HEADER_SIZE ||
+       (p=mmap(0,st.st_size,PROT_READ,MAP_SHARED,fd,0))==MAP_FAILED) { ::close(fd); return false; }
+   ::close(fd); mapSize=st.st_size; hdr=(shmheader*)p; base=(char*)p+SHM_HEADER_SIZE;
+   if (hdr->magic!=SHM_MAGIC || hdr->version!=SHM_VERSION ||
+       SHM_HEADER_SIZE+hdr->slots*hdr->frameSize>mapSize || !sub.set(TcpSubscription::full(),hdr->ampCount)) {
+    close(); return false;
+   }
+   return true;
+  }
+
+  uint64_t published() const { return hdr->pIdx.load(std::memory_order_acquire); }
+  const char *frame(uint64_t idx) const { return base+(idx%hdr->slots)*hdr->frameSize; }
+  uint64_t contiguous(uint64_t idx) const { return hdr->slots-idx%hdr->slots; } // Frames up to the ring's end
+  bool intact(uint64_t idx) const { return published()-idx<=hdr->slots-hdr->guard; } // Not overwritten (yet)
+  bool running() const { return hdr && hdr->running; }
+
+  // Sleep until something beyond idx is published, at most ms; true if there is.
+  bool wait(uint64_t idx,unsigned int ms) const {
+   uint32_t w=hdr->futexWord.load(std::memory_order_acquire); timespec ts;
+   if (published()!=idx || !hdr->running) return published()!=idx;
+   ts.tv_sec=ms/1000; ts.tv_nsec=(ms%1000)*1000000L;
+   syscall(SYS_futex,(uint32_t*)&hdr->futexWord,FUTEX_WAIT,w,&ts,0,0);
+   return published()!=idx;
+  }
+
+  void close() {
+   if (hdr && writer) { hdr->running=0; hdr->futexWord.fetch_add(1); wake(); shm_unlink(name.c_str()); }
+   if (hdr) munmap((void*)hdr,mapSize);
+   hdr=0; base=0; mapSize=0; writer=false;
+  }
+
+  const shmheader *header() const { return hdr; }
+  const TcpSubscription &subscription() const { return sub; }
+
+ private:
+  void wake() { syscall(SYS_futex,(uint32_t*)&hdr->futexWord,FUTEX_WAKE,INT_MAX,0,0,0); }
+
+  std::string name; shmheader *hdr; char *base; size_t mapSize; bool writer; TcpSubscription sub;
+};
+
+#endif
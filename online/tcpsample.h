@@ -26,11 +26,14 @@ Octopus-ReEL - Realtime Encephalography Laboratory Network
 
 #include "../acqglobals.h"
 
+#include <vector>
+
 #include "sample.h"
 
 typedef struct _tcpsample {
- sample amp[EE_AMPCOUNT];
+ std::vector<sample> amp; // One per amp (AMP|COUNT) -- sized once by the owner of the buffer
  unsigned int trigger;
+ float aux[AUX_CHN_COUNT]; // Auxiliary (audio) channels at the EEG sample clock
 } tcpsample;
 
 #endif
@@ -0,0 +1,255 @@
+/*
+Octopus-ReEL - Realtime Encephalography Laboratory Network
+   Copyright (C) 2007-2025 Barkin Ilhan
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Contact info:
+ E-Mail:  barkin@unrlabs.org
+ Website: http://icon.unrlabs.org/staff/barkin/
+ Repo:    https://github.com/4e0n/
+*/
+
+/* Negotiated data stream between the acquisition daemon and its data clients.
+   Right after connecting to the data port a client sends one tcpsubscription telling
+   which sample fields (raw, filtered, CM level) of which physical channels of each amp
+   it wants. The daemon validates it, fills in the resulting frameSize and echoes it
+   back together with the daemon's amp count (AMP|COUNT, decided at runtime); from
+   then on every sample is sent as one frame of frameSize bytes:
+
+     unsigned int trigger;                     tcpsample.trigger
+     per amp:   unsigned int offset,trigger;   sample.offset/trigger of that amp
+     per amp:   per field (RAW,FLT,CM order):  float for each selected channel
+     if AUX:    float aux[AUX_CHN_COUNT];      tcpsample.aux (audio)
+
+   The echo also carries the daemon's session and, in startIdx, the running sample
+   index of the first frame to come, so a client can count where it is. A client that
+   lost its connection may reconnect with resume set and startIdx the next sample it
+   wants (and the session it had): the daemon then replays from its BUFPAST ring at
+   link speed before going live, if that sample is still there; resume in the echo
+   tells whether it was.
+
+   policy is what the daemon does once the client has fallen more than the ring
+   behind: skip the overwritten span and put one gap frame in its place (trigger
+   TCP_SUB_GAP, amp #0 offset/trigger holding the skipped sample count lo/hi), thin
+   the backlog out while lagging (every 2nd/4th sample, for displays), or disconnect
+   (a resume may still pick up). Thinned out frames come after a step frame (trigger
+   TCP_SUB_STEP, amp #0 offset holding the step): each frame from there on stands for
+   that many samples of the stream, until the next step frame (a step of 1 once the
+   client has caught up). Like a gap frame, it stands for no sample itself.
+
+   With TCP_SUB_LPC in fields the same frames are not sent one by one but coded
+   losslessly (lpccodec.h) in blocks of whatever the daemon has at hand: a tcpblock
+   header, a table of one stream end per column, and the columns -- the frame words as
+   integers, the floats per amp/field/channel as nanovolts where that is exact, as float
+   bits else (CM levels always as bits).
+   A block tells the running index of its first sample, the samples it spans (more
+   than it holds when DECIMATE thinned it out) and the samples skipped just before it,
+   in place of a gap frame.
+
+   rate asks for the stream at a lower sample rate than the amps': the daemon grants
+   the lowest one at or above it that divides its own (TcpSubscription::outputRate)
+   and sends it anti-alias filtered and decimated, with startIdx and the block and
+   gap indices counted at that rate; the amps' offsets keep counting their own
+   samples, i.e. advance by the factor from frame to frame. */
+
+#ifndef _TCPSUBSCRIPTION_H
+#define _TCPSUBSCRIPTION_H
+
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include "acqglobals.h"
+#include "sample.h"
+#include "tcpsample.h"
+#include "lpccodec.h"
+
+const unsigned int TCP_SUB_MAGIC=0x4f435342; // "OCSB"
+
+const unsigned int TCP_SUB_RAW=0x01; // sample.data
+const unsigned int TCP_SUB_FLT=0x02; // sample.dataF
+const unsigned int TCP_SUB_CM =0x04; // sample.curCM
+const unsigned int TCP_SUB_AUX=0x08; // tcpsample.aux -- not per amp/channel
+const unsigned int TCP_SUB_ALL=TCP_SUB_RAW|TCP_SUB_FLT|TCP_SUB_CM|TCP_SUB_AUX;
+const unsigned int TCP_SUB_LPC=0x10; // Not a field: frames go LPC-coded in tcpblocks
+const unsigned int TCP_SUB_BLOCK_MAGIC=0x4f43424b; // "OCBK"
+
+const unsigned int TCP_SUB_CHNMASK_WORDS=(PHYS_CHN_COUNT+31)/32;
+
+const unsigned int TCP_SUB_TIMEOUT_MSECS=2000; // Client must subscribe within
+
+const unsigned int TCP_SUB_POLICY_DEFAULT=0; // Overrun policy: the daemon's NET|OVERRUN
+const unsigned int TCP_SUB_DROP=1;       // Skip the overwritten span, gap frame in its place
+const unsigned int TCP_SUB_DECIMATE=2;   // Thin out the backlog while lagging
+const unsigned int TCP_SUB_DISCONNECT=3; // Close the connection
+const unsigned int TCP_SUB_MAX_DECIMATION=128; // Lowest rate granted is the full one over this
+const unsigned int TCP_SUB_GAP=0xFFFFFFFF; // trigger of a gap frame (triggers are 8 bits otherwise)
+const unsigned int TCP_SUB_STEP=0xFFFFFFFE; // trigger of a step frame (DECIMATE, unpacked)
+
+typedef struct _tcpsubscription {
+ unsigned int magic;
+ unsigned int fields; // TCP_SUB_* flags
+ unsigned int chnMask[EE_MAX_AMPCOUNT][TCP_SUB_CHNMASK_WORDS]; // Physical channel selection per amp
+ unsigned int ampCount; // Amps in each frame -- filled in by the daemon
+ unsigned int frameSize; // Bytes per sample on the wire -- filled in by the daemon
+ unsigned int session; // Daemon instance -- filled in by the daemon, echoed by a resuming client
+ unsigned int resume; // Client: continue at startIdx; daemon: 1 if it does
+ unsigned int policy; // TCP_SUB_DROP.. on overrun; the daemon echoes what applies
+ unsigned int rate; // Client: samples/s wanted, 0 for the full rate; daemon: the rate granted
+ uint64_t startIdx; // Client: next sample wanted when resuming; daemon: index of the first frame sent
+} tcpsubscription;
+
+typedef struct _tcpblock {
+ unsigned int magic;
+ unsigned int bytes;  // Whole block, this header included
+ unsigned int count;  // Frames in it
+ unsigned int span;   // Samples they stand for
+ uint64_t firstIdx;   // Running index of the first
+ uint64_t lost;       // Skipped right before it (overrun)
+} tcpblock;
+
+class TcpSubscription {
+ public:
+  TcpSubscription() { ampCount=fieldCount=frameSize=0; std::memset(&sub,0,sizeof(tcpsubscription)); }
+
+  // Everything: all fields of all channels of all amps.
+  static tcpsubscription full() { tcpsubscription s; std::memset(&s,0,sizeof(tcpsubscription));
+   s.magic=TCP_SUB_MAGIC; s.fields=TCP_SUB_ALL;
+   for (unsigned int a=0;a<EE_MAX_AMPCOUNT;a++) for (int c=0;c<PHYS_CHN_COUNT;c++) select(s,a,c);
+   return s;
+  }
+
+  static void select(tcpsubscription &s,unsigned int amp,unsigned int chn) {
+   s.chnMask[amp][chn/32]|=(1u<<(chn%32));
+  }
+
+  // Returns false for a malformed request; out-of-range channel bits are simply dropped.
+  bool set(const tcpsubscription &s,unsigned int ac) {
+   if (s.magic!=TCP_SUB_MAGIC || (s.fields&~(TCP_SUB_ALL|TCP_SUB_LPC)) || ac>EE_MAX_AMPCOUNT || s.policy>TCP_SUB_DISCONNECT) return false;
+   sub=s; ampCount=ac; fieldCount=0;
+   if (sub.fields&TCP_SUB_RAW) fieldCount++;
+   if (sub.fields&TCP_SUB_FLT) fieldCount++;
+   if (sub.fields&TCP_SUB_CM) fieldCount++;
+   chnIdx.resize(ampCount); frameSize=sizeof(unsigned int)*(1+2*ampCount);
+   for (unsigned int a=0;a<ampCount;a++) { chnIdx[a].resize(0);
+    for (int c=0;c<PHYS_CHN_COUNT;c++) if (sub.chnMask[a][c/32]&(1u<<(c%32))) chnIdx[a].push_back(c);
+    frameSize+=fieldCount*chnIdx[a].size()*sizeof(float);
+   }
+   for (unsigned int a=ampCount;a<EE_MAX_AMPCOUNT;a++)
+    for (unsigned int w=0;w<TCP_SUB_CHNMASK_WORDS;w++) sub.chnMask[a][w]=0;
+   for (int c=PHYS_CHN_COUNT;c<(int)(32*TCP_SUB_CHNMASK_WORDS);c++)
+    for (unsigned int a=0;a<ampCount;a++) sub.chnMask[a][c/32]&=~(1u<<(c%32));
+   if (sub.fields&TCP_SUB_AUX) frameSize+=AUX_CHN_COUNT*sizeof(float);
+   sub.ampCount=ampCount; sub.frameSize=frameSize;
+   kinds.assign(1+2*ampCount,LPC_KIND_INT); // Column kinds of a frame, in frame order
+   for (unsigned int a=0;a<ampCount;a++) for (unsigned int f=TCP_SUB_RAW;f<=TCP_SUB_CM;f<<=1) if (sub.fields&f)
+    kinds.insert(kinds.end(),chnIdx[a].size(),(f==TCP_SUB_CM) ? LPC_KIND_BITS : LPC_KIND_NV);
+   if (sub.fields&TCP_SUB_AUX) kinds.insert(kinds.end(),AUX_CHN_COUNT,LPC_KIND_NV);
+   return true;
+  }
+
+  bool packed() const { return sub.fields&TCP_SUB_LPC; }
+
+  // The rate granted for asked at a full rate of full: the lowest at or above asked
+  // that divides full, down to full/TCP_SUB_MAX_DECIMATION (full itself for 0).
+  static unsigned int outputRate(unsigned int asked,unsigned int full) {
+   if (asked==0 || asked>=full) return full;
+   for (unsigned int m=std::min(full/asked,TCP_SUB_MAX_DECIMATION);m>1;m--) if (full%m==0) return full/m;
+   return full;
+  }
+
+  // Bytes a block of count frames may take at most.
+  size_t blockBound(unsigned int count) const { return sizeof(tcpblock)+kinds.size()*(sizeof(unsigned int)+lpcBound(count)); }
+
+  // Daemon side: count packed frames into one block at dst (blockBound() bytes); returns its size.
+  size_t packBlock(const char *frames,unsigned int count,unsigned int span,uint64_t firstIdx,uint64_t lost,char *dst) {
+   tcpblock *h=(tcpblock*)dst; unsigned int *end=(unsigned int*)(h+1),w=frameSize/sizeof(unsigned int);
+   size_t len=sizeof(tcpblock)+kinds.size()*sizeof(unsigned int); const unsigned int *u=(const unsigned int*)frames;
+   col.resize(count);
+   for (unsigned int k=0;k<kinds.size();k++) {
+    for (unsigned int i=0;i<count;i++) col[i]=u[(size_t)i*w+k]; // Frame words and floats alike, as 32 bits
+    len+=lpc.encode(col.data(),count,kinds[k],(unsigned char*)dst+len); end[k]=len;
+   }
+   h->magic=TCP_SUB_BLOCK_MAGIC; h->bytes=len; h->count=count; h->span=span; h->firstIdx=firstIdx; h->lost=lost;
+   return len;
+  }
+
+  // Client side: a whole block (h->bytes) back into h->count frames; false if it is corrupt.
+  bool unpackBlock(const char *src,char *frames) {
+   const tcpblock *h=(const tcpblock*)src; const unsigned int *end=(const unsigned int*)(h+1),w=frameSize/sizeof(unsigned int);
+   size_t beg=sizeof(tcpblock)+kinds.size()*sizeof(unsigned int); unsigned int *u=(unsigned int*)frames;
+   if (h->magic!=TCP_SUB_BLOCK_MAGIC || h->bytes<beg) return false;
+   col.resize(h->count);
+   for (unsigned int k=0;k<kinds.size();k++) {
+    if (end[k]<beg || end[k]>h->bytes || !lpc.decode((const unsigned char*)src+beg,end[k]-beg,h->count,col.data())) return false;
+    for (unsigned int i=0;i<h->count;i++) u[(size_t)i*w+k]=col[i];
+    beg=end[k];
+   }
+   return true;
+  }
+
+  const tcpsubscription& request() const { return sub; }
+
+  // Daemon side: a gap frame in place of lost skipped samples.
+  void packGap(uint64_t lost,char *dst) const { unsigned int *u=(unsigned int*)dst;
+   std::memset(dst,0,frameSize); u[0]=TCP_SUB_GAP; u[1]=(unsigned int)lost; u[2]=(unsigned int)(lost>>32);
+  }
+  // Daemon side: a step frame; the frames after it are step samples apart.
+  void packStep(unsigned int step,char *dst) const { unsigned int *u=(unsigned int*)dst;
+   std::memset(dst,0,frameSize); u[0]=TCP_SUB_STEP; u[1]=step;
+  }
+  void setPolicy(unsigned int p) { sub.policy=p; }
+  void setRate(unsigned int r) { sub.rate=r; }
+
+  // Daemon side: where the stream of this subscription starts, for the echo.
+  void grant(unsigned int session,bool resumed,uint64_t start) { sub.session=session; sub.resume=resumed; sub.startIdx=start; }
+
+  // Daemon side: serialize one ring element into a frameSize-byte frame.
+  void pack(const tcpsample &t,char *dst) const {
+   unsigned int *u=(unsigned int*)dst; float *f;
+   *u++=t.trigger;
+   for (unsigned int a=0;a<ampCount;a++) { *u++=t.amp[a].offset; *u++=t.amp[a].trigger; }
+   f=(float*)u;
+   for (unsigned int a=0;a<ampCount;a++) { const sample &s=t.amp[a]; const std::vector<int> &ci=chnIdx[a];
+    if (sub.fields&TCP_SUB_RAW) for (unsigned int c=0;c<ci.size();c++) *f++=s.data[ci[c]];
+    if (sub.fields&TCP_SUB_FLT) for (unsigned int c=0;c<ci.size();c++) *f++=s.dataF[ci[c]];
+    if (sub.fields&TCP_SUB_CM)  for (unsigned int c=0;c<ci.size();c++) *f++=s.curCM[ci[c]];
+   }
+   if (sub.fields&TCP_SUB_AUX) for (unsigned int c=0;c<AUX_CHN_COUNT;c++) *f++=t.aux[c];
+  }
+
+  // Client side: scatter a frame back into the selected fields/channels of a tcpsample.
+  void unpack(const char *src,tcpsample &t) const {
+   const unsigned int *u=(const unsigned int*)src; const float *f;
+   t.trigger=*u++;
+   for (unsigned int a=0;a<ampCount;a++) { t.amp[a].offset=*u++; t.amp[a].trigger=*u++; }
+   f=(const float*)u;
+   for (unsigned int a=0;a<ampCount;a++) { sample &s=t.amp[a]; const std::vector<int> &ci=chnIdx[a];
+    if (sub.fields&TCP_SUB_RAW) for (unsigned int c=0;c<ci.size();c++) s.data[ci[c]]=*f++;
+    if (sub.fields&TCP_SUB_FLT) for (unsigned int c=0;c<ci.size();c++) s.dataF[ci[c]]=*f++;
+    if (sub.fields&TCP_SUB_CM)  for (unsigned int c=0;c<ci.size();c++) s.curCM[ci[c]]=*f++;
+   }
+   if (sub.fields&TCP_SUB_AUX) for (unsigned int c=0;c<AUX_CHN_COUNT;c++) t.aux[c]=*f++;
+  }
+
+  unsigned int ampCount,fieldCount,frameSize;
+
+ private:
+  tcpsubscription sub; std::vector<std::vector<int> > chnIdx;
+  std::vector<uint8_t> kinds; std::vector<unsigned int> col; LpcCodec lpc;
+};
+
+#endif